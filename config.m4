@@ -67,8 +67,10 @@ if test "$PHP_GEARMAN" != "no"; then
     -L$GEARMAN_LIB_DIR -R$GEARMAN_LIB_DIR
   ])
 
+  PHP_ADD_LIBRARY(pthread, 1, GEARMAN_SHARED_LIBADD)
+
   PHP_SUBST(GEARMAN_SHARED_LIBADD)
 
   PHP_ADD_INCLUDE($GEARMAN_INC_DIR)
-  PHP_NEW_EXTENSION(gearman, php_gearman.c php_gearman_client.c php_gearman_task.c, $ext_shared)
+  PHP_NEW_EXTENSION(gearman, php_gearman.c php_gearman_client.c php_gearman_task.c php_gearman_sender.c php_gearman_conn.c php_gearman_packet.c php_gearman_stream.c, $ext_shared)
 fi
@@ -0,0 +1,94 @@
+<?php
+/*
+ * Gearman PHP Extension
+ *
+ * Copyright (C) 2008 James M. Luedke <contact@jamesluedke.com>,
+ *                    Eric Day <eday@oddments.org>
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the PHP license.  See
+ * the LICENSE file in this directory for full text.
+ */
+
+/* Compares the libgearman and the native engine against the same gearmand.
+ * doNormal() needs a worker, one is forked per engine if pcntl is there.
+ * Usage: php engine_benchmark.php [server] [count] [workload bytes]
+ * e.g.   php engine_benchmark.php 127.0.0.1:4730 100000 1024 */
+
+$server = isset($argv[1]) ? $argv[1] : '127.0.0.1:4730';
+$count = isset($argv[2]) ? (int)$argv[2] : 100000;
+$workload = str_repeat('x', isset($argv[3]) ? (int)$argv[3] : 1024);
+
+$engines = array(
+  'libgearman' => GEARMAN_ENGINE_LIBGEARMAN,
+  'native' => GEARMAN_ENGINE_NATIVE,
+);
+
+function cpu_seconds() {
+  $usage = getrusage();
+  return $usage['ru_utime.tv_sec'] + $usage['ru_utime.tv_usec'] / 1e6 +
+         $usage['ru_stime.tv_sec'] + $usage['ru_stime.tv_usec'] / 1e6;
+}
+
+function bench($name, $server, $engine, $count, $call) {
+  $gmclient = new GearmanClient();
+  $gmclient->addServers($server);
+  $gmclient->setEngine($engine);
+  if (!$gmclient->ping("warmup")) {
+    echo "$name: $server is not reachable\n";
+    return;
+  }
+
+  $cpu = cpu_seconds();
+  $start = microtime(true);
+  for ($i = 0; $i < $count; $i++) {
+    $call($gmclient, $i);
+  }
+  $elapsed = microtime(true) - $start;
+  $cpu = cpu_seconds() - $cpu;
+
+  printf("%-32s %10.0f ops/s %8.1f us/op %8.1f us cpu/op\n", $name,
+         $count / $elapsed, $elapsed * 1e6 / $count, $cpu * 1e6 / $count);
+}
+
+/* a worker on the same engine, answers until killed */
+function start_worker($server, $engine) {
+  if (!function_exists('pcntl_fork')) {
+    return 0;
+  }
+
+  $pid = pcntl_fork();
+  if ($pid != 0) {
+    return $pid;
+  }
+
+  $gmworker = new GearmanWorker();
+  $gmworker->setEngine($engine);
+  $gmworker->addServers($server);
+  $gmworker->addFunction("engine_benchmark_echo", function($job) { return $job->workload(); });
+  while ($gmworker->work());
+  exit(0);
+}
+
+$ping = function($gmclient, $i) { $gmclient->ping("x"); };
+/* nobody works on this function, the jobs only get queued */
+$submit = function($gmclient, $i) use ($workload) { $gmclient->doBackground("engine_benchmark", $workload, "engine_benchmark"); };
+$roundtrip = function($gmclient, $i) use ($workload) { $gmclient->doNormal("engine_benchmark_echo", $workload); };
+
+foreach ($engines as $name => $engine) {
+  bench("ECHO ($name)", $server, $engine, $count, $ping);
+}
+foreach ($engines as $name => $engine) {
+  bench("SUBMIT_JOB_BG ($name)", $server, $engine, $count, $submit);
+}
+foreach ($engines as $name => $engine) {
+  $pid = start_worker($server, $engine);
+  if ($pid == 0) {
+    echo "doNormal(): needs pcntl to fork a worker\n";
+    break;
+  }
+  bench("doNormal() ($name client+worker)", $server, $engine, $count / 10, $roundtrip);
+  posix_kill($pid, SIGTERM);
+  pcntl_waitpid($pid, $status);
+}
+?>
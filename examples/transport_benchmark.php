@@ -0,0 +1,51 @@
+<?php
+/*
+ * Gearman PHP Extension
+ *
+ * Copyright (C) 2008 James M. Luedke <contact@jamesluedke.com>,
+ *                    Eric Day <eday@oddments.org>
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the PHP license.  See
+ * the LICENSE file in this directory for full text.
+ */
+
+/* Compares loopback TCP against a unix domain socket to the same gearmand.
+ * Usage: php transport_benchmark.php [tcp server] [unix socket] [count]
+ * e.g.   php transport_benchmark.php 127.0.0.1:4730 unix:///run/gearmand.sock 100000 */
+
+$tcp = isset($argv[1]) ? $argv[1] : '127.0.0.1:4730';
+$unix = isset($argv[2]) ? $argv[2] : 'unix:///run/gearmand/gearmand.sock';
+$count = isset($argv[3]) ? (int)$argv[3] : 100000;
+
+function bench($name, $server, $count, $call) {
+  $gmclient = new GearmanClient();
+  $gmclient->addServers($server);
+  if (!$gmclient->ping("warmup")) {
+    echo "$name: $server is not reachable\n";
+    return;
+  }
+
+  $usage = getrusage();
+  $start = microtime(true);
+  for ($i = 0; $i < $count; $i++) {
+    $call($gmclient, $i);
+  }
+  $elapsed = microtime(true) - $start;
+  $after = getrusage();
+  $cpu = ($after['ru_utime.tv_sec'] - $usage['ru_utime.tv_sec']) + ($after['ru_utime.tv_usec'] - $usage['ru_utime.tv_usec']) / 1e6 +
+         ($after['ru_stime.tv_sec'] - $usage['ru_stime.tv_sec']) + ($after['ru_stime.tv_usec'] - $usage['ru_stime.tv_usec']) / 1e6;
+
+  printf("%-24s %10.0f ops/s %8.1f us/op %8.1f us cpu/op\n", $name,
+         $count / $elapsed, $elapsed * 1e6 / $count, $cpu * 1e6 / $count);
+}
+
+$ping = function($gmclient, $i) { $gmclient->ping("x"); };
+/* nobody works on this function, the jobs only get queued */
+$submit = function($gmclient, $i) { $gmclient->doBackground("transport_benchmark", "x", "transport_benchmark"); };
+
+bench("ECHO over TCP", $tcp, $count, $ping);
+bench("ECHO over unix socket", $unix, $count, $ping);
+bench("SUBMIT_JOB_BG over TCP", $tcp, $count, $submit);
+bench("SUBMIT_JOB_BG over unix", $unix, $count, $submit);
+?>
@@ -19,14 +19,18 @@
 #include "php_gearman.h"
 #include "php_gearman_client.h"
 #include "php_gearman_task.h"
+#include "php_gearman_packet.h"
+#include "php_gearman_stream.h"
 
 #include "zend_exceptions.h"
 #include "zend_interfaces.h"
+#include "zend_generators.h"
 
 #include <libgearman-1.0/gearman.h>
 #include <libgearman-1.0/interface/status.h>
 #include <libgearman-1.0/status.h>
 
+ZEND_DECLARE_MODULE_GLOBALS(gearman)
 
 // TODO - find a better place for this
 static inline zend_object *gearman_worker_obj_new(zend_class_entry *ce);
@@ -144,6 +148,13 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_task_recv_data, 0, 0, 1)
 	ZEND_ARG_INFO(0, data_len)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_task_get_stream, 0, 0, 1)
+	ZEND_ARG_INFO(0, task_object)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_task_get_stream, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
 
 /*
  * Gearman Job Functions
@@ -247,6 +258,15 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_job_workload_size, 0, 0, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_job_get_output_stream, 0, 0, 1)
+	ZEND_ARG_INFO(0, job_object)
+	ZEND_ARG_INFO(0, chunk_size)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_job_get_output_stream, 0, 0, 0)
+	ZEND_ARG_INFO(0, chunk_size)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_job_set_return, 0, 0, 2)
 	ZEND_ARG_INFO(0, job_object)
 	ZEND_ARG_INFO(0, gearman_return_t)
@@ -374,12 +394,14 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_normal, 0, 0, 3)
 	ZEND_ARG_INFO(0, function_name)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, workload_size)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_do_normal, 0, 0, 2)
 	ZEND_ARG_INFO(0, function_name)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, workload_size)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_high, 0, 0, 3)
@@ -387,12 +409,14 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_high, 0, 0, 3)
 	ZEND_ARG_INFO(0, function_name)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, workload_size)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_do_high, 0, 0, 2)
 	ZEND_ARG_INFO(0, function_name)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, workload_size)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_low, 0, 0, 3)
@@ -400,12 +424,14 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_low, 0, 0, 3)
 	ZEND_ARG_INFO(0, function_name)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, workload_size)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_do_low, 0, 0, 2)
 	ZEND_ARG_INFO(0, function_name)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, workload_size)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_background, 0, 0, 3)
@@ -413,12 +439,14 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_background, 0, 0, 3)
 	ZEND_ARG_INFO(0, function_name)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, workload_size)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_do_background, 0, 0, 2)
 	ZEND_ARG_INFO(0, function_name)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, workload_size)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_high_background, 0, 0, 3)
@@ -426,12 +454,14 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_high_background, 0, 0, 3)
 	ZEND_ARG_INFO(0, function_name)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, workload_size)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_do_high_background, 0, 0, 2)
 	ZEND_ARG_INFO(0, function_name)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, workload_size)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_low_background, 0, 0, 3)
@@ -439,12 +469,14 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_low_background, 0, 0, 3)
 	ZEND_ARG_INFO(0, function_name)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, workload_size)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_do_low_background, 0, 0, 2)
 	ZEND_ARG_INFO(0, function_name)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, workload_size)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_job_handle, 0, 0, 1)
@@ -494,6 +526,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_add_task, 0, 0, 3)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, context)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_add_task, 0, 0, 2)
@@ -501,6 +534,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_add_task, 0, 0, 2)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, context)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_add_task_high, 0, 0, 3)
@@ -509,6 +543,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_add_task_high, 0, 0, 3)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, context)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_add_task_high, 0, 0, 2)
@@ -516,6 +551,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_add_task_high, 0, 0, 2)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, context)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_add_task_low, 0, 0, 3)
@@ -524,6 +560,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_add_task_low, 0, 0, 3)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, context)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_add_task_low, 0, 0, 2)
@@ -531,6 +568,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_add_task_low, 0, 0, 2)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, context)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_add_task_background, 0, 0, 3)
@@ -539,6 +577,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_add_task_background, 0, 0, 3)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, context)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_add_task_background, 0, 0, 2)
@@ -546,6 +585,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_add_task_background, 0, 0, 2)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, context)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_add_task_high_background, 0, 0, 3)
@@ -554,6 +594,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_add_task_high_background, 0, 0, 3)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, context)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_add_task_high_background, 0, 0, 2)
@@ -561,6 +602,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_add_task_high_background, 0, 0,
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, context)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_add_task_low_background, 0, 0, 3)
@@ -569,6 +611,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_add_task_low_background, 0, 0, 3)
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, context)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_add_task_low_background, 0, 0, 2)
@@ -576,6 +619,7 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_add_task_low_background, 0, 0,
 	ZEND_ARG_INFO(0, workload)
 	ZEND_ARG_INFO(0, context)
 	ZEND_ARG_INFO(0, unique)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_add_task_status, 0, 0, 2)
@@ -684,13 +728,236 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_context, 0, 0, 1)
 	ZEND_ARG_INFO(0, context)
 ZEND_END_ARG_INFO()
 
-ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_run_tasks, 0, 0, 2)
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_run_tasks, 0, 0, 1)
 	ZEND_ARG_INFO(0, client_object)
-	ZEND_ARG_INFO(0, data)
+	ZEND_ARG_INFO(0, timeout_ms)
 ZEND_END_ARG_INFO()
 
-ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_run_tasks, 0, 0, 1)
-	ZEND_ARG_INFO(0, data)
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_run_tasks, 0, 0, 0)
+	ZEND_ARG_INFO(0, timeout_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_enable_background_sender, 0, 0, 1)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, capacity)
+	ZEND_ARG_INFO(0, full_policy)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_enable_background_sender, 0, 0, 0)
+	ZEND_ARG_INFO(0, capacity)
+	ZEND_ARG_INFO(0, full_policy)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_disable_background_sender, 0, 0, 1)
+	ZEND_ARG_INFO(0, client_object)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_disable_background_sender, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_get_stats, 0, 0, 1)
+	ZEND_ARG_INFO(0, client_object)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_get_stats, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_deferred_background, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, defer)
+	ZEND_ARG_INFO(0, fail_callback)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_deferred_background, 0, 0, 1)
+	ZEND_ARG_INFO(0, defer)
+	ZEND_ARG_INFO(0, fail_callback)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_flush_deferred, 0, 0, 1)
+	ZEND_ARG_INFO(0, client_object)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_flush_deferred, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_max_in_flight, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, max)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_max_in_flight, 0, 0, 1)
+	ZEND_ARG_INFO(0, max)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_auto_flush, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, count)
+	ZEND_ARG_INFO(0, max_age_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_auto_flush, 0, 0, 1)
+	ZEND_ARG_INFO(0, count)
+	ZEND_ARG_INFO(0, max_age_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_do_multi, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, calls)
+	ZEND_ARG_INFO(0, timeout_ms)
+	ZEND_ARG_INFO(1, errors)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_do_multi, 0, 0, 1)
+	ZEND_ARG_INFO(0, calls)
+	ZEND_ARG_INFO(0, timeout_ms)
+	ZEND_ARG_INFO(1, errors)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_completion_policy, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, policy)
+	ZEND_ARG_INFO(0, quorum)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_completion_policy, 0, 0, 1)
+	ZEND_ARG_INFO(0, policy)
+	ZEND_ARG_INFO(0, quorum)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_hedging, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, delay_ms)
+	ZEND_ARG_INFO(0, adaptive)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_hedging, 0, 0, 1)
+	ZEND_ARG_INFO(0, delay_ms)
+	ZEND_ARG_INFO(0, adaptive)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_adaptive_timeout, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, multiplier)
+	ZEND_ARG_INFO(0, floor_ms)
+	ZEND_ARG_INFO(0, ceiling_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_adaptive_timeout, 0, 0, 1)
+	ZEND_ARG_INFO(0, multiplier)
+	ZEND_ARG_INFO(0, floor_ms)
+	ZEND_ARG_INFO(0, ceiling_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_routing, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, mode)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_routing, 0, 0, 1)
+	ZEND_ARG_INFO(0, mode)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_shard_key, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, key)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_shard_key, 0, 0, 1)
+	ZEND_ARG_INFO(0, key)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_server_weights, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, weights)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_server_weights, 0, 0, 1)
+	ZEND_ARG_INFO(0, weights)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_circuit_breaker, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, threshold)
+	ZEND_ARG_INFO(0, cooldown_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_circuit_breaker, 0, 0, 1)
+	ZEND_ARG_INFO(0, threshold)
+	ZEND_ARG_INFO(0, cooldown_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_connect, 0, 0, 1)
+	ZEND_ARG_INFO(0, client_object)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_connect, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_keepalive, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, interval_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_keepalive, 0, 0, 1)
+	ZEND_ARG_INFO(0, interval_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_servers, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, servers)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_servers, 0, 0, 1)
+	ZEND_ARG_INFO(0, servers)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_socket_options, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_socket_options, 0, 0, 1)
+	ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_set_engine, 0, 0, 2)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, engine)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_set_engine, 0, 0, 1)
+	ZEND_ARG_INFO(0, engine)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_client_completions, 0, 0, 1)
+	ZEND_ARG_INFO(0, client_object)
+	ZEND_ARG_INFO(0, timeout_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_client_completions, 0, 0, 0)
+	ZEND_ARG_INFO(0, timeout_ms)
+ZEND_END_ARG_INFO()
+
+/*
+ * Gearman Completion Iterator arginfo
+ */
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_completion_iterator_destruct, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_completion_iterator_current, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_completion_iterator_key, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_completion_iterator_next, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_completion_iterator_rewind, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_completion_iterator_valid, 0, 0, 0)
 ZEND_END_ARG_INFO()
 
 /*
@@ -878,6 +1145,61 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_worker_ping, 0, 0, 1)
 	ZEND_ARG_INFO(0, workload)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_worker_connect, 0, 0, 1)
+	ZEND_ARG_INFO(0, worker_object)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_worker_connect, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_worker_set_keepalive, 0, 0, 2)
+	ZEND_ARG_INFO(0, worker_object)
+	ZEND_ARG_INFO(0, interval_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_worker_set_keepalive, 0, 0, 1)
+	ZEND_ARG_INFO(0, interval_ms)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_worker_set_servers, 0, 0, 2)
+	ZEND_ARG_INFO(0, worker_object)
+	ZEND_ARG_INFO(0, servers)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_worker_set_servers, 0, 0, 1)
+	ZEND_ARG_INFO(0, servers)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_worker_set_engine, 0, 0, 2)
+	ZEND_ARG_INFO(0, worker_object)
+	ZEND_ARG_INFO(0, engine)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_worker_set_engine, 0, 0, 1)
+	ZEND_ARG_INFO(0, engine)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_worker_set_socket_options, 0, 0, 2)
+	ZEND_ARG_INFO(0, worker_object)
+	ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_oo_gearman_worker_set_socket_options, 0, 0, 1)
+	ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_packet_encode, 0, 0, 2)
+	ZEND_ARG_INFO(0, command)
+	ZEND_ARG_INFO(0, args)
+	ZEND_ARG_INFO(0, response)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_gearman_packet_decode, 0, 0, 1)
+	ZEND_ARG_INFO(0, buffer)
+	ZEND_ARG_INFO(0, offset)
+	ZEND_ARG_INFO(0, slices)
+ZEND_END_ARG_INFO()
 
 /* }}} end arginfo */
 
@@ -888,10 +1210,13 @@ typedef struct {
 	zval zname; /* name associated with callback */
 	zval zcall; /* name of callback */
 	zval zdata; /* data passed to callback via worker */
+	zend_long timeout; /* timeout the function was registered with */
 } gearman_worker_cb_obj;
 
 typedef enum {
-	GEARMAN_WORKER_OBJ_CREATED = (1 << 0)
+	GEARMAN_WORKER_OBJ_CREATED = (1 << 0),
+	/* inside gearman_worker_work(), a job may be running */
+	GEARMAN_WORKER_OBJ_WORKING = (1 << 1)
 } gearman_worker_obj_flags_t;
 
 typedef struct {
@@ -900,6 +1225,28 @@ typedef struct {
 	gearman_worker_st worker;
 	zval cb_list;
 
+	/* process that owns the connections, see _php_worker_check_fork() */
+	pid_t pid;
+
+	/* setKeepalive(), see _php_worker_keepalive() */
+	zend_long keepalive;
+	uint64_t keepalive_last;
+
+	/* servers as passed to addServer()/addServers(), "host[:port]" each,
+	 * and the list setServers() got while a job was running */
+	zval server_list;
+	zval pending_servers;
+
+	/* setEngine(), and the native engine's connections by server_list
+	 * index, see _php_worker_native_work() */
+	php_gearman_engine_t engine;
+	php_gearman_conn *conns;
+	uint32_t conns_count;
+	uint32_t conn_next;
+	int32_t conn_last;
+	/* setSocketOptions(), for the connections above */
+	php_gearman_socket_options socket_options;
+
 	zend_object std;
 } gearman_worker_obj;
 
@@ -912,6 +1259,18 @@ typedef struct {
 	gearman_job_obj_flags_t flags;
 	gearman_job_st *job;
 
+	/* a job the native engine took, conn is only set while it runs */
+	php_gearman_conn *conn;
+	int timeout;
+	zend_bool finished;
+	zend_string *handle;
+	zend_string *function_name;
+	zend_string *unique;
+	zend_string *workload;
+
+	/* the open getOutputStream() stream, closed before the job ends */
+	php_stream *output;
+
 	zend_object std;
 } gearman_job_obj;
 
@@ -923,6 +1282,14 @@ static inline gearman_worker_obj *gearman_worker_fetch_object(zend_object *obj)
 
 #define Z_GEARMAN_WORKER_P(zv) gearman_worker_fetch_object(Z_OBJ_P((zv)))
 
+static void _php_worker_check_fork(gearman_worker_obj *obj);
+static void _php_worker_keepalive(gearman_worker_obj *obj);
+static zend_bool _php_worker_replace_servers(gearman_worker_obj *obj, zval *new_list);
+static gearman_return_t _php_worker_native_announce(gearman_worker_obj *obj, php_gearman_conn *conn,
+						zend_bool reset, int timeout);
+static void _php_worker_native_reannounce(gearman_worker_obj *obj);
+static void _php_worker_native_close(gearman_worker_obj *obj);
+
 static inline gearman_job_obj *gearman_job_fetch_object(zend_object *obj) {
 	return (gearman_job_obj *)((char*)(obj) - XtOffsetOf(gearman_job_obj, std));
 }
@@ -1147,6 +1514,9 @@ PHP_FUNCTION(gearman_task_data) {
 
 		RETURN_STRINGL((char *)data, (long) data_len);
 	}
+	if (!Z_ISUNDEF(obj->zresult)) {
+		RETURN_ZVAL(&obj->zresult, 1, 0);
+	}
 	RETURN_FALSE;
 }
 /* }}} */
@@ -1165,6 +1535,9 @@ PHP_FUNCTION(gearman_task_data_size) {
 	if (obj->flags & GEARMAN_TASK_OBJ_CREATED) {
 		RETURN_LONG(gearman_task_data_size(obj->task));
 	}
+	if (!Z_ISUNDEF(obj->zresult)) {
+		RETURN_LONG(Z_STRLEN(obj->zresult));
+	}
 	RETURN_FALSE;
 }
 /* }}} */
@@ -1204,11 +1577,11 @@ PHP_FUNCTION(gearman_task_send_workload) {
 
 
 /* {{{ proto array gearman_task_recv_data(object task, long buffer_size)
-   NOT-TESTED Read work or result data into a buffer for a task. */
+   Read work or result data into a buffer for a task. GearmanTask::getStream() reads the same data without an array per call. */
 PHP_FUNCTION(gearman_task_recv_data) {
 	zval *zobj;
 	gearman_task_obj *obj;
-	char *data_buffer;
+	zend_string *data;
 	zend_long data_buffer_size;
 	size_t data_len;
 
@@ -1218,25 +1591,30 @@ PHP_FUNCTION(gearman_task_recv_data) {
 	}
 	obj = Z_GEARMAN_TASK_P(zobj);
 
-	if (!(obj->flags & GEARMAN_TASK_OBJ_CREATED)) {
+	if (!(obj->flags & GEARMAN_TASK_OBJ_CREATED) || data_buffer_size < 0) {
 		RETURN_FALSE;
 	}
 
-	data_buffer= (char *) emalloc(data_buffer_size);
+	/* read into the string that is returned, no copy */
+	data = zend_string_alloc(data_buffer_size, 0);
 
-	data_len= gearman_task_recv_data(obj->task, data_buffer, data_buffer_size,
+	data_len= gearman_task_recv_data(obj->task, ZSTR_VAL(data), data_buffer_size,
 									 &obj->ret);
 	if (obj->ret != GEARMAN_SUCCESS &&
 		!gearman_client_has_option(&Z_GEARMAN_CLIENT_P(&obj->zclient)->client, GEARMAN_CLIENT_UNBUFFERED_RESULT)) {
+		zend_string_release(data);
 		php_error_docref(NULL, E_WARNING,  "%s",
 						 gearman_client_error(&Z_GEARMAN_CLIENT_P(&obj->zclient)->client));
 		RETURN_FALSE;
 	}
+	obj->recv_left -= MIN(data_len, obj->recv_left);
+
+	ZSTR_LEN(data) = data_len;
+	ZSTR_VAL(data)[data_len] = '\0';
 
 	array_init(return_value);
 	add_next_index_long(return_value, (long)data_len);
-	add_next_index_stringl(return_value, (char *)data_buffer,
-						  (long)data_len);
+	add_next_index_str(return_value, data);
 }
 /* }}} */
 
@@ -1244,6 +1622,163 @@ PHP_FUNCTION(gearman_task_recv_data) {
  * Functions from job.h
  */
 
+/* Sends a WORK_* packet for a job taken by the native engine, data is
+ * left out if NULL. WORK_COMPLETE, WORK_FAIL and WORK_EXCEPTION end the
+ * job. */
+static gearman_return_t _php_job_native_send(gearman_job_obj *obj, gearman_command_t command,
+						const char *data, size_t data_len) {
+	const char *args[2];
+	size_t sizes[2];
+	gearman_return_t ret;
+
+	if (obj->conn == NULL) {
+		return GEARMAN_NOT_CONNECTED;
+	}
+	/* libgearman ignores anything sent after the job ended as well */
+	if (obj->finished) {
+		return GEARMAN_SUCCESS;
+	}
+
+	args[0] = ZSTR_VAL(obj->handle);
+	sizes[0] = ZSTR_LEN(obj->handle);
+	args[1] = data != NULL ? data : "";
+	sizes[1] = data_len;
+
+	ret = php_gearman_conn_send(obj->conn, command, args, sizes, data != NULL ? 2 : 1, obj->timeout);
+	if (ret == GEARMAN_SUCCESS && (command == GEARMAN_COMMAND_WORK_COMPLETE ||
+			command == GEARMAN_COMMAND_WORK_FAIL || command == GEARMAN_COMMAND_WORK_EXCEPTION)) {
+		obj->finished = 1;
+	}
+	return ret;
+}
+
+static const char *_php_job_error(gearman_job_obj *obj) {
+	if (obj->handle == NULL) {
+		return gearman_job_error(obj->job);
+	}
+	if (obj->conn != NULL && obj->conn->error[0] != '\0') {
+		return obj->conn->error;
+	}
+	return obj->ret == GEARMAN_NOT_CONNECTED ? "The job is no longer running" : gearman_strerror(obj->ret);
+}
+
+static gearman_return_t _php_job_send_data(gearman_job_obj *obj, const char *data, size_t data_len) {
+	if (obj->handle != NULL) {
+		return _php_job_native_send(obj, GEARMAN_COMMAND_WORK_DATA, data, data_len);
+	}
+	return gearman_job_send_data(obj->job, data, data_len);
+}
+
+static gearman_return_t _php_job_send_status(gearman_job_obj *obj, zend_long numerator, zend_long denominator) {
+	if (obj->handle != NULL) {
+		/* numerator\0denominator is what two arguments look like on the wire */
+		char status[2 * MAX_LENGTH_OF_LONG];
+		int status_len = snprintf(status, sizeof(status), "%u%c%u", (uint32_t)numerator, '\0', (uint32_t)denominator);
+
+		return _php_job_native_send(obj, GEARMAN_COMMAND_WORK_STATUS, status, (size_t)status_len);
+	}
+	return gearman_job_send_status(obj->job, (uint32_t)numerator, (uint32_t)denominator);
+}
+
+/* GearmanJob::getOutputStream(), writes go out as WORK_DATA packets of
+ * size bytes, the rest when the stream is flushed or closed */
+typedef struct {
+	zval zjob;
+	char *buf;
+	size_t size;
+	size_t used;
+} php_gearman_job_stream;
+
+static int _php_job_stream_send(php_gearman_job_stream *self, const char *data, size_t data_len) {
+	gearman_job_obj *obj = Z_GEARMAN_JOB_P(&self->zjob);
+
+	obj->ret = _php_job_send_data(obj, data, data_len);
+	if (obj->ret != GEARMAN_SUCCESS && obj->ret != GEARMAN_IO_WAIT) {
+		php_error_docref(NULL, E_WARNING, "%s", _php_job_error(obj));
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+static PHP_GEARMAN_STREAM_RET _php_job_stream_write(php_stream *stream, const char *buf, size_t count) {
+	php_gearman_job_stream *self = (php_gearman_job_stream *) stream->abstract;
+	size_t left = count, n;
+
+	while (left > 0) {
+		/* whole packets are sent straight from the caller's buffer */
+		if (self->used == 0 && left >= self->size) {
+			n = self->size;
+			if (_php_job_stream_send(self, buf, n) != SUCCESS) {
+				return PHP_GEARMAN_STREAM_ERROR;
+			}
+		} else {
+			n = MIN(left, self->size - self->used);
+			memcpy(self->buf + self->used, buf, n);
+			self->used += n;
+			if (self->used == self->size) {
+				self->used = 0;
+				if (_php_job_stream_send(self, self->buf, self->size) != SUCCESS) {
+					return PHP_GEARMAN_STREAM_ERROR;
+				}
+			}
+		}
+		buf += n;
+		left -= n;
+	}
+
+	return (PHP_GEARMAN_STREAM_RET) count;
+}
+
+static PHP_GEARMAN_STREAM_RET _php_job_stream_read(php_stream *stream, char *buf, size_t count) {
+	return PHP_GEARMAN_STREAM_ERROR;
+}
+
+static int _php_job_stream_flush(php_stream *stream) {
+	php_gearman_job_stream *self = (php_gearman_job_stream *) stream->abstract;
+	size_t used = self->used;
+
+	if (used == 0) {
+		return 0;
+	}
+	self->used = 0;
+	return _php_job_stream_send(self, self->buf, used) == SUCCESS ? 0 : EOF;
+}
+
+static int _php_job_stream_close(php_stream *stream, int close_handle) {
+	php_gearman_job_stream *self = (php_gearman_job_stream *) stream->abstract;
+	gearman_job_obj *obj = Z_GEARMAN_JOB_P(&self->zjob);
+
+	_php_job_stream_flush(stream);
+	if (obj->output == stream) {
+		obj->output = NULL;
+	}
+
+	zval_ptr_dtor(&self->zjob);
+	efree(self->buf);
+	efree(self);
+	return 0;
+}
+
+static php_stream_ops _php_job_stream_ops = {
+	_php_job_stream_write,
+	_php_job_stream_read,
+	_php_job_stream_close,
+	_php_job_stream_flush,
+	"gearman",
+	NULL, /* seek */
+	NULL, /* cast */
+	NULL, /* stat */
+	NULL  /* set_option */
+};
+
+/* Sends what the output stream still holds and closes it, anything
+ * written after the job ended would go nowhere. */
+static void _php_job_end_output(gearman_job_obj *obj) {
+	if (obj->output != NULL) {
+		php_stream_close(obj->output);
+	}
+}
+
 /* {{{ proto int gearman_job_return_code()
    get last gearman_return_t */
 PHP_FUNCTION(gearman_job_return_code)
@@ -1275,14 +1810,19 @@ PHP_FUNCTION(gearman_job_send_data) {
 	obj = Z_GEARMAN_JOB_P(zobj);
 
 	/* make sure worker initialized a job */
-	if (obj->job == NULL) {
+	if (obj->job == NULL && obj->handle == NULL) {
 		RETURN_FALSE;
 	}
 
-	obj->ret = gearman_job_send_data(obj->job, data, data_len);
+	/* keep the order of what was written to the output stream */
+	if (obj->output != NULL) {
+		php_stream_flush(obj->output);
+	}
+
+	obj->ret = _php_job_send_data(obj, data, data_len);
 	if (obj->ret != GEARMAN_SUCCESS && obj->ret != GEARMAN_IO_WAIT) {
 		php_error_docref(NULL, E_WARNING,  "%s",
-			gearman_job_error(obj->job));
+			_php_job_error(obj));
 		RETURN_FALSE;
 	}
 
@@ -1305,15 +1845,19 @@ PHP_FUNCTION(gearman_job_send_warning) {
 	obj = Z_GEARMAN_JOB_P(zobj);
 
 	/* make sure worker initialized a job */
-	if (obj->job == NULL) {
+	if (obj->job == NULL && obj->handle == NULL) {
 		RETURN_FALSE;
 	}
 
-	obj->ret = gearman_job_send_warning(obj->job, (void *) warning,
+	if (obj->handle != NULL) {
+		obj->ret = _php_job_native_send(obj, GEARMAN_COMMAND_WORK_WARNING, warning, warning_len);
+	} else {
+		obj->ret = gearman_job_send_warning(obj->job, (void *) warning,
 								 (size_t) warning_len);
+	}
 	if (obj->ret != GEARMAN_SUCCESS && obj->ret != GEARMAN_IO_WAIT) {
 		php_error_docref(NULL, E_WARNING,  "%s",
-			gearman_job_error(obj->job));
+			_php_job_error(obj));
 		RETURN_FALSE;
 	}
 
@@ -1334,11 +1878,10 @@ PHP_FUNCTION(gearman_job_send_status) {
 	}
 	obj = Z_GEARMAN_JOB_P(zobj);
 
-	obj->ret = gearman_job_send_status(obj->job, (uint32_t)numerator,
-								(uint32_t)denominator);
+	obj->ret = _php_job_send_status(obj, numerator, denominator);
 	if (obj->ret != GEARMAN_SUCCESS && obj->ret != GEARMAN_IO_WAIT) {
 		php_error_docref(NULL, E_WARNING,  "%s",
-			gearman_job_error(obj->job));
+			_php_job_error(obj));
 		RETURN_FALSE;
 	}
 
@@ -1359,11 +1902,16 @@ PHP_FUNCTION(gearman_job_send_complete) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_JOB_P(zobj);
+	_php_job_end_output(obj);
 
-	obj->ret = gearman_job_send_complete(obj->job, result, result_len);
+	if (obj->handle != NULL) {
+		obj->ret = _php_job_native_send(obj, GEARMAN_COMMAND_WORK_COMPLETE, result, result_len);
+	} else {
+		obj->ret = gearman_job_send_complete(obj->job, result, result_len);
+	}
 	if (obj->ret != GEARMAN_SUCCESS && obj->ret != GEARMAN_IO_WAIT) {
 		php_error_docref(NULL, E_WARNING,  "%s",
-			gearman_job_error(obj->job));
+			_php_job_error(obj));
 		RETURN_FALSE;
 	}
 
@@ -1384,11 +1932,16 @@ PHP_FUNCTION(gearman_job_send_exception) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_JOB_P(zobj);
+	_php_job_end_output(obj);
 
-	obj->ret= gearman_job_send_exception(obj->job, exception, exception_len);
+	if (obj->handle != NULL) {
+		obj->ret = _php_job_native_send(obj, GEARMAN_COMMAND_WORK_EXCEPTION, exception, exception_len);
+	} else {
+		obj->ret = gearman_job_send_exception(obj->job, exception, exception_len);
+	}
 	if (obj->ret != GEARMAN_SUCCESS && obj->ret != GEARMAN_IO_WAIT) {
 		php_error_docref(NULL, E_WARNING,  "%s",
-			gearman_job_error(obj->job));
+			_php_job_error(obj));
 		RETURN_FALSE;
 	}
 
@@ -1406,11 +1959,16 @@ PHP_FUNCTION(gearman_job_send_fail) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_JOB_P(zobj);
+	_php_job_end_output(obj);
 
-	obj->ret = gearman_job_send_fail(obj->job);
+	if (obj->handle != NULL) {
+		obj->ret = _php_job_native_send(obj, GEARMAN_COMMAND_WORK_FAIL, NULL, 0);
+	} else {
+		obj->ret = gearman_job_send_fail(obj->job);
+	}
 	if (obj->ret != GEARMAN_SUCCESS && obj->ret != GEARMAN_IO_WAIT) {
 		php_error_docref(NULL, E_WARNING,  "%s",
-			gearman_job_error(obj->job));
+			_php_job_error(obj));
 		RETURN_FALSE;
 	}
 
@@ -1418,30 +1976,84 @@ PHP_FUNCTION(gearman_job_send_fail) {
 }
 /* }}} */
 
-/* {{{ proto string gearman_job_handle(object job)
-   Return job handle. */
-PHP_FUNCTION(gearman_job_handle) {
+/* {{{ proto resource gearman_job_get_output_stream(object job [, int chunk_size ])
+   A writable stream for the job's output. Writes are sent as WORK_DATA packets of chunk_size bytes, the rest on fflush() or fclose(). The stream is flushed and closed when the job ends. */
+PHP_FUNCTION(gearman_job_get_output_stream) {
 	zval *zobj;
 	gearman_job_obj *obj;
+	php_gearman_job_stream *self;
+	php_stream *stream;
+	zend_long chunk_size = PHP_GEARMAN_OUTPUT_CHUNK;
 
-	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_job_ce) == FAILURE) {
-		RETURN_NULL();
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O|l", &zobj, gearman_job_ce,
+								&chunk_size) == FAILURE) {
+		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_JOB_P(zobj);
 
-	/* make sure worker initialized a job */
-	if (obj->job == NULL) {
+	if ((obj->job == NULL && obj->handle == NULL) || obj->finished) {
 		RETURN_FALSE;
 	}
 
-	RETURN_STRING((char *)gearman_job_handle(obj->job))
-}
-/* }}} */
+	if (chunk_size <= 0 || chunk_size > UINT32_MAX / 2) {
+		php_error_docref(NULL, E_WARNING, "Invalid chunk_size " ZEND_LONG_FMT, chunk_size);
+		RETURN_FALSE;
+	}
 
-/* {{{ proto string gearman_job_function_name(object job)
-   Return the function name associated with a job. */
-PHP_FUNCTION(gearman_job_function_name) {
-	zval *zobj;
+	/* one per job, so nothing it holds can end up behind the result */
+	if (obj->output != NULL) {
+		ZVAL_RES(return_value, obj->output->res);
+		Z_ADDREF_P(return_value);
+		return;
+	}
+
+	self = emalloc(sizeof(php_gearman_job_stream));
+	ZVAL_COPY(&self->zjob, zobj);
+	self->size = (size_t) chunk_size;
+	self->used = 0;
+	self->buf = emalloc(self->size);
+
+	stream = php_stream_alloc(&_php_job_stream_ops, self, NULL, "wb");
+	if (stream == NULL) {
+		zval_ptr_dtor(&self->zjob);
+		efree(self->buf);
+		efree(self);
+		RETURN_FALSE;
+	}
+	obj->output = stream;
+
+	php_stream_to_zval(stream, return_value);
+}
+/* }}} */
+
+/* {{{ proto string gearman_job_handle(object job)
+   Return job handle. */
+PHP_FUNCTION(gearman_job_handle) {
+	zval *zobj;
+	gearman_job_obj *obj;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_job_ce) == FAILURE) {
+		RETURN_NULL();
+	}
+	obj = Z_GEARMAN_JOB_P(zobj);
+
+	if (obj->handle != NULL) {
+		RETURN_STR_COPY(obj->handle);
+	}
+
+	/* make sure worker initialized a job */
+	if (obj->job == NULL) {
+		RETURN_FALSE;
+	}
+
+	RETURN_STRING((char *)gearman_job_handle(obj->job))
+}
+/* }}} */
+
+/* {{{ proto string gearman_job_function_name(object job)
+   Return the function name associated with a job. */
+PHP_FUNCTION(gearman_job_function_name) {
+	zval *zobj;
 	gearman_job_obj *obj;
 
 	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_job_ce) == FAILURE) {
@@ -1449,6 +2061,10 @@ PHP_FUNCTION(gearman_job_function_name) {
 	}
 	obj = Z_GEARMAN_JOB_P(zobj);
 
+	if (obj->function_name != NULL) {
+		RETURN_STR_COPY(obj->function_name);
+	}
+
 	/* make sure worker initialized a job */
 	if (obj->job == NULL) {
 		RETURN_FALSE;
@@ -1469,6 +2085,10 @@ PHP_FUNCTION(gearman_job_unique) {
 	}
 	obj = Z_GEARMAN_JOB_P(zobj);
 
+	if (obj->unique != NULL) {
+		RETURN_STR_COPY(obj->unique);
+	}
+
 	/* make sure worker initialized a job */
 	if (obj->job == NULL) {
 		RETURN_FALSE;
@@ -1491,6 +2111,11 @@ PHP_FUNCTION(gearman_job_workload) {
 	}
 	obj = Z_GEARMAN_JOB_P(zobj);
 
+	/* the native engine read it into a string already */
+	if (obj->workload != NULL) {
+		RETURN_STR_COPY(obj->workload);
+	}
+
 	workload = gearman_job_workload(obj->job);
 	workload_len = gearman_job_workload_size(obj->job);
 
@@ -1510,6 +2135,10 @@ PHP_FUNCTION(gearman_job_workload_size) {
 	}
 	obj = Z_GEARMAN_JOB_P(zobj);
 
+	if (obj->workload != NULL) {
+		RETURN_LONG((zend_long) ZSTR_LEN(obj->workload));
+	}
+
 	workload_len = gearman_job_workload_size(obj->job);
 
 	RETURN_LONG((long) workload_len);
@@ -1556,6 +2185,8 @@ PHP_FUNCTION(gearman_client_wait) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_CLIENT_P(zobj);
+	_php_client_check_fork(obj);
+	_php_client_autoflush(obj);
 
 	obj->ret = gearman_client_wait(&(obj->client));
 
@@ -1571,7 +2202,67 @@ PHP_FUNCTION(gearman_client_wait) {
 }
 /* }}} */
 
-/* {{{ proto object gearman_client_do_work_handler(void *add_task_func, object client, string function, zval workload [, string unique ])
+/* The stream a do*() workload is read from, and in workload_size how
+ * much of it to send, the rest of the stream unless given. NULL with a
+ * warning if it cannot be streamed. */
+static php_stream *_php_client_workload_stream(gearman_client_obj *obj, zval *zworkload, zend_long *workload_size) {
+	php_stream_statbuf ssb;
+	php_stream *stream;
+	zend_off_t offset;
+
+	if (!PHP_GEARMAN_CLIENT_NATIVE(obj)) {
+		php_error_docref(NULL, E_WARNING, "Stream workloads need GEARMAN_ENGINE_NATIVE, see GearmanClient::setEngine()");
+		return NULL;
+	}
+
+	php_stream_from_zval_no_verify(stream, zworkload);
+	if (stream == NULL) {
+		return NULL;
+	}
+
+	/* a pipe or a download has no size to go by */
+	if (*workload_size < 0) {
+		if (php_stream_stat(stream, &ssb) != 0 || !S_ISREG(ssb.sb.st_mode) ||
+		    (offset = php_stream_tell(stream)) < 0) {
+			php_error_docref(NULL, E_WARNING, "Unable to tell the size of the workload stream, pass workload_size");
+			return NULL;
+		}
+		*workload_size = offset < ssb.sb.st_size ? ssb.sb.st_size - offset : 0;
+	}
+
+	return stream;
+}
+
+/* Parses the arguments of the do*() calls. A stream workload is taken
+ * as is, anything else has to pass as a string, with the coercion and
+ * the errors "s" gives, strict_types included. Exactly one of zworkload
+ * and workload is set on success. */
+static int _php_client_parse_do_args(INTERNAL_FUNCTION_PARAMETERS, zval **zobj,
+				char **function_name, size_t *function_name_len,
+				zval **zworkload, zend_string **workload,
+				char **unique, size_t *unique_len,
+				zend_long *workload_size) {
+	uint32_t arg = getThis() ? 2 : 3;
+
+	*zworkload = NULL;
+	*workload = NULL;
+
+	if (ZEND_NUM_ARGS() >= arg && Z_TYPE_P(ZEND_CALL_ARG(execute_data, arg)) == IS_RESOURCE) {
+		return zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Osr|sl", zobj, gearman_client_ce,
+							function_name, function_name_len,
+							zworkload,
+							unique, unique_len,
+							workload_size);
+	}
+
+	return zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "OsS|sl", zobj, gearman_client_ce,
+						function_name, function_name_len,
+						workload,
+						unique, unique_len,
+						workload_size);
+}
+
+/* {{{ proto object gearman_client_do_work_handler(void *add_task_func, object client, string function, zval workload [, string unique [, int workload_size ]])
    Run a task, high/normal/low dependent upon do_work_func */
 static void gearman_client_do_work_handler(void* (*do_work_func)(
 								gearman_client_st *client,
@@ -1581,42 +2272,130 @@ static void gearman_client_do_work_handler(void* (*do_work_func)(
 								size_t *result_size,
 								gearman_return_t *ret_ptr
 					),
+					gearman_job_priority_t priority,
 					INTERNAL_FUNCTION_PARAMETERS) {
 	char *function_name;
 	size_t function_name_len;
-	char *workload;
+	zval *zworkload;
+	zend_string *workload_str;
+	zend_long workload_size = -1;
+	php_stream *stream = NULL;
+	char *workload = NULL;
 	size_t workload_len;
 	char *unique = NULL;
 	size_t unique_len = 0;
-	void *result;
+	void *result = NULL;
 	size_t result_size = 0;
+	zend_string *result_str = NULL;
+	zend_bool hedged = 0, native = 0;
+	zend_long adaptive_timeout;
+	int client_timeout = 0;
+	uint64_t start, call_start;
+	uint32_t attempts;
+	gearman_client_st *target;
+	int32_t server = -1;
 
 	gearman_client_obj *obj;
 	zval *zobj;
 
-	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Oss|s", &zobj, gearman_client_ce,
+	if (_php_client_parse_do_args(INTERNAL_FUNCTION_PARAM_PASSTHRU, &zobj,
 							&function_name, &function_name_len,
-							&workload, &workload_len,
-							&unique, &unique_len) == FAILURE) {
+							&zworkload, &workload_str,
+							&unique, &unique_len,
+							&workload_size) == FAILURE) {
 		RETURN_EMPTY_STRING();
 	}
 	obj = Z_GEARMAN_CLIENT_P(zobj);
+	_php_client_check_fork(obj);
+	_php_client_autoflush(obj);
+	_php_client_keepalive(obj);
+
+	if (zworkload != NULL) {
+		stream = _php_client_workload_stream(obj, zworkload, &workload_size);
+		if (stream == NULL) {
+			obj->ret = GEARMAN_INVALID_ARGUMENT;
+			RETURN_EMPTY_STRING();
+		}
+		workload_len = (size_t) workload_size;
+	} else {
+		/* never copied, every path sends straight from the caller's string */
+		workload = ZSTR_VAL(workload_str);
+		workload_len = ZSTR_LEN(workload_str);
+	}
 
-	result = (char *)(*do_work_func)(
-						&(obj->client),
-						function_name,
-						unique,
-						workload,
-						(size_t)workload_len,
-						&result_size,
-						&(obj)->ret
-					);
+	/* hedged calls pick their servers themselves, on the client's own
+	 * connections as well */
+	hedged = stream == NULL && obj->hedge_delay > 0 && zend_hash_num_elements(Z_ARRVAL(obj->server_list)) > 1;
+
+	adaptive_timeout = _php_client_adaptive_timeout(obj, function_name, function_name_len);
+	start = _php_gearman_now_ms();
+
+	for (attempts = 0; ; attempts++) {
+		/* on the native engine, for unix sockets libgearman cannot reach
+		 * and for streams, jobs go through the client's own connections */
+		target = hedged ? NULL : _php_client_route_do(obj, unique, unique_len, &server);
+		native = !hedged && (target == NULL || stream != NULL);
+		if (target == NULL) {
+			target = &(obj->client);
+		}
+
+		/* the adaptive timeout replaces the static one for this call only */
+		if (adaptive_timeout > 0) {
+			client_timeout = gearman_client_timeout(target);
+			gearman_client_set_timeout(target, (int) adaptive_timeout);
+		}
+		call_start = _php_gearman_now_ms();
+
+		if (hedged) {
+			result_str = _php_client_do_hedged(obj, priority, function_name, unique, workload_str);
+		} else if (native) {
+			result_str = _php_client_native_do(obj, priority, 0, function_name, function_name_len,
+								unique, unique_len, workload, workload_len, stream,
+								server, gearman_client_timeout(target));
+		} else {
+			result = (char *)(*do_work_func)(
+								target,
+								function_name,
+								unique,
+								workload,
+								(size_t)workload_len,
+								&result_size,
+								&(obj)->ret
+							);
+		}
+
+		if (adaptive_timeout > 0) {
+			gearman_client_set_timeout(target, client_timeout);
+		}
+
+		_php_client_server_done(obj, server, obj->ret, _php_gearman_now_ms() - call_start);
+		if (hedged || !_php_client_fail_over(obj, server, obj->ret, 0, attempts)) {
+			break;
+		}
+	}
+
+	/* only answered calls tell how long the function takes, a timed out
+	 * one would feed the current timeout back into the estimate */
+	if (obj->ret == GEARMAN_SUCCESS) {
+		_php_client_record_latency(obj, function_name, function_name_len, _php_gearman_now_ms() - start);
+	} else if (obj->ret == GEARMAN_TIMEOUT && adaptive_timeout > 0) {
+		_php_client_record_timeout(obj, function_name, function_name_len);
+	}
 
 	if (! PHP_GEARMAN_CLIENT_RET_OK(obj->ret)) {
-		php_error_docref(NULL, E_WARNING, "%s", gearman_client_error(&(obj->client)));
+		php_error_docref(NULL, E_WARNING, "%s",
+			hedged || native ? _php_client_native_error(obj) : gearman_client_error(target));
 		RETURN_EMPTY_STRING();
 	}
 
+	if (hedged || native) {
+		if (! result_str) {
+			RETURN_EMPTY_STRING();
+		}
+
+		RETURN_STR(result_str);
+	}
+
 	/* NULL results are valid */
 	if (! result) {
 		RETURN_EMPTY_STRING();
@@ -1626,28 +2405,28 @@ static void gearman_client_do_work_handler(void* (*do_work_func)(
 }
 /* }}} */
 
-/* {{{ proto string GearmanClient::doNormal(string function, string workload [, string unique ])
-   Run a single task and return an allocated result. */
+/* {{{ proto string GearmanClient::doNormal(string function, mixed workload [, string unique [, int workload_size ]])
+   Run a single task and return an allocated result. On the native engine the workload may be a stream, sent in chunks, workload_size bytes of it or the rest of a file. */
 PHP_FUNCTION(gearman_client_do_normal) {
-	gearman_client_do_work_handler(gearman_client_do, INTERNAL_FUNCTION_PARAM_PASSTHRU);
+	gearman_client_do_work_handler(gearman_client_do, GEARMAN_JOB_PRIORITY_NORMAL, INTERNAL_FUNCTION_PARAM_PASSTHRU);
 }
 /* }}} */
 
-/* {{{ proto string GearmanClient::doHigh(object client, string function, string workload [, string unique ])
+/* {{{ proto string GearmanClient::doHigh(object client, string function, mixed workload [, string unique [, int workload_size ]])
    Run a high priority task and return an allocated result. */
 PHP_FUNCTION(gearman_client_do_high) {
-	gearman_client_do_work_handler(gearman_client_do_high, INTERNAL_FUNCTION_PARAM_PASSTHRU);
+	gearman_client_do_work_handler(gearman_client_do_high, GEARMAN_JOB_PRIORITY_HIGH, INTERNAL_FUNCTION_PARAM_PASSTHRU);
 }
 /* }}} */
 
-/* {{{ proto array GearmanClient::doLow(object client, string function, string workload [, string unique ])
+/* {{{ proto array GearmanClient::doLow(object client, string function, mixed workload [, string unique [, int workload_size ]])
    Run a low priority task and return an allocated result. */
 PHP_FUNCTION(gearman_client_do_low) {
-	gearman_client_do_work_handler(gearman_client_do_low, INTERNAL_FUNCTION_PARAM_PASSTHRU);
+	gearman_client_do_work_handler(gearman_client_do_low, GEARMAN_JOB_PRIORITY_LOW, INTERNAL_FUNCTION_PARAM_PASSTHRU);
 }
 /* }}} */
 
-/* {{{ proto object gearman_client_do_background_work_handler(void *add_task_func, object client, string function, zval workload [, string unique ])
+/* {{{ proto object gearman_client_do_background_work_handler(void *add_task_func, object client, string function, zval workload [, string unique [, int workload_size ]])
    Run a task in the background, high/normal/low dependent upon do_work_func */
 static void gearman_client_do_background_work_handler(gearman_return_t (*do_background_work_func)(
 								gearman_client_st *client,
@@ -1660,67 +2439,151 @@ static void gearman_client_do_background_work_handler(gearman_return_t (*do_back
 					INTERNAL_FUNCTION_PARAMETERS) {
 	char *function_name;
 	size_t function_name_len;
-	char *workload;
+	zval *zworkload;
+	zend_string *workload_str;
+	zend_long workload_size = -1;
+	php_stream *stream = NULL;
+	char *workload = NULL;
 	size_t workload_len;
 	char *unique = NULL;
 	size_t unique_len = 0;
-	zend_string *job_handle;
+	zend_string *job_handle = NULL;
+	gearman_job_handle_t handle;
+	gearman_client_st *target;
+	gearman_job_priority_t priority;
+	zend_bool native;
+	int32_t server;
+	uint64_t start;
+	uint32_t attempts;
 	gearman_client_obj *obj;
 	zval *zobj;
 
-	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Oss|s", &zobj, gearman_client_ce,
+	if (_php_client_parse_do_args(INTERNAL_FUNCTION_PARAM_PASSTHRU, &zobj,
 							&function_name, &function_name_len,
-							&workload, &workload_len,
-							&unique, &unique_len) == FAILURE) {
+							&zworkload, &workload_str,
+							&unique, &unique_len,
+							&workload_size) == FAILURE) {
 		RETURN_EMPTY_STRING();
 	}
 
 	obj = Z_GEARMAN_CLIENT_P(zobj);
+	_php_client_check_fork(obj);
+	_php_client_autoflush(obj);
+	_php_client_keepalive(obj);
+
+	if (zworkload != NULL) {
+		stream = _php_client_workload_stream(obj, zworkload, &workload_size);
+		if (stream == NULL) {
+			obj->ret = GEARMAN_INVALID_ARGUMENT;
+			RETURN_EMPTY_STRING();
+		}
+		workload_len = (size_t) workload_size;
+	} else {
+		workload = ZSTR_VAL(workload_str);
+		workload_len = ZSTR_LEN(workload_str);
+	}
+
+	priority = do_background_work_func == gearman_client_do_high_background ? GEARMAN_JOB_PRIORITY_HIGH :
+			do_background_work_func == gearman_client_do_low_background ? GEARMAN_JOB_PRIORITY_LOW :
+			GEARMAN_JOB_PRIORITY_NORMAL;
+
+	/* submitted later by flushDeferred(), so there is no handle yet.
+	 * Streams go out right away, they would have to be read in first. */
+	if (obj->defer_background && stream == NULL) {
+		_php_client_defer_background(obj, priority,
+				function_name, function_name_len,
+				workload_str,
+				unique, unique_len);
+		obj->ret = GEARMAN_SUCCESS;
+		RETURN_EMPTY_STRING();
+	}
 
-	job_handle = zend_string_alloc(GEARMAN_JOB_HANDLE_SIZE-1, 0);
+	/* the job handle is only ever known to the sender thread */
+	if (obj->sender != NULL && stream == NULL) {
+		obj->ret = php_gearman_sender_push(obj->sender,
+						do_background_work_func,
+						function_name, function_name_len,
+						unique, unique_len,
+						workload, workload_len);
 
-	obj->ret = (*do_background_work_func)(
-						&(obj->client),
-						(char *)function_name,
-						(char *)unique,
-						(void *)workload,
-						(size_t)workload_len,
-						job_handle->val
-					);
+		if (obj->ret == GEARMAN_MEMORY_ALLOCATION_FAILURE) {
+			php_error_docref(NULL, E_WARNING, "Unable to queue background job");
+			RETURN_EMPTY_STRING();
+		}
+
+		/* a full ring with GEARMAN_SENDER_SPILL falls through to a synchronous submit */
+		if (obj->ret == GEARMAN_SUCCESS || obj->sender->policy != GEARMAN_SENDER_SPILL) {
+			RETURN_EMPTY_STRING();
+		}
+	}
 
-	ZSTR_LEN(job_handle) = strnlen(ZSTR_VAL(job_handle), GEARMAN_JOB_HANDLE_SIZE-1);
+	for (attempts = 0; ; attempts++) {
+		/* see gearman_client_do_work_handler() */
+		target = _php_client_route_do(obj, unique, unique_len, &server);
+		native = target == NULL || stream != NULL;
+		if (target == NULL) {
+			target = &(obj->client);
+		}
+		start = _php_gearman_now_ms();
+
+		if (native) {
+			job_handle = _php_client_native_do(obj, priority, 1, function_name, function_name_len,
+								unique, unique_len, workload, workload_len, stream,
+								server, gearman_client_timeout(target));
+		} else {
+			handle[0] = '\0';
+			obj->ret = (*do_background_work_func)(
+								target,
+								(char *)function_name,
+								(char *)unique,
+								(void *)workload,
+								(size_t)workload_len,
+								handle
+							);
+		}
+
+		_php_client_server_done(obj, server, obj->ret, _php_gearman_now_ms() - start);
+		/* what was read from a stream is gone */
+		if (stream != NULL || !_php_client_fail_over(obj, server, obj->ret, 1, attempts)) {
+			break;
+		}
+	}
 
 	if (! PHP_GEARMAN_CLIENT_RET_OK(obj->ret)) {
 		php_error_docref(NULL, E_WARNING, "%s",
-						 gearman_client_error(&(obj->client)));
-		zend_string_release(job_handle);
+						 native ? _php_client_native_error(obj) : gearman_client_error(target));
+		if (job_handle) {
+			zend_string_release(job_handle);
+		}
 		RETURN_EMPTY_STRING();
 	}
 
-	if (! job_handle) {
-		zend_string_release(job_handle);
-		RETURN_EMPTY_STRING();
+	if (native) {
+		if (! job_handle) {
+			RETURN_EMPTY_STRING();
+		}
+		RETURN_STR(job_handle);
 	}
 
-	RETURN_STR(job_handle);
+	RETURN_STRINGL(handle, strnlen(handle, GEARMAN_JOB_HANDLE_SIZE-1));
 }
 /* }}} */
 
-/* {{{ proto string GearmanClient::doBackground(string function, string workload [, string unique ])
-   Run a task in the background. */
+/* {{{ proto string GearmanClient::doBackground(string function, mixed workload [, string unique [, int workload_size ]])
+   Run a task in the background. Stream workloads work like in doNormal(), they are never deferred or queued. */
 PHP_FUNCTION(gearman_client_do_background) {
 	gearman_client_do_background_work_handler(gearman_client_do_background, INTERNAL_FUNCTION_PARAM_PASSTHRU);
 }
 /* }}} */
 
-/* {{{ proto string GearmanClient::doHighBackground(string function, string workload [, string unique ])
+/* {{{ proto string GearmanClient::doHighBackground(string function, mixed workload [, string unique [, int workload_size ]])
    Run a high priority task in the background. */
 PHP_FUNCTION(gearman_client_do_high_background) {
 	gearman_client_do_background_work_handler(gearman_client_do_high_background, INTERNAL_FUNCTION_PARAM_PASSTHRU);
 }
 /* }}} */
 
-/* {{{ proto string GearmanClient::doLowBackground(string function, string workload [, string unique ])
+/* {{{ proto string GearmanClient::doLowBackground(string function, mixed workload [, string unique [, int workload_size ]])
    Run a low priority task in the background. */
 PHP_FUNCTION(gearman_client_do_low_background) {
 	gearman_client_do_background_work_handler(gearman_client_do_low_background, INTERNAL_FUNCTION_PARAM_PASSTHRU);
@@ -1783,6 +2646,9 @@ PHP_FUNCTION(gearman_client_job_status) {
 		RETURN_EMPTY_STRING();
 	}
 	obj = Z_GEARMAN_CLIENT_P(zobj);
+	_php_client_check_fork(obj);
+	_php_client_autoflush(obj);
+	_php_client_keepalive(obj);
 
 	obj->ret = gearman_client_job_status(&(obj->client), job_handle,
 										&is_known, &is_running,
@@ -1813,6 +2679,9 @@ PHP_FUNCTION(gearman_client_job_status_by_unique_key) {
 		RETURN_EMPTY_STRING();
 	}
 	obj = Z_GEARMAN_CLIENT_P(zobj);
+	_php_client_check_fork(obj);
+	_php_client_autoflush(obj);
+	_php_client_keepalive(obj);
 
 	gearman_status_t status = gearman_client_unique_status(&(obj->client), unique_key, unique_key_len);
 	gearman_return_t rc = gearman_status_return(status);
@@ -1842,6 +2711,16 @@ PHP_FUNCTION(gearman_client_ping) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_CLIENT_P(zobj);
+	_php_client_check_fork(obj);
+	_php_client_autoflush(obj);
+
+	if (PHP_GEARMAN_CLIENT_NATIVE(obj)) {
+		if (_php_client_native_echo(obj, workload, (size_t)workload_len) != GEARMAN_SUCCESS) {
+			php_error_docref(NULL, E_WARNING, "%s", _php_client_native_error(obj));
+			RETURN_FALSE;
+		}
+		RETURN_TRUE;
+	}
 
 	obj->ret = gearman_client_echo(&(obj->client), workload, (size_t)workload_len);
 
@@ -1855,7 +2734,7 @@ PHP_FUNCTION(gearman_client_ping) {
 }
 /* }}} */
 
-/* {{{ proto object gearman_client_add_task_handler(void *add_task_func, object client, string function, zval workload [, string unique ])
+/* {{{ proto object gearman_client_add_task_handler(void *add_task_func, object client, string function, zval workload [, mixed context [, string unique [, int timeout_ms ]]])
    Add a task to be run in parallel, background or not, high/normal/low dependent upon add_task_func. */
 static void gearman_client_add_task_handler(gearman_task_st* (*add_task_func)(
 								gearman_client_st *client,
@@ -1870,26 +2749,31 @@ static void gearman_client_add_task_handler(gearman_task_st* (*add_task_func)(
 	zval *zworkload;
 	zval *zdata = NULL;
 	gearman_task_obj *task;
+	gearman_client_st *target;
+	int32_t server;
 
 	char *unique;
 	char *function_name;
 	size_t unique_len = 0;
 	size_t function_name_len = 0;
+	zend_long timeout = 0;
 
 	gearman_client_obj *obj;
 	zval *zobj;
 
 	// TODO - the documentation on php.net differs from this
 	// As found, this doesn't allow for user to pass in context.
-	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Osz|zs", &zobj, gearman_client_ce,
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Osz|zsl", &zobj, gearman_client_ce,
 								&function_name, &function_name_len,
 								&zworkload,
 								&zdata,
-								&unique, &unique_len
+								&unique, &unique_len,
+								&timeout
 								) == FAILURE) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_CLIENT_P(zobj);
+	_php_client_check_fork(obj);
 
 	if (unique_len == 0) {
 	  unique = NULL;
@@ -1899,6 +2783,17 @@ static void gearman_client_add_task_handler(gearman_task_st* (*add_task_func)(
 		convert_to_string(zworkload);
 	}
 
+	/* make room first, so producers get backpressure instead of a
+	 * task list that grows with their input */
+	if (obj->max_in_flight > 0) {
+		obj->ret = _php_client_drain(obj, (uint32_t) obj->max_in_flight);
+		if (! PHP_GEARMAN_CLIENT_RET_OK(obj->ret)) {
+			php_error_docref(NULL, E_WARNING, "%s",
+							 gearman_client_error(&(obj->client)));
+			RETURN_FALSE;
+		}
+	}
+
 	/* get a task object, and prepare it for return */
 	if (object_init_ex(return_value, gearman_task_ce) != SUCCESS) {
 		php_error_docref(NULL, E_WARNING, "GearmanTask Object creation failure.");
@@ -1911,14 +2806,18 @@ static void gearman_client_add_task_handler(gearman_task_st* (*add_task_func)(
 		ZVAL_COPY(&task->zdata, zdata);
 	}
 
+	/* libgearman sends workloads past its own send buffer straight
+	 * from this string, the task keeps it alive until then */
 	ZVAL_COPY(&task->zworkload, zworkload);
 
 	/* need to store a ref to the client for later access to cb's */
 	ZVAL_COPY(&task->zclient, zobj);
 
+	target = _php_client_route(obj, unique, unique_len, &server);
+
 	/* add the task */
 	task->task = (*add_task_func)(
-					&(obj->client),
+					target,
 					task->task,
 					(void *)task,
 					function_name,
@@ -1930,54 +2829,86 @@ static void gearman_client_add_task_handler(gearman_task_st* (*add_task_func)(
 
 	if (obj->ret != GEARMAN_SUCCESS) {
 		php_error_docref(NULL, E_WARNING, "%s",
-						 gearman_client_error(&(obj->client)));
+						 gearman_client_error(target));
 		RETURN_FALSE;
 	}
 
 	task->flags |= GEARMAN_TASK_OBJ_CREATED;
 	task->task_id = ++obj->created_tasks;
 
+	if (server >= 0) {
+		task->server = server;
+		obj->servers[server].tasks++;
+		obj->routed_tasks++;
+	}
+
 	// prepend task to list of tasks on client obj
 	Z_ADDREF_P(return_value);
 	add_index_zval(&obj->task_list, task->task_id, return_value);
+
+	if (add_task_func == gearman_client_add_task_background ||
+	    add_task_func == gearman_client_add_task_high_background ||
+	    add_task_func == gearman_client_add_task_low_background) {
+		task->flags |= GEARMAN_TASK_OBJ_BACKGROUND;
+		if (obj->background_queued++ == 0) {
+			obj->background_since = _php_gearman_now_ms();
+		}
+	} else {
+		task->started = _php_gearman_now_ms();
+		if (timeout <= 0) {
+			timeout = _php_client_adaptive_timeout(obj, function_name, function_name_len);
+			if (timeout > 0) {
+				task->flags |= GEARMAN_TASK_OBJ_ADAPTIVE;
+			}
+		}
+	}
+
+	/* enforced by runTasks() and completions() */
+	if (timeout > 0) {
+		task->deadline = _php_gearman_now_ms() + timeout;
+		obj->deadline_tasks++;
+	}
+
+	_php_client_autoflush(obj);
+	_php_client_keepalive(obj);
 }
 /* }}} */
 
-/* {{{ proto object GearmanClient::addTask(string function, zval workload [, string unique ])
+/* {{{ proto object GearmanClient::addTask(string function, zval workload [, mixed context [, string unique [, int timeout_ms ]]])
    Add a task to be run in parallel. */
 PHP_FUNCTION(gearman_client_add_task) {
 	gearman_client_add_task_handler(gearman_client_add_task, INTERNAL_FUNCTION_PARAM_PASSTHRU);
 }
 
-/* {{{ proto object GearmanClient::addTaskHigh(string function, zval workload [, string unique ])
+/* {{{ proto object GearmanClient::addTaskHigh(string function, zval workload [, mixed context [, string unique [, int timeout_ms ]]])
    Add a high priority task to be run in parallel. */
 PHP_FUNCTION(gearman_client_add_task_high) {
 	gearman_client_add_task_handler(gearman_client_add_task_high, INTERNAL_FUNCTION_PARAM_PASSTHRU);
 }
 /* }}} */
 
-/* {{{ proto object GearmanClient::addTaskLow(string function, zval workload [, string unique ])
+/* {{{ proto object GearmanClient::addTaskLow(string function, zval workload [, mixed context [, string unique [, int timeout_ms ]]])
    Add a low priority task to be run in parallel. */
 PHP_FUNCTION(gearman_client_add_task_low) {
 	gearman_client_add_task_handler(gearman_client_add_task_low, INTERNAL_FUNCTION_PARAM_PASSTHRU);
 }
 /* }}} */
 
-/* {{{ proto object GearmanClient(string function, zval workload [, string unique ])
+/* {{{ proto object GearmanClient::addTaskBackground(string function, zval workload [, mixed context [, string unique [, int timeout_ms ]]])
    Add a background task to be run in parallel. */
 PHP_FUNCTION(gearman_client_add_task_background) {
 	gearman_client_add_task_handler(gearman_client_add_task_background, INTERNAL_FUNCTION_PARAM_PASSTHRU);
 }
 /* }}} */
 
-/* {{{ proto object GearmanClient::addTaskHighBackground(string function, zval workload [, string unique ])
+/* {{{ proto object GearmanClient::addTaskHighBackground(string function, zval workload [, mixed context [, string unique [, int timeout_ms ]]])
    Add a high priority background task to be run in parallel. */
 PHP_FUNCTION(gearman_client_add_task_high_background) {
 	gearman_client_add_task_handler(gearman_client_add_task_high_background, INTERNAL_FUNCTION_PARAM_PASSTHRU);
 }
 /* }}} */
 
-/* {{{ proto object GearmanClient::addTaskLowBackground(string function, zval workload [, string unique ])
+/* {{{ proto object GearmanClient::addTaskLowBackground(string function, zval workload [, mixed context [, string unique [, int timeout_ms ]]])
    Add a low priority background task to be run in parallel. */
 PHP_FUNCTION(gearman_client_add_task_low_background) {
 	gearman_client_add_task_handler(gearman_client_add_task_low_background, INTERNAL_FUNCTION_PARAM_PASSTHRU);
@@ -2006,6 +2937,9 @@ PHP_FUNCTION(gearman_client_add_task_status) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_CLIENT_P(zobj);
+	_php_client_check_fork(obj);
+	_php_client_autoflush(obj);
+	_php_client_keepalive(obj);
 
 	/* get a task object, and prepare it for return */
 	if (object_init_ex(return_value, gearman_task_ce) != SUCCESS) {
@@ -2375,13 +3309,24 @@ PHP_FUNCTION(gearman_client_clear_callbacks) {
 	gearman_client_clear_fn(&obj->client);
 
 	zval_dtor(&obj->zworkload_fn);
+	ZVAL_UNDEF(&obj->zworkload_fn);
 	zval_dtor(&obj->zcreated_fn);
+	ZVAL_UNDEF(&obj->zcreated_fn);
 	zval_dtor(&obj->zdata_fn);
+	ZVAL_UNDEF(&obj->zdata_fn);
 	zval_dtor(&obj->zwarning_fn);
+	ZVAL_UNDEF(&obj->zwarning_fn);
 	zval_dtor(&obj->zstatus_fn);
+	ZVAL_UNDEF(&obj->zstatus_fn);
 	zval_dtor(&obj->zcomplete_fn);
+	ZVAL_UNDEF(&obj->zcomplete_fn);
 	zval_dtor(&obj->zexception_fn);
+	ZVAL_UNDEF(&obj->zexception_fn);
 	zval_dtor(&obj->zfail_fn);
+	ZVAL_UNDEF(&obj->zfail_fn);
+
+	/* iterators and completion policies still need theirs */
+	_php_client_sync_fns(obj);
 
 	RETURN_TRUE;
 }
@@ -2433,22 +3378,67 @@ PHP_FUNCTION(gearman_client_set_context) {
 }
 /* }}} */
 
-/* {{{ proto bool gearman_client_run_tasks(object client)
-   Run tasks that have been added in parallel */
+/* {{{ proto bool gearman_client_run_tasks(object client [, int timeout_ms])
+   Run tasks that have been added in parallel. Tasks still running after timeout_ms, or past their own timeout, are cancelled with GEARMAN_TIMEOUT and reported to the fail callback. */
 PHP_FUNCTION(gearman_client_run_tasks) {
+	zend_long timeout = 0;
+	uint64_t deadline = 0, now, next;
 	gearman_client_obj *obj;
 	zval *zobj;
 
-	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O|l", &zobj, gearman_client_ce, &timeout) == FAILURE) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_CLIENT_P(zobj);
+	_php_client_check_fork(obj);
+
+	_php_client_start_batch(obj);
+
+	if (timeout <= 0 && obj->deadline_tasks == 0 && obj->completion_policy == GEARMAN_COMPLETION_ALL &&
+	    obj->routed_tasks == 0) {
+		obj->ret = gearman_client_run_tasks(&(obj->client));
+	} else {
+		/* wake up for every deadline, tasks that miss theirs are
+		 * cancelled and the rest keep running */
+		if (timeout > 0) {
+			deadline = _php_gearman_now_ms() + timeout;
+		}
+
+		while (1) {
+			now = _php_gearman_now_ms();
+			if (deadline && now >= deadline) {
+				_php_client_expire_tasks(obj, now, 1);
+				obj->ret = GEARMAN_TIMEOUT;
+				RETURN_FALSE;
+			}
+
+			next = _php_client_expire_tasks(obj, now, 0);
+			if (_php_client_completion_reached(obj)) {
+				break;
+			}
+			if (deadline && (next == 0 || deadline < next)) {
+				next = deadline;
+			}
+
+			obj->ret = _php_client_run_step(obj, next ? (int) (next - now) : -1);
+			if (_php_client_completion_reached(obj)) {
+				break;
+			}
+			if (obj->ret != GEARMAN_IO_WAIT && !(obj->ret == GEARMAN_TIMEOUT && next)) {
+				break;
+			}
+		}
+	}
 
-	obj->ret = gearman_client_run_tasks(&(obj->client));
+	/* returnCode() tells which failure ended the batch */
+	if ((obj->completion_policy & GEARMAN_COMPLETION_FAIL_FAST) && obj->batch_failed > 0) {
+		obj->ret = obj->batch_ret;
+		RETURN_FALSE;
+	}
 
 	if (! PHP_GEARMAN_CLIENT_RET_OK(obj->ret)) {
 		php_error_docref(NULL, E_WARNING, "%s",
-						 gearman_client_error(&(obj->client)));
+						 _php_client_error(obj, &(obj->client)));
 		RETURN_FALSE;
 	}
 
@@ -2639,6 +3629,7 @@ PHP_FUNCTION(gearman_worker_add_server) {
 	char *host = NULL;
 	size_t host_len = 0;
 	zend_long port = 0;
+	zend_string *server;
 
 	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O|sl", &zobj,
 								gearman_worker_ce,
@@ -2649,6 +3640,17 @@ PHP_FUNCTION(gearman_worker_add_server) {
 	}
 	obj = Z_GEARMAN_WORKER_P(zobj);
 
+	/* libgearman cannot reach unix sockets, only the native engine uses them */
+	if (host != NULL && PHP_GEARMAN_IS_UNIX(host)) {
+		if (obj->engine != GEARMAN_ENGINE_NATIVE) {
+			php_error_docref(NULL, E_WARNING, "Unix domain sockets need GEARMAN_ENGINE_NATIVE, see GearmanWorker::setEngine()");
+			RETURN_FALSE;
+		}
+		add_next_index_stringl(&obj->server_list, host, host_len);
+		obj->ret = GEARMAN_SUCCESS;
+		RETURN_TRUE;
+	}
+
 	obj->ret = gearman_worker_add_server(&obj->worker, host, port);
 	if (obj->ret != GEARMAN_SUCCESS) {
 		php_error_docref(NULL, E_WARNING, "%s",
@@ -2656,6 +3658,13 @@ PHP_FUNCTION(gearman_worker_add_server) {
 		RETURN_FALSE;
 	}
 
+	server = strpprintf(0, "%s:%ld",
+				host_len ? host : GEARMAN_DEFAULT_TCP_HOST,
+				port ? (long) port : (long) GEARMAN_DEFAULT_TCP_PORT);
+	/* spelled like _php_gearman_server_key() does */
+	zend_str_tolower(ZSTR_VAL(server), ZSTR_LEN(server));
+	add_next_index_str(&obj->server_list, server);
+
 	if (! gearman_worker_set_server_option(&(obj->worker), "exceptions", (sizeof("exceptions") - 1))) {
 		GEARMAN_EXCEPTION("Failed to set exception option", 0);
 	}
@@ -2671,6 +3680,8 @@ PHP_FUNCTION(gearman_worker_add_servers) {
 	gearman_worker_obj *obj;
 	char *servers = NULL;
 	size_t servers_len = 0;
+	zend_string *tcp;
+	zval *zserver, list;
 
 	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Os", &zobj,
 								gearman_worker_ce,
@@ -2681,11 +3692,41 @@ PHP_FUNCTION(gearman_worker_add_servers) {
 
 	obj = Z_GEARMAN_WORKER_P(zobj);
 
-	obj->ret = gearman_worker_add_servers(&obj->worker, servers);
-	if (obj->ret != GEARMAN_SUCCESS) {
-		php_error_docref(NULL, E_WARNING, "%s",
-						 gearman_worker_error(&obj->worker));
-		RETURN_FALSE;
+	/* libgearman only gets to see the TCP servers */
+	if (strstr(servers, PHP_GEARMAN_UNIX_PREFIX) != NULL) {
+		if (obj->engine != GEARMAN_ENGINE_NATIVE) {
+			php_error_docref(NULL, E_WARNING, "Unix domain sockets need GEARMAN_ENGINE_NATIVE, see GearmanWorker::setEngine()");
+			RETURN_FALSE;
+		}
+
+		array_init(&list);
+		_php_gearman_record_servers(&list, servers);
+		tcp = _php_gearman_join_servers(&list, 0);
+
+		obj->ret = tcp ? gearman_worker_add_servers(&obj->worker, ZSTR_VAL(tcp)) : GEARMAN_SUCCESS;
+		if (tcp) {
+			zend_string_release(tcp);
+		}
+		if (obj->ret != GEARMAN_SUCCESS) {
+			php_error_docref(NULL, E_WARNING, "%s",
+							 gearman_worker_error(&obj->worker));
+			zval_dtor(&list);
+			RETURN_FALSE;
+		}
+
+		ZEND_HASH_FOREACH_VAL(Z_ARRVAL(list), zserver) {
+			add_next_index_str(&obj->server_list, zend_string_copy(Z_STR_P(zserver)));
+		} ZEND_HASH_FOREACH_END();
+		zval_dtor(&list);
+	} else {
+		obj->ret = gearman_worker_add_servers(&obj->worker, servers);
+		if (obj->ret != GEARMAN_SUCCESS) {
+			php_error_docref(NULL, E_WARNING, "%s",
+							 gearman_worker_error(&obj->worker));
+			RETURN_FALSE;
+		}
+
+		_php_gearman_record_servers(&obj->server_list, servers);
 	}
 
 	if (! gearman_worker_set_server_option(&(obj->worker), "exceptions", (sizeof("exceptions") - 1))) {
@@ -2706,6 +3747,7 @@ PHP_FUNCTION(gearman_worker_wait) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_WORKER_P(zobj);
+	_php_worker_check_fork(obj);
 
 	obj->ret = gearman_worker_wait(&(obj->worker));
 
@@ -2738,6 +3780,7 @@ PHP_FUNCTION(gearman_worker_register) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_WORKER_P(zobj);
+	_php_worker_check_fork(obj);
 
 	obj->ret = gearman_worker_register(&(obj->worker), function_name, timeout);
 	if (obj->ret != GEARMAN_SUCCESS) {
@@ -2764,6 +3807,7 @@ PHP_FUNCTION(gearman_worker_unregister) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_WORKER_P(zobj);
+	_php_worker_check_fork(obj);
 
 	obj->ret = gearman_worker_unregister(&(obj->worker), function_name);
 	if (obj->ret != GEARMAN_SUCCESS) {
@@ -2772,6 +3816,11 @@ PHP_FUNCTION(gearman_worker_unregister) {
 		RETURN_FALSE;
 	}
 
+	/* the native engine tells the servers itself */
+	if (obj->engine == GEARMAN_ENGINE_NATIVE) {
+		_php_worker_native_reannounce(obj);
+	}
+
 	RETURN_TRUE;
 }
 /* }}} */
@@ -2786,6 +3835,7 @@ PHP_FUNCTION(gearman_worker_unregister_all) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_WORKER_P(zobj);
+	_php_worker_check_fork(obj);
 
 	obj->ret= gearman_worker_unregister_all(&(obj->worker));
 	if (obj->ret != GEARMAN_SUCCESS) {
@@ -2794,6 +3844,11 @@ PHP_FUNCTION(gearman_worker_unregister_all) {
 		RETURN_FALSE;
 	}
 
+	/* the native engine tells the servers itself */
+	if (obj->engine == GEARMAN_ENGINE_NATIVE) {
+		_php_worker_native_reannounce(obj);
+	}
+
 	RETURN_TRUE;
 }
 /* }}} */
@@ -2810,6 +3865,7 @@ PHP_FUNCTION(gearman_worker_grab_job) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_WORKER_P(zobj);
+	_php_worker_check_fork(obj);
 
 	object_init_ex(return_value, gearman_job_ce);
 	job = Z_GEARMAN_JOB_P(return_value);
@@ -2825,30 +3881,90 @@ PHP_FUNCTION(gearman_worker_grab_job) {
 	job->flags |= GEARMAN_JOB_OBJ_CREATED;
 }
 
-/* *job is passed in via gearman, need to convert that into a zval that
- * is accessable in the user_defined php callback function */
-static void *_php_worker_function_callback(gearman_job_st *job,
-						void *context,
-						size_t *result_size,
-						gearman_return_t *ret_ptr) {
-	zval zjob, message;
-	gearman_job_obj *jobj;
-	gearman_worker_cb_obj *worker_cb = (gearman_worker_cb_obj *)context;
-	char *result = NULL;
+/* A value yielded by a generator worker function. ['status' => [n, d]]
+ * is sent as WORK_STATUS, anything else as WORK_DATA. */
+static void _php_job_yield(gearman_job_obj *jobj, zval *value) {
+	zval *zstatus, *znumerator, *zdenominator;
+	zend_string *data;
+
+	ZVAL_DEREF(value);
+
+	/* keep the order of what was written to the output stream */
+	if (jobj->output != NULL) {
+		php_stream_flush(jobj->output);
+	}
+
+	if (Z_TYPE_P(value) == IS_ARRAY &&
+	    (zstatus = zend_hash_str_find(Z_ARRVAL_P(value), "status", sizeof("status") - 1)) != NULL) {
+		ZVAL_DEREF(zstatus);
+		if (Z_TYPE_P(zstatus) != IS_ARRAY ||
+		    (znumerator = zend_hash_index_find(Z_ARRVAL_P(zstatus), 0)) == NULL ||
+		    (zdenominator = zend_hash_index_find(Z_ARRVAL_P(zstatus), 1)) == NULL) {
+			php_error_docref(NULL, E_WARNING, "A yielded status must be [numerator, denominator]");
+			return;
+		}
+		jobj->ret = _php_job_send_status(jobj, zval_get_long(znumerator), zval_get_long(zdenominator));
+	} else {
+		data = zval_get_string(value);
+		jobj->ret = _php_job_send_data(jobj, ZSTR_VAL(data), ZSTR_LEN(data));
+		zend_string_release(data);
+	}
+
+	if (jobj->ret != GEARMAN_SUCCESS && jobj->ret != GEARMAN_IO_WAIT) {
+		php_error_docref(NULL, E_WARNING, "%s", _php_job_error(jobj));
+	}
+}
+
+/* Runs a generator worker function to its end, sending what it yields
+ * as it goes. retval is replaced by what the generator returned. Once a
+ * yielded value could not be sent the connection is of no use anymore,
+ * the generator is dropped unfinished and retval left undefined. */
+static void _php_worker_run_generator(gearman_job_obj *jobj, zval *retval) {
+	zend_object_iterator *it;
+	zval generator, *value;
+	zend_bool failed = 0;
+
+	ZVAL_COPY_VALUE(&generator, retval);
+	ZVAL_UNDEF(retval);
+
+	it = zend_ce_generator->get_iterator(zend_ce_generator, &generator, 0);
+	if (it != NULL) {
+		if (it->funcs->rewind) {
+			it->funcs->rewind(it);
+		}
+		while (!EG(exception) && it->funcs->valid(it) == SUCCESS) {
+			value = it->funcs->get_current_data(it);
+			if (EG(exception) || value == NULL) {
+				break;
+			}
+			_php_job_yield(jobj, value);
+			if (jobj->ret != GEARMAN_SUCCESS && jobj->ret != GEARMAN_IO_WAIT) {
+				failed = 1;
+				break;
+			}
+			it->funcs->move_forward(it);
+		}
+		zend_iterator_dtor(it);
+	}
+
+	if (!failed && !EG(exception)) {
+		zend_call_method_with_0_params(&generator, zend_ce_generator, NULL, "getreturn", retval);
+	}
+	zval_ptr_dtor(&generator);
+}
+
+/* Calls the function added for a job with zjob, a GearmanJob, as its
+ * argument. Returns what it returned as a string, NULL if nothing. */
+static zend_string *_php_worker_call(gearman_worker_cb_obj *worker_cb, zval *zjob, gearman_return_t *ret_ptr) {
+	zval message;
+	gearman_job_obj *jobj = Z_GEARMAN_JOB_P(zjob);
+	zend_string *result = NULL;
 	uint32_t param_count;
 
 	/* cb vars */
 	zval argv[2], retval;
 
-	/* first create our job object that will be passed to the callback */
-	if (object_init_ex(&zjob, gearman_job_ce) != SUCCESS) {
-		php_error_docref(NULL, E_WARNING, "Failed to create gearman_job_ce object.");
-		return result;
-	}
-	jobj = Z_GEARMAN_JOB_P(&zjob);
-	jobj->job = job;
-
-	ZVAL_COPY_VALUE(&argv[0], &zjob);
+	ZVAL_COPY_VALUE(&argv[0], zjob);
 
 	if (Z_ISUNDEF(worker_cb->zdata)) {
 		param_count = 1;
@@ -2867,8 +3983,14 @@ static void *_php_worker_function_callback(gearman_job_st *job,
 				( Z_ISUNDEF(worker_cb->zcall) || Z_TYPE(worker_cb->zcall) != IS_STRING)  ? "[undefined]" : Z_STRVAL(worker_cb->zcall)
 				);
 		jobj->ret = GEARMAN_WORK_FAIL;
+	} else if (Z_TYPE(retval) == IS_OBJECT && Z_OBJCE(retval) == zend_ce_generator) {
+		/* yield streams partial results, return completes the job */
+		_php_worker_run_generator(jobj, &retval);
 	}
 
+	/* written before the job completes */
+	_php_job_end_output(jobj);
+
 	*ret_ptr = jobj->ret;
 
 	if (EG(exception)) {
@@ -2876,41 +3998,345 @@ static void *_php_worker_function_callback(gearman_job_st *job,
 
 		ZVAL_STRING(&message, "Unable to add worker function");
 
-		jobj->ret = gearman_job_send_exception(jobj->job, Z_STRVAL(message), Z_STRLEN(message));
+		if (jobj->handle != NULL) {
+			jobj->ret = _php_job_native_send(jobj, GEARMAN_COMMAND_WORK_EXCEPTION, Z_STRVAL(message), Z_STRLEN(message));
+		} else {
+			jobj->ret = gearman_job_send_exception(jobj->job, Z_STRVAL(message), Z_STRLEN(message));
+		}
 
 		if (jobj->ret != GEARMAN_SUCCESS && jobj->ret != GEARMAN_IO_WAIT) {
 			php_error_docref(NULL, E_WARNING,  "Unable to add worker function: %s",
-					gearman_job_error(jobj->job));
+					_php_job_error(jobj));
 		}
+		zval_dtor(&message);
 	}
 
-	if (Z_ISUNDEF(retval)) {
-		result = NULL;
-		*result_size = 0;
-	} else {
-		if (Z_TYPE(retval) != IS_STRING) {
-			convert_to_string(&retval);
-		}
-		result = estrndup(Z_STRVAL(retval), Z_STRLEN(retval));
-		*result_size = Z_STRLEN(retval);
+	if (!Z_ISUNDEF(retval)) {
+		result = zval_get_string(&retval);
 		zval_dtor(&retval);
 	}
 
-	if (!Z_ISUNDEF(argv[0])) {
-		zval_dtor(&argv[0]);
+	return result;
+}
+
+/* *job is passed in via gearman, need to convert that into a zval that
+ * is accessable in the user_defined php callback function */
+static void *_php_worker_function_callback(gearman_job_st *job,
+						void *context,
+						size_t *result_size,
+						gearman_return_t *ret_ptr) {
+	zval zjob;
+	zend_string *result;
+	char *ret = NULL;
+
+	/* first create our job object that will be passed to the callback */
+	if (object_init_ex(&zjob, gearman_job_ce) != SUCCESS) {
+		php_error_docref(NULL, E_WARNING, "Failed to create gearman_job_ce object.");
+		return ret;
 	}
+	Z_GEARMAN_JOB_P(&zjob)->job = job;
+
+	result = _php_worker_call((gearman_worker_cb_obj *)context, &zjob, ret_ptr);
 
-	if (!Z_ISUNDEF(argv[1])) {
-		zval_dtor(&argv[1]);
+	*result_size = 0;
+	if (result != NULL) {
+		ret = estrndup(ZSTR_VAL(result), ZSTR_LEN(result));
+		*result_size = ZSTR_LEN(result);
+		zend_string_release(result);
 	}
 
+	zval_ptr_dtor(&zjob);
 
-	return result;
+	return ret;
 }
 /* }}} */
 
+/* The native engine's connection to server_list[index], connected and
+ * with the worker's functions announced. NULL with obj->ret set if that
+ * failed. */
+static php_gearman_conn *_php_worker_conn(gearman_worker_obj *obj, uint32_t index, int timeout) {
+	php_gearman_conn *conn;
+	zval *zserver;
+	uint32_t count = zend_hash_num_elements(Z_ARRVAL(obj->server_list)), i;
+
+	zserver = zend_hash_index_find(Z_ARRVAL(obj->server_list), index);
+	if (zserver == NULL) {
+		obj->ret = GEARMAN_NO_SERVERS;
+		return NULL;
+	}
+
+	if (obj->conns_count < count) {
+		obj->conns = erealloc(obj->conns, count * sizeof(php_gearman_conn));
+		for (i = obj->conns_count; i < count; i++) {
+			php_gearman_conn_init(&obj->conns[i]);
+		}
+		obj->conns_count = count;
+	}
+
+	conn = &obj->conns[index];
+	obj->conn_last = (int32_t) index;
+	if (conn->fd != -1) {
+		return conn;
+	}
+
+	obj->ret = php_gearman_conn_open(conn, Z_STRVAL_P(zserver), timeout, &obj->socket_options);
+	if (obj->ret == GEARMAN_SUCCESS) {
+		obj->ret = _php_worker_native_announce(obj, conn, 0, timeout);
+	}
+	if (obj->ret != GEARMAN_SUCCESS) {
+		return NULL;
+	}
+
+	return conn;
+}
+
+/* CAN_DO for every function added with addFunction() that is still
+ * registered, after a RESET_ABILITIES if reset is set. */
+static gearman_return_t _php_worker_native_announce(gearman_worker_obj *obj, php_gearman_conn *conn,
+						zend_bool reset, int timeout) {
+	gearman_worker_cb_obj *worker_cb;
+	const char *args[2];
+	size_t sizes[2];
+	char timeout_str[MAX_LENGTH_OF_LONG];
+	gearman_return_t ret = GEARMAN_SUCCESS;
+
+	if (reset) {
+		ret = php_gearman_conn_send(conn, GEARMAN_COMMAND_RESET_ABILITIES, NULL, NULL, 0, timeout);
+	}
+
+	ZEND_HASH_FOREACH_PTR(Z_ARRVAL(obj->cb_list), worker_cb) {
+		if (ret != GEARMAN_SUCCESS) {
+			break;
+		}
+		if (!gearman_worker_function_exist(&(obj->worker), Z_STRVAL(worker_cb->zname), Z_STRLEN(worker_cb->zname))) {
+			continue;
+		}
+
+		args[0] = Z_STRVAL(worker_cb->zname);
+		sizes[0] = Z_STRLEN(worker_cb->zname);
+		if (worker_cb->timeout > 0) {
+			args[1] = timeout_str;
+			sizes[1] = snprintf(timeout_str, sizeof(timeout_str), ZEND_LONG_FMT, worker_cb->timeout);
+			ret = php_gearman_conn_send(conn, GEARMAN_COMMAND_CAN_DO_TIMEOUT, args, sizes, 2, timeout);
+		} else {
+			ret = php_gearman_conn_send(conn, GEARMAN_COMMAND_CAN_DO, args, sizes, 1, timeout);
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	return ret;
+}
+
+/* Announces the functions again on the open connections after they
+ * changed. */
+static void _php_worker_native_reannounce(gearman_worker_obj *obj) {
+	int timeout = gearman_worker_timeout(&(obj->worker));
+	uint32_t i;
+
+	for (i = 0; i < obj->conns_count; i++) {
+		if (obj->conns[i].fd != -1) {
+			_php_worker_native_announce(obj, &obj->conns[i], 1, timeout);
+		}
+	}
+}
+
+/* Drops the native engine's connections, work() connects again. */
+static void _php_worker_native_close(gearman_worker_obj *obj) {
+	uint32_t i;
+
+	for (i = 0; i < obj->conns_count; i++) {
+		php_gearman_conn_close(&obj->conns[i]);
+	}
+	obj->conn_last = -1;
+}
+
+/* Runs the job in packet, a JOB_ASSIGN_UNIQ, and reports how it ended
+ * unless the function did so itself. */
+static gearman_return_t _php_worker_native_run(gearman_worker_obj *obj, php_gearman_conn *conn,
+						php_gearman_packet *packet, int timeout) {
+	gearman_worker_cb_obj *worker_cb, *found = NULL;
+	gearman_job_obj *jobj;
+	zend_string *result;
+	gearman_return_t ret;
+	zval zjob;
+
+	if (object_init_ex(&zjob, gearman_job_ce) != SUCCESS) {
+		php_error_docref(NULL, E_WARNING, "Failed to create gearman_job_ce object.");
+		return obj->ret = GEARMAN_MEMORY_ALLOCATION_FAILURE;
+	}
+	jobj = Z_GEARMAN_JOB_P(&zjob);
+	jobj->conn = conn;
+	jobj->timeout = timeout;
+	jobj->handle = zend_string_init(packet->args[0], packet->sizes[0], 0);
+	jobj->function_name = zend_string_init(packet->args[1], packet->sizes[1], 0);
+	jobj->unique = zend_string_init(packet->args[2], packet->sizes[2], 0);
+	jobj->workload = zend_string_init(packet->args[3], packet->sizes[3], 0);
+
+	ZEND_HASH_FOREACH_PTR(Z_ARRVAL(obj->cb_list), worker_cb) {
+		if (zend_string_equals(Z_STR(worker_cb->zname), jobj->function_name)) {
+			found = worker_cb;
+			break;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	if (found == NULL) {
+		obj->ret = _php_job_native_send(jobj, GEARMAN_COMMAND_WORK_FAIL, NULL, 0);
+		if (obj->ret == GEARMAN_SUCCESS) {
+			obj->ret = GEARMAN_INVALID_FUNCTION_NAME;
+		}
+		jobj->conn = NULL;
+		zval_ptr_dtor(&zjob);
+		return obj->ret;
+	}
+
+	result = _php_worker_call(found, &zjob, &ret);
+
+	obj->ret = ret;
+	if (!jobj->finished) {
+		if (ret == GEARMAN_SUCCESS) {
+			jobj->ret = _php_job_native_send(jobj, GEARMAN_COMMAND_WORK_COMPLETE,
+						result ? ZSTR_VAL(result) : "", result ? ZSTR_LEN(result) : 0);
+		} else {
+			jobj->ret = _php_job_native_send(jobj, GEARMAN_COMMAND_WORK_FAIL, NULL, 0);
+		}
+		if (jobj->ret != GEARMAN_SUCCESS) {
+			obj->ret = jobj->ret;
+		}
+	}
+
+	if (result != NULL) {
+		zend_string_release(result);
+	}
+	/* a job object kept by the function cannot send anything any more */
+	jobj->conn = NULL;
+	zval_ptr_dtor(&zjob);
+
+	return obj->ret;
+}
+
+/* work() on the native engine. Asks every server for a job in turn,
+ * starting after the one that had the last job. When none has one it
+ * sends PRE_SLEEP to all of them and waits for a NOOP. */
+static gearman_return_t _php_worker_native_work(gearman_worker_obj *obj) {
+	int timeout = gearman_worker_timeout(&(obj->worker));
+	uint32_t count = zend_hash_num_elements(Z_ARRVAL(obj->server_list)), connected, index, i;
+	php_gearman_packet packet;
+	php_gearman_conn *conn, **sleeping;
+
+	if (count == 0) {
+		return obj->ret = GEARMAN_NO_SERVERS;
+	}
+	if (zend_hash_num_elements(Z_ARRVAL(obj->cb_list)) == 0) {
+		return obj->ret = GEARMAN_NO_REGISTERED_FUNCTIONS;
+	}
+
+	while (1) {
+		connected = 0;
+		for (i = 0; i < count; i++) {
+			index = (obj->conn_next + i) % count;
+			conn = _php_worker_conn(obj, index, timeout);
+			if (conn == NULL) {
+				continue;
+			}
+			connected++;
+
+			obj->ret = php_gearman_conn_send(conn, GEARMAN_COMMAND_GRAB_JOB_UNIQ, NULL, NULL, 0, timeout);
+			/* NOOPs left over from an earlier PRE_SLEEP */
+			do {
+				if (obj->ret == GEARMAN_SUCCESS) {
+					obj->ret = php_gearman_conn_recv(conn, &packet, timeout);
+				}
+			} while (obj->ret == GEARMAN_SUCCESS && packet.command == GEARMAN_COMMAND_NOOP);
+
+			if (obj->ret != GEARMAN_SUCCESS) {
+				continue;
+			}
+			if (packet.command == GEARMAN_COMMAND_JOB_ASSIGN_UNIQ) {
+				obj->conn_next = (index + 1) % count;
+				return _php_worker_native_run(obj, conn, &packet, timeout);
+			}
+			if (packet.command != GEARMAN_COMMAND_NO_JOB) {
+				obj->ret = GEARMAN_UNEXPECTED_PACKET;
+				php_gearman_conn_close(conn);
+			}
+		}
+
+		if (connected == 0) {
+			return obj->ret;
+		}
+		if (gearman_worker_options(&(obj->worker)) & GEARMAN_WORKER_NON_BLOCKING) {
+			return obj->ret = GEARMAN_NO_JOBS;
+		}
+
+		sleeping = safe_emalloc(obj->conns_count, sizeof(php_gearman_conn *), 0);
+		for (i = 0; i < obj->conns_count; i++) {
+			if (obj->conns[i].fd != -1) {
+				php_gearman_conn_send(&obj->conns[i], GEARMAN_COMMAND_PRE_SLEEP, NULL, NULL, 0, timeout);
+			}
+			sleeping[i] = &obj->conns[i];
+		}
+
+		obj->ret = php_gearman_conn_select(sleeping, obj->conns_count, timeout, &index);
+		efree(sleeping);
+		if (obj->ret != GEARMAN_SUCCESS) {
+			return obj->ret;
+		}
+		/* the NOOP, or the connection closing */
+		obj->conn_last = (int32_t) index;
+		php_gearman_conn_recv(&obj->conns[index], &packet, timeout);
+	}
+}
+
+/* ECHO on every server through the native engine's connections, or only
+ * on those already open if open_only is set. */
+static gearman_return_t _php_worker_native_echo(gearman_worker_obj *obj, zend_bool open_only,
+						const char *workload, size_t workload_len) {
+	int timeout = gearman_worker_timeout(&(obj->worker));
+	uint32_t count = zend_hash_num_elements(Z_ARRVAL(obj->server_list)), i;
+	php_gearman_packet packet;
+	php_gearman_conn *conn;
+
+	obj->ret = GEARMAN_SUCCESS;
+	for (i = 0; i < count; i++) {
+		if (open_only && (i >= obj->conns_count || obj->conns[i].fd == -1)) {
+			continue;
+		}
+
+		conn = _php_worker_conn(obj, i, timeout);
+		if (conn == NULL) {
+			return obj->ret;
+		}
+
+		obj->ret = php_gearman_conn_send(conn, GEARMAN_COMMAND_ECHO_REQ, &workload, &workload_len, 1, timeout);
+		do {
+			if (obj->ret == GEARMAN_SUCCESS) {
+				obj->ret = php_gearman_conn_recv(conn, &packet, timeout);
+			}
+		} while (obj->ret == GEARMAN_SUCCESS && packet.command == GEARMAN_COMMAND_NOOP);
+
+		if (obj->ret == GEARMAN_SUCCESS &&
+				(packet.command != GEARMAN_COMMAND_ECHO_RES || packet.sizes[0] != workload_len ||
+				 memcmp(packet.args[0], workload, workload_len) != 0)) {
+			obj->ret = GEARMAN_ECHO_DATA_CORRUPTION;
+			php_gearman_conn_close(conn);
+		}
+		if (obj->ret != GEARMAN_SUCCESS) {
+			return obj->ret;
+		}
+	}
+
+	return obj->ret;
+}
+
+static const char *_php_worker_native_error(gearman_worker_obj *obj) {
+	if (obj->conn_last >= 0 && (uint32_t) obj->conn_last < obj->conns_count &&
+			obj->conns[obj->conn_last].error[0] != '\0') {
+		return obj->conns[obj->conn_last].error;
+	}
+	return gearman_strerror(obj->ret);
+}
+
 /* {{{ proto bool gearman_worker_add_function(object worker, zval function_name, zval callback [, zval data [, int timeout]])
-   Register and add callback function for worker. */
+   Register and add callback function for worker. A callback that is a generator sends what it yields as WORK_DATA, or WORK_STATUS for ['status' => [n, d]], and completes the job with what it returns. */
 PHP_FUNCTION(gearman_worker_add_function) {
 	zval *zobj = NULL;
 	gearman_worker_obj *obj;
@@ -2962,6 +4388,8 @@ PHP_FUNCTION(gearman_worker_add_function) {
 		ZVAL_NULL(&worker_cb->zdata);
 	}
 
+	worker_cb->timeout = timeout;
+
 	// Add the worker_cb to the list
 	zend_hash_next_index_insert_ptr(Z_ARRVAL(obj->cb_list), worker_cb);
 
@@ -2981,6 +4409,11 @@ PHP_FUNCTION(gearman_worker_add_function) {
 		RETURN_FALSE;
 	}
 
+	/* the native engine tells the servers itself */
+	if (obj->engine == GEARMAN_ENGINE_NATIVE) {
+		_php_worker_native_reannounce(obj);
+	}
+
 	RETURN_TRUE;
 }
 /* }}} */
@@ -2995,14 +4428,32 @@ PHP_FUNCTION(gearman_worker_work) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_WORKER_P(zobj);
+	_php_worker_check_fork(obj);
+	_php_worker_keepalive(obj);
 
+	obj->flags |= GEARMAN_WORKER_OBJ_WORKING;
+	if (obj->engine == GEARMAN_ENGINE_NATIVE) {
+		_php_worker_native_work(obj);
+	} else {
+		obj->ret = gearman_worker_work(&(obj->worker));
+	}
+	obj->flags &= ~GEARMAN_WORKER_OBJ_WORKING;
+	if (obj->keepalive > 0) {
+		obj->keepalive_last = _php_gearman_now_ms();
+	}
 
-	obj->ret = gearman_worker_work(&(obj->worker));
+	/* setServers() called by the job, its connection is free now */
+	if (Z_TYPE(obj->pending_servers) == IS_ARRAY) {
+		_php_worker_replace_servers(obj, &obj->pending_servers);
+		zval_dtor(&obj->pending_servers);
+		ZVAL_UNDEF(&obj->pending_servers);
+	}
 
 	if (obj->ret != GEARMAN_SUCCESS && obj->ret != GEARMAN_IO_WAIT &&
 			obj->ret != GEARMAN_WORK_FAIL && obj->ret != GEARMAN_TIMEOUT &&
 			obj->ret != GEARMAN_WORK_EXCEPTION && obj->ret != GEARMAN_NO_JOBS) {
 		php_error_docref(NULL, E_WARNING, "%s",
+				obj->engine == GEARMAN_ENGINE_NATIVE ? _php_worker_native_error(obj) :
 				gearman_worker_error(&(obj->worker)));
 		RETURN_FALSE;
 	}
@@ -3028,6 +4479,15 @@ PHP_FUNCTION(gearman_worker_ping) {
 		RETURN_FALSE;
 	}
 	obj = Z_GEARMAN_WORKER_P(zobj);
+	_php_worker_check_fork(obj);
+
+	if (obj->engine == GEARMAN_ENGINE_NATIVE) {
+		if (_php_worker_native_echo(obj, 0, workload, (size_t)workload_len) != GEARMAN_SUCCESS) {
+			php_error_docref(NULL, E_WARNING, "%s", _php_worker_native_error(obj));
+			RETURN_FALSE;
+		}
+		RETURN_TRUE;
+	}
 
 	obj->ret = gearman_worker_echo(&(obj->worker), workload, (size_t)workload_len);
 
@@ -3041,6 +4501,231 @@ PHP_FUNCTION(gearman_worker_ping) {
 }
 /* }}} */
 
+/* {{{ proto bool gearman_worker_connect(object worker)
+   Connect to all job servers now instead of on the first job, so DNS, connecting and option negotiation are done up front. */
+PHP_FUNCTION(gearman_worker_connect) {
+	zval *zobj;
+	gearman_worker_obj *obj;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_worker_ce) == FAILURE) {
+		RETURN_FALSE;
+	}
+	obj = Z_GEARMAN_WORKER_P(zobj);
+	_php_worker_check_fork(obj);
+
+	obj->keepalive_last = _php_gearman_now_ms();
+
+	if (obj->engine == GEARMAN_ENGINE_NATIVE) {
+		if (_php_worker_native_echo(obj, 0, PHP_GEARMAN_WARMUP, sizeof(PHP_GEARMAN_WARMUP) - 1) != GEARMAN_SUCCESS) {
+			php_error_docref(NULL, E_WARNING, "%s", _php_worker_native_error(obj));
+			RETURN_FALSE;
+		}
+		RETURN_TRUE;
+	}
+
+	obj->ret = gearman_worker_echo(&(obj->worker), PHP_GEARMAN_WARMUP, sizeof(PHP_GEARMAN_WARMUP) - 1);
+
+	if (obj->ret != GEARMAN_SUCCESS && obj->ret != GEARMAN_IO_WAIT) {
+		php_error_docref(NULL, E_WARNING, "%s",
+						 gearman_worker_error(&(obj->worker)));
+		RETURN_FALSE;
+	}
+
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool gearman_worker_set_keepalive(object worker, int interval_ms)
+   Check the connections with ECHO when work() is called after they were idle for interval_ms, so dead ones are replaced before they are waited on. 0 turns this off. */
+PHP_FUNCTION(gearman_worker_set_keepalive) {
+	zval *zobj;
+	gearman_worker_obj *obj;
+	zend_long interval;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_worker_ce, &interval) == FAILURE) {
+		RETURN_FALSE;
+	}
+	obj = Z_GEARMAN_WORKER_P(zobj);
+
+	if (interval < 0) {
+		php_error_docref(NULL, E_WARNING, "Keepalive interval must be greater than or equal to 0");
+		RETURN_FALSE;
+	}
+
+	obj->keepalive = interval;
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool gearman_worker_set_engine(object worker, int engine)
+   GEARMAN_ENGINE_NATIVE makes work(), ping() and connect() speak the protocol over the extension's own connections instead of going through libgearman, and lets the worker use unix:// servers. Jobs are read straight into strings. grabJob() stays on libgearman, functions need to be added with addFunction(). */
+PHP_FUNCTION(gearman_worker_set_engine) {
+	zval *zobj;
+	gearman_worker_obj *obj;
+	zend_long engine;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_worker_ce, &engine) == FAILURE) {
+		RETURN_FALSE;
+	}
+	obj = Z_GEARMAN_WORKER_P(zobj);
+
+	if (engine != GEARMAN_ENGINE_LIBGEARMAN && engine != GEARMAN_ENGINE_NATIVE) {
+		php_error_docref(NULL, E_WARNING, "Invalid engine: " ZEND_LONG_FMT, engine);
+		RETURN_FALSE;
+	}
+
+	if (obj->flags & GEARMAN_WORKER_OBJ_WORKING) {
+		php_error_docref(NULL, E_WARNING, "The engine cannot be changed while a job is running");
+		RETURN_FALSE;
+	}
+
+	if (engine == GEARMAN_ENGINE_LIBGEARMAN && _php_gearman_count_unix(&obj->server_list) > 0) {
+		php_error_docref(NULL, E_WARNING, "Unix domain sockets need GEARMAN_ENGINE_NATIVE, see GearmanWorker::setEngine()");
+		RETURN_FALSE;
+	}
+
+	if (engine == GEARMAN_ENGINE_LIBGEARMAN) {
+		_php_worker_native_close(obj);
+	}
+
+	obj->engine = engine;
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool gearman_worker_set_socket_options(object worker, array options)
+   Socket options for the native engine's connections, see GearmanClient::setSocketOptions(). libgearman's connections keep their defaults. Open connections are closed so they are made again with the new options. */
+PHP_FUNCTION(gearman_worker_set_socket_options) {
+	zval *zobj, *zoptions;
+	gearman_worker_obj *obj;
+	php_gearman_socket_options options;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Oa", &zobj, gearman_worker_ce, &zoptions) == FAILURE) {
+		RETURN_FALSE;
+	}
+	obj = Z_GEARMAN_WORKER_P(zobj);
+
+	if (obj->flags & GEARMAN_WORKER_OBJ_WORKING) {
+		php_error_docref(NULL, E_WARNING, "Socket options cannot be changed while a job is running");
+		RETURN_FALSE;
+	}
+
+	if (!_php_gearman_socket_options(zoptions, &options)) {
+		RETURN_FALSE;
+	}
+
+	obj->socket_options = options;
+	_php_worker_native_close(obj);
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* Makes new_list the worker's servers. Servers only appended to the list
+ * are added next to the existing connections, anything else makes
+ * libgearman drop all of them. The functions stay registered either way
+ * and are announced to each server as it gets connected. */
+static zend_bool _php_worker_replace_servers(gearman_worker_obj *obj, zval *new_list) {
+	zend_string *servers;
+	uint32_t old_count = zend_hash_num_elements(Z_ARRVAL(obj->server_list));
+	zend_ulong index;
+	zval *zserver;
+	zend_bool append = old_count <= zend_hash_num_elements(Z_ARRVAL_P(new_list));
+	gearman_return_t ret;
+
+	ZEND_HASH_FOREACH_NUM_KEY_VAL(Z_ARRVAL(obj->server_list), index, zserver) {
+		if (_php_gearman_find_server(new_list, Z_STR_P(zserver)) != (int32_t)index) {
+			append = 0;
+			break;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	if (append && old_count == zend_hash_num_elements(Z_ARRVAL_P(new_list))) {
+		return 1;
+	}
+
+	if (!append) {
+		gearman_worker_remove_servers(&(obj->worker));
+		/* the native engine's connections go by index */
+		_php_worker_native_close(obj);
+	}
+	servers = _php_gearman_join_servers(new_list, append ? old_count : 0);
+	ret = GEARMAN_SUCCESS;
+	if (servers != NULL) {
+		ret = gearman_worker_add_servers(&(obj->worker), ZSTR_VAL(servers));
+		zend_string_release(servers);
+	}
+
+	if (ret != GEARMAN_SUCCESS) {
+		php_error_docref(NULL, E_WARNING, "%s",
+						 gearman_worker_error(&(obj->worker)));
+		return 0;
+	}
+	gearman_worker_set_server_option(&(obj->worker), "exceptions", (sizeof("exceptions") - 1));
+
+	zval_dtor(&obj->server_list);
+	ZVAL_DUP(&obj->server_list, new_list);
+	return 1;
+}
+
+/* {{{ proto bool gearman_worker_set_servers(object worker, string servers)
+   Replace the job servers with servers, in the addServers() format. Called from a job, the list is swapped once the job is done. */
+PHP_FUNCTION(gearman_worker_set_servers) {
+	zval *zobj;
+	gearman_worker_obj *obj;
+	gearman_worker_st *check;
+	char *servers;
+	size_t servers_len;
+	zend_string *tcp;
+	zval new_list;
+	zend_bool ok;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Os", &zobj, gearman_worker_ce, &servers, &servers_len) == FAILURE) {
+		RETURN_FALSE;
+	}
+	obj = Z_GEARMAN_WORKER_P(zobj);
+	_php_worker_check_fork(obj);
+
+	if (strstr(servers, PHP_GEARMAN_UNIX_PREFIX) != NULL && obj->engine != GEARMAN_ENGINE_NATIVE) {
+		php_error_docref(NULL, E_WARNING, "Unix domain sockets need GEARMAN_ENGINE_NATIVE, see GearmanWorker::setEngine()");
+		RETURN_FALSE;
+	}
+
+	array_init(&new_list);
+	_php_gearman_record_servers(&new_list, servers);
+
+	/* catch a bad list before the connections are dropped */
+	tcp = _php_gearman_join_servers(&new_list, 0);
+	if (tcp != NULL) {
+		check = gearman_worker_create(NULL);
+		if (check == NULL) {
+			php_error_docref(NULL, E_WARNING, "Memory allocation failure");
+			zend_string_release(tcp);
+			zval_dtor(&new_list);
+			RETURN_FALSE;
+		}
+		obj->ret = gearman_worker_add_servers(check, ZSTR_VAL(tcp));
+		zend_string_release(tcp);
+		if (obj->ret != GEARMAN_SUCCESS) {
+			php_error_docref(NULL, E_WARNING, "%s", gearman_worker_error(check));
+			gearman_worker_free(check);
+			zval_dtor(&new_list);
+			RETURN_FALSE;
+		}
+		gearman_worker_free(check);
+	}
+
+	if (obj->flags & GEARMAN_WORKER_OBJ_WORKING) {
+		zval_ptr_dtor(&obj->pending_servers);
+		ZVAL_COPY_VALUE(&obj->pending_servers, &new_list);
+		RETURN_TRUE;
+	}
+
+	ok = _php_worker_replace_servers(obj, &new_list);
+	zval_dtor(&new_list);
+	RETURN_BOOL(ok);
+}
+/* }}} */
+
 /*
  * Methods for gearman_worker
  */
@@ -3061,11 +4746,77 @@ static void gearman_worker_ctor(INTERNAL_FUNCTION_PARAMETERS) {
 	}
 
 	worker->flags |= GEARMAN_WORKER_OBJ_CREATED;
+	worker->pid = getpid();
 	gearman_worker_set_workload_malloc_fn(&(worker->worker), _php_malloc, NULL);
 	gearman_worker_set_workload_free_fn(&(worker->worker), _php_free, NULL);
 }
 /* }}} */
 
+/* Worker counterpart of _php_client_check_fork(). Functions added through
+ * addFunction() are registered again if the clone did not carry them over. */
+static void _php_worker_check_fork(gearman_worker_obj *obj) {
+	gearman_worker_st *clone;
+	gearman_worker_cb_obj *worker_cb;
+	pid_t pid = getpid();
+
+	if (obj->pid == pid || !(obj->flags & GEARMAN_WORKER_OBJ_CREATED)) {
+		return;
+	}
+
+	clone = gearman_worker_clone(NULL, &(obj->worker));
+	if (clone == NULL) {
+		php_error_docref(NULL, E_WARNING, "Unable to reinitialize worker after fork");
+		return;
+	}
+
+	gearman_worker_clone(&(obj->worker), clone);
+	gearman_worker_free(clone);
+
+	gearman_worker_set_workload_malloc_fn(&(obj->worker), _php_malloc, NULL);
+	gearman_worker_set_workload_free_fn(&(obj->worker), _php_free, NULL);
+	gearman_worker_set_server_option(&(obj->worker), "exceptions", (sizeof("exceptions") - 1));
+
+	ZEND_HASH_FOREACH_PTR(Z_ARRVAL(obj->cb_list), worker_cb) {
+		if (gearman_worker_function_exist(&(obj->worker), Z_STRVAL(worker_cb->zname), Z_STRLEN(worker_cb->zname))) {
+			continue;
+		}
+
+		gearman_worker_add_function(&(obj->worker),
+					Z_STRVAL(worker_cb->zname),
+					(uint32_t)worker_cb->timeout,
+					_php_worker_function_callback,
+					(void *)worker_cb
+					);
+	} ZEND_HASH_FOREACH_END();
+
+	/* the parent keeps talking on its copies of the sockets */
+	_php_worker_native_close(obj);
+
+	obj->pid = pid;
+}
+
+/* With setKeepalive() on, checks the connections with an ECHO when work()
+ * was not called for that long, typically because a job ran long, so a
+ * connection dropped meanwhile is not only noticed while waiting on it. */
+static void _php_worker_keepalive(gearman_worker_obj *obj) {
+	uint64_t now;
+
+	if (obj->keepalive <= 0) {
+		return;
+	}
+
+	now = _php_gearman_now_ms();
+	if (obj->keepalive_last > 0 && now - obj->keepalive_last >= (uint64_t)obj->keepalive) {
+		/* a failed ECHO drops the connection, work() connects again */
+		if (obj->engine == GEARMAN_ENGINE_NATIVE) {
+			(void)_php_worker_native_echo(obj, 1, PHP_GEARMAN_WARMUP, sizeof(PHP_GEARMAN_WARMUP) - 1);
+		} else {
+			(void)gearman_worker_echo(&(obj->worker), PHP_GEARMAN_WARMUP, sizeof(PHP_GEARMAN_WARMUP) - 1);
+		}
+	}
+	obj->keepalive_last = now;
+}
+
 /* {{{ proto object gearman_worker_create()
    Returns a worker object */
 PHP_FUNCTION(gearman_worker_create) {
@@ -3093,16 +4844,27 @@ PHP_METHOD(GearmanWorker, __construct)
 PHP_METHOD(GearmanWorker, __destruct)
 {
 	gearman_worker_obj *intern = Z_GEARMAN_WORKER_P(getThis());
+	uint32_t i;
 
 	if (!intern)  {
 		return;
 	}
 
-	if (intern->flags & GEARMAN_WORKER_OBJ_CREATED) {
+	/* see GearmanClient::__destruct(), an inherited worker is left alone */
+	if ((intern->flags & GEARMAN_WORKER_OBJ_CREATED) && intern->pid == getpid()) {
 		gearman_worker_free(&(intern->worker));
 	}
 
+	for (i = 0; i < intern->conns_count; i++) {
+		php_gearman_conn_free(&intern->conns[i]);
+	}
+	if (intern->conns != NULL) {
+		efree(intern->conns);
+	}
+
 	zval_dtor(&intern->cb_list);
+	zval_dtor(&intern->server_list);
+	zval_ptr_dtor(&intern->pending_servers);
 	zend_object_std_dtor(&intern->std);
 }
 /* }}} */
@@ -3125,6 +4887,10 @@ static inline zend_object *gearman_worker_obj_new(zend_class_entry *ce) {
 
 	ZVAL_NEW_ARR(&intern->cb_list);
 	zend_hash_init(Z_ARRVAL(intern->cb_list), 0, NULL, cb_list_dtor, 0);
+	array_init(&intern->server_list);
+	ZVAL_UNDEF(&intern->pending_servers);
+	intern->conn_last = -1;
+	php_gearman_socket_options_init(&intern->socket_options);
 
 	intern->std.handlers = &gearman_worker_obj_handlers;
 	return &intern->std;
@@ -3146,6 +4912,13 @@ PHP_METHOD(GearmanJob, __destruct)
 		gearman_job_free(intern->job);
 	}
 
+	if (intern->handle != NULL) {
+		zend_string_release(intern->handle);
+		zend_string_release(intern->function_name);
+		zend_string_release(intern->unique);
+		zend_string_release(intern->workload);
+	}
+
 	zend_object_std_dtor(&intern->std);
 }
 
@@ -3182,6 +4955,7 @@ static PHP_METHOD(GearmanTask, __destruct)
 	zval_dtor(&intern->zworkload);
 	zval_dtor(&intern->zdata);
 	zval_dtor(&intern->zclient);
+	zval_dtor(&intern->zresult);
 
 	zend_object_std_dtor(&intern->std);
 }
@@ -3237,6 +5011,27 @@ zend_function_entry gearman_functions[] = {
 	PHP_FE(gearman_client_set_fail_callback, arginfo_gearman_client_set_fail_callback)
 	PHP_FE(gearman_client_clear_callbacks, arginfo_gearman_client_clear_callbacks)
 	PHP_FE(gearman_client_run_tasks, arginfo_gearman_client_run_tasks)
+	PHP_FE(gearman_client_enable_background_sender, arginfo_gearman_client_enable_background_sender)
+	PHP_FE(gearman_client_disable_background_sender, arginfo_gearman_client_disable_background_sender)
+	PHP_FE(gearman_client_get_stats, arginfo_gearman_client_get_stats)
+	PHP_FE(gearman_client_set_deferred_background, arginfo_gearman_client_set_deferred_background)
+	PHP_FE(gearman_client_flush_deferred, arginfo_gearman_client_flush_deferred)
+	PHP_FE(gearman_client_set_max_in_flight, arginfo_gearman_client_set_max_in_flight)
+	PHP_FE(gearman_client_set_auto_flush, arginfo_gearman_client_set_auto_flush)
+	PHP_FE(gearman_client_do_multi, arginfo_gearman_client_do_multi)
+	PHP_FE(gearman_client_completions, arginfo_gearman_client_completions)
+	PHP_FE(gearman_client_set_completion_policy, arginfo_gearman_client_set_completion_policy)
+	PHP_FE(gearman_client_set_hedging, arginfo_gearman_client_set_hedging)
+	PHP_FE(gearman_client_set_adaptive_timeout, arginfo_gearman_client_set_adaptive_timeout)
+	PHP_FE(gearman_client_set_routing, arginfo_gearman_client_set_routing)
+	PHP_FE(gearman_client_set_shard_key, arginfo_gearman_client_set_shard_key)
+	PHP_FE(gearman_client_set_server_weights, arginfo_gearman_client_set_server_weights)
+	PHP_FE(gearman_client_set_circuit_breaker, arginfo_gearman_client_set_circuit_breaker)
+	PHP_FE(gearman_client_connect, arginfo_gearman_client_connect)
+	PHP_FE(gearman_client_set_keepalive, arginfo_gearman_client_set_keepalive)
+	PHP_FE(gearman_client_set_servers, arginfo_gearman_client_set_servers)
+	PHP_FE(gearman_client_set_socket_options, arginfo_gearman_client_set_socket_options)
+	PHP_FE(gearman_client_set_engine, arginfo_gearman_client_set_engine)
 
 	/* Functions from task.h */
 	PHP_FE(gearman_task_return_code, arginfo_gearman_task_return_code)
@@ -3251,6 +5046,7 @@ zend_function_entry gearman_functions[] = {
 	PHP_FE(gearman_task_data_size, arginfo_gearman_task_data_size)
 	PHP_FE(gearman_task_send_workload, arginfo_gearman_task_send_workload)
 	PHP_FE(gearman_task_recv_data, arginfo_gearman_task_recv_data)
+	PHP_FE(gearman_task_get_stream, arginfo_gearman_task_get_stream)
 
 	/* Functions from worker.h */
 	PHP_FE(gearman_worker_return_code, arginfo_gearman_worker_return_code)
@@ -3274,6 +5070,11 @@ zend_function_entry gearman_functions[] = {
 	PHP_FE(gearman_worker_add_function, arginfo_gearman_worker_add_function)
 	PHP_FE(gearman_worker_work, arginfo_gearman_worker_work)
 	PHP_FE(gearman_worker_ping, arginfo_gearman_worker_ping)
+	PHP_FE(gearman_worker_connect, arginfo_gearman_worker_connect)
+	PHP_FE(gearman_worker_set_keepalive, arginfo_gearman_worker_set_keepalive)
+	PHP_FE(gearman_worker_set_servers, arginfo_gearman_worker_set_servers)
+	PHP_FE(gearman_worker_set_engine, arginfo_gearman_worker_set_engine)
+	PHP_FE(gearman_worker_set_socket_options, arginfo_gearman_worker_set_socket_options)
 
 	/* Functions from job.h */
 	PHP_FE(gearman_job_return_code, arginfo_gearman_job_return_code)
@@ -3289,6 +5090,11 @@ zend_function_entry gearman_functions[] = {
 	PHP_FE(gearman_job_unique, arginfo_gearman_job_unique)
 	PHP_FE(gearman_job_workload, arginfo_gearman_job_workload)
 	PHP_FE(gearman_job_workload_size, arginfo_gearman_job_workload_size)
+	PHP_FE(gearman_job_get_output_stream, arginfo_gearman_job_get_output_stream)
+
+	/* Functions from packet.h */
+	PHP_FE(gearman_packet_encode, arginfo_gearman_packet_encode)
+	PHP_FE(gearman_packet_decode, arginfo_gearman_packet_decode)
 
 	ZEND_FE_END
 };
@@ -3342,6 +5148,37 @@ static zend_function_entry gearman_client_methods[]= {
 	PHP_ME_MAPPING(setFailCallback, gearman_client_set_fail_callback, arginfo_oo_gearman_client_set_fail_callback, ZEND_ACC_PUBLIC)
 	PHP_ME_MAPPING(clearCallbacks, gearman_client_clear_callbacks, arginfo_oo_gearman_client_clear_callbacks, ZEND_ACC_PUBLIC)
 	PHP_ME_MAPPING(runTasks, gearman_client_run_tasks, arginfo_oo_gearman_client_run_tasks, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(enableBackgroundSender, gearman_client_enable_background_sender, arginfo_oo_gearman_client_enable_background_sender, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(disableBackgroundSender, gearman_client_disable_background_sender, arginfo_oo_gearman_client_disable_background_sender, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(getStats, gearman_client_get_stats, arginfo_oo_gearman_client_get_stats, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setDeferredBackground, gearman_client_set_deferred_background, arginfo_oo_gearman_client_set_deferred_background, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(flushDeferred, gearman_client_flush_deferred, arginfo_oo_gearman_client_flush_deferred, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setMaxInFlight, gearman_client_set_max_in_flight, arginfo_oo_gearman_client_set_max_in_flight, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setAutoFlush, gearman_client_set_auto_flush, arginfo_oo_gearman_client_set_auto_flush, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(doMulti, gearman_client_do_multi, arginfo_oo_gearman_client_do_multi, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(completions, gearman_client_completions, arginfo_oo_gearman_client_completions, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setCompletionPolicy, gearman_client_set_completion_policy, arginfo_oo_gearman_client_set_completion_policy, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setHedging, gearman_client_set_hedging, arginfo_oo_gearman_client_set_hedging, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setAdaptiveTimeout, gearman_client_set_adaptive_timeout, arginfo_oo_gearman_client_set_adaptive_timeout, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setRouting, gearman_client_set_routing, arginfo_oo_gearman_client_set_routing, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setShardKey, gearman_client_set_shard_key, arginfo_oo_gearman_client_set_shard_key, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setServerWeights, gearman_client_set_server_weights, arginfo_oo_gearman_client_set_server_weights, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setCircuitBreaker, gearman_client_set_circuit_breaker, arginfo_oo_gearman_client_set_circuit_breaker, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(connect, gearman_client_connect, arginfo_oo_gearman_client_connect, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setKeepalive, gearman_client_set_keepalive, arginfo_oo_gearman_client_set_keepalive, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setServers, gearman_client_set_servers, arginfo_oo_gearman_client_set_servers, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setSocketOptions, gearman_client_set_socket_options, arginfo_oo_gearman_client_set_socket_options, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setEngine, gearman_client_set_engine, arginfo_oo_gearman_client_set_engine, ZEND_ACC_PUBLIC)
+	ZEND_FE_END
+};
+
+zend_function_entry gearman_completion_iterator_methods[]= {
+	PHP_ME(GearmanCompletionIterator, __destruct, arginfo_oo_gearman_completion_iterator_destruct, ZEND_ACC_DTOR | ZEND_ACC_PUBLIC)
+	PHP_ME(GearmanCompletionIterator, current, arginfo_oo_gearman_completion_iterator_current, ZEND_ACC_PUBLIC)
+	PHP_ME(GearmanCompletionIterator, key, arginfo_oo_gearman_completion_iterator_key, ZEND_ACC_PUBLIC)
+	PHP_ME(GearmanCompletionIterator, next, arginfo_oo_gearman_completion_iterator_next, ZEND_ACC_PUBLIC)
+	PHP_ME(GearmanCompletionIterator, rewind, arginfo_oo_gearman_completion_iterator_rewind, ZEND_ACC_PUBLIC)
+	PHP_ME(GearmanCompletionIterator, valid, arginfo_oo_gearman_completion_iterator_valid, ZEND_ACC_PUBLIC)
 	ZEND_FE_END
 };
 
@@ -3360,6 +5197,7 @@ zend_function_entry gearman_task_methods[]= {
 	PHP_ME_MAPPING(data, gearman_task_data, arginfo_oo_gearman_task_data, ZEND_ACC_PUBLIC)
 	PHP_ME_MAPPING(dataSize, gearman_task_data_size, arginfo_oo_gearman_task_data_size, ZEND_ACC_PUBLIC)
 	PHP_ME_MAPPING(recvData, gearman_task_recv_data, arginfo_oo_gearman_task_recv_data, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(getStream, gearman_task_get_stream, arginfo_oo_gearman_task_get_stream, ZEND_ACC_PUBLIC)
 	ZEND_FE_END
 };
 
@@ -3386,6 +5224,11 @@ zend_function_entry gearman_worker_methods[]= {
 	PHP_ME_MAPPING(addFunction, gearman_worker_add_function, arginfo_oo_gearman_worker_add_function, ZEND_ACC_PUBLIC)
 	PHP_ME_MAPPING(work, gearman_worker_work, arginfo_oo_gearman_worker_work, ZEND_ACC_PUBLIC)
 	PHP_ME_MAPPING(echo, gearman_worker_ping, arginfo_oo_gearman_worker_ping, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(connect, gearman_worker_connect, arginfo_oo_gearman_worker_connect, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setKeepalive, gearman_worker_set_keepalive, arginfo_oo_gearman_worker_set_keepalive, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setServers, gearman_worker_set_servers, arginfo_oo_gearman_worker_set_servers, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setEngine, gearman_worker_set_engine, arginfo_oo_gearman_worker_set_engine, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(setSocketOptions, gearman_worker_set_socket_options, arginfo_oo_gearman_worker_set_socket_options, ZEND_ACC_PUBLIC)
 	ZEND_FE_END
 };
 
@@ -3404,6 +5247,13 @@ zend_function_entry gearman_job_methods[]= {
 	PHP_ME_MAPPING(unique, gearman_job_unique, arginfo_oo_gearman_job_unique, ZEND_ACC_PUBLIC)
 	PHP_ME_MAPPING(workload, gearman_job_workload, arginfo_oo_gearman_job_workload, ZEND_ACC_PUBLIC)
 	PHP_ME_MAPPING(workloadSize, gearman_job_workload_size, arginfo_oo_gearman_job_workload_size, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(getOutputStream, gearman_job_get_output_stream, arginfo_oo_gearman_job_get_output_stream, ZEND_ACC_PUBLIC)
+	ZEND_FE_END
+};
+
+zend_function_entry gearman_packet_methods[] = {
+	PHP_ME_MAPPING(encode, gearman_packet_encode, arginfo_gearman_packet_encode, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	PHP_ME_MAPPING(decode, gearman_packet_decode, arginfo_gearman_packet_decode, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
 	ZEND_FE_END
 };
 
@@ -3428,6 +5278,15 @@ PHP_MINIT_FUNCTION(gearman) {
 	gearman_task_obj_handlers.offset = XtOffsetOf(gearman_task_obj, std);
 	gearman_task_obj_handlers.free_obj = NULL;
 
+	INIT_CLASS_ENTRY(ce, "GearmanCompletionIterator", gearman_completion_iterator_methods);
+	gearman_completion_iterator_ce = zend_register_internal_class(&ce);
+	gearman_completion_iterator_ce->ce_flags |= ZEND_ACC_FINAL;
+	gearman_completion_iterator_ce->create_object = gearman_completion_iterator_obj_new;
+	zend_class_implements(gearman_completion_iterator_ce, 1, zend_ce_iterator);
+	memcpy(&gearman_completion_iterator_obj_handlers, zend_get_std_object_handlers(), sizeof(gearman_completion_iterator_obj_handlers));
+	gearman_completion_iterator_obj_handlers.offset = XtOffsetOf(gearman_completion_iterator_obj, std);
+	gearman_completion_iterator_obj_handlers.free_obj = NULL;
+
 	INIT_CLASS_ENTRY(ce, "GearmanWorker", gearman_worker_methods);
 	gearman_worker_ce = zend_register_internal_class(&ce);
 	gearman_worker_ce->create_object = gearman_worker_obj_new;
@@ -3442,6 +5301,10 @@ PHP_MINIT_FUNCTION(gearman) {
 	gearman_job_obj_handlers.offset = XtOffsetOf(gearman_job_obj, std);
 	gearman_job_obj_handlers.free_obj = NULL;
 
+	INIT_CLASS_ENTRY(ce, "GearmanPacket", gearman_packet_methods);
+	gearman_packet_ce = zend_register_internal_class(&ce);
+	gearman_packet_ce->ce_flags |= ZEND_ACC_FINAL;
+
 	/* XXX exception class */
 	INIT_CLASS_ENTRY(ce, "GearmanException", gearman_exception_methods)
 	gearman_exception_ce = zend_register_internal_class_ex(&ce, zend_exception_get_default());
@@ -3926,6 +5789,41 @@ PHP_MINIT_FUNCTION(gearman) {
 		CONST_CS | CONST_PERSISTENT);
 	/* CONST_GEN_STOP */
 
+	/* Constants defined by the extension itself */
+	REGISTER_LONG_CONSTANT("GEARMAN_SENDER_BLOCK",
+		GEARMAN_SENDER_BLOCK,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("GEARMAN_SENDER_DROP",
+		GEARMAN_SENDER_DROP,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("GEARMAN_SENDER_SPILL",
+		GEARMAN_SENDER_SPILL,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("GEARMAN_COMPLETION_ALL",
+		GEARMAN_COMPLETION_ALL,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("GEARMAN_COMPLETION_QUORUM",
+		GEARMAN_COMPLETION_QUORUM,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("GEARMAN_COMPLETION_FAIL_FAST",
+		GEARMAN_COMPLETION_FAIL_FAST,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("GEARMAN_ROUTING_DEFAULT",
+		GEARMAN_ROUTING_DEFAULT,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("GEARMAN_ROUTING_CONSISTENT_HASH",
+		GEARMAN_ROUTING_CONSISTENT_HASH,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("GEARMAN_ROUTING_LEAST_OUTSTANDING",
+		GEARMAN_ROUTING_LEAST_OUTSTANDING,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("GEARMAN_ENGINE_LIBGEARMAN",
+		GEARMAN_ENGINE_LIBGEARMAN,
+		CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("GEARMAN_ENGINE_NATIVE",
+		GEARMAN_ENGINE_NATIVE,
+		CONST_CS | CONST_PERSISTENT);
+
 	return SUCCESS;
 }
 
@@ -3933,6 +5831,24 @@ PHP_MSHUTDOWN_FUNCTION(gearman) {
 	return SUCCESS;
 }
 
+static PHP_GINIT_FUNCTION(gearman) {
+#if defined(COMPILE_DL_GEARMAN) && defined(ZTS)
+	ZEND_TSRMLS_CACHE_UPDATE();
+#endif
+	ZVAL_UNDEF(&gearman_globals->deferred_clients);
+}
+
+/* the output went out by now, so the deferred jobs of clients destroyed
+ * at the end of the request no longer hold up the response */
+PHP_RSHUTDOWN_FUNCTION(gearman) {
+	if (Z_TYPE(GEARMAN_G(deferred_clients)) == IS_ARRAY) {
+		_php_client_shutdown_deferred(&GEARMAN_G(deferred_clients));
+		zval_ptr_dtor(&GEARMAN_G(deferred_clients));
+		ZVAL_UNDEF(&GEARMAN_G(deferred_clients));
+	}
+	return SUCCESS;
+}
+
 PHP_MINFO_FUNCTION(gearman) {
 	char port_str[6];
 
@@ -3954,12 +5870,19 @@ zend_module_entry gearman_module_entry = {
 	PHP_MINIT(gearman),
 	PHP_MSHUTDOWN(gearman),
 	NULL,
-	NULL,
+	PHP_RSHUTDOWN(gearman),
 	PHP_MINFO(gearman),
 	PHP_GEARMAN_VERSION,
-	STANDARD_MODULE_PROPERTIES
+	PHP_MODULE_GLOBALS(gearman),
+	PHP_GINIT(gearman),
+	NULL,
+	NULL,
+	STANDARD_MODULE_PROPERTIES_EX
 };
 
 #ifdef COMPILE_DL_GEARMAN
+#ifdef ZTS
+ZEND_TSRMLS_CACHE_DEFINE()
+#endif
 ZEND_GET_MODULE(gearman)
 #endif
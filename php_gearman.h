@@ -29,6 +29,19 @@
 extern zend_module_entry gearman_module_entry;
 #define phpext_gearman_ptr &gearman_module_entry
 
+ZEND_BEGIN_MODULE_GLOBALS(gearman)
+	/* clients destroyed at the end of the request with deferred jobs
+	 * left, see _php_client_shutdown_deferred() */
+	zval deferred_clients;
+ZEND_END_MODULE_GLOBALS(gearman)
+
+ZEND_EXTERN_MODULE_GLOBALS(gearman)
+#define GEARMAN_G(v) ZEND_MODULE_GLOBALS_ACCESSOR(gearman, v)
+
+#if defined(ZTS) && defined(COMPILE_DL_GEARMAN)
+ZEND_TSRMLS_CACHE_EXTERN()
+#endif
+
 typedef enum {
         GEARMAN_OBJ_CREATED = (1 << 0)
 } gearman_obj_flags_t;
@@ -12,301 +12,3346 @@
 #include "php_gearman_task.h"
 #include "php_gearman_client.h"
 
+#include "zend_smart_str.h"
+#include "ext/standard/md5.h"
+
+#include <math.h>
+
+/* server as "host:port", with the default host and port filled in and the
+ * host lowercased, so the same server is always spelled the same way.
+ * "[v6 address][:port]" keeps its brackets, unix:// entries are left as
+ * they are. */
+zend_string *_php_gearman_server_key(const char *server, size_t len) {
+        const char *host = server, *port = NULL, *colon;
+        size_t host_len = len, port_len = 0;
+        zend_string *key;
+
+        if (len >= sizeof(PHP_GEARMAN_UNIX_PREFIX) - 1 && PHP_GEARMAN_IS_UNIX(server)) {
+                return zend_string_init(server, len, 0);
+        }
+
+        if (len > 0 && *server == '[' && (colon = memchr(server, ']', len)) != NULL) {
+                host_len = colon - server + 1;
+                if (host_len < len && colon[1] == ':') {
+                        port = colon + 2;
+                }
+        } else if ((colon = zend_memrchr(server, ':', len)) != NULL) {
+                host_len = colon - server;
+                port = colon + 1;
+        }
+        if (port != NULL) {
+                port_len = len - (port - server);
+        }
+
+        if (host_len == 0) {
+                host = GEARMAN_DEFAULT_TCP_HOST;
+                host_len = strlen(host);
+        }
+        if (port_len == 0) {
+                key = strpprintf(0, "%.*s:%d", (int) host_len, host, GEARMAN_DEFAULT_TCP_PORT);
+        } else {
+                key = strpprintf(0, "%.*s:%.*s", (int) host_len, host, (int) port_len, port);
+        }
+        zend_str_tolower(ZSTR_VAL(key), host_len);
+        return key;
+}
+
+/* Keeps our own copy of the configured servers, libgearman has no way of
+ * listing them back. servers uses the addServers() format. */
+void _php_gearman_record_servers(zval *list, const char *servers) {
+        const char *start, *end;
+        size_t len;
+
+        if (servers == NULL || *servers == '\0') {
+                add_next_index_str(list, strpprintf(0, "%s:%d", GEARMAN_DEFAULT_TCP_HOST, GEARMAN_DEFAULT_TCP_PORT));
+                return;
+        }
+
+        for (start = servers; *start != '\0'; start = end) {
+                while (*start == ',' || *start == ' ') {
+                        start++;
+                }
+
+                for (end = start; *end != '\0' && *end != ','; end++);
+
+                for (len = end - start; len > 0 && start[len - 1] == ' '; len--);
+
+                if (len > 0) {
+                        add_next_index_str(list, _php_gearman_server_key(start, len));
+                }
+        }
+}
+
+/* The entries of list from index from on that libgearman can connect
+ * to, in the addServers() format. NULL if there are none. */
+zend_string *_php_gearman_join_servers(zval *list, uint32_t from) {
+        smart_str servers = {0};
+        zend_ulong index;
+        zval *zserver;
+
+        ZEND_HASH_FOREACH_NUM_KEY_VAL(Z_ARRVAL_P(list), index, zserver) {
+                if (index < from || PHP_GEARMAN_IS_UNIX(Z_STRVAL_P(zserver))) {
+                        continue;
+                }
+                if (servers.s) {
+                        smart_str_appendc(&servers, ',');
+                }
+                smart_str_append(&servers, Z_STR_P(zserver));
+        } ZEND_HASH_FOREACH_END();
+        smart_str_0(&servers);
+
+        return servers.s;
+}
+
+/* Fills options from the array setSocketOptions() got, with a warning
+ * and 0 returned if it has anything it does not know. */
+zend_bool _php_gearman_socket_options(zval *zoptions, php_gearman_socket_options *options) {
+        zval *zoption;
+        zend_string *key;
+        zend_long value;
+
+        php_gearman_socket_options_init(options);
+
+        ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL_P(zoptions), key, zoption) {
+                value = zval_get_long(zoption);
+                if (key == NULL) {
+                        php_error_docref(NULL, E_WARNING, "Socket options must be given as name => int");
+                        return 0;
+                }
+                if (value < 0 || value > INT_MAX) {
+                        php_error_docref(NULL, E_WARNING, "Socket option %s must be greater than or equal to 0", ZSTR_VAL(key));
+                        return 0;
+                }
+
+                if (zend_string_equals_literal(key, "send_size")) {
+                        options->send_size = (int) value;
+                } else if (zend_string_equals_literal(key, "recv_size")) {
+                        options->recv_size = (int) value;
+                } else if (zend_string_equals_literal(key, "nodelay")) {
+                        options->nodelay = value ? 1 : 0;
+                } else if (zend_string_equals_literal(key, "quickack")) {
+                        options->quickack = value ? 1 : 0;
+                } else if (zend_string_equals_literal(key, "busy_poll")) {
+                        options->busy_poll = (int) value;
+                } else {
+                        php_error_docref(NULL, E_WARNING, "Unknown socket option %s", ZSTR_VAL(key));
+                        return 0;
+                }
+        } ZEND_HASH_FOREACH_END();
+
+        return 1;
+}
+
+/* Position of server in list, -1 if it is not there. */
+int32_t _php_gearman_find_server(zval *list, zend_string *server) {
+        zend_ulong index;
+        zval *zserver;
+
+        ZEND_HASH_FOREACH_NUM_KEY_VAL(Z_ARRVAL_P(list), index, zserver) {
+                if (zend_string_equals(Z_STR_P(zserver), server)) {
+                        return (int32_t) index;
+                }
+        } ZEND_HASH_FOREACH_END();
+
+        return -1;
+}
+
+/* Number of unix:// entries in list. */
+uint32_t _php_gearman_count_unix(zval *list) {
+        uint32_t count = 0;
+        zval *zserver;
+
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(list), zserver) {
+                if (PHP_GEARMAN_IS_UNIX(Z_STRVAL_P(zserver))) {
+                        count++;
+                }
+        } ZEND_HASH_FOREACH_END();
+
+        return count;
+}
+
+/* Starts a sender thread for the servers recorded so far. */
+static zend_bool _php_client_start_sender(gearman_client_obj *obj, uint32_t capacity, php_gearman_sender_policy_t policy) {
+        zend_string *servers = _php_gearman_join_servers(&obj->server_list, 0);
+
+        obj->sender = php_gearman_sender_create(servers ? ZSTR_VAL(servers) : NULL,
+                                                gearman_client_timeout(&(obj->client)),
+                                                capacity, policy);
+        if (servers) {
+                zend_string_release(servers);
+        }
+
+        return obj->sender != NULL;
+}
+
+/* Stops the sender thread. It gets PHP_GEARMAN_SENDER_DRAIN_TIMEOUT to
+ * deliver what is queued, so an unreachable server cannot hang us. */
+static void _php_client_stop_sender(gearman_client_obj *obj) {
+        uint32_t dropped = php_gearman_sender_free(obj->sender, PHP_GEARMAN_SENDER_DRAIN_TIMEOUT);
+
+        obj->sender = NULL;
+        if (dropped > 0) {
+                php_error_docref(NULL, E_WARNING, "Background sender did not drain in time, %u jobs dropped", dropped);
+        }
+}
+
+/* Makes room in servers for every entry of server_list. */
+static void _php_client_servers_grow(gearman_client_obj *obj) {
+        uint32_t count = zend_hash_num_elements(Z_ARRVAL(obj->server_list));
+
+        if (obj->servers_count < count) {
+                obj->servers = erealloc(obj->servers, count * sizeof(php_gearman_server_t));
+                memset(obj->servers + obj->servers_count, 0, (count - obj->servers_count) * sizeof(php_gearman_server_t));
+                obj->servers_count = count;
+        }
+}
+
+/* Returns a libgearman client connected to server_list[index] only,
+ * creating it on first use, or NULL if there is no such server or it
+ * could not be set up. */
+gearman_client_st *_php_client_server(gearman_client_obj *obj, uint32_t index) {
+        gearman_client_st *client;
+        zval *zserver;
+
+        zserver = zend_hash_index_find(Z_ARRVAL(obj->server_list), index);
+        if (zserver == NULL || PHP_GEARMAN_IS_UNIX(Z_STRVAL_P(zserver))) {
+                return NULL;
+        }
+
+        _php_client_servers_grow(obj);
+
+        if (obj->servers[index].client != NULL) {
+                return obj->servers[index].client;
+        }
+
+        client = gearman_client_create(NULL);
+        if (client == NULL) {
+                return NULL;
+        }
+
+        if (gearman_failed(gearman_client_add_servers(client, Z_STRVAL_P(zserver)))) {
+                gearman_client_free(client);
+                return NULL;
+        }
+
+        gearman_client_set_timeout(client, gearman_client_timeout(&(obj->client)));
+        gearman_client_add_options(client, GEARMAN_CLIENT_FREE_TASKS);
+        gearman_client_set_workload_malloc_fn(client, _php_malloc, NULL);
+        gearman_client_set_workload_free_fn(client, _php_free, NULL);
+        gearman_client_set_task_context_free_fn(client, _php_task_free);
+        gearman_client_set_server_option(client, "exceptions", (sizeof("exceptions") - 1));
+        _php_task_install_fns(client);
+
+        obj->servers[index].client = client;
+        return client;
+}
+
+/* Returns the clone of client the extension runs its internal tasks on,
+ * so they never share a queue or callbacks with the user's tasks. It is
+ * cloned again once the server list changed. NULL if it could not be set
+ * up. */
+gearman_client_st *_php_client_internal(gearman_client_obj *obj) {
+        uint32_t count = zend_hash_num_elements(Z_ARRVAL(obj->server_list));
+        gearman_client_st *client;
+
+        if (obj->internal != NULL) {
+                if (obj->internal_servers == count) {
+                        return obj->internal;
+                }
+
+                /* FREE_TASKS takes whatever is still on it */
+                gearman_client_free(obj->internal);
+                obj->internal = NULL;
+        }
+
+        client = gearman_client_clone(NULL, &(obj->client));
+        if (client == NULL) {
+                return NULL;
+        }
+
+        gearman_client_remove_options(client, GEARMAN_CLIENT_NON_BLOCKING | GEARMAN_CLIENT_UNBUFFERED_RESULT);
+        gearman_client_add_options(client, GEARMAN_CLIENT_FREE_TASKS);
+        gearman_client_set_context(client, NULL);
+        gearman_client_set_workload_malloc_fn(client, _php_malloc, NULL);
+        gearman_client_set_workload_free_fn(client, _php_free, NULL);
+        gearman_client_set_task_context_free_fn(client, _php_task_free);
+        gearman_client_set_server_option(client, "exceptions", (sizeof("exceptions") - 1));
+        _php_task_install_fns(client);
+
+        obj->internal = client;
+        obj->internal_servers = count;
+        return client;
+}
+
+static int _php_client_ring_compare(const void *a, const void *b) {
+        uint32_t x = ((const php_gearman_ring_point_t *) a)->point;
+        uint32_t y = ((const php_gearman_ring_point_t *) b)->point;
+
+        return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Hashes key the way ketama does, four ring points per MD5 digest. */
+static void _php_client_ring_hash(const char *key, size_t key_len, uint32_t points[4]) {
+        PHP_MD5_CTX context;
+        unsigned char digest[16];
+        int i;
+
+        PHP_MD5Init(&context);
+        PHP_MD5Update(&context, key, key_len);
+        PHP_MD5Final(digest, &context);
+
+        for (i = 0; i < 4; i++) {
+                points[i] = ((uint32_t) digest[i * 4 + 3] << 24) | ((uint32_t) digest[i * 4 + 2] << 16) |
+                            ((uint32_t) digest[i * 4 + 1] << 8) | (uint32_t) digest[i * 4];
+        }
+}
+
+/* Places PHP_GEARMAN_RING_POINTS points per server on the ring. They only
+ * depend on the server's name, so a server coming or going only moves the
+ * keys next to its own points. */
+static void _php_client_ring_build(gearman_client_obj *obj) {
+        zval *zserver;
+        zend_ulong index;
+        uint32_t points[4], i, j;
+        size_t key_len;
+        char key[256];
+
+        obj->ring_size = 0;
+        obj->ring = erealloc(obj->ring, zend_hash_num_elements(Z_ARRVAL(obj->server_list)) *
+                                        PHP_GEARMAN_RING_POINTS * sizeof(php_gearman_ring_point_t));
+
+        ZEND_HASH_FOREACH_NUM_KEY_VAL(Z_ARRVAL(obj->server_list), index, zserver) {
+                for (i = 0; i < PHP_GEARMAN_RING_POINTS / 4; i++) {
+                        key_len = snprintf(key, sizeof(key), "%s-%u", Z_STRVAL_P(zserver), i);
+                        _php_client_ring_hash(key, MIN(key_len, sizeof(key) - 1), points);
+                        for (j = 0; j < 4; j++) {
+                                obj->ring[obj->ring_size].point = points[j];
+                                obj->ring[obj->ring_size].server = (uint32_t) index;
+                                obj->ring_size++;
+                        }
+                }
+        } ZEND_HASH_FOREACH_END();
+
+        qsort(obj->ring, obj->ring_size, sizeof(php_gearman_ring_point_t), _php_client_ring_compare);
+        obj->ring_servers = zend_hash_num_elements(Z_ARRVAL(obj->server_list));
+}
+
+/* Whether servers[index] may get jobs. A server whose breaker is open
+ * gets probed with ECHO once its cooldown is over. The probe runs in the
+ * job's path, so it gets PHP_GEARMAN_BREAKER_PROBE_TIMEOUT ms at most:
+ * a server that refuses it stays out of rotation, one too slow to answer
+ * that fast is let through half open and the next job decides. */
+static zend_bool _php_client_server_available(gearman_client_obj *obj, uint32_t index, uint64_t now) {
+        php_gearman_server_t *server = &obj->servers[index];
+        gearman_client_st *client;
+        gearman_return_t ret;
+        int client_timeout;
+
+        if (now < server->retry_at) {
+                return 0;
+        }
+        if (server->state != GEARMAN_BREAKER_OPEN) {
+                return 1;
+        }
+
+        server->state = GEARMAN_BREAKER_HALF_OPEN;
+        client = _php_client_server(obj, index);
+        ret = GEARMAN_COULD_NOT_CONNECT;
+        if (client != NULL) {
+                client_timeout = gearman_client_timeout(client);
+                gearman_client_set_timeout(client, PHP_GEARMAN_BREAKER_PROBE_TIMEOUT);
+                ret = gearman_client_echo(client, "ping", sizeof("ping") - 1);
+                gearman_client_set_timeout(client, client_timeout);
+        }
+
+        if (ret == GEARMAN_TIMEOUT) {
+                return 1;
+        }
+        _php_client_server_done(obj, (int32_t) index, ret, 0);
+        return server->state == GEARMAN_BREAKER_CLOSED;
+}
+
+/* The first server at or after the key's hash on the ring, skipping the
+ * unavailable ones when the breaker is on. -1 if none is available. */
+static int32_t _php_client_ring_lookup(gearman_client_obj *obj, const char *key, size_t key_len) {
+        uint32_t points[4], low = 0, high, middle, i, index;
+        uint64_t now;
+
+        if (obj->ring_servers != zend_hash_num_elements(Z_ARRVAL(obj->server_list))) {
+                _php_client_ring_build(obj);
+        }
+
+        _php_client_ring_hash(key, key_len, points);
+
+        high = obj->ring_size;
+        while (low < high) {
+                middle = low + (high - low) / 2;
+                if (obj->ring[middle].point < points[0]) {
+                        low = middle + 1;
+                } else {
+                        high = middle;
+                }
+        }
+
+        if (obj->breaker_threshold == 0) {
+                return (int32_t) obj->ring[low == obj->ring_size ? 0 : low].server;
+        }
+
+        _php_client_servers_grow(obj);
+        now = _php_gearman_now_ms();
+        for (i = 0; i < obj->ring_size; i++) {
+                index = obj->ring[(low + i) % obj->ring_size].server;
+                if (_php_client_server_available(obj, index, now)) {
+                        return (int32_t) index;
+                }
+        }
+
+        return -1;
+}
+
+/* Weight of server_list[index] given to setServerWeights(), 1 if none was. */
+static zend_long _php_client_server_weight(gearman_client_obj *obj, uint32_t index) {
+        zval *zserver, *zweight;
+
+        zserver = zend_hash_index_find(Z_ARRVAL(obj->server_list), index);
+        if (zserver == NULL || (zweight = zend_hash_find(Z_ARRVAL(obj->server_weights), Z_STR_P(zserver))) == NULL) {
+                return 1;
+        }
+        return Z_LVAL_P(zweight);
+}
+
+/* The available server with the fewest outstanding tasks for its weight,
+ * scaled by how fast it answered lately. Ties go round robin. Returns -1
+ * if every server is weighted 0 or unavailable. */
+static int32_t _php_client_least_outstanding(gearman_client_obj *obj) {
+        php_gearman_server_t *server;
+        uint32_t count = zend_hash_num_elements(Z_ARRVAL(obj->server_list)), i, index;
+        uint64_t now = _php_gearman_now_ms();
+        zend_long weight;
+        double score, best_score = 0;
+        int32_t best = -1;
+
+        _php_client_servers_grow(obj);
+
+        for (i = 0; i < count; i++) {
+                index = (obj->balance_next + i) % count;
+                server = &obj->servers[index];
+                weight = _php_client_server_weight(obj, index);
+                if (weight <= 0 || !_php_client_server_available(obj, index, now)) {
+                        continue;
+                }
+
+                score = (server->tasks + 1) * MAX(server->latency, 1.0) / weight;
+                if (best < 0 || score < best_score) {
+                        best = (int32_t) index;
+                        best_score = score;
+                }
+        }
+
+        obj->balance_next++;
+        return best;
+}
+
+/* The first available server in the order they were added, which is the
+ * order libgearman tries them in. -1 if all of them are available, so
+ * libgearman keeps choosing, or if none is. */
+static int32_t _php_client_first_available(gearman_client_obj *obj) {
+        uint32_t count = zend_hash_num_elements(Z_ARRVAL(obj->server_list)), i;
+        uint64_t now = _php_gearman_now_ms();
+        int32_t first = -1;
+        zend_bool filtered = 0;
+
+        _php_client_servers_grow(obj);
+
+        for (i = 0; i < count; i++) {
+                if (!_php_client_server_available(obj, i, now)) {
+                        filtered = 1;
+                } else if (first < 0) {
+                        first = (int32_t) i;
+                }
+        }
+
+        return filtered ? first : -1;
+}
+
+/* Records how a call through servers[server] went. Without the breaker a
+ * server that could not be reached is left out for PHP_GEARMAN_SERVER_RETRY
+ * ms. With it, connection failures open the breaker right away and other
+ * errors and timeouts once breaker_threshold of them came in a row. */
+void _php_client_server_done(gearman_client_obj *obj, int32_t server, gearman_return_t ret, uint64_t ms) {
+        php_gearman_server_t *entry;
+        zend_bool trip = 0;
+
+        if (server < 0 || (uint32_t) server >= obj->servers_count) {
+                return;
+        }
+        entry = &obj->servers[server];
+
+        switch (ret) {
+        case GEARMAN_COULD_NOT_CONNECT:
+        case GEARMAN_GETADDRINFO:
+                trip = 1;
+                break;
+        case GEARMAN_TIMEOUT:
+                entry->timeouts++;
+                break;
+        case GEARMAN_LOST_CONNECTION:
+        case GEARMAN_ERRNO:
+        case GEARMAN_SERVER_ERROR:
+                break;
+        default:
+                /* the server answered, whatever the job did */
+                if (ret == GEARMAN_SUCCESS && ms > 0) {
+                        entry->latency = entry->latency > 0 ? entry->latency + ((double) ms - entry->latency) / 8 : (double) ms;
+                }
+                entry->consecutive_errors = 0;
+                entry->state = GEARMAN_BREAKER_CLOSED;
+                return;
+        }
+
+        entry->errors++;
+        entry->consecutive_errors++;
+
+        if (obj->breaker_threshold == 0) {
+                if (ret != GEARMAN_TIMEOUT) {
+                        entry->retry_at = _php_gearman_now_ms() + PHP_GEARMAN_SERVER_RETRY;
+                }
+                return;
+        }
+
+        if (trip || entry->state == GEARMAN_BREAKER_HALF_OPEN ||
+            entry->consecutive_errors >= (uint32_t) obj->breaker_threshold) {
+                if (entry->state != GEARMAN_BREAKER_OPEN) {
+                        entry->trips++;
+                }
+                entry->state = GEARMAN_BREAKER_OPEN;
+                entry->retry_at = _php_gearman_now_ms() + obj->breaker_cooldown;
+        }
+}
+
+/* Whether a call that just failed through servers[server] should be
+ * repeated on another server. Only once the failure took the server out
+ * of rotation, and for do*() only if the job cannot have reached it. */
+zend_bool _php_client_fail_over(gearman_client_obj *obj, int32_t server, gearman_return_t ret, zend_bool background, uint32_t attempts) {
+        if (server < 0 || obj->breaker_threshold == 0 || attempts + 1 >= obj->servers_count ||
+            obj->servers[server].state != GEARMAN_BREAKER_OPEN) {
+                return 0;
+        }
+
+        return background ? gearman_failed(ret) && ret != GEARMAN_WORK_FAIL :
+                            (ret == GEARMAN_COULD_NOT_CONNECT || ret == GEARMAN_GETADDRINFO);
+}
+
+/* Index of the server a job with the given unique key is routed to, -1
+ * if libgearman chooses. */
+static int32_t _php_client_pick(gearman_client_obj *obj, const char *unique, size_t unique_len) {
+        if (zend_hash_num_elements(Z_ARRVAL(obj->server_list)) < 2) {
+                return -1;
+        }
+
+        if (obj->routing == GEARMAN_ROUTING_LEAST_OUTSTANDING) {
+                return _php_client_least_outstanding(obj);
+        } else if (obj->routing == GEARMAN_ROUTING_CONSISTENT_HASH && obj->shard_key != NULL) {
+                return _php_client_ring_lookup(obj, ZSTR_VAL(obj->shard_key), ZSTR_LEN(obj->shard_key));
+        } else if (obj->routing == GEARMAN_ROUTING_CONSISTENT_HASH && unique != NULL && unique_len > 0) {
+                return _php_client_ring_lookup(obj, unique, unique_len);
+        } else if (obj->breaker_threshold > 0) {
+                /* libgearman would keep trying a server whose breaker is open */
+                return _php_client_first_available(obj);
+        }
+
+        return -1;
+}
+
+/* Picks the libgearman client a job with the given unique key goes
+ * through. server is set to the index of the server it was routed to, or
+ * -1 when it goes through the client's own connections. */
+gearman_client_st *_php_client_route(gearman_client_obj *obj, const char *unique, size_t unique_len, int32_t *server) {
+        gearman_client_st *client;
+        int32_t index = _php_client_pick(obj, unique, unique_len);
+
+        *server = -1;
+
+        if (index < 0 || (client = _php_client_server(obj, (uint32_t) index)) == NULL) {
+                return &(obj->client);
+        }
+
+        *server = index;
+        return client;
+}
+
+/* _php_client_route() for do*() and doBackground(), which can also run
+ * over the extension's own connections. Returns NULL when the job goes
+ * there: on the native engine, when it was routed to a unix:// server,
+ * or when libgearman would choose but cannot reach the unix:// ones.
+ * server is the index the job was routed to or -1 either way. */
+gearman_client_st *_php_client_route_do(gearman_client_obj *obj, const char *unique, size_t unique_len, int32_t *server) {
+        gearman_client_st *client;
+        zval *zserver;
+
+        *server = _php_client_pick(obj, unique, unique_len);
+
+        if (obj->engine == GEARMAN_ENGINE_NATIVE) {
+                return NULL;
+        }
+        if (*server >= 0) {
+                zserver = zend_hash_index_find(Z_ARRVAL(obj->server_list), (zend_ulong) *server);
+                if (zserver != NULL && PHP_GEARMAN_IS_UNIX(Z_STRVAL_P(zserver))) {
+                        return NULL;
+                }
+                if ((client = _php_client_server(obj, (uint32_t) *server)) != NULL) {
+                        return client;
+                }
+                *server = -1;
+        }
+
+        return obj->unix_servers > 0 ? NULL : &(obj->client);
+}
+
+/* Error message for a failed call, libgearman only has one for the
+ * connections the call went through. */
+const char *_php_client_error(gearman_client_obj *obj, gearman_client_st *client) {
+        const char *error = gearman_client_error(client);
+
+        if (error == NULL || *error == '\0') {
+                error = gearman_strerror(obj->ret);
+        }
+        return error;
+}
+
+/* The connection to server_list[index], connected and with the
+ * exceptions option asked for. NULL with obj->ret set if that failed. */
+static php_gearman_conn *_php_client_conn(gearman_client_obj *obj, uint32_t index, int timeout) {
+        static const char *option = "exceptions";
+        static const size_t option_len = sizeof("exceptions") - 1;
+        php_gearman_packet packet;
+        php_gearman_conn *conn;
+        zval *zserver;
+        uint32_t count = zend_hash_num_elements(Z_ARRVAL(obj->server_list)), i;
+
+        zserver = zend_hash_index_find(Z_ARRVAL(obj->server_list), index);
+        if (zserver == NULL) {
+                obj->ret = GEARMAN_NO_SERVERS;
+                return NULL;
+        }
+
+        if (obj->conns_count < count) {
+                obj->conns = erealloc(obj->conns, count * sizeof(php_gearman_conn));
+                for (i = obj->conns_count; i < count; i++) {
+                        php_gearman_conn_init(&obj->conns[i]);
+                }
+                obj->conns_count = count;
+        }
+
+        conn = &obj->conns[index];
+        conn->error[0] = '\0';
+        obj->conn_last = (int32_t) index;
+        if (conn->fd != -1) {
+                return conn;
+        }
+
+        obj->ret = php_gearman_conn_open(conn, Z_STRVAL_P(zserver), timeout, &obj->socket_options);
+        if (obj->ret == GEARMAN_SUCCESS) {
+                obj->ret = php_gearman_conn_send(conn, GEARMAN_COMMAND_OPTION_REQ, &option, &option_len, 1, timeout);
+        }
+        if (obj->ret == GEARMAN_SUCCESS) {
+                obj->ret = php_gearman_conn_recv(conn, &packet, timeout);
+        }
+        if (obj->ret != GEARMAN_SUCCESS) {
+                return NULL;
+        }
+
+        /* a server without the option still runs jobs */
+        if (packet.command != GEARMAN_COMMAND_OPTION_RES && packet.command != GEARMAN_COMMAND_ERROR) {
+                obj->ret = GEARMAN_UNEXPECTED_PACKET;
+                php_gearman_conn_close(conn);
+                return NULL;
+        }
+
+        return conn;
+}
+
+/* Sends a job whose workload is read from stream, size bytes of it,
+ * PHP_GEARMAN_WORKLOAD_CHUNK at a time. */
+static gearman_return_t _php_client_send_stream(php_gearman_conn *conn, gearman_command_t command,
+                                                const char **args, const size_t *sizes,
+                                                php_stream *stream, size_t size, int timeout) {
+        gearman_return_t ret;
+        char *chunk;
+        size_t left = size;
+        ssize_t n;
+
+        ret = php_gearman_conn_send_header(conn, command, args, sizes, 2, size, timeout);
+        if (ret != GEARMAN_SUCCESS || size == 0) {
+                return ret;
+        }
+
+        chunk = emalloc(MIN(size, PHP_GEARMAN_WORKLOAD_CHUNK));
+        while (left > 0) {
+                n = php_stream_read(stream, chunk, MIN(left, PHP_GEARMAN_WORKLOAD_CHUNK));
+                if (n <= 0) {
+                        break;
+                }
+                ret = php_gearman_conn_write(conn, chunk, (size_t) n, timeout);
+                if (ret != GEARMAN_SUCCESS) {
+                        break;
+                }
+                left -= (size_t) n;
+        }
+        efree(chunk);
+
+        /* the packet is half out, only closing takes it back */
+        if (ret == GEARMAN_SUCCESS && left > 0) {
+                php_gearman_conn_close(conn);
+                snprintf(conn->error, sizeof(conn->error), "Workload stream ended %zu bytes short of its size", left);
+                ret = GEARMAN_INVALID_ARGUMENT;
+        }
+
+        return ret;
+}
+
+/* Runs a job through the client's own connections, on servers[server]
+ * or, with server -1, trying the servers in order until one takes it.
+ * Returns the result, or the job handle for a background job, with
+ * obj->ret set. NULL for an empty result or if the job did not run. With
+ * a stream, workload_len bytes of it are the workload and only the first
+ * server that can be reached gets a try. */
+zend_string *_php_client_native_do(gearman_client_obj *obj, gearman_job_priority_t priority, zend_bool background,
+                                   const char *function_name, size_t function_name_len,
+                                   const char *unique, size_t unique_len,
+                                   const char *workload, size_t workload_len, php_stream *stream,
+                                   int32_t server, int timeout) {
+        php_gearman_conn *conn = NULL;
+        php_gearman_packet packet;
+        gearman_command_t command;
+        smart_str result = {0};
+        const char *args[3];
+        size_t sizes[3];
+        uint32_t count = zend_hash_num_elements(Z_ARRVAL(obj->server_list)), i;
+
+        if (priority == GEARMAN_JOB_PRIORITY_HIGH) {
+                command = background ? GEARMAN_COMMAND_SUBMIT_JOB_HIGH_BG : GEARMAN_COMMAND_SUBMIT_JOB_HIGH;
+        } else if (priority == GEARMAN_JOB_PRIORITY_LOW) {
+                command = background ? GEARMAN_COMMAND_SUBMIT_JOB_LOW_BG : GEARMAN_COMMAND_SUBMIT_JOB_LOW;
+        } else {
+                command = background ? GEARMAN_COMMAND_SUBMIT_JOB_BG : GEARMAN_COMMAND_SUBMIT_JOB;
+        }
+
+        args[0] = function_name;
+        sizes[0] = function_name_len;
+        args[1] = unique != NULL ? unique : "";
+        sizes[1] = unique != NULL ? unique_len : 0;
+        args[2] = workload;
+        sizes[2] = workload_len;
+
+        obj->ret = GEARMAN_NO_SERVERS;
+        for (i = 0; i < count; i++) {
+                if (server >= 0 && i != (uint32_t) server) {
+                        continue;
+                }
+
+                conn = _php_client_conn(obj, i, timeout);
+                if (conn == NULL) {
+                        continue;
+                }
+
+                if (stream != NULL) {
+                        obj->ret = _php_client_send_stream(conn, command, args, sizes, stream, workload_len, timeout);
+                } else {
+                        obj->ret = php_gearman_conn_send(conn, command, args, sizes, 3, timeout);
+                }
+                if (obj->ret == GEARMAN_SUCCESS) {
+                        obj->ret = php_gearman_conn_recv(conn, &packet, timeout);
+                }
+                if (obj->ret == GEARMAN_SUCCESS) {
+                        break;
+                }
+                /* what was read from the stream is gone */
+                if (stream != NULL) {
+                        return NULL;
+                }
+        }
+        if (i == count) {
+                return NULL;
+        }
+
+        /* the server refusing the job is an answer, not a reason to try the next one */
+        if (packet.command != GEARMAN_COMMAND_JOB_CREATED) {
+                goto error;
+        }
+
+        if (background) {
+                return zend_string_init(packet.args[0], packet.sizes[0], 0);
+        }
+
+        while (1) {
+                obj->ret = php_gearman_conn_recv(conn, &packet, timeout);
+                if (obj->ret != GEARMAN_SUCCESS) {
+                        smart_str_free(&result);
+                        return NULL;
+                }
+
+                switch (packet.command) {
+                case GEARMAN_COMMAND_WORK_DATA:
+                        smart_str_appendl(&result, packet.args[1], packet.sizes[1]);
+                        continue;
+                case GEARMAN_COMMAND_WORK_STATUS:
+                case GEARMAN_COMMAND_WORK_WARNING:
+                        continue;
+                case GEARMAN_COMMAND_WORK_COMPLETE:
+                        /* the usual case, no WORK_DATA before it */
+                        if (result.s == NULL) {
+                                obj->ret = GEARMAN_SUCCESS;
+                                return packet.sizes[1] > 0 ? zend_string_init(packet.args[1], packet.sizes[1], 0) : NULL;
+                        }
+                        smart_str_appendl(&result, packet.args[1], packet.sizes[1]);
+                        obj->ret = GEARMAN_SUCCESS;
+                        break;
+                case GEARMAN_COMMAND_WORK_EXCEPTION:
+                        smart_str_free(&result);
+                        smart_str_appendl(&result, packet.args[1], packet.sizes[1]);
+                        obj->ret = GEARMAN_WORK_EXCEPTION;
+                        break;
+                case GEARMAN_COMMAND_WORK_FAIL:
+                        smart_str_free(&result);
+                        obj->ret = GEARMAN_WORK_FAIL;
+                        break;
+                default:
+                        smart_str_free(&result);
+                        goto error;
+                }
+                break;
+        }
+
+        smart_str_0(&result);
+        return result.s;
+
+error:
+        if (packet.command == GEARMAN_COMMAND_ERROR) {
+                obj->ret = GEARMAN_SERVER_ERROR;
+                snprintf(conn->error, sizeof(conn->error), "%.*s", (int) packet.sizes[1], packet.args[1]);
+        } else {
+                obj->ret = GEARMAN_UNEXPECTED_PACKET;
+        }
+        php_gearman_conn_close(conn);
+        return NULL;
+}
+
+/* ECHO on server_list[index], connecting first unless open_only is set. */
+static gearman_return_t _php_client_conn_echo(gearman_client_obj *obj, uint32_t index, zend_bool open_only,
+                                              const char *workload, size_t workload_len) {
+        php_gearman_packet packet;
+        php_gearman_conn *conn;
+        int timeout = gearman_client_timeout(&(obj->client));
+
+        if (open_only && (index >= obj->conns_count || obj->conns[index].fd == -1)) {
+                return GEARMAN_SUCCESS;
+        }
+
+        conn = _php_client_conn(obj, index, timeout);
+        if (conn == NULL) {
+                return obj->ret;
+        }
+
+        obj->ret = php_gearman_conn_send(conn, GEARMAN_COMMAND_ECHO_REQ, &workload, &workload_len, 1, timeout);
+        if (obj->ret == GEARMAN_SUCCESS) {
+                obj->ret = php_gearman_conn_recv(conn, &packet, timeout);
+        }
+        if (obj->ret == GEARMAN_SUCCESS &&
+            (packet.command != GEARMAN_COMMAND_ECHO_RES || packet.sizes[0] != workload_len ||
+             memcmp(packet.args[0], workload, workload_len) != 0)) {
+                obj->ret = GEARMAN_ECHO_DATA_CORRUPTION;
+                php_gearman_conn_close(conn);
+        }
+
+        return obj->ret;
+}
+
+/* ECHO through the client's own connections to every server, like
+ * gearman_client_echo() does. */
+gearman_return_t _php_client_native_echo(gearman_client_obj *obj, const char *workload, size_t workload_len) {
+        uint32_t count = zend_hash_num_elements(Z_ARRVAL(obj->server_list)), i;
+
+        for (i = 0; i < count; i++) {
+                if (_php_client_conn_echo(obj, i, 0, workload, workload_len) != GEARMAN_SUCCESS) {
+                        return obj->ret;
+                }
+        }
+
+        obj->ret = GEARMAN_SUCCESS;
+        return obj->ret;
+}
+
+/* Error message for a failed call through the client's own connections. */
+const char *_php_client_native_error(gearman_client_obj *obj) {
+        if (obj->conn_last >= 0 && (uint32_t) obj->conn_last < obj->conns_count &&
+            obj->conns[obj->conn_last].error[0] != '\0') {
+                return obj->conns[obj->conn_last].error;
+        }
+        return gearman_strerror(obj->ret);
+}
+
+/* Hands a failed deferred job to the callback set with
+ * setDeferredBackground(), if any. */
+static void _php_client_deferred_failed(gearman_client_obj *obj, zval *zjob, gearman_return_t ret) {
+        zval argv[4], retval;
+        uint32_t i;
+
+        obj->deferred_failures++;
+
+        if (Z_ISUNDEF(obj->zdeferred_fail_fn)) {
+                return;
+        }
+
+        for (i = 0; i < 3; i++) {
+                ZVAL_COPY_VALUE(&argv[i], zend_hash_index_find(Z_ARRVAL_P(zjob), i));
+        }
+        ZVAL_LONG(&argv[3], ret);
+
+        if (call_user_function_ex(EG(function_table), NULL, &obj->zdeferred_fail_fn, &retval, 4, argv, 0, NULL) != SUCCESS) {
+                php_error_docref(NULL, E_WARNING, "Could not call the deferred failure callback");
+                return;
+        }
+        zval_ptr_dtor(&retval);
+}
+
+static gearman_return_t _php_client_deferred_fn(gearman_task_obj *task, gearman_task_obj_event_t event) {
+        gearman_client_obj *obj;
+
+        switch (event) {
+        case GEARMAN_TASK_OBJ_EVENT_CREATED:
+                task->ret = GEARMAN_SUCCESS;
+                break;
+        case GEARMAN_TASK_OBJ_EVENT_FREE:
+                if (task->ret != GEARMAN_SUCCESS) {
+                        obj = Z_GEARMAN_CLIENT_P(&task->zclient);
+                        _php_client_deferred_failed(obj, &task->zdata, gearman_failed(obj->ret) ? obj->ret : GEARMAN_LOST_CONNECTION);
+                }
+                break;
+        default:
+                break;
+        }
+
+        return GEARMAN_SUCCESS;
+}
+
+void _php_client_defer_background(gearman_client_obj *obj, gearman_job_priority_t priority,
+                                  const char *function_name, size_t function_name_len,
+                                  zend_string *workload,
+                                  const char *unique, size_t unique_len) {
+        zval zjob;
+
+        array_init_size(&zjob, 4);
+        add_next_index_stringl(&zjob, function_name, function_name_len);
+        /* kept by reference, flushDeferred() sends it from there */
+        add_next_index_str(&zjob, zend_string_copy(workload));
+        if (unique != NULL) {
+                add_next_index_stringl(&zjob, unique, unique_len);
+        } else {
+                add_next_index_null(&zjob);
+        }
+        add_next_index_long(&zjob, priority);
+
+        add_next_index_zval(&obj->deferred, &zjob);
+}
+
+/* Submits all deferred jobs as one pipelined batch of background tasks and
+ * waits for every JOB_CREATED. Returns 0 if any of them failed. */
+static zend_bool _php_client_flush_deferred(gearman_client_obj *obj) {
+        zval jobs, *zjob, *zunique;
+        php_gearman_add_task_fn add_task_func;
+
+        obj->deferred_failures = 0;
+
+        /* taken over first, a failure callback may defer new jobs */
+        ZVAL_COPY_VALUE(&jobs, &obj->deferred);
+        array_init(&obj->deferred);
+
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL(jobs), zjob) {
+                switch (Z_LVAL_P(zend_hash_index_find(Z_ARRVAL_P(zjob), 3))) {
+                case GEARMAN_JOB_PRIORITY_HIGH:
+                        add_task_func = gearman_client_add_task_high_background;
+                        break;
+                case GEARMAN_JOB_PRIORITY_LOW:
+                        add_task_func = gearman_client_add_task_low_background;
+                        break;
+                default:
+                        add_task_func = gearman_client_add_task_background;
+                        break;
+                }
+
+                zunique = zend_hash_index_find(Z_ARRVAL_P(zjob), 2);
+
+                if (_php_task_internal_add(obj, NULL, add_task_func, _php_client_deferred_fn,
+                                           Z_STRVAL_P(zend_hash_index_find(Z_ARRVAL_P(zjob), 0)),
+                                           Z_TYPE_P(zunique) == IS_STRING ? Z_STRVAL_P(zunique) : NULL,
+                                           zend_hash_index_find(Z_ARRVAL_P(zjob), 1),
+                                           zjob) == NULL) {
+                        _php_client_deferred_failed(obj, zjob, obj->ret);
+                }
+        } ZEND_HASH_FOREACH_END();
+        zval_ptr_dtor(&jobs);
+
+        /* only the deferred tasks are driven, the user's queue is left alone */
+        obj->ret = GEARMAN_SUCCESS;
+        while (obj->internal != NULL && _php_task_internal_count(obj, _php_client_deferred_fn) > 0) {
+                obj->ret = _php_gearman_run_step(obj->internal, -1);
+                if (obj->ret != GEARMAN_IO_WAIT && obj->ret != GEARMAN_PAUSE) {
+                        break;
+                }
+        }
+
+        /* whatever libgearman still holds never made it to a server */
+        _php_task_internal_abandon_all(obj, _php_client_deferred_fn);
+
+        if (obj->deferred_failures > 0 && Z_ISUNDEF(obj->zdeferred_fail_fn)) {
+                php_error_docref(NULL, E_WARNING, ZEND_ULONG_FMT " deferred background jobs could not be submitted: %s",
+                                 obj->deferred_failures,
+                                 obj->internal != NULL ? gearman_client_error(obj->internal) : gearman_client_error(&(obj->client)));
+        }
+
+        return obj->deferred_failures == 0;
+}
+
+/* Does all the I/O the queued tasks allow without blocking, then waits up
+ * to timeout ms for more, a negative timeout uses the client's own. Returns
+ * GEARMAN_IO_WAIT while tasks remain and GEARMAN_SUCCESS once all are done. */
+gearman_return_t _php_gearman_run_step(gearman_client_st *client, int timeout) {
+        zend_bool non_blocking = gearman_client_has_option(client, GEARMAN_CLIENT_NON_BLOCKING);
+        int client_timeout;
+        gearman_return_t ret;
+
+        if (!non_blocking) {
+                gearman_client_add_options(client, GEARMAN_CLIENT_NON_BLOCKING);
+        }
+
+        ret = gearman_client_run_tasks(client);
+
+        if (ret == GEARMAN_IO_WAIT && timeout != 0) {
+                client_timeout = gearman_client_timeout(client);
+                if (timeout > 0) {
+                        gearman_client_set_timeout(client, timeout);
+                }
+
+                ret = gearman_client_wait(client);
+                if (ret == GEARMAN_SUCCESS) {
+                        ret = GEARMAN_IO_WAIT;
+                }
+
+                gearman_client_set_timeout(client, client_timeout);
+        }
+
+        if (!non_blocking) {
+                gearman_client_remove_options(client, GEARMAN_CLIENT_NON_BLOCKING);
+        }
+
+        return ret;
+}
+
+/* Does all the I/O the tasks on any of the libgearman clients allow
+ * without blocking. Failures win over tasks still running, those over
+ * done. */
+static gearman_return_t _php_client_run_pass(gearman_client_obj *obj) {
+        gearman_return_t ret, server_ret;
+        uint32_t i;
+
+        ret = _php_gearman_run_step(&(obj->client), 0);
+        for (i = 0; i < obj->servers_count; i++) {
+                if (obj->servers[i].tasks == 0) {
+                        continue;
+                }
+
+                server_ret = _php_gearman_run_step(obj->servers[i].client, 0);
+                if (server_ret == GEARMAN_TIMEOUT || server_ret == GEARMAN_PAUSE) {
+                        server_ret = GEARMAN_IO_WAIT;
+                }
+                if (server_ret != GEARMAN_IO_WAIT && server_ret != GEARMAN_SUCCESS) {
+                        _php_client_server_done(obj, (int32_t) i, server_ret, 0);
+                }
+
+                if (server_ret == GEARMAN_SUCCESS) {
+                        continue;
+                }
+                if (ret == GEARMAN_SUCCESS || (ret == GEARMAN_IO_WAIT && server_ret != GEARMAN_IO_WAIT)) {
+                        ret = server_ret;
+                }
+        }
+
+        return ret;
+}
+
+/* Counts the libgearman clients with tasks outstanding and stores the
+ * pick-th of them in client. */
+static uint32_t _php_client_busy(gearman_client_obj *obj, uint32_t pick, gearman_client_st **client) {
+        uint32_t count = 0, i;
+
+        if (PHP_GEARMAN_CLIENT_OUTSTANDING(obj) > obj->routed_tasks && count++ == pick) {
+                *client = &(obj->client);
+        }
+        for (i = 0; i < obj->servers_count; i++) {
+                if (obj->servers[i].tasks > 0 && count++ == pick) {
+                        *client = obj->servers[i].client;
+                }
+        }
+
+        return count;
+}
+
+/* _php_gearman_run_step() for all of the client's tasks. Routed tasks
+ * are spread over several libgearman clients, and libgearman keeps its
+ * sockets to itself, so they cannot be poll()ed together. While more
+ * than one is busy they are waited on in turn instead, each for
+ * PHP_GEARMAN_STEP_SLICE ms. A reply can so take up to that much longer
+ * per other busy client to be noticed. A single busy client gets the
+ * whole timeout. Returns once a task finished or something failed. */
+gearman_return_t _php_client_run_step(gearman_client_obj *obj, int timeout) {
+        gearman_client_st *client = NULL;
+        gearman_return_t ret;
+        uint64_t deadline = 0, now;
+        uint32_t outstanding, count, turn = 0;
+        int wait;
+
+        if (obj->routed_tasks == 0) {
+                return _php_gearman_run_step(&(obj->client), timeout);
+        }
+
+        if (timeout < 0) {
+                timeout = gearman_client_timeout(&(obj->client));
+        }
+        if (timeout > 0) {
+                deadline = _php_gearman_now_ms() + timeout;
+        }
+        outstanding = PHP_GEARMAN_CLIENT_OUTSTANDING(obj);
+
+        while (1) {
+                ret = _php_client_run_pass(obj);
+                if (ret != GEARMAN_IO_WAIT || timeout == 0 || PHP_GEARMAN_CLIENT_OUTSTANDING(obj) != outstanding) {
+                        return ret;
+                }
+
+                wait = -1;
+                if (deadline) {
+                        now = _php_gearman_now_ms();
+                        if (now >= deadline) {
+                                return GEARMAN_TIMEOUT;
+                        }
+                        wait = (int) (deadline - now);
+                }
+
+                count = _php_client_busy(obj, UINT32_MAX, &client);
+                if (count == 0) {
+                        return ret;
+                }
+                _php_client_busy(obj, turn++ % count, &client);
+                if (count > 1 && (wait < 0 || wait > PHP_GEARMAN_STEP_SLICE)) {
+                        wait = PHP_GEARMAN_STEP_SLICE;
+                }
+
+                /* failures show up in the next pass */
+                _php_gearman_run_step(client, wait);
+        }
+}
+
+/* Runs the queued tasks until fewer than limit are outstanding. */
+gearman_return_t _php_client_drain(gearman_client_obj *obj, uint32_t limit) {
+        gearman_return_t ret = GEARMAN_SUCCESS;
+
+        while (PHP_GEARMAN_CLIENT_OUTSTANDING(obj) >= limit) {
+                ret = _php_client_run_step(obj, -1);
+                /* a callback returning GEARMAN_PAUSE only interrupts one pass */
+                if (ret != GEARMAN_IO_WAIT && ret != GEARMAN_PAUSE) {
+                        break;
+                }
+        }
+
+        return (ret == GEARMAN_IO_WAIT || ret == GEARMAN_PAUSE) ? GEARMAN_SUCCESS : ret;
+}
+
+uint64_t _php_gearman_now_ms(void) {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/* Called on the way into client calls. Sends the queued background tasks
+ * once enough of them piled up or the oldest waited long enough, so the
+ * batch size follows the rate they are added at. libgearman can only run
+ * all tasks of a client at once, so while foreground tasks are outstanding
+ * this is left to runTasks(), their callbacks must not fire from inside
+ * unrelated calls. */
+void _php_client_autoflush(gearman_client_obj *obj) {
+        gearman_return_t ret;
+
+        if (obj->background_queued == 0 || PHP_GEARMAN_CLIENT_OUTSTANDING(obj) > obj->background_queued) {
+                return;
+        }
+
+        if (!(obj->autoflush_count > 0 && obj->background_queued >= obj->autoflush_count) &&
+            !(obj->autoflush_age > 0 && _php_gearman_now_ms() - obj->background_since >= (uint64_t) obj->autoflush_age)) {
+                return;
+        }
+
+        do {
+                ret = _php_client_run_step(obj, -1);
+        } while (obj->background_queued > 0 && (ret == GEARMAN_IO_WAIT || ret == GEARMAN_PAUSE));
+
+        if (obj->background_queued > 0) {
+                obj->ret = ret;
+                php_error_docref(NULL, E_WARNING, "Unable to flush background tasks: %s",
+                                 gearman_client_error(&(obj->client)));
+        }
+}
+
+/* Called on the way into client calls. Once setKeepalive() is on and the
+ * client sat idle for that long, its open connections are checked with an
+ * ECHO, so one the server or a NAT box dropped meanwhile is reconnected
+ * here rather than failing the call. Tasks in flight keep the connections
+ * busy, those are left alone. */
+void _php_client_keepalive(gearman_client_obj *obj) {
+        uint64_t now, idle;
+        gearman_return_t ret;
+        uint32_t i;
+
+        if (obj->keepalive <= 0) {
+                return;
+        }
+
+        now = _php_gearman_now_ms();
+        idle = now - obj->keepalive_last;
+        obj->keepalive_last = now;
+        if (idle < (uint64_t) obj->keepalive || PHP_GEARMAN_CLIENT_OUTSTANDING(obj) > 0) {
+                return;
+        }
+
+        /* unless calls bypass libgearman or it has no servers at all */
+        if (obj->engine == GEARMAN_ENGINE_LIBGEARMAN &&
+            (obj->unix_servers == 0 || obj->unix_servers < zend_hash_num_elements(Z_ARRVAL(obj->server_list)))) {
+                obj->keepalive_probes++;
+                ret = gearman_client_echo(&(obj->client), PHP_GEARMAN_WARMUP, sizeof(PHP_GEARMAN_WARMUP) - 1);
+                if (ret != GEARMAN_SUCCESS && ret != GEARMAN_IO_WAIT) {
+                        obj->keepalive_failures++;
+                }
+        }
+
+        for (i = 0; i < obj->servers_count; i++) {
+                if (obj->servers[i].client == NULL || obj->servers[i].tasks > 0) {
+                        continue;
+                }
+                obj->keepalive_probes++;
+                ret = gearman_client_echo(obj->servers[i].client, PHP_GEARMAN_WARMUP, sizeof(PHP_GEARMAN_WARMUP) - 1);
+                if (ret != GEARMAN_SUCCESS && ret != GEARMAN_IO_WAIT) {
+                        obj->keepalive_failures++;
+                        _php_client_server_done(obj, (int32_t) i, ret, 0);
+                }
+        }
+
+        /* a failed ECHO closes the connection, the next call opens it again */
+        for (i = 0; i < obj->conns_count; i++) {
+                if (obj->conns[i].fd == -1) {
+                        continue;
+                }
+                obj->keepalive_probes++;
+                if (_php_client_conn_echo(obj, i, 1, PHP_GEARMAN_WARMUP, sizeof(PHP_GEARMAN_WARMUP) - 1) != GEARMAN_SUCCESS) {
+                        obj->keepalive_failures++;
+                }
+        }
+}
+
+/* Cancels the tasks whose deadline passed, or all tasks if all is set.
+ * Returns the earliest deadline still ahead, 0 if there is none. */
+uint64_t _php_client_expire_tasks(gearman_client_obj *obj, uint64_t now, zend_bool all) {
+        zval expired, *ztask;
+        gearman_task_obj *task;
+        uint64_t next = 0;
+
+        if (obj->deadline_tasks == 0 && !all) {
+                return 0;
+        }
+
+        /* cancelling drops tasks from task_list, so collect first */
+        array_init(&expired);
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL(obj->task_list), ztask) {
+                task = Z_GEARMAN_TASK_P(ztask);
+                if (all || (task->deadline && task->deadline <= now)) {
+                        Z_ADDREF_P(ztask);
+                        add_next_index_zval(&expired, ztask);
+                } else if (task->deadline && (next == 0 || task->deadline < next)) {
+                        next = task->deadline;
+                }
+        } ZEND_HASH_FOREACH_END();
+
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL(expired), ztask) {
+                _php_task_cancel(Z_GEARMAN_TASK_P(ztask), GEARMAN_TIMEOUT);
+        } ZEND_HASH_FOREACH_END();
+        zval_ptr_dtor(&expired);
+
+        return next;
+}
+
+/* Sets the task callbacks of the client for the events somebody listens
+ * to and unsets the others, so libgearman does not report them. That is
+ * a PHP callback, or for the events that end a task an open completion
+ * iterator, a completion policy or adaptive timeouts. */
+void _php_client_sync_fns(gearman_client_obj *obj) {
+        gearman_client_st *client = &(obj->client);
+        zend_bool finish = obj->completions > 0
+                || obj->completion_policy != GEARMAN_COMPLETION_ALL
+                || obj->adaptive_multiplier > 0;
+
+        gearman_client_set_created_fn(client, Z_ISUNDEF(obj->zcreated_fn) ? NULL : _php_task_created_fn);
+        gearman_client_set_data_fn(client, Z_ISUNDEF(obj->zdata_fn) ? NULL : _php_task_data_fn);
+        gearman_client_set_warning_fn(client, Z_ISUNDEF(obj->zwarning_fn) ? NULL : _php_task_warning_fn);
+        gearman_client_set_status_fn(client, Z_ISUNDEF(obj->zstatus_fn) ? NULL : _php_task_status_fn);
+        gearman_client_set_complete_fn(client, finish || !Z_ISUNDEF(obj->zcomplete_fn) ? _php_task_complete_fn : NULL);
+        gearman_client_set_exception_fn(client, finish || !Z_ISUNDEF(obj->zexception_fn) ? _php_task_exception_fn : NULL);
+        gearman_client_set_fail_fn(client, finish || !Z_ISUNDEF(obj->zfail_fn) ? _php_task_fail_fn : NULL);
+}
+
+/* Starts counting for a runTasks() call. With a completion policy the
+ * foreground tasks not yet covered by an earlier call make up the batch,
+ * background tasks and tasks added while it runs are left alone. */
+void _php_client_start_batch(gearman_client_obj *obj) {
+        gearman_task_obj *task_obj;
+        zval *ztask;
+
+        obj->batch_succeeded = 0;
+        obj->batch_failed = 0;
+
+        if (obj->completion_policy == GEARMAN_COMPLETION_ALL) {
+                return;
+        }
+
+        if (++obj->batch == 0) {
+                obj->batch = 1;
+        }
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL(obj->task_list), ztask) {
+                task_obj = Z_GEARMAN_TASK_P(ztask);
+                if (task_obj->batch == 0 && !(task_obj->flags & GEARMAN_TASK_OBJ_BACKGROUND)) {
+                        task_obj->batch = obj->batch;
+                }
+        } ZEND_HASH_FOREACH_END();
+}
+
+/* Checks the completion policy against the tasks of the batch finished so
+ * far. Once it decides the outcome the rest of the batch is abandoned
+ * without callbacks and obj->ret holds the outcome. */
+zend_bool _php_client_completion_reached(gearman_client_obj *obj) {
+        zval abandoned, *ztask;
+
+        if ((obj->completion_policy & GEARMAN_COMPLETION_FAIL_FAST) && obj->batch_failed > 0) {
+                obj->ret = obj->batch_ret;
+        } else if ((obj->completion_policy & GEARMAN_COMPLETION_QUORUM) && obj->batch_succeeded >= obj->quorum) {
+                obj->ret = GEARMAN_SUCCESS;
+        } else {
+                return 0;
+        }
+
+        /* freeing drops tasks from task_list, so collect first */
+        array_init(&abandoned);
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL(obj->task_list), ztask) {
+                if (Z_GEARMAN_TASK_P(ztask)->batch == obj->batch) {
+                        Z_ADDREF_P(ztask);
+                        add_next_index_zval(&abandoned, ztask);
+                }
+        } ZEND_HASH_FOREACH_END();
+
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL(abandoned), ztask) {
+                _php_task_abandon(Z_GEARMAN_TASK_P(ztask));
+        } ZEND_HASH_FOREACH_END();
+        zval_ptr_dtor(&abandoned);
+
+        return 1;
+}
+
 inline gearman_client_obj *gearman_client_fetch_object(zend_object *obj) {
        return (gearman_client_obj *)((char*)(obj) - XtOffsetOf(gearman_client_obj, std));
 }
 
-static void gearman_client_ctor(INTERNAL_FUNCTION_PARAMETERS) {
-        gearman_client_obj *client;
+static void gearman_client_ctor(INTERNAL_FUNCTION_PARAMETERS) {
+        gearman_client_obj *client;
+
+        if (zend_parse_parameters_none() == FAILURE) {
+                return;
+        }
+
+        client = Z_GEARMAN_CLIENT_P(return_value);
+
+        if (gearman_client_create(&(client->client)) == NULL) {
+                GEARMAN_EXCEPTION("Memory allocation failure", 0);
+        }    
+
+        client->flags |= GEARMAN_CLIENT_OBJ_CREATED;
+        client->pid = getpid();
+        gearman_client_add_options(&(client->client), GEARMAN_CLIENT_FREE_TASKS);
+        gearman_client_set_workload_malloc_fn(&(client->client), _php_malloc, NULL);
+        gearman_client_set_workload_free_fn(&(client->client), _php_free, NULL);
+        gearman_client_set_task_context_free_fn(&(client->client), _php_task_free);
+}
+
+/* Called before a client does any I/O. After pcntl_fork() the child still
+ * holds the parent's connections, so the first call made in the child
+ * rebuilds the libgearman client from a clone of its settings. The old
+ * client is abandoned rather than freed, libgearman shuts sockets down when
+ * freeing a connection and that would cut the parent off as well. */
+void _php_client_check_fork(gearman_client_obj *obj) {
+        gearman_client_st *clone;
+        void *context;
+        zval *ztask;
+        gearman_task_obj *task;
+        uint32_t i;
+        pid_t pid = getpid();
+
+        if (obj->pid == pid || !(obj->flags & GEARMAN_CLIENT_OBJ_CREATED)) {
+                return;
+        }
+
+        context = gearman_client_context(&(obj->client));
+
+        clone = gearman_client_clone(NULL, &(obj->client));
+        if (clone == NULL) {
+                php_error_docref(NULL, E_WARNING, "Unable to reinitialize client after fork");
+                return;
+        }
+
+        gearman_client_clone(&(obj->client), clone);
+        gearman_client_free(clone);
+
+        gearman_client_add_options(&(obj->client), GEARMAN_CLIENT_FREE_TASKS);
+        gearman_client_set_workload_malloc_fn(&(obj->client), _php_malloc, NULL);
+        gearman_client_set_workload_free_fn(&(obj->client), _php_free, NULL);
+        gearman_client_set_task_context_free_fn(&(obj->client), _php_task_free);
+        gearman_client_set_context(&(obj->client), context);
+        gearman_client_set_server_option(&(obj->client), "exceptions", (sizeof("exceptions") - 1));
+        _php_client_sync_fns(obj);
+
+        /* tasks queued by the parent belong to the abandoned client */
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL(obj->task_list), ztask) {
+                task = Z_GEARMAN_TASK_P(ztask);
+                task->flags &= ~GEARMAN_TASK_OBJ_CREATED;
+                task->task = NULL;
+                task->server = -1;
+        } ZEND_HASH_FOREACH_END();
+        zend_hash_clean(Z_ARRVAL(obj->task_list));
+        obj->background_queued = 0;
+        obj->deadline_tasks = 0;
+        ZEND_HASH_FOREACH_PTR(&obj->internal_tasks, task) {
+                zval_ptr_dtor(&task->zdata);
+                zval_ptr_dtor(&task->zworkload);
+                efree(task);
+        } ZEND_HASH_FOREACH_END();
+        zend_hash_clean(&obj->internal_tasks);
+        obj->internal = NULL;
+
+        /* deferred jobs are the parent's to submit */
+        zend_hash_clean(Z_ARRVAL(obj->deferred));
+
+        /* so are the per server clients, new ones get created on demand */
+        for (i = 0; i < obj->servers_count; i++) {
+                obj->servers[i].client = NULL;
+                obj->servers[i].tasks = 0;
+        }
+        obj->routed_tasks = 0;
+        for (i = 0; i < obj->conns_count; i++) {
+                php_gearman_conn_close(&obj->conns[i]);
+        }
+
+        /* the sender thread did not survive the fork, start our own */
+        if (obj->sender != NULL && !_php_client_start_sender(obj, obj->sender->capacity, obj->sender->policy)) {
+                php_error_docref(NULL, E_WARNING, "Unable to restart background sender after fork");
+        }
+
+        obj->pid = pid;
+}
+
+/* {{{ proto object gearman_client_create()
+   Returns a GearmanClient object */
+PHP_FUNCTION(gearman_client_create) {
+        if (object_init_ex(return_value, gearman_client_ce) != SUCCESS) {
+                php_error_docref(NULL, E_WARNING, "Object creation failure.");
+                RETURN_FALSE;
+        }    
+
+        gearman_client_ctor(INTERNAL_FUNCTION_PARAM_PASSTHRU);
+}
+
+static void _php_client_latency_dtor(zval *zv) {
+        efree(Z_PTR_P(zv));
+}
+
+inline zend_object *gearman_client_obj_new(zend_class_entry *ce) {
+	gearman_client_obj *intern = ecalloc(1,
+		sizeof(gearman_client_obj) +
+		zend_object_properties_size(ce));
+
+	zend_object_std_init(&(intern->std), ce);
+	object_properties_init(&intern->std, ce);
+	array_init(&intern->task_list);
+	intern->created_tasks = 0;
+	array_init(&intern->server_list);
+	array_init(&intern->deferred);
+	array_init(&intern->completed);
+	array_init(&intern->server_weights);
+	intern->conn_last = -1;
+	php_gearman_socket_options_init(&intern->socket_options);
+	zend_hash_init(&intern->internal_tasks, 0, NULL, NULL, 0);
+	zend_hash_init(&intern->latencies, 0, NULL, _php_client_latency_dtor, 0);
+
+	intern->std.handlers = &gearman_client_obj_handlers;
+	return &intern->std;
+}
+
+/* {{{ proto object GearmanClient::__construct()
+   Returns a GearmanClient object */
+PHP_METHOD(GearmanClient, __construct)
+{
+        return_value = getThis();
+        gearman_client_ctor(INTERNAL_FUNCTION_PARAM_PASSTHRU);
+
+}
+/* }}} */
+
+/* Frees everything the client holds, deferred jobs are flushed first. */
+static void _php_client_destroy(gearman_client_obj *intern) {
+        char *context = NULL;
+        uint32_t i;
+
+        context = gearman_client_context(&(intern->client));
+        efree(context);
+
+        /* a client inherited through fork() and never used here still
+         * shares its sockets with the parent, freeing it would shut them down */
+        if ((intern->flags & GEARMAN_CLIENT_OBJ_CREATED) && intern->pid == getpid()) {
+                if (intern->defer_background || zend_hash_num_elements(Z_ARRVAL(intern->deferred)) > 0) {
+                        _php_client_flush_deferred(intern);
+                }
+                if (intern->sender != NULL) {
+                        _php_client_stop_sender(intern);
+                }
+                for (i = 0; i < intern->servers_count; i++) {
+                        if (intern->servers[i].client != NULL) {
+                                gearman_client_free(intern->servers[i].client);
+                        }
+                }
+                if (intern->internal != NULL) {
+                        gearman_client_free(intern->internal);
+                }
+                gearman_client_free(&intern->client);
+        }
+
+        if (intern->servers != NULL) {
+                efree(intern->servers);
+        }
+        for (i = 0; i < intern->conns_count; i++) {
+                php_gearman_conn_free(&intern->conns[i]);
+        }
+        if (intern->conns != NULL) {
+                efree(intern->conns);
+        }
+        if (intern->ring != NULL) {
+                efree(intern->ring);
+        }
+        if (intern->shard_key != NULL) {
+                zend_string_release(intern->shard_key);
+        }
+
+        // Clear Callbacks
+        zval_dtor(&intern->zworkload_fn);
+        zval_dtor(&intern->zcreated_fn);
+        zval_dtor(&intern->zdata_fn);
+        zval_dtor(&intern->zwarning_fn);
+        zval_dtor(&intern->zstatus_fn);
+        zval_dtor(&intern->zcomplete_fn);
+        zval_dtor(&intern->zexception_fn);
+        zval_dtor(&intern->zfail_fn);
+
+        zval_dtor(&intern->task_list);
+        zval_dtor(&intern->server_list);
+        zval_dtor(&intern->server_weights);
+        zval_dtor(&intern->deferred);
+        zval_dtor(&intern->completed);
+        ZVAL_UNDEF(&intern->completed);
+        zval_dtor(&intern->zdeferred_fail_fn);
+        zend_hash_destroy(&intern->internal_tasks);
+        zend_hash_destroy(&intern->latencies);
+
+        zend_object_std_dtor(&intern->std);
+}
+
+/* Flushes the deferred jobs of the clients __destruct handed over, then
+ * frees them. Runs from RSHUTDOWN, once the output went out. */
+void _php_client_shutdown_deferred(zval *clients) {
+        zval *zclient;
+
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(clients), zclient) {
+                _php_client_destroy(Z_GEARMAN_CLIENT_P(zclient));
+        } ZEND_HASH_FOREACH_END();
+}
+
+/* {{{ proto object GearmanClient::__destruct()
+   cleans up GearmanClient object */
+PHP_METHOD(GearmanClient, __destruct)
+{
+        gearman_client_obj *intern = Z_GEARMAN_CLIENT_P(getThis());
+        if (!intern) {
+                return;
+        }
+
+#ifdef EG_FLAGS_IN_SHUTDOWN
+        /* destructors run before the output is flushed, so deferred jobs
+         * left at the end of the request wait for RSHUTDOWN instead of
+         * holding up the response. The reference keeps the client alive. */
+        if ((EG(flags) & EG_FLAGS_IN_SHUTDOWN)
+            && (intern->flags & GEARMAN_CLIENT_OBJ_CREATED) && intern->pid == getpid()
+            && (intern->defer_background || zend_hash_num_elements(Z_ARRVAL(intern->deferred)) > 0)) {
+                if (Z_TYPE(GEARMAN_G(deferred_clients)) != IS_ARRAY) {
+                        array_init(&GEARMAN_G(deferred_clients));
+                }
+                Z_ADDREF_P(getThis());
+                add_next_index_zval(&GEARMAN_G(deferred_clients), getThis());
+                return;
+        }
+#endif
+
+        _php_client_destroy(intern);
+}
+/* }}} */
+
+/* {{{ proto int gearman_client_return_code()
+   get last gearman_return_t */
+PHP_FUNCTION(gearman_client_return_code)
+{
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
+                RETURN_NULL();
+        }    
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        RETURN_LONG(obj->ret);
+}
+/* }}} */
+
+/* {{{ proto string gearman_client_error()
+   Return an error string for the last error encountered. */
+PHP_FUNCTION(gearman_client_error) {
+        char *error = NULL;
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
+                RETURN_NULL();
+        }    
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        error = (char *)gearman_client_error(&(obj->client));
+        if (error) {
+                RETURN_STRING(error)
+        }    
+        RETURN_FALSE;
+}
+/* }}} */
+
+/* {{{ proto int gearman_client_get_errno()
+   Value of errno in the case of a GEARMAN_ERRNO return value. */
+PHP_FUNCTION(gearman_client_get_errno) {
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
+                RETURN_NULL();
+        }    
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        RETURN_LONG(gearman_client_errno(&(obj->client)))
+}
+/* }}} */
+
+/* {{{ proto int gearman_client_options()
+   Get options for a client structure. */
+PHP_FUNCTION(gearman_client_options) {
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
+                RETURN_NULL();
+        }    
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        RETURN_LONG(gearman_client_options(&(obj->client)))
+}
+/* }}} */
+
+/* {{{ proto void gearman_client_set_options(constant option)
+   Set options for a client structure. */
+PHP_FUNCTION(gearman_client_set_options) {
+        zend_long options;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_client_ce, &options) == FAILURE) {
+                RETURN_FALSE;
+        }    
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        gearman_client_set_options(&(obj->client), options);
+        RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto void GearmanClient::addOptions(constant option)
+   Set options for a client structure. */
+PHP_FUNCTION(gearman_client_add_options) {
+        zend_long options;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_client_ce, &options) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        gearman_client_add_options(&(obj->client), options);
+        RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto void GearmanClient::removeOptions(constant option)
+   Set options for a client structure. */
+PHP_FUNCTION(gearman_client_remove_options) {
+        zend_long options;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_client_ce, &options) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        gearman_client_remove_options(&(obj->client), options);
+        RETURN_TRUE;
+}
+/* }}} */
+
+PHP_FUNCTION(gearman_client_timeout) {
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
+                RETURN_NULL();
+        }    
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        RETURN_LONG(gearman_client_timeout(&(obj->client)))
+}
+/* }}} */
+
+/* {{{ proto void gearman_client_set_timeout(object, constant timeout)
+   Set timeout for a client structure. */
+PHP_FUNCTION(gearman_client_set_timeout) {
+        zend_long timeout;
+        uint32_t i;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_client_ce, &timeout) == FAILURE) {
+                RETURN_FALSE;
+        }    
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        gearman_client_set_timeout(&(obj->client), timeout);
+        for (i = 0; i < obj->servers_count; i++) {
+                if (obj->servers[i].client != NULL) {
+                        gearman_client_set_timeout(obj->servers[i].client, timeout);
+                }
+        }
+        RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool gearman_client_add_server(object client [, string host [, int port]])
+   Add a job server to a client. This goes into a list of servers than can be used to run tasks. No socket I/O happens here, it is just added to a list. */
+PHP_FUNCTION(gearman_client_add_server) {
+        char *host = NULL;
+        size_t host_len = 0;
+        zend_long port = 0;
+        zend_string *server;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O|sl", &zobj, gearman_client_ce, &host, &host_len, &port) == FAILURE) {
+                RETURN_FALSE;
+        }            
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        if (host != NULL && PHP_GEARMAN_IS_UNIX(host)) {
+                add_next_index_stringl(&obj->server_list, host, host_len);
+                obj->unix_servers++;
+                obj->ret = GEARMAN_SUCCESS;
+                RETURN_TRUE;
+        }
+
+        obj->ret = gearman_client_add_server(&(obj->client), host, port);
+        if (obj->ret != GEARMAN_SUCCESS) {
+                php_error_docref(NULL, E_WARNING, "%s",
+                                                 gearman_client_error(&(obj->client)));
+                RETURN_FALSE;                         
+        }            
+
+        server = strpprintf(0, "%s:%ld",
+                                host_len ? host : GEARMAN_DEFAULT_TCP_HOST,
+                                port ? (long) port : (long) GEARMAN_DEFAULT_TCP_PORT);
+        /* same spelling as _php_gearman_server_key(), setServerWeights() looks servers up by it */
+        zend_str_tolower(ZSTR_VAL(server), ZSTR_LEN(server));
+        add_next_index_str(&obj->server_list, server);
+
+        if (!gearman_client_set_server_option(&(obj->client), "exceptions", (sizeof("exceptions") - 1))) {
+                GEARMAN_EXCEPTION("Failed to set exception option", 0);
+        }            
+
+        RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool gearman_client_add_servers(object client [, string servers])
+   Add a list of job servers to a client. This goes into a list of servers that can be used to run tasks. No socket I/O happens here, it is just added to a list. */
+PHP_FUNCTION(gearman_client_add_servers) {
+        char *servers = NULL;
+        size_t servers_len = 0;
+        zend_string *tcp;
+
+        gearman_client_obj *obj;
+        zval *zobj, *zserver, list;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O|s", &zobj, gearman_client_ce, &servers, &servers_len) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        /* libgearman only gets to see the TCP servers */
+        if (servers != NULL && strstr(servers, PHP_GEARMAN_UNIX_PREFIX) != NULL) {
+                array_init(&list);
+                _php_gearman_record_servers(&list, servers);
+                tcp = _php_gearman_join_servers(&list, 0);
+
+                obj->ret = tcp ? gearman_client_add_servers(&(obj->client), ZSTR_VAL(tcp)) : GEARMAN_SUCCESS;
+                if (tcp) {
+                        zend_string_release(tcp);
+                }
+                if (obj->ret != GEARMAN_SUCCESS) {
+                        php_error_docref(NULL, E_WARNING, "%s",
+                                                         gearman_client_error(&(obj->client)));
+                        zval_dtor(&list);
+                        RETURN_FALSE;
+                }
+
+                obj->unix_servers += _php_gearman_count_unix(&list);
+                ZEND_HASH_FOREACH_VAL(Z_ARRVAL(list), zserver) {
+                        add_next_index_str(&obj->server_list, zend_string_copy(Z_STR_P(zserver)));
+                } ZEND_HASH_FOREACH_END();
+                zval_dtor(&list);
+        } else {
+                obj->ret = gearman_client_add_servers(&(obj->client), servers);
+                if (obj->ret != GEARMAN_SUCCESS) {
+                        php_error_docref(NULL, E_WARNING, "%s",
+                                                         gearman_client_error(&(obj->client)));
+                        RETURN_FALSE;
+                }
+
+                _php_gearman_record_servers(&obj->server_list, servers);
+        }
+
+        if (!gearman_client_set_server_option(&(obj->client), "exceptions", (sizeof("exceptions") - 1))) {
+                GEARMAN_EXCEPTION("Failed to set exception option", 0);
+        }
+
+        RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool GearmanClient::enableBackgroundSender([int capacity [, int full_policy]])
+   Queue doBackground() submissions for a native sender thread with its own connections, instead of waiting for JOB_CREATED. Uses the servers added so far. */
+PHP_FUNCTION(gearman_client_enable_background_sender) {
+        zend_long capacity = 1024;
+        zend_long policy = GEARMAN_SENDER_BLOCK;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O|ll", &zobj, gearman_client_ce, &capacity, &policy) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+        _php_client_check_fork(obj);
+
+        if (capacity <= 0 || capacity > ((zend_long) 1 << 31)) {
+                php_error_docref(NULL, E_WARNING, "Capacity must be between 1 and 2147483648");
+                RETURN_FALSE;
+        }
+
+        if (policy != GEARMAN_SENDER_BLOCK && policy != GEARMAN_SENDER_DROP && policy != GEARMAN_SENDER_SPILL) {
+                php_error_docref(NULL, E_WARNING, "Invalid full policy: " ZEND_LONG_FMT, policy);
+                RETURN_FALSE;
+        }
+
+        /* the thread's connections are libgearman's */
+        if (obj->unix_servers > 0) {
+                php_error_docref(NULL, E_WARNING, "The background sender does not support unix sockets");
+                RETURN_FALSE;
+        }
+        if (obj->engine == GEARMAN_ENGINE_NATIVE) {
+                php_error_docref(NULL, E_WARNING, "The background sender does not run on the native engine");
+                RETURN_FALSE;
+        }
+
+        /* reconfiguring, let the old thread deliver what it has first */
+        if (obj->sender != NULL) {
+                _php_client_stop_sender(obj);
+        }
+
+        if (!_php_client_start_sender(obj, (uint32_t) capacity, (php_gearman_sender_policy_t) policy)) {
+                php_error_docref(NULL, E_WARNING, "Unable to start background sender");
+                RETURN_FALSE;
+        }
+
+        RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool GearmanClient::disableBackgroundSender()
+   Wait for the sender thread to drain its queue and stop it. Jobs still queued after PHP_GEARMAN_SENDER_DRAIN_TIMEOUT ms are dropped with a warning. */
+PHP_FUNCTION(gearman_client_disable_background_sender) {
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+        _php_client_check_fork(obj);
+
+        if (obj->sender == NULL) {
+                RETURN_FALSE;
+        }
+
+        _php_client_stop_sender(obj);
+
+        RETURN_TRUE;
+}
+/* }}} */
+
+/* Adds a call of function_name that took ms to its latency estimate. */
+void _php_client_record_latency(gearman_client_obj *obj, const char *function_name, size_t function_name_len, uint64_t ms) {
+        php_gearman_latency_t *latency;
+        uint32_t bucket, i;
 
-        if (zend_parse_parameters_none() == FAILURE) {
+        latency = zend_hash_str_find_ptr(&obj->latencies, function_name, function_name_len);
+        if (latency == NULL) {
+                latency = ecalloc(1, sizeof(php_gearman_latency_t));
+                latency->ewma = (double) ms;
+                zend_hash_str_add_ptr(&obj->latencies, function_name, function_name_len, latency);
+        } else {
+                latency->ewma += ((double) ms - latency->ewma) / 8;
+        }
+
+        for (bucket = 0; bucket < PHP_GEARMAN_LATENCY_BUCKETS - 1 && ms >= ((uint64_t) 1 << bucket); bucket++);
+
+        latency->buckets[bucket]++;
+        latency->count++;
+        latency->timeouts = 0;
+
+        if (++latency->samples >= PHP_GEARMAN_LATENCY_WINDOW) {
+                latency->samples = 0;
+                for (i = 0; i < PHP_GEARMAN_LATENCY_BUCKETS; i++) {
+                        latency->buckets[i] /= 2;
+                        latency->samples += latency->buckets[i];
+                }
+        }
+}
+
+/* p99 in ms, interpolated within the histogram bucket it falls into. */
+static double _php_client_latency_p99(php_gearman_latency_t *latency) {
+        double target = latency->samples * 0.99, seen = 0, lower, upper;
+        uint32_t i;
+
+        for (i = 0; i < PHP_GEARMAN_LATENCY_BUCKETS; i++) {
+                if (latency->buckets[i] > 0 && seen + latency->buckets[i] >= target) {
+                        lower = i == 0 ? 0 : (double) ((uint64_t) 1 << (i - 1));
+                        upper = (double) ((uint64_t) 1 << i);
+                        return lower + (upper - lower) * (target - seen) / latency->buckets[i];
+                }
+                seen += latency->buckets[i];
+        }
+
+        return (double) ((uint64_t) 1 << (PHP_GEARMAN_LATENCY_BUCKETS - 1));
+}
+
+static zend_long _php_client_latency_timeout(gearman_client_obj *obj, php_gearman_latency_t *latency) {
+        zend_long timeout;
+
+        if (latency->count < PHP_GEARMAN_LATENCY_MIN_SAMPLES) {
+                return 0;
+        }
+
+        timeout = (zend_long) ceil(obj->adaptive_multiplier * _php_client_latency_p99(latency));
+        if (timeout < obj->adaptive_floor) {
+                timeout = obj->adaptive_floor;
+        }
+        if (obj->adaptive_ceiling > 0 && timeout > obj->adaptive_ceiling) {
+                timeout = obj->adaptive_ceiling;
+        }
+
+        return MAX(timeout, 1);
+}
+
+/* Timeout in ms for a call of function_name, 0 if adaptive timeouts are
+ * off or too few calls of it were seen to tell. */
+/* Counts a call the adaptive timeout cut off. */
+void _php_client_record_timeout(gearman_client_obj *obj, const char *function_name, size_t function_name_len) {
+        php_gearman_latency_t *latency;
+
+        latency = zend_hash_str_find_ptr(&obj->latencies, function_name, function_name_len);
+        if (latency != NULL) {
+                latency->timeouts++;
+        }
+}
+
+zend_long _php_client_adaptive_timeout(gearman_client_obj *obj, const char *function_name, size_t function_name_len) {
+        php_gearman_latency_t *latency;
+
+        if (obj->adaptive_multiplier <= 0) {
+                return 0;
+        }
+
+        latency = zend_hash_str_find_ptr(&obj->latencies, function_name, function_name_len);
+        if (latency == NULL || latency->timeouts >= PHP_GEARMAN_LATENCY_MAX_TIMEOUTS) {
+                return 0;
+        }
+
+        return _php_client_latency_timeout(obj, latency);
+}
+
+static int _php_client_hedge_compare(const void *a, const void *b) {
+        uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+        return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* How long a hedged call waits for the first copy before sending the second. */
+static uint64_t _php_client_hedge_delay(gearman_client_obj *obj) {
+        uint64_t sorted[PHP_GEARMAN_HEDGE_SAMPLES];
+        uint32_t count = MIN(obj->hedge_sample_count, PHP_GEARMAN_HEDGE_SAMPLES);
+
+        if (!obj->hedge_adaptive || count < PHP_GEARMAN_HEDGE_MIN_SAMPLES) {
+                return (uint64_t) obj->hedge_delay;
+        }
+
+        memcpy(sorted, obj->hedge_samples, count * sizeof(uint64_t));
+        qsort(sorted, count, sizeof(uint64_t), _php_client_hedge_compare);
+
+        return MAX(sorted[(count * 95 + 99) / 100 - 1], 1);
+}
+
+/* {{{ proto array GearmanClient::getStats()
+   Returns counters kept by the extension for this client. */
+PHP_FUNCTION(gearman_client_get_stats) {
+        zval zsender, zhedge, zkeepalive, zlatencies, zlatency, zservers, zserver;
+        zend_string *function_name;
+        php_gearman_latency_t *latency;
+        uint64_t now;
+        uint32_t i;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        array_init(return_value);
+
+        if (obj->sender != NULL) {
+                array_init(&zsender);
+                add_assoc_long(&zsender, "capacity", (zend_long) obj->sender->capacity);
+                add_assoc_long(&zsender, "pending", (zend_long) php_gearman_sender_pending(obj->sender));
+                add_assoc_long(&zsender, "queued", (zend_long) __atomic_load_n(&obj->sender->queued, __ATOMIC_RELAXED));
+                add_assoc_long(&zsender, "sent", (zend_long) __atomic_load_n(&obj->sender->sent, __ATOMIC_RELAXED));
+                add_assoc_long(&zsender, "dropped", (zend_long) __atomic_load_n(&obj->sender->dropped, __ATOMIC_RELAXED));
+                add_assoc_long(&zsender, "spilled", (zend_long) __atomic_load_n(&obj->sender->spilled, __ATOMIC_RELAXED));
+                add_assoc_long(&zsender, "errors", (zend_long) __atomic_load_n(&obj->sender->errors, __ATOMIC_RELAXED));
+                add_assoc_zval(return_value, "sender", &zsender);
+        }
+
+        if (obj->hedge_delay > 0 || obj->hedges_sent > 0) {
+                array_init(&zhedge);
+                add_assoc_long(&zhedge, "sent", (zend_long) obj->hedges_sent);
+                add_assoc_long(&zhedge, "won", (zend_long) obj->hedges_won);
+                add_assoc_long(&zhedge, "delay", (zend_long) _php_client_hedge_delay(obj));
+                add_assoc_zval(return_value, "hedge", &zhedge);
+        }
+
+        if (obj->keepalive > 0 || obj->keepalive_probes > 0) {
+                array_init(&zkeepalive);
+                add_assoc_long(&zkeepalive, "probes", (zend_long) obj->keepalive_probes);
+                add_assoc_long(&zkeepalive, "failures", (zend_long) obj->keepalive_failures);
+                add_assoc_long(&zkeepalive, "interval", obj->keepalive);
+                add_assoc_zval(return_value, "keepalive", &zkeepalive);
+        }
+
+        if (obj->servers_count > 0) {
+                array_init(&zservers);
+                now = _php_gearman_now_ms();
+                for (i = 0; i < obj->servers_count; i++) {
+                        array_init(&zserver);
+                        add_assoc_long(&zserver, "outstanding", (zend_long) obj->servers[i].tasks);
+                        add_assoc_double(&zserver, "latency", obj->servers[i].latency);
+                        add_assoc_long(&zserver, "weight", _php_client_server_weight(obj, i));
+                        add_assoc_bool(&zserver, "available", now >= obj->servers[i].retry_at);
+                        add_assoc_string(&zserver, "breaker",
+                                         obj->servers[i].state == GEARMAN_BREAKER_OPEN ? "open" :
+                                         obj->servers[i].state == GEARMAN_BREAKER_HALF_OPEN ? "half-open" : "closed");
+                        add_assoc_long(&zserver, "consecutive_errors", (zend_long) obj->servers[i].consecutive_errors);
+                        add_assoc_long(&zserver, "errors", (zend_long) obj->servers[i].errors);
+                        add_assoc_long(&zserver, "timeouts", (zend_long) obj->servers[i].timeouts);
+                        add_assoc_long(&zserver, "trips", (zend_long) obj->servers[i].trips);
+                        add_assoc_zval_ex(&zservers, Z_STRVAL_P(zend_hash_index_find(Z_ARRVAL(obj->server_list), i)),
+                                          Z_STRLEN_P(zend_hash_index_find(Z_ARRVAL(obj->server_list), i)), &zserver);
+                }
+                add_assoc_zval(return_value, "servers", &zservers);
+        }
+
+        if (zend_hash_num_elements(&obj->latencies) > 0) {
+                array_init(&zlatencies);
+                ZEND_HASH_FOREACH_STR_KEY_PTR(&obj->latencies, function_name, latency) {
+                        array_init(&zlatency);
+                        add_assoc_long(&zlatency, "count", (zend_long) latency->count);
+                        add_assoc_double(&zlatency, "ewma", latency->ewma);
+                        add_assoc_double(&zlatency, "p99", _php_client_latency_p99(latency));
+                        if (obj->adaptive_multiplier > 0) {
+                                add_assoc_long(&zlatency, "timeout", _php_client_latency_timeout(obj, latency));
+                        }
+                        add_assoc_zval_ex(&zlatencies, ZSTR_VAL(function_name), ZSTR_LEN(function_name), &zlatency);
+                } ZEND_HASH_FOREACH_END();
+                add_assoc_zval(return_value, "latency", &zlatencies);
+        }
+}
+/* }}} */
+
+/* {{{ proto bool GearmanClient::setDeferredBackground(bool defer [, callable fail_callback])
+   Buffer doBackground() jobs until flushDeferred() or until the client is destroyed. Clients living until the end of the request flush them during request shutdown, after the output has been flushed. fail_callback(function, workload, unique, return_code) gets jobs that could not be submitted. Turning this off flushes the buffer. */
+PHP_FUNCTION(gearman_client_set_deferred_background) {
+        zend_bool defer;
+        zval *zfail_fn = NULL;
+        zend_string *callable = NULL;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ob|z", &zobj, gearman_client_ce, &defer, &zfail_fn) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+        _php_client_check_fork(obj);
+
+        if (zfail_fn != NULL) {
+                if (!zend_is_callable(zfail_fn, 0, &callable)) {
+                        php_error_docref(NULL, E_WARNING, "function %s is not callable", ZSTR_VAL(callable));
+                        zend_string_release(callable);
+                        RETURN_FALSE;
+                }
+                zend_string_release(callable);
+
+                zval_ptr_dtor(&obj->zdeferred_fail_fn);
+                ZVAL_COPY(&obj->zdeferred_fail_fn, zfail_fn);
+        }
+
+        obj->defer_background = defer;
+
+        if (!defer && zend_hash_num_elements(Z_ARRVAL(obj->deferred)) > 0) {
+                RETURN_BOOL(_php_client_flush_deferred(obj));
+        }
+
+        RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool GearmanClient::flushDeferred()
+   Submit the buffered doBackground() jobs in one batch. Tasks added with addTask*() are left for runTasks(). */
+PHP_FUNCTION(gearman_client_flush_deferred) {
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+        _php_client_check_fork(obj);
+
+        RETURN_BOOL(_php_client_flush_deferred(obj));
+}
+/* }}} */
+
+/* {{{ proto bool GearmanClient::setMaxInFlight(int max)
+   Limit the tasks outstanding on the client. Once max are queued or running, addTask() and friends run tasks, and so their callbacks, until one finishes. 0 removes the limit. */
+PHP_FUNCTION(gearman_client_set_max_in_flight) {
+        zend_long max_in_flight;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_client_ce, &max_in_flight) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        if (max_in_flight < 0 || max_in_flight > UINT32_MAX) {
+                php_error_docref(NULL, E_WARNING, "Invalid in-flight limit: " ZEND_LONG_FMT, max_in_flight);
+                RETURN_FALSE;
+        }
+
+        obj->max_in_flight = max_in_flight;
+        RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool GearmanClient::setAutoFlush(int count [, int max_age_ms])
+   Send queued addTaskBackground() tasks without runTasks() once count are queued or the oldest is max_age_ms old. Checked on the next client call, wait() included. Not done while foreground tasks are outstanding, runTasks() sends them all then. 0 disables either trigger. */
+PHP_FUNCTION(gearman_client_set_auto_flush) {
+        zend_long count;
+        zend_long age = 0;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol|l", &zobj, gearman_client_ce, &count, &age) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        if (count < 0 || age < 0) {
+                php_error_docref(NULL, E_WARNING, "Count and age must not be negative");
+                RETURN_FALSE;
+        }
+
+        obj->autoflush_count = count;
+        obj->autoflush_age = age;
+        RETURN_TRUE;
+}
+/* }}} */
+
+static void _php_client_multi_store(zval *array, zval *zkey, zval *value) {
+        if (Z_TYPE_P(zkey) == IS_LONG) {
+                zend_hash_index_update(Z_ARRVAL_P(array), Z_LVAL_P(zkey), value);
+        } else {
+                zend_hash_update(Z_ARRVAL_P(array), Z_STR_P(zkey), value);
+        }
+}
+
+static void _php_client_multi_error(gearman_client_multi_t *multi, zval *zkey, gearman_return_t ret, const char *message, size_t message_len) {
+        zval zerror;
+
+        if (multi->errors == NULL) {
                 return;
         }
 
-        client = Z_GEARMAN_CLIENT_P(return_value);
+        array_init(&zerror);
+        add_assoc_long(&zerror, "code", ret);
+        add_assoc_stringl(&zerror, "message", (char *) message, message_len);
+        _php_client_multi_store(multi->errors, zkey, &zerror);
+}
 
-        if (gearman_client_create(&(client->client)) == NULL) {
-                GEARMAN_EXCEPTION("Memory allocation failure", 0);
-        }    
+/* Event handler for the tasks of a doMulti() call, zdata holds the key of
+ * the call in the input array. */
+static gearman_return_t _php_client_multi_fn(gearman_task_obj *task, gearman_task_obj_event_t event) {
+        gearman_client_obj *obj = Z_GEARMAN_CLIENT_P(&task->zclient);
+        gearman_client_multi_t *multi = obj->multi;
+        gearman_return_t ret;
+        const char *message;
+        zval zresult;
 
-        client->flags |= GEARMAN_CLIENT_OBJ_CREATED;
-        gearman_client_add_options(&(client->client), GEARMAN_CLIENT_FREE_TASKS);
-        gearman_client_set_workload_malloc_fn(&(client->client), _php_malloc, NULL);
-        gearman_client_set_workload_free_fn(&(client->client), _php_free, NULL);
-        gearman_client_set_task_context_free_fn(&(client->client), _php_task_free);
+        if (multi == NULL) {
+                return GEARMAN_SUCCESS;
+        }
+
+        switch (event) {
+        case GEARMAN_TASK_OBJ_EVENT_COMPLETE:
+                ZVAL_STRINGL(&zresult, (char *) gearman_task_data(task->task), gearman_task_data_size(task->task));
+                _php_client_multi_store(multi->results, &task->zdata, &zresult);
+                task->ret = GEARMAN_SUCCESS;
+                break;
+        case GEARMAN_TASK_OBJ_EVENT_EXCEPTION:
+                if (task->ret == GEARMAN_IO_WAIT) {
+                        _php_client_multi_error(multi, &task->zdata, GEARMAN_WORK_EXCEPTION,
+                                                gearman_task_data(task->task), gearman_task_data_size(task->task));
+                        task->ret = GEARMAN_WORK_EXCEPTION;
+                }
+                break;
+        case GEARMAN_TASK_OBJ_EVENT_FAIL:
+                if (task->ret == GEARMAN_IO_WAIT) {
+                        message = gearman_strerror(GEARMAN_WORK_FAIL);
+                        _php_client_multi_error(multi, &task->zdata, GEARMAN_WORK_FAIL, message, strlen(message));
+                        task->ret = GEARMAN_WORK_FAIL;
+                }
+                break;
+        case GEARMAN_TASK_OBJ_EVENT_FREE:
+                if (task->ret == GEARMAN_IO_WAIT) {
+                        ret = gearman_failed(obj->ret) ? obj->ret : GEARMAN_LOST_CONNECTION;
+                        message = gearman_strerror(ret);
+                        _php_client_multi_error(multi, &task->zdata, ret, message, strlen(message));
+                }
+                multi->pending--;
+                break;
+        default:
+                break;
+        }
+
+        return GEARMAN_SUCCESS;
 }
 
-/* {{{ proto object gearman_client_create()
-   Returns a GearmanClient object */
-PHP_FUNCTION(gearman_client_create) {
-        if (object_init_ex(return_value, gearman_client_ce) != SUCCESS) {
-                php_error_docref(NULL, E_WARNING, "Object creation failure.");
+/* {{{ proto array GearmanClient::doMulti(array calls [, int timeout_ms [, array &errors]])
+   Run calls, each array(function, workload [, unique]), in parallel and wait for them. Returns their results keyed like calls, false for those that failed, threw or did not finish within timeout_ms. errors receives array('code' => ..., 'message' => ...) for each of those. */
+PHP_FUNCTION(gearman_client_do_multi) {
+        zval *zcalls, *zcall, *zfunction, *zunique;
+        zval *zerrors = NULL;
+        zval zkey, zworkload, zresult;
+        const char *error;
+        zend_long timeout = -1;
+        zend_ulong num_key;
+        zend_string *str_key;
+        gearman_client_multi_t multi;
+        uint64_t deadline = 0, now;
+        gearman_return_t ret;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Oa|lz", &zobj, gearman_client_ce, &zcalls, &timeout, &zerrors) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+        _php_client_check_fork(obj);
+        _php_client_autoflush(obj);
+
+        if (obj->multi != NULL) {
+                php_error_docref(NULL, E_WARNING, "doMulti() is already running on this client");
+                RETURN_FALSE;
+        }
+
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(zcalls), zcall) {
+                if (Z_TYPE_P(zcall) != IS_ARRAY ||
+                    (zfunction = zend_hash_index_find(Z_ARRVAL_P(zcall), 0)) == NULL || Z_TYPE_P(zfunction) != IS_STRING ||
+                    zend_hash_index_find(Z_ARRVAL_P(zcall), 1) == NULL) {
+                        php_error_docref(NULL, E_WARNING, "Each call must be an array(function, workload [, unique])");
+                        RETURN_FALSE;
+                }
+        } ZEND_HASH_FOREACH_END();
+
+        array_init_size(return_value, zend_hash_num_elements(Z_ARRVAL_P(zcalls)));
+        multi.results = return_value;
+        multi.errors = NULL;
+        multi.pending = 0;
+
+        if (zerrors != NULL) {
+                ZVAL_DEREF(zerrors);
+                zval_ptr_dtor(zerrors);
+                array_init(zerrors);
+                multi.errors = zerrors;
+        }
+
+        obj->multi = &multi;
+
+        ZEND_HASH_FOREACH_KEY_VAL(Z_ARRVAL_P(zcalls), num_key, str_key, zcall) {
+                if (str_key) {
+                        ZVAL_STR_COPY(&zkey, str_key);
+                } else {
+                        ZVAL_LONG(&zkey, num_key);
+                }
+
+                /* keeps the order of calls whatever order they finish in */
+                ZVAL_FALSE(&zresult);
+                _php_client_multi_store(return_value, &zkey, &zresult);
+
+                ZVAL_STR(&zworkload, zval_get_string(zend_hash_index_find(Z_ARRVAL_P(zcall), 1)));
+                zunique = zend_hash_index_find(Z_ARRVAL_P(zcall), 2);
+
+                if (_php_task_internal_add(obj, NULL, gearman_client_add_task, _php_client_multi_fn,
+                                           Z_STRVAL_P(zend_hash_index_find(Z_ARRVAL_P(zcall), 0)),
+                                           zunique != NULL && Z_TYPE_P(zunique) == IS_STRING ? Z_STRVAL_P(zunique) : NULL,
+                                           &zworkload, &zkey) != NULL) {
+                        multi.pending++;
+                } else {
+                        error = obj->internal != NULL ? gearman_client_error(obj->internal) : NULL;
+                        if (error == NULL) {
+                                error = gearman_strerror(obj->ret);
+                        }
+                        _php_client_multi_error(&multi, &zkey, obj->ret, error, strlen(error));
+                }
+
+                zval_ptr_dtor(&zworkload);
+                zval_ptr_dtor(&zkey);
+        } ZEND_HASH_FOREACH_END();
+
+        if (timeout > 0) {
+                deadline = _php_gearman_now_ms() + timeout;
+        }
+
+        ret = GEARMAN_SUCCESS;
+        while (multi.pending > 0) {
+                if (deadline) {
+                        now = _php_gearman_now_ms();
+                        if (now >= deadline) {
+                                ret = GEARMAN_TIMEOUT;
+                                break;
+                        }
+                        ret = _php_gearman_run_step(obj->internal, (int) (deadline - now));
+                } else {
+                        ret = _php_gearman_run_step(obj->internal, -1);
+                }
+
+                if (ret != GEARMAN_IO_WAIT && ret != GEARMAN_PAUSE) {
+                        break;
+                }
+        }
+
+        obj->ret = (ret == GEARMAN_IO_WAIT || ret == GEARMAN_PAUSE) ? GEARMAN_SUCCESS : ret;
+        /* whatever is left did not finish in time or lost its server */
+        _php_task_internal_abandon_all(obj, _php_client_multi_fn);
+        obj->multi = NULL;
+}
+/* }}} */
+
+inline gearman_completion_iterator_obj *gearman_completion_iterator_fetch_object(zend_object *obj) {
+        return (gearman_completion_iterator_obj *)((char*)(obj) - XtOffsetOf(gearman_completion_iterator_obj, std));
+}
+
+inline zend_object *gearman_completion_iterator_obj_new(zend_class_entry *ce) {
+        gearman_completion_iterator_obj *intern = ecalloc(1,
+                sizeof(gearman_completion_iterator_obj) +
+                zend_object_properties_size(ce));
+
+        zend_object_std_init(&(intern->std), ce);
+        object_properties_init(&intern->std, ce);
+
+        intern->std.handlers = &gearman_completion_iterator_obj_handlers;
+        return &intern->std;
+}
+
+/* Moves to the next finished task, running the client's tasks until one
+ * finishes, none are left or the deadline passed. */
+static void _php_completion_iterator_fetch(gearman_completion_iterator_obj *it) {
+        gearman_client_obj *obj;
+        HashTable *completed;
+        HashPosition pos;
+        zend_ulong index;
+        zval *ztask;
+        uint64_t now, next;
+        gearman_return_t ret;
+
+        zval_ptr_dtor(&it->zcurrent);
+        ZVAL_UNDEF(&it->zcurrent);
+
+        if (Z_ISUNDEF(it->zclient)) {
+                return;
+        }
+        obj = Z_GEARMAN_CLIENT_P(&it->zclient);
+        completed = Z_ARRVAL(obj->completed);
+
+        while (1) {
+                zend_hash_internal_pointer_reset_ex(completed, &pos);
+                if ((ztask = zend_hash_get_current_data_ex(completed, &pos)) != NULL) {
+                        zend_hash_get_current_key_ex(completed, NULL, &index, &pos);
+                        ZVAL_COPY(&it->zcurrent, ztask);
+                        zend_hash_index_del(completed, index);
+                        return;
+                }
+
+                if (zend_hash_num_elements(Z_ARRVAL(obj->task_list)) == 0) {
+                        return;
+                }
+
+                now = _php_gearman_now_ms();
+                if (it->deadline && now >= it->deadline) {
+                        obj->ret = GEARMAN_TIMEOUT;
+                        return;
+                }
+
+                /* timed out tasks are handed out like finished ones */
+                next = _php_client_expire_tasks(obj, now, 0);
+                if (zend_hash_num_elements(completed) > 0) {
+                        continue;
+                }
+                if (it->deadline && (next == 0 || it->deadline < next)) {
+                        next = it->deadline;
+                }
+
+                ret = _php_client_run_step(obj, next ? (int) (next - now) : -1);
+                if (ret == GEARMAN_TIMEOUT && next) {
+                        continue;
+                }
+                if (ret != GEARMAN_SUCCESS && ret != GEARMAN_IO_WAIT && ret != GEARMAN_PAUSE) {
+                        obj->ret = ret;
+                        if (ret != GEARMAN_TIMEOUT) {
+                                php_error_docref(NULL, E_WARNING, "%s", gearman_client_error(&(obj->client)));
+                        }
+                        return;
+                }
+        }
+}
+
+/* {{{ proto object GearmanClient::completions([int timeout_ms])
+   Run the queued tasks and iterate over them as they finish, keyed by the context passed to addTask(). Stops once all are done or after timeout_ms. */
+PHP_FUNCTION(gearman_client_completions) {
+        zend_long timeout = -1;
+        gearman_completion_iterator_obj *it;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O|l", &zobj, gearman_client_ce, &timeout) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+        _php_client_check_fork(obj);
+
+        if (object_init_ex(return_value, gearman_completion_iterator_ce) != SUCCESS) {
+                php_error_docref(NULL, E_WARNING, "GearmanCompletionIterator Object creation failure.");
+                RETURN_FALSE;
+        }
+
+        it = Z_GEARMAN_COMPLETION_ITERATOR_P(return_value);
+        ZVAL_COPY(&it->zclient, zobj);
+        if (timeout > 0) {
+                it->deadline = _php_gearman_now_ms() + timeout;
+        }
+
+        /* the terminal events have to reach us even without callbacks */
+        obj->completions++;
+        _php_client_sync_fns(obj);
+}
+/* }}} */
+
+/* {{{ proto object GearmanCompletionIterator::__destruct()
+   cleans up GearmanCompletionIterator object */
+PHP_METHOD(GearmanCompletionIterator, __destruct) {
+        gearman_completion_iterator_obj *intern = Z_GEARMAN_COMPLETION_ITERATOR_P(getThis());
+        gearman_client_obj *obj;
+
+        if (!Z_ISUNDEF(intern->zclient)) {
+                obj = Z_GEARMAN_CLIENT_P(&intern->zclient);
+                /* the client may have been destroyed first during shutdown */
+                if (--obj->completions == 0 && !Z_ISUNDEF(obj->completed)) {
+                        zend_hash_clean(Z_ARRVAL(obj->completed));
+                        _php_client_sync_fns(obj);
+                }
+        }
+
+        zval_dtor(&intern->zcurrent);
+        zval_dtor(&intern->zclient);
+
+        zend_object_std_dtor(&intern->std);
+}
+/* }}} */
+
+/* {{{ proto GearmanTask GearmanCompletionIterator::current()
+   The task that finished last */
+PHP_METHOD(GearmanCompletionIterator, current) {
+        gearman_completion_iterator_obj *it = Z_GEARMAN_COMPLETION_ITERATOR_P(getThis());
+
+        if (Z_ISUNDEF(it->zcurrent)) {
+                RETURN_NULL();
+        }
+        RETURN_ZVAL(&it->zcurrent, 1, 0);
+}
+/* }}} */
+
+/* {{{ proto mixed GearmanCompletionIterator::key()
+   The context the current task was added with */
+PHP_METHOD(GearmanCompletionIterator, key) {
+        gearman_completion_iterator_obj *it = Z_GEARMAN_COMPLETION_ITERATOR_P(getThis());
+        gearman_task_obj *task;
+
+        if (Z_ISUNDEF(it->zcurrent)) {
+                RETURN_NULL();
+        }
+
+        task = Z_GEARMAN_TASK_P(&it->zcurrent);
+        if (Z_ISUNDEF(task->zdata)) {
+                RETURN_NULL();
+        }
+        RETURN_ZVAL(&task->zdata, 1, 0);
+}
+/* }}} */
+
+/* {{{ proto void GearmanCompletionIterator::next()
+   Wait for the next task to finish */
+PHP_METHOD(GearmanCompletionIterator, next) {
+        _php_completion_iterator_fetch(Z_GEARMAN_COMPLETION_ITERATOR_P(getThis()));
+}
+/* }}} */
+
+/* {{{ proto void GearmanCompletionIterator::rewind()
+   Wait for the first task to finish. Tasks already handed out are not seen again. */
+PHP_METHOD(GearmanCompletionIterator, rewind) {
+        gearman_completion_iterator_obj *it = Z_GEARMAN_COMPLETION_ITERATOR_P(getThis());
+
+        if (Z_ISUNDEF(it->zcurrent)) {
+                _php_completion_iterator_fetch(it);
+        }
+}
+/* }}} */
+
+/* {{{ proto bool GearmanCompletionIterator::valid()
+   Whether there is a current task */
+PHP_METHOD(GearmanCompletionIterator, valid) {
+        gearman_completion_iterator_obj *it = Z_GEARMAN_COMPLETION_ITERATOR_P(getThis());
+
+        RETURN_BOOL(!Z_ISUNDEF(it->zcurrent));
+}
+/* }}} */
+
+/* {{{ proto bool GearmanClient::setCompletionPolicy(int policy [, int quorum])
+   Let runTasks() return early. GEARMAN_COMPLETION_QUORUM returns once quorum tasks completed, GEARMAN_COMPLETION_FAIL_FAST returns false on the first failure, both may be combined. Only foreground tasks added before runTasks() count, the ones still outstanding are abandoned without callbacks. */
+PHP_FUNCTION(gearman_client_set_completion_policy) {
+        zend_long policy;
+        zend_long quorum = 0;
+
+        gearman_client_obj *obj;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol|l", &zobj, gearman_client_ce, &policy, &quorum) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_CLIENT_P(zobj);
+
+        if (policy & ~(GEARMAN_COMPLETION_QUORUM | GEARMAN_COMPLETION_FAIL_FAST)) {
+                php_error_docref(NULL, E_WARNING, "Invalid completion policy: " ZEND_LONG_FMT, policy);
                 RETURN_FALSE;
-        }    
+        }
 
-        gearman_client_ctor(INTERNAL_FUNCTION_PARAM_PASSTHRU);
+        if ((policy & GEARMAN_COMPLETION_QUORUM) && (quorum <= 0 || quorum > UINT32_MAX)) {
+                php_error_docref(NULL, E_WARNING, "Quorum must be greater than 0");
+                RETURN_FALSE;
+        }
+
+        obj->completion_policy = (php_gearman_completion_policy_t) policy;
+        obj->quorum = quorum;
+        _php_client_sync_fns(obj);
+        RETURN_TRUE;
 }
+/* }}} */
 
-inline zend_object *gearman_client_obj_new(zend_class_entry *ce) {
-	gearman_client_obj *intern = ecalloc(1,
-		sizeof(gearman_client_obj) +
-		zend_object_properties_size(ce));
+/* Sends one copy of a hedged job on the connection to server_list[index].
+ * NULL with obj->ret set if it could not be sent. */
+static php_gearman_conn *_php_client_hedge_send(gearman_client_obj *obj, uint32_t index, gearman_command_t command,
+                                                const char **args, const size_t *sizes, int timeout) {
+        php_gearman_conn *conn = _php_client_conn(obj, index, timeout);
 
-	zend_object_std_init(&(intern->std), ce);
-	object_properties_init(&intern->std, ce);
-	array_init(&intern->task_list);
-	intern->created_tasks = 0;
+        if (conn == NULL) {
+                return NULL;
+        }
 
-	intern->std.handlers = &gearman_client_obj_handlers;
-	return &intern->std;
+        obj->ret = php_gearman_conn_send(conn, command, args, sizes, 3, timeout);
+        if (obj->ret != GEARMAN_SUCCESS) {
+                return NULL;
+        }
+        return conn;
 }
 
-/* {{{ proto object GearmanClient::__construct()
-   Returns a GearmanClient object */
-PHP_METHOD(GearmanClient, __construct)
-{
-        return_value = getThis();
-        gearman_client_ctor(INTERNAL_FUNCTION_PARAM_PASSTHRU);
+/* Runs a do*() call as up to two copies of the job on the client's own
+ * connections, the second one sent to another server once the first did
+ * not answer in time. Both are waited on in one poll(). The first answer
+ * wins, the connection of the other copy is closed, which also tells the
+ * server nobody waits for it anymore. Returns the result, or NULL for an
+ * empty one, with obj->ret set like gearman_client_do() would. */
+zend_string *_php_client_do_hedged(gearman_client_obj *obj, gearman_job_priority_t priority,
+                                   const char *function_name, const char *unique,
+                                   zend_string *workload) {
+        php_gearman_conn *conns[2];
+        php_gearman_packet packet;
+        gearman_command_t command;
+        smart_str results[2] = {{0}, {0}};
+        const char *args[3];
+        size_t sizes[3];
+        uint32_t count = zend_hash_num_elements(Z_ARRVAL(obj->server_list)), live = 0, ready, i;
+        int32_t servers[2], primary;
+        uint64_t start, now, delay, deadline = 0;
+        int timeout = gearman_client_timeout(&(obj->client)), wait;
+        int winner = -1;
+        zend_bool hedged = 0;
+        gearman_return_t ret = GEARMAN_LOST_CONNECTION;
 
-}
-/* }}} */
+        if (priority == GEARMAN_JOB_PRIORITY_HIGH) {
+                command = GEARMAN_COMMAND_SUBMIT_JOB_HIGH;
+        } else if (priority == GEARMAN_JOB_PRIORITY_LOW) {
+                command = GEARMAN_COMMAND_SUBMIT_JOB_LOW;
+        } else {
+                command = GEARMAN_COMMAND_SUBMIT_JOB;
+        }
 
-/* {{{ proto object GearmanClient::__destruct()
-   cleans up GearmanClient object */
-PHP_METHOD(GearmanClient, __destruct)
-{
-        char *context = NULL;
-        gearman_client_obj *intern = Z_GEARMAN_CLIENT_P(getThis());
-        if (!intern) {
-                return;
+        /* both copies send from the caller's string */
+        args[0] = function_name;
+        sizes[0] = strlen(function_name);
+        args[1] = unique != NULL ? unique : "";
+        sizes[1] = unique != NULL ? strlen(unique) : 0;
+        args[2] = ZSTR_VAL(workload);
+        sizes[2] = ZSTR_LEN(workload);
+
+        start = _php_gearman_now_ms();
+        delay = _php_client_hedge_delay(obj);
+        if (timeout > 0) {
+                deadline = start + timeout;
         }
 
-        context = gearman_client_context(&(intern->client));
-        efree(context);
+        /* the original on the first server it could reach */
+        obj->ret = GEARMAN_NO_SERVERS;
+        for (i = 0; i < count && live == 0; i++) {
+                if ((conns[0] = _php_client_hedge_send(obj, i, command, args, sizes, timeout)) != NULL) {
+                        servers[0] = (int32_t) i;
+                        live = 1;
+                }
+        }
+        if (live == 0) {
+                return NULL;
+        }
+        primary = servers[0];
 
-        if (intern->flags & GEARMAN_CLIENT_OBJ_CREATED) {
-                gearman_client_free(&intern->client);
+        while (live > 0) {
+                now = _php_gearman_now_ms();
+                if (deadline && now >= deadline) {
+                        ret = GEARMAN_TIMEOUT;
+                        break;
+                }
+
+                /* the hedge on one of the other servers, taking turns */
+                if (!hedged && now - start >= delay) {
+                        hedged = 1;
+                        servers[live] = (int32_t) ((primary + 1 + obj->hedges_sent % (count - 1)) % count);
+                        if ((conns[live] = _php_client_hedge_send(obj, (uint32_t) servers[live], command, args, sizes,
+                                                                  deadline ? (int) (deadline - now) : timeout)) != NULL) {
+                                live++;
+                                obj->hedges_sent++;
+                        }
+                        continue;
+                }
+
+                wait = deadline ? (int) (deadline - now) : -1;
+                if (!hedged && (wait < 0 || start + delay - now < (uint64_t) wait)) {
+                        wait = (int) (start + delay - now);
+                }
+
+                obj->ret = php_gearman_conn_select(conns, live, wait, &ready);
+                if (obj->ret == GEARMAN_TIMEOUT) {
+                        continue;
+                }
+                if (obj->ret != GEARMAN_SUCCESS) {
+                        ret = obj->ret;
+                        break;
+                }
+
+                obj->conn_last = servers[ready];
+                obj->ret = php_gearman_conn_recv(conns[ready], &packet, deadline ? (int) (deadline - now) : timeout);
+                if (obj->ret != GEARMAN_SUCCESS) {
+                        /* recv closed the connection already */
+                        ret = obj->ret;
+                        packet.command = GEARMAN_COMMAND_MAX;
+                }
+
+                switch (packet.command) {
+                case GEARMAN_COMMAND_JOB_CREATED:
+                case GEARMAN_COMMAND_WORK_STATUS:
+                case GEARMAN_COMMAND_WORK_WARNING:
+                        continue;
+                case GEARMAN_COMMAND_WORK_DATA:
+                        smart_str_appendl(&results[ready], packet.args[1], packet.sizes[1]);
+                        continue;
+                case GEARMAN_COMMAND_WORK_COMPLETE:
+                        smart_str_appendl(&results[ready], packet.args[1], packet.sizes[1]);
+                        ret = GEARMAN_SUCCESS;
+                        break;
+                case GEARMAN_COMMAND_WORK_EXCEPTION:
+                        smart_str_free(&results[ready]);
+                        smart_str_appendl(&results[ready], packet.args[1], packet.sizes[1]);
+                        ret = GEARMAN_WORK_EXCEPTION;
+                        break;
+                case GEARMAN_COMMAND_WORK_FAIL:
+                        smart_str_free(&results[ready]);
+                        ret = GEARMAN_WORK_FAIL;
+                        break;
+                default:
+                        /* this copy is lost, the other may still answer */
+                        if (packet.command == GEARMAN_COMMAND_ERROR) {
+                                ret = GEARMAN_SERVER_ERROR;
+                                snprintf(conns[ready]->error, sizeof(conns[ready]->error), "%.*s",
+                                         (int) packet.sizes[1], packet.args[1]);
+                        } else if (obj->ret == GEARMAN_SUCCESS) {
+                                ret = GEARMAN_UNEXPECTED_PACKET;
+                        }
+                        php_gearman_conn_close(conns[ready]);
+                        smart_str_free(&results[ready]);
+                        if (--live > 0 && ready == 0) {
+                                conns[0] = conns[1];
+                                servers[0] = servers[1];
+                                results[0] = results[1];
+                                memset(&results[1], 0, sizeof(smart_str));
+                        }
+                        continue;
+                }
+
+                winner = (int) ready;
+                break;
         }
 
-        // Clear Callbacks
-        zval_dtor(&intern->zworkload_fn);
-        zval_dtor(&intern->zcreated_fn);
-        zval_dtor(&intern->zdata_fn);
-        zval_dtor(&intern->zwarning_fn);
-        zval_dtor(&intern->zstatus_fn);
-        zval_dtor(&intern->zcomplete_fn);
-        zval_dtor(&intern->zexception_fn);
-        zval_dtor(&intern->zfail_fn);
+        /* the copies still running have nowhere to report to */
+        for (i = 0; i < live; i++) {
+                if ((int) i != winner) {
+                        php_gearman_conn_close(conns[i]);
+                        smart_str_free(&results[i]);
+                }
+        }
 
-        zval_dtor(&intern->task_list);
+        obj->ret = ret;
+        if (winner < 0) {
+                return NULL;
+        }
 
-        zend_object_std_dtor(&intern->std);
+        if (servers[winner] != primary) {
+                obj->hedges_won++;
+        }
+        obj->hedge_samples[obj->hedge_sample_count++ % PHP_GEARMAN_HEDGE_SAMPLES] = _php_gearman_now_ms() - start;
+
+        if (results[winner].s == NULL || ZSTR_LEN(results[winner].s) == 0) {
+                smart_str_free(&results[winner]);
+                return NULL;
+        }
+        smart_str_0(&results[winner]);
+        return results[winner].s;
 }
 
-/* {{{ proto int gearman_client_return_code()
-   get last gearman_return_t */
-PHP_FUNCTION(gearman_client_return_code)
-{
+/* {{{ proto bool GearmanClient::setHedging(int delay_ms [, bool adaptive])
+   Make doNormal(), doHigh() and doLow() send a copy of the job to another server when the first one did not answer within delay_ms, and return whichever answers first. Hedged calls run over the client's own connections. With adaptive, the p95 latency of recent calls is used instead once enough of them were seen. 0 turns hedging off. Needs at least two servers. */
+PHP_FUNCTION(gearman_client_set_hedging) {
+        zend_long delay;
+        zend_bool adaptive = 0;
+
         gearman_client_obj *obj;
         zval *zobj;
 
-        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
-                RETURN_NULL();
-        }    
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol|b", &zobj, gearman_client_ce, &delay, &adaptive) == FAILURE) {
+                RETURN_FALSE;
+        }
         obj = Z_GEARMAN_CLIENT_P(zobj);
 
-        RETURN_LONG(obj->ret);
+        if (delay < 0) {
+                php_error_docref(NULL, E_WARNING, "Hedging delay must be greater than or equal to 0");
+                RETURN_FALSE;
+        }
+
+        obj->hedge_delay = delay;
+        obj->hedge_adaptive = adaptive;
+        RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto string gearman_client_error()
-   Return an error string for the last error encountered. */
-PHP_FUNCTION(gearman_client_error) {
-        char *error = NULL;
+/* {{{ proto bool GearmanClient::setAdaptiveTimeout(float multiplier [, int floor_ms [, int ceiling_ms]])
+   Give do*() calls and addTask() tasks without a timeout of their own multiplier times the p99 latency recently seen for their function, at least floor_ms and at most ceiling_ms. Functions with too few calls seen keep the static timeout, so do the calls after three in a row timed out, until one completes. 0 turns this off, latencies of completed calls are recorded either way. */
+PHP_FUNCTION(gearman_client_set_adaptive_timeout) {
+        double multiplier;
+        zend_long floor_ms = 0;
+        zend_long ceiling_ms = 0;
+
         gearman_client_obj *obj;
         zval *zobj;
 
-        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
-                RETURN_NULL();
-        }    
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Od|ll", &zobj, gearman_client_ce, &multiplier, &floor_ms, &ceiling_ms) == FAILURE) {
+                RETURN_FALSE;
+        }
         obj = Z_GEARMAN_CLIENT_P(zobj);
 
-        error = (char *)gearman_client_error(&(obj->client));
-        if (error) {
-                RETURN_STRING(error)
-        }    
-        RETURN_FALSE;
+        if (multiplier < 0 || floor_ms < 0 || ceiling_ms < 0) {
+                php_error_docref(NULL, E_WARNING, "Multiplier, floor and ceiling must be greater than or equal to 0");
+                RETURN_FALSE;
+        }
+
+        if (ceiling_ms > 0 && ceiling_ms < floor_ms) {
+                php_error_docref(NULL, E_WARNING, "Ceiling must not be below floor");
+                RETURN_FALSE;
+        }
+
+        obj->adaptive_multiplier = multiplier;
+        obj->adaptive_floor = floor_ms;
+        obj->adaptive_ceiling = ceiling_ms;
+        _php_client_sync_fns(obj);
+        RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto int gearman_client_get_errno()
-   Value of errno in the case of a GEARMAN_ERRNO return value. */
-PHP_FUNCTION(gearman_client_get_errno) {
+/* {{{ proto bool GearmanClient::setRouting(int mode)
+   Choose how jobs are spread over the servers. GEARMAN_ROUTING_CONSISTENT_HASH sends every job with the same unique key, or shard key, to the same server, adding a server only moves a small share of the keys. GEARMAN_ROUTING_LEAST_OUTSTANDING sends each job to the reachable server with the fewest outstanding tasks for its weight and latency. Jobs without a key and all jobs under GEARMAN_ROUTING_DEFAULT go wherever libgearman sends them. runTasks() waits on the servers with routed tasks in turn, which adds up to 1 ms per server to noticing a reply. */
+PHP_FUNCTION(gearman_client_set_routing) {
+        zend_long mode;
+
         gearman_client_obj *obj;
         zval *zobj;
 
-        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
-                RETURN_NULL();
-        }    
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_client_ce, &mode) == FAILURE) {
+                RETURN_FALSE;
+        }
         obj = Z_GEARMAN_CLIENT_P(zobj);
 
-        RETURN_LONG(gearman_client_errno(&(obj->client)))
+        if (mode != GEARMAN_ROUTING_DEFAULT && mode != GEARMAN_ROUTING_CONSISTENT_HASH &&
+            mode != GEARMAN_ROUTING_LEAST_OUTSTANDING) {
+                php_error_docref(NULL, E_WARNING, "Invalid routing mode: " ZEND_LONG_FMT, mode);
+                RETURN_FALSE;
+        }
+
+        obj->routing = (php_gearman_routing_t) mode;
+        RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto int gearman_client_options()
-   Get options for a client structure. */
-PHP_FUNCTION(gearman_client_options) {
+/* {{{ proto bool GearmanClient::setShardKey(string key)
+   Route the jobs submitted from now on by key instead of their unique key. The key stays set for every later addTask*() and do*() call on this client, pinning all of them to one server, until setShardKey(null) goes back to the unique key. */
+PHP_FUNCTION(gearman_client_set_shard_key) {
+        zend_string *key = NULL;
+
         gearman_client_obj *obj;
         zval *zobj;
 
-        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
-                RETURN_NULL();
-        }    
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "OS!", &zobj, gearman_client_ce, &key) == FAILURE) {
+                RETURN_FALSE;
+        }
         obj = Z_GEARMAN_CLIENT_P(zobj);
 
-        RETURN_LONG(gearman_client_options(&(obj->client)))
+        if (obj->shard_key != NULL) {
+                zend_string_release(obj->shard_key);
+                obj->shard_key = NULL;
+        }
+
+        if (key != NULL && ZSTR_LEN(key) > 0) {
+                obj->shard_key = zend_string_copy(key);
+        }
+
+        RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto void gearman_client_set_options(constant option)
-   Set options for a client structure. */
-PHP_FUNCTION(gearman_client_set_options) {
-        zend_long options;
+/* {{{ proto bool GearmanClient::setServerWeights(array weights)
+   Weights for GEARMAN_ROUTING_LEAST_OUTSTANDING, keyed by server, "host:port". The port defaults to 4730 and host names are not case sensitive, so "Gearman1" weighs the server added as "gearman1:4730". Servers not listed weigh 1, 0 takes a server out of rotation. */
+PHP_FUNCTION(gearman_client_set_server_weights) {
+        zval *zweights, *zweight;
+        zend_string *server, *key;
 
         gearman_client_obj *obj;
         zval *zobj;
 
-        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_client_ce, &options) == FAILURE) {
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Oa", &zobj, gearman_client_ce, &zweights) == FAILURE) {
                 RETURN_FALSE;
-        }    
+        }
         obj = Z_GEARMAN_CLIENT_P(zobj);
 
-        gearman_client_set_options(&(obj->client), options);
+        ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL_P(zweights), server, zweight) {
+                if (server == NULL || zval_get_long(zweight) < 0) {
+                        php_error_docref(NULL, E_WARNING, "Weights must be given as \"host:port\" => int, at least 0");
+                        RETURN_FALSE;
+                }
+        } ZEND_HASH_FOREACH_END();
+
+        zend_hash_clean(Z_ARRVAL(obj->server_weights));
+        ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL_P(zweights), server, zweight) {
+                key = _php_gearman_server_key(ZSTR_VAL(server), ZSTR_LEN(server));
+                add_assoc_long_ex(&obj->server_weights, ZSTR_VAL(key), ZSTR_LEN(key), zval_get_long(zweight));
+                zend_string_release(key);
+        } ZEND_HASH_FOREACH_END();
+
         RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto void GearmanClient::addOptions(constant option)
-   Set options for a client structure. */
-PHP_FUNCTION(gearman_client_add_options) {
-        zend_long options;
+/* {{{ proto bool GearmanClient::setCircuitBreaker(int threshold [, int cooldown_ms])
+   Take a server out of rotation once it could not be connected to, or after threshold errors or timeouts in a row. After cooldown_ms it is probed with an ECHO of a few ms before it gets jobs again, one too slow to answer that fast gets the next job as its trial. Jobs go to the next available server meanwhile, doBackground() and do*() calls that could not connect are repeated there right away. 0 turns this off. */
+PHP_FUNCTION(gearman_client_set_circuit_breaker) {
+        zend_long threshold;
+        zend_long cooldown = 5000;
 
         gearman_client_obj *obj;
         zval *zobj;
 
-        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_client_ce, &options) == FAILURE) {
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol|l", &zobj, gearman_client_ce, &threshold, &cooldown) == FAILURE) {
                 RETURN_FALSE;
         }
         obj = Z_GEARMAN_CLIENT_P(zobj);
 
-        gearman_client_add_options(&(obj->client), options);
+        if (threshold < 0 || threshold > UINT32_MAX || cooldown < 0) {
+                php_error_docref(NULL, E_WARNING, "Threshold and cooldown must be greater than or equal to 0");
+                RETURN_FALSE;
+        }
+
+        obj->breaker_threshold = threshold;
+        obj->breaker_cooldown = cooldown;
         RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto void GearmanClient::removeOptions(constant option)
-   Set options for a client structure. */
-PHP_FUNCTION(gearman_client_remove_options) {
-        zend_long options;
-
+/* {{{ proto bool gearman_client_connect(object client)
+   Connect to the job servers now instead of on the first call, so DNS, connecting and option negotiation are not paid for by the first job. With routing or the circuit breaker on every server is connected, otherwise the one libgearman would use. */
+PHP_FUNCTION(gearman_client_connect) {
         gearman_client_obj *obj;
+        gearman_client_st *client;
+        gearman_return_t ret;
         zval *zobj;
+        uint32_t count, i;
+        uint64_t start;
 
-        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_client_ce, &options) == FAILURE) {
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
                 RETURN_FALSE;
         }
         obj = Z_GEARMAN_CLIENT_P(zobj);
+        _php_client_check_fork(obj);
 
-        gearman_client_remove_options(&(obj->client), options);
+        obj->keepalive_last = _php_gearman_now_ms();
+
+        if (PHP_GEARMAN_CLIENT_NATIVE(obj)) {
+                if (_php_client_native_echo(obj, PHP_GEARMAN_WARMUP, sizeof(PHP_GEARMAN_WARMUP) - 1) != GEARMAN_SUCCESS) {
+                        php_error_docref(NULL, E_WARNING, "%s", _php_client_native_error(obj));
+                        RETURN_FALSE;
+                }
+                RETURN_TRUE;
+        }
+
+        if (obj->routing == GEARMAN_ROUTING_DEFAULT && obj->breaker_threshold == 0) {
+                obj->ret = gearman_client_echo(&(obj->client), PHP_GEARMAN_WARMUP, sizeof(PHP_GEARMAN_WARMUP) - 1);
+                if (obj->ret != GEARMAN_SUCCESS && obj->ret != GEARMAN_IO_WAIT) {
+                        php_error_docref(NULL, E_WARNING, "%s",
+                                         gearman_client_error(&(obj->client)));
+                        RETURN_FALSE;
+                }
+                RETURN_TRUE;
+        }
+
+        /* routed jobs go out through the per server clients, those are the
+         * connections worth opening */
+        obj->ret = GEARMAN_SUCCESS;
+        count = zend_hash_num_elements(Z_ARRVAL(obj->server_list));
+        for (i = 0; i < count; i++) {
+                client = _php_client_server(obj, i);
+                if (client == NULL) {
+                        continue;
+                }
+
+                start = _php_gearman_now_ms();
+                ret = gearman_client_echo(client, PHP_GEARMAN_WARMUP, sizeof(PHP_GEARMAN_WARMUP) - 1);
+                _php_client_server_done(obj, (int32_t) i, ret, _php_gearman_now_ms() - start);
+
+                if (ret != GEARMAN_SUCCESS && ret != GEARMAN_IO_WAIT) {
+                        obj->ret = ret;
+                        php_error_docref(NULL, E_WARNING, "%s", gearman_client_error(client));
+                }
+        }
+
+        if (obj->ret != GEARMAN_SUCCESS) {
+                RETURN_FALSE;
+        }
         RETURN_TRUE;
 }
 /* }}} */
 
-PHP_FUNCTION(gearman_client_timeout) {
+/* {{{ proto bool gearman_client_set_keepalive(object client, int interval_ms)
+   Check the connections with ECHO before a call when the client was idle for interval_ms, 0 turns this off. */
+PHP_FUNCTION(gearman_client_set_keepalive) {
         gearman_client_obj *obj;
         zval *zobj;
+        zend_long interval;
 
-        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_client_ce) == FAILURE) {
-                RETURN_NULL();
-        }    
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_client_ce, &interval) == FAILURE) {
+                RETURN_FALSE;
+        }
         obj = Z_GEARMAN_CLIENT_P(zobj);
 
-        RETURN_LONG(gearman_client_timeout(&(obj->client)))
+        if (interval < 0) {
+                php_error_docref(NULL, E_WARNING, "Keepalive interval must be greater than or equal to 0");
+                RETURN_FALSE;
+        }
+
+        obj->keepalive = interval;
+        obj->keepalive_last = _php_gearman_now_ms();
+        RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto void gearman_client_set_timeout(object, constant timeout)
-   Set timeout for a client structure. */
-PHP_FUNCTION(gearman_client_set_timeout) {
-        zend_long timeout;
+/* {{{ proto bool GearmanClient::setSocketOptions(array options)
+   Socket options for the connections the extension opens itself, those to unix:// servers and on the native engine. Keys are send_size and recv_size (SO_SNDBUF/SO_RCVBUF in bytes), nodelay and quickack (TCP_NODELAY/TCP_QUICKACK), busy_poll (SO_BUSY_POLL in us). 0 leaves the system default, except for nodelay which is on unless turned off. Open connections are closed so the next call uses the new options. */
+PHP_FUNCTION(gearman_client_set_socket_options) {
+        php_gearman_socket_options options;
+        zval *zoptions;
+        uint32_t i;
 
         gearman_client_obj *obj;
         zval *zobj;
 
-        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_client_ce, &timeout) == FAILURE) {
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Oa", &zobj, gearman_client_ce, &zoptions) == FAILURE) {
                 RETURN_FALSE;
-        }    
+        }
         obj = Z_GEARMAN_CLIENT_P(zobj);
 
-        gearman_client_set_timeout(&(obj->client), timeout);
+        if (!_php_gearman_socket_options(zoptions, &options)) {
+                RETURN_FALSE;
+        }
+
+        obj->socket_options = options;
+        for (i = 0; i < obj->conns_count; i++) {
+                php_gearman_conn_close(&obj->conns[i]);
+        }
         RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto bool gearman_client_add_server(object client [, string host [, int port]])
-   Add a job server to a client. This goes into a list of servers than can be used to run tasks. No socket I/O happens here, it is just added to a list. */
-PHP_FUNCTION(gearman_client_add_server) {
-        char *host = NULL;
-        size_t host_len = 0;
-        zend_long port = 0;
+/* {{{ proto bool GearmanClient::setEngine(int engine)
+   GEARMAN_ENGINE_NATIVE runs do*(), doBackground() and ping() over the extension's own connections, speaking the protocol itself instead of going through libgearman. Tasks and everything else stay on libgearman. Jobs for unix:// servers always take the native path, and so do the jobs libgearman would otherwise pick a server for, since it cannot reach those. Jobs setRouting() or setCircuitBreaker() send to another server stay on libgearman unless the native engine is on. */
+PHP_FUNCTION(gearman_client_set_engine) {
+        zend_long engine;
+        uint32_t i;
 
         gearman_client_obj *obj;
-        zval *zobj;
+        zval *zobj, *zserver;
 
-        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O|sl", &zobj, gearman_client_ce, &host, &host_len, &port) == FAILURE) {
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Ol", &zobj, gearman_client_ce, &engine) == FAILURE) {
                 RETURN_FALSE;
-        }            
+        }
         obj = Z_GEARMAN_CLIENT_P(zobj);
 
-        obj->ret = gearman_client_add_server(&(obj->client), host, port);
-        if (obj->ret != GEARMAN_SUCCESS) {
-                php_error_docref(NULL, E_WARNING, "%s",
-                                                 gearman_client_error(&(obj->client)));
-                RETURN_FALSE;                         
-        }            
+        if (engine != GEARMAN_ENGINE_LIBGEARMAN && engine != GEARMAN_ENGINE_NATIVE) {
+                php_error_docref(NULL, E_WARNING, "Invalid engine: " ZEND_LONG_FMT, engine);
+                RETURN_FALSE;
+        }
 
-        if (!gearman_client_set_server_option(&(obj->client), "exceptions", (sizeof("exceptions") - 1))) {
-                GEARMAN_EXCEPTION("Failed to set exception option", 0);
-        }            
+        if (engine == GEARMAN_ENGINE_NATIVE && obj->sender != NULL) {
+                php_error_docref(NULL, E_WARNING, "The background sender does not run on the native engine");
+                RETURN_FALSE;
+        }
+
+        /* connections only unix:// servers need stay open */
+        if (engine == GEARMAN_ENGINE_LIBGEARMAN) {
+                for (i = 0; i < obj->conns_count; i++) {
+                        zserver = zend_hash_index_find(Z_ARRVAL(obj->server_list), i);
+                        if (zserver == NULL || !PHP_GEARMAN_IS_UNIX(Z_STRVAL_P(zserver))) {
+                                php_gearman_conn_close(&obj->conns[i]);
+                        }
+                }
+        }
 
+        obj->engine = engine;
         RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto bool gearman_client_add_servers(object client [, string servers])
-   Add a list of job servers to a client. This goes into a list of servers that can be used to run tasks. No socket I/O happens here, it is just added to a list. */
-PHP_FUNCTION(gearman_client_add_servers) {
-        char *servers = NULL;
-        size_t servers_len = 0;
-
+/* {{{ proto bool gearman_client_set_servers(object client, string servers)
+   Replace the job servers with servers, in the addServers() format. Connections to servers on both lists are kept, tasks still running on servers that are dropped are run to completion first. */
+PHP_FUNCTION(gearman_client_set_servers) {
+        char *servers;
+        size_t servers_len;
         gearman_client_obj *obj;
-        zval *zobj;
+        gearman_client_st *check;
+        gearman_return_t ret;
+        php_gearman_server_t *entries;
+        php_gearman_conn *conns;
+        php_gearman_sender_policy_t policy;
+        gearman_task_obj *task;
+        zend_string *tcp, *added;
+        zval *zobj, *ztask, *zserver, new_list;
+        int32_t *map;
+        uint32_t old_count, new_count, capacity, i;
+        zend_ulong index;
+        zend_bool append;
 
-        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O|s", &zobj, gearman_client_ce, &servers, &servers_len) == FAILURE) {
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Os", &zobj, gearman_client_ce, &servers, &servers_len) == FAILURE) {
                 RETURN_FALSE;
         }
         obj = Z_GEARMAN_CLIENT_P(zobj);
+        _php_client_check_fork(obj);
+
+        array_init(&new_list);
+        _php_gearman_record_servers(&new_list, servers);
+        tcp = _php_gearman_join_servers(&new_list, 0);
+
+        /* catch a bad list before anything is torn down */
+        if (tcp != NULL) {
+                check = gearman_client_create(NULL);
+                if (check == NULL) {
+                        php_error_docref(NULL, E_WARNING, "Memory allocation failure");
+                        zend_string_release(tcp);
+                        zval_dtor(&new_list);
+                        RETURN_FALSE;
+                }
+                obj->ret = gearman_client_add_servers(check, ZSTR_VAL(tcp));
+                if (obj->ret != GEARMAN_SUCCESS) {
+                        php_error_docref(NULL, E_WARNING, "%s", gearman_client_error(check));
+                        gearman_client_free(check);
+                        zend_string_release(tcp);
+                        zval_dtor(&new_list);
+                        RETURN_FALSE;
+                }
+                gearman_client_free(check);
+        }
+
+        old_count = zend_hash_num_elements(Z_ARRVAL(obj->server_list));
+        new_count = zend_hash_num_elements(Z_ARRVAL(new_list));
+
+        /* map[i] is where server_list[i] ends up, -1 if it is dropped */
+        map = safe_emalloc(MAX(old_count, 1), sizeof(int32_t), 0);
+        append = old_count <= new_count;
+        ZEND_HASH_FOREACH_NUM_KEY_VAL(Z_ARRVAL(obj->server_list), index, zserver) {
+                map[index] = _php_gearman_find_server(&new_list, Z_STR_P(zserver));
+                if (map[index] != (int32_t) index) {
+                        append = 0;
+                }
+        } ZEND_HASH_FOREACH_END();
+
+        if (append && old_count == new_count) {
+                efree(map);
+                if (tcp != NULL) {
+                        zend_string_release(tcp);
+                }
+                zval_dtor(&new_list);
+                RETURN_TRUE;
+        }
+
+        obj->ret = GEARMAN_SUCCESS;
+        if (append) {
+                /* libgearman keeps the connections it has and only learns
+                 * about the new servers */
+                added = _php_gearman_join_servers(&new_list, old_count);
+                if (added != NULL) {
+                        obj->ret = gearman_client_add_servers(&(obj->client), ZSTR_VAL(added));
+                        zend_string_release(added);
+                }
+        } else {
+                /* libgearman can only forget all of its servers at once, so
+                 * the tasks on its connections have to be done by then */
+                ret = GEARMAN_SUCCESS;
+                while (PHP_GEARMAN_CLIENT_OUTSTANDING(obj) > obj->routed_tasks) {
+                        ret = _php_gearman_run_step(&(obj->client), -1);
+                        if (ret != GEARMAN_IO_WAIT && ret != GEARMAN_PAUSE) {
+                                break;
+                        }
+                }
+                if (PHP_GEARMAN_CLIENT_OUTSTANDING(obj) > obj->routed_tasks) {
+                        obj->ret = ret;
+                        php_error_docref(NULL, E_WARNING, "Unable to finish the running tasks: %s",
+                                         gearman_client_error(&(obj->client)));
+                        efree(map);
+                        if (tcp != NULL) {
+                                zend_string_release(tcp);
+                        }
+                        zval_dtor(&new_list);
+                        RETURN_FALSE;
+                }
+
+                gearman_client_remove_servers(&(obj->client));
+                if (tcp != NULL) {
+                        obj->ret = gearman_client_add_servers(&(obj->client), ZSTR_VAL(tcp));
+                }
+        }
+        if (tcp != NULL) {
+                zend_string_release(tcp);
+        }
 
-        obj->ret = gearman_client_add_servers(&(obj->client), servers);
         if (obj->ret != GEARMAN_SUCCESS) {
-                php_error_docref(NULL, E_WARNING, "%s",
-                                                 gearman_client_error(&(obj->client)));
+                php_error_docref(NULL, E_WARNING, "%s", gearman_client_error(&(obj->client)));
+                efree(map);
+                zval_dtor(&new_list);
                 RETURN_FALSE;
         }
+        gearman_client_set_server_option(&(obj->client), "exceptions", (sizeof("exceptions") - 1));
 
-        if (!gearman_client_set_server_option(&(obj->client), "exceptions", (sizeof("exceptions") - 1))) {
-                GEARMAN_EXCEPTION("Failed to set exception option", 0);
+        /* internal tasks only run within a call, nothing is left on it */
+        if (obj->internal != NULL) {
+                gearman_client_free(obj->internal);
+                obj->internal = NULL;
+        }
+
+        /* routed tasks on a dropped server run to completion, its client
+         * goes away with whatever could not be finished */
+        for (i = 0; i < old_count && i < obj->servers_count; i++) {
+                if (map[i] >= 0 || obj->servers[i].client == NULL) {
+                        continue;
+                }
+                while (obj->servers[i].tasks > 0) {
+                        ret = _php_gearman_run_step(obj->servers[i].client, -1);
+                        if (ret != GEARMAN_IO_WAIT && ret != GEARMAN_PAUSE) {
+                                break;
+                        }
+                }
+                if (obj->servers[i].tasks > 0) {
+                        php_error_docref(NULL, E_WARNING, "Dropped %u tasks of a removed server: %s",
+                                         obj->servers[i].tasks, gearman_client_error(obj->servers[i].client));
+                }
+                gearman_client_free(obj->servers[i].client);
+                obj->servers[i].client = NULL;
+        }
+
+        entries = ecalloc(new_count, sizeof(php_gearman_server_t));
+        for (i = 0; i < old_count && i < obj->servers_count; i++) {
+                if (map[i] >= 0) {
+                        entries[map[i]] = obj->servers[i];
+                }
+        }
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL(obj->task_list), ztask) {
+                task = Z_GEARMAN_TASK_P(ztask);
+                if (task->server >= 0) {
+                        task->server = map[task->server];
+                }
+        } ZEND_HASH_FOREACH_END();
+
+        if (obj->servers != NULL) {
+                efree(obj->servers);
+        }
+        obj->servers = entries;
+        obj->servers_count = new_count;
+
+        /* same for the connections of our own */
+        conns = safe_emalloc(new_count, sizeof(php_gearman_conn), 0);
+        for (i = 0; i < new_count; i++) {
+                php_gearman_conn_init(&conns[i]);
+        }
+        for (i = 0; i < old_count && i < obj->conns_count; i++) {
+                if (map[i] >= 0) {
+                        conns[map[i]] = obj->conns[i];
+                } else {
+                        php_gearman_conn_free(&obj->conns[i]);
+                }
+        }
+        if (obj->conns != NULL) {
+                efree(obj->conns);
+        }
+        obj->conns = conns;
+        obj->conns_count = new_count;
+        obj->conn_last = -1;
+        efree(map);
+
+        zval_dtor(&obj->server_list);
+        ZVAL_COPY_VALUE(&obj->server_list, &new_list);
+        obj->unix_servers = _php_gearman_count_unix(&obj->server_list);
+        /* rebuilt on the next lookup */
+        obj->ring_servers = 0;
+
+        /* the sender thread has its own connections, it drains (for a
+         * bounded time) before it stops */
+        if (obj->sender != NULL) {
+                capacity = obj->sender->capacity;
+                policy = obj->sender->policy;
+                _php_client_stop_sender(obj);
+                if (obj->unix_servers > 0) {
+                        php_error_docref(NULL, E_WARNING, "The background sender does not support unix sockets, it was stopped");
+                } else if (!_php_client_start_sender(obj, capacity, policy)) {
+                        php_error_docref(NULL, E_WARNING, "Unable to restart background sender");
+                }
         }
 
         RETURN_TRUE;
@@ -20,6 +20,12 @@
 #include "zend_interfaces.h"
 
 #include "php_gearman.h"
+#include "php_gearman_sender.h"
+#include "php_gearman_conn.h"
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
 
 #include <libgearman-1.0/gearman.h>
 #include <libgearman-1.0/interface/status.h>
@@ -34,6 +40,98 @@ typedef enum {
 	GEARMAN_CLIENT_OBJ_CREATED = (1 << 0)
 } gearman_client_obj_flags_t;
 
+/* when runTasks() may return before every task finished */
+typedef enum {
+	GEARMAN_COMPLETION_ALL = 0,
+	GEARMAN_COMPLETION_QUORUM = (1 << 0),
+	GEARMAN_COMPLETION_FAIL_FAST = (1 << 1)
+} php_gearman_completion_policy_t;
+
+/* which server a job is sent to, see _php_client_route() */
+typedef enum {
+	GEARMAN_ROUTING_DEFAULT = 0,
+	GEARMAN_ROUTING_CONSISTENT_HASH = 1,
+	GEARMAN_ROUTING_LEAST_OUTSTANDING = 2
+} php_gearman_routing_t;
+
+/* ms a server that could not be reached is left out by the balancer */
+#define PHP_GEARMAN_SERVER_RETRY 1000
+
+/* most ms the ECHO probing a server after its cooldown may take, it
+ * runs while a job waits to be routed */
+#define PHP_GEARMAN_BREAKER_PROBE_TIMEOUT 5
+
+/* wait in ms on one of several busy routed clients before the next one
+ * gets its turn. A reply on another client waits up to this long for
+ * each client ahead of it. */
+#define PHP_GEARMAN_STEP_SLICE 1
+
+/* workload of the ECHO sent by connect() and setKeepalive() probes */
+#define PHP_GEARMAN_WARMUP "warmup"
+
+typedef enum {
+	GEARMAN_BREAKER_CLOSED = 0,
+	GEARMAN_BREAKER_OPEN,
+	GEARMAN_BREAKER_HALF_OPEN
+} php_gearman_breaker_state_t;
+
+/* consistent hash ring points per server, a multiple of 4 */
+#define PHP_GEARMAN_RING_POINTS 160
+
+typedef struct {
+	uint32_t point;
+	uint32_t server;
+} php_gearman_ring_point_t;
+
+/* a server of server_list, for jobs that have to go to that server */
+typedef struct {
+	/* libgearman client connected to this server only, NULL until needed */
+	gearman_client_st *client;
+	/* tasks outstanding on client */
+	uint32_t tasks;
+	/* EWMA of the latency of the calls it served, in ms */
+	double latency;
+	/* not picked before this, after a connection failure or while its
+	 * breaker is open */
+	uint64_t retry_at;
+	php_gearman_breaker_state_t state;
+	uint32_t consecutive_errors;
+	uint64_t errors;
+	uint64_t timeouts;
+	uint64_t trips;
+} php_gearman_server_t;
+
+/* where a running doMulti() collects its results */
+typedef struct {
+	zval *results;
+	zval *errors;
+	uint32_t pending;
+} gearman_client_multi_t;
+
+/* latencies setHedging() takes the p95 of in adaptive mode */
+#define PHP_GEARMAN_HEDGE_SAMPLES 64
+#define PHP_GEARMAN_HEDGE_MIN_SAMPLES 20
+
+/* per function latency histogram, bucket i counts calls that took less
+ * than 2^i ms. It is halved every PHP_GEARMAN_LATENCY_WINDOW calls so old
+ * calls fade out. */
+#define PHP_GEARMAN_LATENCY_BUCKETS 24
+#define PHP_GEARMAN_LATENCY_WINDOW 1024
+#define PHP_GEARMAN_LATENCY_MIN_SAMPLES 20
+/* timed out calls are not recorded, so once the function got slower than
+ * the adaptive timeout nothing would tell. After this many in a row calls
+ * use the static timeout until one completes. */
+#define PHP_GEARMAN_LATENCY_MAX_TIMEOUTS 3
+
+typedef struct {
+	double ewma;
+	uint32_t buckets[PHP_GEARMAN_LATENCY_BUCKETS];
+	uint32_t samples;
+	uint64_t count;
+	/* calls in a row the adaptive timeout cut off */
+	uint32_t timeouts;
+} php_gearman_latency_t;
+
 typedef struct {
 	gearman_return_t ret;
 	gearman_client_obj_flags_t flags;
@@ -51,13 +149,194 @@ typedef struct {
 	zend_ulong created_tasks;
 	zval task_list;
 
+	/* process that owns the connections, see _php_client_check_fork() */
+	pid_t pid;
+
+	/* servers as passed to addServer()/addServers(), "host[:port]" each */
+	zval server_list;
+
+	/* set while doBackground() hands jobs to a sender thread */
+	php_gearman_sender *sender;
+
+	/* doBackground() jobs held back by setDeferredBackground(), each
+	 * [function, workload, unique, priority] */
+	zend_bool defer_background;
+	zval deferred;
+	zval zdeferred_fail_fn;
+	zend_ulong deferred_failures;
+
+	/* tasks the extension submits itself, see _php_task_internal_add(),
+	 * and the clone of client they run on, see _php_client_internal() */
+	HashTable internal_tasks;
+	gearman_client_st *internal;
+	uint32_t internal_servers;
+
+	/* addTask() runs queued tasks while this many are outstanding, 0 for no limit */
+	zend_long max_in_flight;
+
+	/* addTaskBackground() tasks not yet accepted by a server, flushed by
+	 * _php_client_autoflush() once there are autoflush_count of them or
+	 * the oldest is autoflush_age ms old */
+	uint32_t background_queued;
+	uint64_t background_since;
+	zend_long autoflush_count;
+	zend_long autoflush_age;
+
+	gearman_client_multi_t *multi;
+
+	/* tasks freed while a completion iterator is open, in that order */
+	uint32_t completions;
+	zval completed;
+
+	/* tasks added with a timeout that are still outstanding */
+	uint32_t deadline_tasks;
+
+	/* outcome of the tasks of the current runTasks() call */
+	php_gearman_completion_policy_t completion_policy;
+	zend_long quorum;
+	/* numbers the runTasks() calls a policy applies to */
+	uint32_t batch;
+	uint32_t batch_succeeded;
+	uint32_t batch_failed;
+	gearman_return_t batch_ret;
+
+	/* what we know about each entry of server_list, see
+	 * _php_client_server(), and the tasks outstanding on all of them */
+	php_gearman_server_t *servers;
+	uint32_t servers_count;
+	uint32_t routed_tasks;
+
+	/* setRouting(), the ring is rebuilt once servers were added */
+	php_gearman_routing_t routing;
+	zend_string *shard_key;
+	php_gearman_ring_point_t *ring;
+	uint32_t ring_size;
+	uint32_t ring_servers;
+	/* setServerWeights(), "host:port" => weight */
+	zval server_weights;
+	uint32_t balance_next;
+
+	/* setCircuitBreaker(), 0 for off */
+	zend_long breaker_threshold;
+	zend_long breaker_cooldown;
+
+	/* do*() sends a copy of the job to another server once the first
+	 * did not answer within hedge_delay ms, or the p95 of the last calls
+	 * when hedge_adaptive is set */
+	zend_long hedge_delay;
+	zend_bool hedge_adaptive;
+	uint64_t hedge_samples[PHP_GEARMAN_HEDGE_SAMPLES];
+	uint32_t hedge_sample_count;
+	uint64_t hedges_sent;
+	uint64_t hedges_won;
+
+	/* php_gearman_latency_t of do*() calls and addTask() tasks by
+	 * function name. With adaptive_multiplier set, calls without a timeout
+	 * of their own get multiplier * p99, within floor and ceiling. */
+	HashTable latencies;
+	double adaptive_multiplier;
+	zend_long adaptive_floor;
+	zend_long adaptive_ceiling;
+
+	/* connections of our own by server_list index, for clients on the
+	 * native engine or with unix:// servers, see _php_client_native_do() */
+	php_gearman_engine_t engine;
+	php_gearman_conn *conns;
+	uint32_t conns_count;
+	uint32_t unix_servers;
+	int32_t conn_last;
+	/* setSocketOptions(), for the connections above */
+	php_gearman_socket_options socket_options;
+
+	/* setKeepalive(), connections idle for keepalive ms are checked with
+	 * an ECHO before the next call uses them, 0 for off */
+	zend_long keepalive;
+	uint64_t keepalive_last;
+	uint64_t keepalive_probes;
+	uint64_t keepalive_failures;
+
 	zend_object std;
 } gearman_client_obj;
 
+zend_class_entry *gearman_completion_iterator_ce;
+zend_object_handlers gearman_completion_iterator_obj_handlers;
+
+zend_object *gearman_completion_iterator_obj_new(zend_class_entry *ce);
+
+/* what GearmanClient::completions() returns */
+typedef struct {
+	zval zclient;
+	zval zcurrent;
+	uint64_t deadline;
+
+	zend_object std;
+} gearman_completion_iterator_obj;
+
+gearman_completion_iterator_obj *gearman_completion_iterator_fetch_object(zend_object *obj);
+
+#define Z_GEARMAN_COMPLETION_ITERATOR_P(zv) gearman_completion_iterator_fetch_object(Z_OBJ_P((zv)))
+
 gearman_client_obj *gearman_client_fetch_object(zend_object *obj);
 
 #define Z_GEARMAN_CLIENT_P(zv) gearman_client_fetch_object(Z_OBJ_P((zv)))
 
+/* PHP level tasks queued or running on the client, internal ones run
+ * on a client of their own */
+#define PHP_GEARMAN_CLIENT_OUTSTANDING(obj) \
+	zend_hash_num_elements(Z_ARRVAL((obj)->task_list))
+
+/* the client has connections of its own, libgearman cannot reach unix
+ * sockets. ping() and stream workloads always use them, do*() and
+ * doBackground() when _php_client_route_do() says so. */
+#define PHP_GEARMAN_CLIENT_NATIVE(obj) \
+	((obj)->engine == GEARMAN_ENGINE_NATIVE || (obj)->unix_servers > 0)
+
+/* a stream workload is read and sent this much at a time */
+#define PHP_GEARMAN_WORKLOAD_CHUNK 65536
+
+void _php_client_check_fork(gearman_client_obj *obj);
+void _php_client_sync_fns(gearman_client_obj *obj);
+void _php_client_shutdown_deferred(zval *clients);
+uint64_t _php_gearman_now_ms(void);
+zend_string *_php_gearman_server_key(const char *server, size_t len);
+void _php_gearman_record_servers(zval *list, const char *servers);
+zend_string *_php_gearman_join_servers(zval *list, uint32_t from);
+int32_t _php_gearman_find_server(zval *list, zend_string *server);
+uint32_t _php_gearman_count_unix(zval *list);
+zend_bool _php_gearman_socket_options(zval *zoptions, php_gearman_socket_options *options);
+void _php_client_autoflush(gearman_client_obj *obj);
+void _php_client_keepalive(gearman_client_obj *obj);
+uint64_t _php_client_expire_tasks(gearman_client_obj *obj, uint64_t now, zend_bool all);
+void _php_client_start_batch(gearman_client_obj *obj);
+zend_bool _php_client_completion_reached(gearman_client_obj *obj);
+gearman_return_t _php_gearman_run_step(gearman_client_st *client, int timeout);
+gearman_return_t _php_client_run_step(gearman_client_obj *obj, int timeout);
+gearman_return_t _php_client_drain(gearman_client_obj *obj, uint32_t limit);
+gearman_client_st *_php_client_server(gearman_client_obj *obj, uint32_t index);
+gearman_client_st *_php_client_internal(gearman_client_obj *obj);
+gearman_client_st *_php_client_route(gearman_client_obj *obj, const char *unique, size_t unique_len, int32_t *server);
+gearman_client_st *_php_client_route_do(gearman_client_obj *obj, const char *unique, size_t unique_len, int32_t *server);
+const char *_php_client_error(gearman_client_obj *obj, gearman_client_st *client);
+void _php_client_server_done(gearman_client_obj *obj, int32_t server, gearman_return_t ret, uint64_t ms);
+zend_bool _php_client_fail_over(gearman_client_obj *obj, int32_t server, gearman_return_t ret, zend_bool background, uint32_t attempts);
+void _php_client_record_latency(gearman_client_obj *obj, const char *function_name, size_t function_name_len, uint64_t ms);
+void _php_client_record_timeout(gearman_client_obj *obj, const char *function_name, size_t function_name_len);
+zend_long _php_client_adaptive_timeout(gearman_client_obj *obj, const char *function_name, size_t function_name_len);
+zend_string *_php_client_do_hedged(gearman_client_obj *obj, gearman_job_priority_t priority,
+                                   const char *function_name, const char *unique,
+                                   zend_string *workload);
+zend_string *_php_client_native_do(gearman_client_obj *obj, gearman_job_priority_t priority, zend_bool background,
+                                   const char *function_name, size_t function_name_len,
+                                   const char *unique, size_t unique_len,
+                                   const char *workload, size_t workload_len, php_stream *stream,
+                                   int32_t server, int timeout);
+gearman_return_t _php_client_native_echo(gearman_client_obj *obj, const char *workload, size_t workload_len);
+const char *_php_client_native_error(gearman_client_obj *obj);
+void _php_client_defer_background(gearman_client_obj *obj, gearman_job_priority_t priority,
+                                  const char *function_name, size_t function_name_len,
+                                  zend_string *workload,
+                                  const char *unique, size_t unique_len);
+
 /* NOTE: It seems kinda weird that GEARMAN_WORK_FAIL is a valid
  * return code, however it is required for a worker to pass status
  * back to the client about a failed job, other return codes can
@@ -86,5 +365,32 @@ PHP_FUNCTION(gearman_client_timeout);
 PHP_FUNCTION(gearman_client_set_timeout);
 PHP_FUNCTION(gearman_client_add_server);
 PHP_FUNCTION(gearman_client_add_servers);
+PHP_FUNCTION(gearman_client_enable_background_sender);
+PHP_FUNCTION(gearman_client_disable_background_sender);
+PHP_FUNCTION(gearman_client_get_stats);
+PHP_FUNCTION(gearman_client_set_deferred_background);
+PHP_FUNCTION(gearman_client_flush_deferred);
+PHP_FUNCTION(gearman_client_set_max_in_flight);
+PHP_FUNCTION(gearman_client_set_auto_flush);
+PHP_FUNCTION(gearman_client_do_multi);
+PHP_FUNCTION(gearman_client_completions);
+PHP_FUNCTION(gearman_client_set_completion_policy);
+PHP_FUNCTION(gearman_client_set_hedging);
+PHP_FUNCTION(gearman_client_set_adaptive_timeout);
+PHP_FUNCTION(gearman_client_set_routing);
+PHP_FUNCTION(gearman_client_set_shard_key);
+PHP_FUNCTION(gearman_client_set_server_weights);
+PHP_FUNCTION(gearman_client_set_circuit_breaker);
+PHP_FUNCTION(gearman_client_connect);
+PHP_FUNCTION(gearman_client_set_keepalive);
+PHP_FUNCTION(gearman_client_set_servers);
+PHP_FUNCTION(gearman_client_set_socket_options);
+PHP_FUNCTION(gearman_client_set_engine);
+PHP_METHOD(GearmanCompletionIterator, __destruct);
+PHP_METHOD(GearmanCompletionIterator, current);
+PHP_METHOD(GearmanCompletionIterator, key);
+PHP_METHOD(GearmanCompletionIterator, next);
+PHP_METHOD(GearmanCompletionIterator, rewind);
+PHP_METHOD(GearmanCompletionIterator, valid);
 
 #endif  /* __PHP_GEARMAN_CLIENT_H */
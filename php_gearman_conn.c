@@ -0,0 +1,604 @@
+/*
+ * Gearman PHP Extension
+ *
+ * Copyright (C) 2008 James M. Luedke <contact@jamesluedke.com>,
+ *			Eric Day <eday@oddments.org>
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the PHP license.  See
+ * the LICENSE file in this directory for full text.
+ */
+
+#include "php.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "php_gearman_conn.h"
+
+#define PHP_GEARMAN_CONN_BUFFER 8192
+
+static uint64_t php_gearman_conn_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Arguments of each command by its number on the wire, the last one
+ * takes the rest of the packet. -1 for numbers that are no command of the
+ * binary protocol. */
+static const int php_gearman_command_args[] = {
+	-1,	/* 0, TEXT is the admin protocol */
+	1,	/* CAN_DO */
+	1,	/* CANT_DO */
+	0,	/* RESET_ABILITIES */
+	0,	/* PRE_SLEEP */
+	-1,	/* 5, unused */
+	0,	/* NOOP */
+	3,	/* SUBMIT_JOB */
+	1,	/* JOB_CREATED */
+	0,	/* GRAB_JOB */
+	0,	/* NO_JOB */
+	3,	/* JOB_ASSIGN */
+	3,	/* WORK_STATUS */
+	2,	/* WORK_COMPLETE */
+	1,	/* WORK_FAIL */
+	1,	/* GET_STATUS */
+	1,	/* ECHO_REQ */
+	1,	/* ECHO_RES */
+	3,	/* SUBMIT_JOB_BG */
+	2,	/* ERROR */
+	5,	/* STATUS_RES */
+	3,	/* SUBMIT_JOB_HIGH */
+	1,	/* SET_CLIENT_ID */
+	2,	/* CAN_DO_TIMEOUT */
+	0,	/* ALL_YOURS */
+	2,	/* WORK_EXCEPTION */
+	1,	/* OPTION_REQ */
+	1,	/* OPTION_RES */
+	2,	/* WORK_DATA */
+	2,	/* WORK_WARNING */
+	0,	/* GRAB_JOB_UNIQ */
+	4,	/* JOB_ASSIGN_UNIQ */
+	3,	/* SUBMIT_JOB_HIGH_BG */
+	3,	/* SUBMIT_JOB_LOW */
+	3,	/* SUBMIT_JOB_LOW_BG */
+	8,	/* SUBMIT_JOB_SCHED */
+	4,	/* SUBMIT_JOB_EPOCH */
+	4,	/* SUBMIT_REDUCE_JOB */
+	4,	/* SUBMIT_REDUCE_JOB_BACKGROUND */
+	0,	/* GRAB_JOB_ALL */
+	5,	/* JOB_ASSIGN_ALL */
+	1,	/* GET_STATUS_UNIQUE */
+	6	/* STATUS_RES_UNIQUE */
+};
+
+int php_gearman_command_argc(uint32_t command) {
+	if (command >= sizeof(php_gearman_command_args) / sizeof(php_gearman_command_args[0])) {
+		return -1;
+	}
+	return php_gearman_command_args[command];
+}
+
+static gearman_return_t php_gearman_conn_fail(php_gearman_conn *conn, gearman_return_t ret, const char *what) {
+	snprintf(conn->error, sizeof(conn->error), "%s: %s", what,
+			 ret == GEARMAN_ERRNO ? strerror(errno) : gearman_strerror(ret));
+	php_gearman_conn_close(conn);
+	return ret;
+}
+
+/* Waits for events on the socket until deadline, 0 for none. */
+static gearman_return_t php_gearman_conn_wait(php_gearman_conn *conn, short events, uint64_t deadline) {
+	struct pollfd pfd;
+	uint64_t now;
+	int timeout = -1, n;
+
+	pfd.fd = conn->fd;
+	pfd.events = events;
+
+	while (1) {
+		if (deadline > 0) {
+			now = php_gearman_conn_now();
+			if (now >= deadline) {
+				return GEARMAN_TIMEOUT;
+			}
+			timeout = (int)(deadline - now);
+		}
+
+		n = poll(&pfd, 1, timeout);
+		if (n > 0) {
+			return GEARMAN_SUCCESS;
+		}
+		if (n == 0) {
+			return GEARMAN_TIMEOUT;
+		}
+		if (errno != EINTR) {
+			return GEARMAN_ERRNO;
+		}
+	}
+}
+
+static gearman_return_t php_gearman_conn_connect(php_gearman_conn *conn, int family,
+				const struct sockaddr *addr, socklen_t addrlen, uint64_t deadline) {
+	gearman_return_t ret;
+	socklen_t len = sizeof(int);
+	int error = 0, one = 1;
+
+	conn->fd = socket(family, SOCK_STREAM, 0);
+	if (conn->fd == -1) {
+		return GEARMAN_ERRNO;
+	}
+	fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+	fcntl(conn->fd, F_SETFD, FD_CLOEXEC);
+
+	/* buffer sizes have to be known before the handshake picks the
+	 * window scale. The options are hints, failing to set one is not
+	 * worth failing the connection for. */
+	if (conn->options.send_size > 0) {
+		setsockopt(conn->fd, SOL_SOCKET, SO_SNDBUF, &conn->options.send_size, sizeof(int));
+	}
+	if (conn->options.recv_size > 0) {
+		setsockopt(conn->fd, SOL_SOCKET, SO_RCVBUF, &conn->options.recv_size, sizeof(int));
+	}
+#ifdef SO_BUSY_POLL
+	if (conn->options.busy_poll > 0) {
+		setsockopt(conn->fd, SOL_SOCKET, SO_BUSY_POLL, &conn->options.busy_poll, sizeof(int));
+	}
+#endif
+
+	conn->tcp = family != AF_UNIX;
+	if (conn->tcp && conn->options.nodelay) {
+		setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+
+	if (connect(conn->fd, addr, addrlen) == 0) {
+		return GEARMAN_SUCCESS;
+	}
+	if (errno != EINPROGRESS) {
+		error = errno;
+		close(conn->fd);
+		conn->fd = -1;
+		errno = error;
+		return GEARMAN_COULD_NOT_CONNECT;
+	}
+
+	ret = php_gearman_conn_wait(conn, POLLOUT, deadline);
+	if (ret == GEARMAN_SUCCESS &&
+		(getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0)) {
+		ret = GEARMAN_COULD_NOT_CONNECT;
+	}
+	if (ret != GEARMAN_SUCCESS) {
+		close(conn->fd);
+		conn->fd = -1;
+		if (error != 0) {
+			errno = error;
+		}
+	}
+	return ret;
+}
+
+static gearman_return_t php_gearman_conn_open_unix(php_gearman_conn *conn, const char *path, uint64_t deadline) {
+	struct sockaddr_un addr;
+
+	if (*path == '\0' || strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return GEARMAN_COULD_NOT_CONNECT;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	return php_gearman_conn_connect(conn, AF_UNIX, (struct sockaddr *)&addr, sizeof(addr), deadline);
+}
+
+/* server is "host[:port]", "[v6 address][:port]" also works. */
+static gearman_return_t php_gearman_conn_open_tcp(php_gearman_conn *conn, const char *server, uint64_t deadline) {
+	struct addrinfo hints, *addrs, *addr;
+	char host[NI_MAXHOST], port[NI_MAXSERV];
+	const char *colon;
+	size_t host_len;
+	gearman_return_t ret = GEARMAN_COULD_NOT_CONNECT;
+
+	if (*server == '[' && (colon = strchr(server, ']')) != NULL) {
+		host_len = colon - server - 1;
+		server++;
+		colon = colon[1] == ':' ? colon + 1 : NULL;
+	} else {
+		colon = strrchr(server, ':');
+		host_len = colon ? (size_t)(colon - server) : strlen(server);
+	}
+
+	if (host_len >= sizeof(host)) {
+		return GEARMAN_GETADDRINFO;
+	}
+	memcpy(host, server, host_len);
+	host[host_len] = '\0';
+	if (colon != NULL && colon[1] != '\0') {
+		snprintf(port, sizeof(port), "%s", colon + 1);
+	} else {
+		snprintf(port, sizeof(port), "%d", GEARMAN_DEFAULT_TCP_PORT);
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	if (getaddrinfo(host_len ? host : GEARMAN_DEFAULT_TCP_HOST, port, &hints, &addrs) != 0) {
+		return GEARMAN_GETADDRINFO;
+	}
+
+	for (addr = addrs; addr != NULL; addr = addr->ai_next) {
+		ret = php_gearman_conn_connect(conn, addr->ai_family, addr->ai_addr, addr->ai_addrlen, deadline);
+		if (ret == GEARMAN_SUCCESS || ret == GEARMAN_TIMEOUT) {
+			break;
+		}
+	}
+	freeaddrinfo(addrs);
+
+	return ret;
+}
+
+void php_gearman_socket_options_init(php_gearman_socket_options *options) {
+	memset(options, 0, sizeof(php_gearman_socket_options));
+	options->nodelay = 1;
+}
+
+void php_gearman_conn_init(php_gearman_conn *conn) {
+	memset(conn, 0, sizeof(php_gearman_conn));
+	conn->fd = -1;
+	php_gearman_socket_options_init(&conn->options);
+}
+
+/* Connects to server, an addServers() entry, unless already connected.
+ * options take effect on the next connect, NULL for the defaults. */
+gearman_return_t php_gearman_conn_open(php_gearman_conn *conn, const char *server, int timeout,
+				const php_gearman_socket_options *options) {
+	uint64_t deadline = timeout >= 0 ? php_gearman_conn_now() + timeout : 0;
+	gearman_return_t ret;
+
+	if (conn->fd != -1) {
+		return GEARMAN_SUCCESS;
+	}
+
+	if (options != NULL) {
+		conn->options = *options;
+	} else {
+		php_gearman_socket_options_init(&conn->options);
+	}
+
+	conn->rstart = conn->rend = 0;
+	conn->error[0] = '\0';
+
+	if (PHP_GEARMAN_IS_UNIX(server)) {
+		ret = php_gearman_conn_open_unix(conn, server + sizeof(PHP_GEARMAN_UNIX_PREFIX) - 1, deadline);
+	} else {
+		ret = php_gearman_conn_open_tcp(conn, server, deadline);
+	}
+
+	if (ret != GEARMAN_SUCCESS) {
+		snprintf(conn->error, sizeof(conn->error), "Unable to connect to %s: %s", server,
+				 ret == GEARMAN_TIMEOUT || ret == GEARMAN_GETADDRINFO ? gearman_strerror(ret) : strerror(errno));
+	}
+	return ret;
+}
+
+/* Writes out all of iov, waiting for the socket until deadline. */
+static gearman_return_t php_gearman_conn_writev(php_gearman_conn *conn, struct iovec *next, int count, uint64_t deadline) {
+	gearman_return_t ret;
+	ssize_t n;
+
+	if (conn->fd == -1) {
+		return php_gearman_conn_fail(conn, GEARMAN_LOST_CONNECTION, "Unable to send");
+	}
+
+	while (count > 0) {
+		n = writev(conn->fd, next, count);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				return php_gearman_conn_fail(conn, GEARMAN_LOST_CONNECTION, "Unable to send");
+			}
+			ret = php_gearman_conn_wait(conn, POLLOUT, deadline);
+			if (ret != GEARMAN_SUCCESS) {
+				return php_gearman_conn_fail(conn, ret, "Unable to send");
+			}
+			continue;
+		}
+
+		while (count > 0 && (size_t)n >= next->iov_len) {
+			n -= next->iov_len;
+			next++;
+			count--;
+		}
+		if (count > 0) {
+			next->iov_base = (char *)next->iov_base + n;
+			next->iov_len -= n;
+		}
+	}
+
+	return GEARMAN_SUCCESS;
+}
+
+/* The header and arguments of a packet. With data set, an argument of
+ * data_size more bytes is announced after them, and a NUL ends the last
+ * of them even if data_size is 0, the argument is still there. */
+static gearman_return_t php_gearman_conn_start(php_gearman_conn *conn, gearman_command_t command,
+				const char **args, const size_t *sizes, uint32_t argc, int data, size_t data_size, int timeout) {
+	struct iovec iov[1 + 2 * PHP_GEARMAN_MAX_ARGS];
+	unsigned char header[PHP_GEARMAN_HEADER_SIZE];
+	uint64_t deadline = timeout >= 0 ? php_gearman_conn_now() + timeout : 0;
+	uint64_t size = data_size;
+	uint32_t value, i;
+	int count = 0;
+
+	iov[count].iov_base = header;
+	iov[count++].iov_len = sizeof(header);
+	for (i = 0; i < argc; i++) {
+		if (i > 0) {
+			iov[count].iov_base = "\0";
+			iov[count++].iov_len = 1;
+			size++;
+		}
+		iov[count].iov_base = (void *)args[i];
+		iov[count++].iov_len = sizes[i];
+		size += sizes[i];
+	}
+	if (data && argc > 0) {
+		iov[count].iov_base = "\0";
+		iov[count++].iov_len = 1;
+		size++;
+	}
+
+	if (size > UINT32_MAX) {
+		snprintf(conn->error, sizeof(conn->error), "Unable to send: packet of %llu bytes is too large",
+				 (unsigned long long)size);
+		return GEARMAN_ARGUMENT_TOO_LARGE;
+	}
+
+	memcpy(header, "\0REQ", 4);
+	value = htonl((uint32_t)command);
+	memcpy(header + 4, &value, 4);
+	value = htonl((uint32_t)size);
+	memcpy(header + 8, &value, 4);
+
+	return php_gearman_conn_writev(conn, iov, count, deadline);
+}
+
+/* Sends a request, the header and the arguments go out in one writev(). */
+gearman_return_t php_gearman_conn_send(php_gearman_conn *conn, gearman_command_t command,
+				const char **args, const size_t *sizes, uint32_t argc, int timeout) {
+	return php_gearman_conn_start(conn, command, args, sizes, argc, 0, 0, timeout);
+}
+
+/* Sends a packet whose last argument, data_size bytes of it, is written
+ * by the caller with php_gearman_conn_write() afterwards. */
+gearman_return_t php_gearman_conn_send_header(php_gearman_conn *conn, gearman_command_t command,
+				const char **args, const size_t *sizes, uint32_t argc, size_t data_size, int timeout) {
+	return php_gearman_conn_start(conn, command, args, sizes, argc, 1, data_size, timeout);
+}
+
+/* Raw bytes of a packet started with php_gearman_conn_send_header(). */
+gearman_return_t php_gearman_conn_write(php_gearman_conn *conn, const char *data, size_t len, int timeout) {
+	struct iovec iov;
+
+	iov.iov_base = (void *)data;
+	iov.iov_len = len;
+	return php_gearman_conn_writev(conn, &iov, 1, timeout >= 0 ? php_gearman_conn_now() + timeout : 0);
+}
+
+/* Reads until the buffer holds at least need bytes from rstart on. */
+static gearman_return_t php_gearman_conn_fill(php_gearman_conn *conn, size_t need, uint64_t deadline) {
+	gearman_return_t ret;
+	ssize_t n;
+
+	if (conn->rsize < need) {
+		conn->rsize = MAX(need, PHP_GEARMAN_CONN_BUFFER);
+		conn->rbuf = erealloc(conn->rbuf, conn->rsize);
+	}
+
+	while (conn->rend < need) {
+		n = read(conn->fd, conn->rbuf + conn->rend, conn->rsize - conn->rend);
+		if (n > 0) {
+			conn->rend += n;
+#ifdef TCP_QUICKACK
+			/* the kernel falls back to delayed ACKs on its own */
+			if (conn->tcp && conn->options.quickack) {
+				setsockopt(conn->fd, IPPROTO_TCP, TCP_QUICKACK, &conn->options.quickack, sizeof(int));
+			}
+#endif
+			continue;
+		}
+		if (n == 0) {
+			return GEARMAN_LOST_CONNECTION;
+		}
+		if (errno == EINTR) {
+			continue;
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			return GEARMAN_LOST_CONNECTION;
+		}
+		ret = php_gearman_conn_wait(conn, POLLIN, deadline);
+		if (ret != GEARMAN_SUCCESS) {
+			return ret;
+		}
+	}
+
+	return GEARMAN_SUCCESS;
+}
+
+/* Reads the next response. */
+gearman_return_t php_gearman_conn_recv(php_gearman_conn *conn, php_gearman_packet *packet, int timeout) {
+	uint64_t deadline = timeout >= 0 ? php_gearman_conn_now() + timeout : 0;
+	gearman_return_t ret;
+	uint32_t value, size, i;
+	const char *start, *nul;
+	size_t left;
+	int argc;
+
+	if (conn->fd == -1) {
+		return php_gearman_conn_fail(conn, GEARMAN_LOST_CONNECTION, "Unable to receive");
+	}
+
+	/* what the previous packet left behind moves to the front */
+	if (conn->rstart > 0) {
+		memmove(conn->rbuf, conn->rbuf + conn->rstart, conn->rend - conn->rstart);
+		conn->rend -= conn->rstart;
+		conn->rstart = 0;
+	}
+
+	ret = php_gearman_conn_fill(conn, PHP_GEARMAN_HEADER_SIZE, deadline);
+	if (ret != GEARMAN_SUCCESS) {
+		return php_gearman_conn_fail(conn, ret, "Unable to receive");
+	}
+
+	if (memcmp(conn->rbuf, "\0RES", 4) != 0) {
+		return php_gearman_conn_fail(conn, GEARMAN_INVALID_MAGIC, "Unable to receive");
+	}
+	memcpy(&value, conn->rbuf + 4, 4);
+	packet->command = (gearman_command_t)ntohl(value);
+	memcpy(&value, conn->rbuf + 8, 4);
+	size = ntohl(value);
+
+	/* more arguments than a client or worker is ever sent */
+	argc = php_gearman_command_argc((uint32_t)packet->command);
+	if (argc < 0 || argc > PHP_GEARMAN_MAX_ARGS) {
+		return php_gearman_conn_fail(conn, GEARMAN_INVALID_COMMAND, "Unable to receive");
+	}
+
+	/* the size is the server's word, a corrupt or hostile one must not
+	 * make us allocate gigabytes */
+	if (size > PHP_GEARMAN_MAX_PACKET_SIZE) {
+		php_gearman_conn_close(conn);
+		snprintf(conn->error, sizeof(conn->error), "Unable to receive: packet of %u bytes is larger than %u",
+				 size, (uint32_t)PHP_GEARMAN_MAX_PACKET_SIZE);
+		return GEARMAN_ARGUMENT_TOO_LARGE;
+	}
+
+	ret = php_gearman_conn_fill(conn, PHP_GEARMAN_HEADER_SIZE + (size_t)size, deadline);
+	if (ret != GEARMAN_SUCCESS) {
+		return php_gearman_conn_fail(conn, ret, "Unable to receive");
+	}
+
+	start = conn->rbuf + PHP_GEARMAN_HEADER_SIZE;
+	left = size;
+	packet->argc = (uint32_t)argc;
+	for (i = 0; i < packet->argc; i++) {
+		packet->args[i] = start;
+		if (i + 1 == packet->argc) {
+			packet->sizes[i] = left;
+			break;
+		}
+		nul = memchr(start, '\0', left);
+		if (nul == NULL) {
+			return php_gearman_conn_fail(conn, GEARMAN_INVALID_PACKET, "Unable to receive");
+		}
+		packet->sizes[i] = nul - start;
+		left -= packet->sizes[i] + 1;
+		start = nul + 1;
+	}
+	if (argc == 0 && size > 0) {
+		return php_gearman_conn_fail(conn, GEARMAN_INVALID_PACKET, "Unable to receive");
+	}
+
+	conn->rstart = PHP_GEARMAN_HEADER_SIZE + (size_t)size;
+	return GEARMAN_SUCCESS;
+}
+
+/* Waits until one of the count connections has a response to read. The
+ * index of the first one is stored in ready. Closed connections are left
+ * out, GEARMAN_NO_ACTIVE_FDS if that is all of them. */
+gearman_return_t php_gearman_conn_select(php_gearman_conn **conns, uint32_t count, int timeout, uint32_t *ready) {
+	uint64_t deadline = timeout >= 0 ? php_gearman_conn_now() + timeout : 0, now;
+	struct pollfd *pfds;
+	uint32_t *indexes, polled = 0, i;
+	gearman_return_t ret = GEARMAN_TIMEOUT;
+	int n;
+
+	/* a response already read along with an earlier one */
+	for (i = 0; i < count; i++) {
+		if (conns[i]->fd != -1 && conns[i]->rend > conns[i]->rstart) {
+			*ready = i;
+			return GEARMAN_SUCCESS;
+		}
+	}
+
+	pfds = safe_emalloc(count, sizeof(struct pollfd), 0);
+	indexes = safe_emalloc(count, sizeof(uint32_t), 0);
+	for (i = 0; i < count; i++) {
+		if (conns[i]->fd == -1) {
+			continue;
+		}
+		pfds[polled].fd = conns[i]->fd;
+		pfds[polled].events = POLLIN;
+		pfds[polled].revents = 0;
+		indexes[polled++] = i;
+	}
+
+	if (polled == 0) {
+		ret = GEARMAN_NO_ACTIVE_FDS;
+	}
+	while (polled > 0) {
+		timeout = -1;
+		if (deadline > 0) {
+			now = php_gearman_conn_now();
+			if (now >= deadline) {
+				break;
+			}
+			timeout = (int)(deadline - now);
+		}
+
+		n = poll(pfds, polled, timeout);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		}
+		if (n == -1) {
+			ret = GEARMAN_ERRNO;
+		}
+		for (i = 0; n > 0 && i < polled; i++) {
+			if (pfds[i].revents != 0) {
+				*ready = indexes[i];
+				ret = GEARMAN_SUCCESS;
+				break;
+			}
+		}
+		break;
+	}
+
+	efree(pfds);
+	efree(indexes);
+	return ret;
+}
+
+/* Closes the socket, a later open() connects again. */
+void php_gearman_conn_close(php_gearman_conn *conn) {
+	if (conn->fd != -1) {
+		close(conn->fd);
+		conn->fd = -1;
+	}
+	conn->rstart = conn->rend = 0;
+}
+
+void php_gearman_conn_free(php_gearman_conn *conn) {
+	php_gearman_conn_close(conn);
+	if (conn->rbuf != NULL) {
+		efree(conn->rbuf);
+		conn->rbuf = NULL;
+	}
+	conn->rsize = 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Gearman PHP Extension
+ *
+ * Copyright (C) 2008 James M. Luedke <contact@jamesluedke.com>,
+ *			Eric Day <eday@oddments.org>
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the PHP license.  See
+ * the LICENSE file in this directory for full text.
+ */
+
+#ifndef __PHP_GEARMAN_CONN_H
+#define __PHP_GEARMAN_CONN_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <libgearman-1.0/gearman.h>
+
+/* servers given as unix:///path/to/socket are connected to by the
+ * extension itself, libgearman only knows about TCP */
+#define PHP_GEARMAN_UNIX_PREFIX "unix://"
+#define PHP_GEARMAN_IS_UNIX(server) \
+	(strncmp((server), PHP_GEARMAN_UNIX_PREFIX, sizeof(PHP_GEARMAN_UNIX_PREFIX) - 1) == 0)
+
+/* setEngine(), GEARMAN_ENGINE_NATIVE runs the hot commands over
+ * php_gearman_conn instead of libgearman */
+typedef enum {
+	GEARMAN_ENGINE_LIBGEARMAN = 0,
+	GEARMAN_ENGINE_NATIVE = 1
+} php_gearman_engine_t;
+
+#define PHP_GEARMAN_HEADER_SIZE 12
+/* largest response php_gearman_conn_recv() reads, arguments and all */
+#define PHP_GEARMAN_MAX_PACKET_SIZE (64 * 1024 * 1024)
+#define PHP_GEARMAN_MAX_ARGS 5
+/* most arguments any command has, SUBMIT_JOB_SCHED */
+#define PHP_GEARMAN_COMMAND_MAX_ARGS 8
+
+/* A response read by php_gearman_conn_recv(). The arguments point into
+ * the connection's buffer and stay valid until the next recv. */
+typedef struct {
+	gearman_command_t command;
+	uint32_t argc;
+	const char *args[PHP_GEARMAN_MAX_ARGS];
+	size_t sizes[PHP_GEARMAN_MAX_ARGS];
+} php_gearman_packet;
+
+/* setsockopt()s applied to every connection, 0 leaves the system
+ * default. Only nodelay is on unless asked otherwise. */
+typedef struct {
+	int send_size;	/* SO_SNDBUF */
+	int recv_size;	/* SO_RCVBUF */
+	int nodelay;	/* TCP_NODELAY */
+	int quickack;	/* TCP_QUICKACK, armed again after every read */
+	int busy_poll;	/* SO_BUSY_POLL, in us */
+} php_gearman_socket_options;
+
+/* One connection to one job server, speaking the binary protocol over a
+ * non-blocking socket. Timeouts are in ms, -1 waits forever. */
+typedef struct {
+	int fd;
+	int tcp;
+	php_gearman_socket_options options;
+	char *rbuf;
+	size_t rsize;
+	size_t rstart;
+	size_t rend;
+	char error[256];
+} php_gearman_conn;
+
+int php_gearman_command_argc(uint32_t command);
+void php_gearman_socket_options_init(php_gearman_socket_options *options);
+void php_gearman_conn_init(php_gearman_conn *conn);
+gearman_return_t php_gearman_conn_open(php_gearman_conn *conn, const char *server, int timeout,
+				const php_gearman_socket_options *options);
+gearman_return_t php_gearman_conn_send(php_gearman_conn *conn, gearman_command_t command,
+				const char **args, const size_t *sizes, uint32_t argc, int timeout);
+gearman_return_t php_gearman_conn_send_header(php_gearman_conn *conn, gearman_command_t command,
+				const char **args, const size_t *sizes, uint32_t argc, size_t data_size, int timeout);
+gearman_return_t php_gearman_conn_write(php_gearman_conn *conn, const char *data, size_t len, int timeout);
+gearman_return_t php_gearman_conn_recv(php_gearman_conn *conn, php_gearman_packet *packet, int timeout);
+gearman_return_t php_gearman_conn_select(php_gearman_conn **conns, uint32_t count, int timeout, uint32_t *ready);
+void php_gearman_conn_close(php_gearman_conn *conn);
+void php_gearman_conn_free(php_gearman_conn *conn);
+
+#endif  /* __PHP_GEARMAN_CONN_H */
@@ -0,0 +1,179 @@
+/*
+ * Gearman PHP Extension
+ *
+ * Copyright (C) 2008 James M. Luedke <contact@jamesluedke.com>,
+ *			Eric Day <eday@oddments.org>
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the PHP license.  See
+ * the LICENSE file in this directory for full text.
+ */
+
+#include <arpa/inet.h>
+
+#include "php_gearman_packet.h"
+
+/* {{{ proto string GearmanPacket::encode(int command, array args [, bool response])
+   Builds a packet in one string, a request unless response is set. args holds one string per argument of the command, only the last one may contain NUL bytes. */
+PHP_FUNCTION(gearman_packet_encode) {
+        zend_long command;
+        zend_bool response = 0, error = 0;
+        zend_string *packet, *strs[PHP_GEARMAN_COMMAND_MAX_ARGS];
+        zval *zargs, *zarg;
+        uint32_t count, value, i = 0;
+        size_t size = 0;
+        char *p;
+        int argc;
+
+        if (zend_parse_parameters(ZEND_NUM_ARGS(), "la|b", &command, &zargs, &response) == FAILURE) {
+                RETURN_FALSE;
+        }
+
+        argc = command >= 0 && command <= UINT32_MAX ? php_gearman_command_argc((uint32_t) command) : -1;
+        if (argc < 0) {
+                php_error_docref(NULL, E_WARNING, "Invalid command: " ZEND_LONG_FMT, command);
+                RETURN_FALSE;
+        }
+
+        count = zend_hash_num_elements(Z_ARRVAL_P(zargs));
+        if (count != (uint32_t) argc) {
+                php_error_docref(NULL, E_WARNING, "Command " ZEND_LONG_FMT " takes %d arguments, %u given", command, argc, count);
+                RETURN_FALSE;
+        }
+
+        ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(zargs), zarg) {
+                strs[i] = zval_get_string(zarg);
+                size += ZSTR_LEN(strs[i]) + (i > 0 ? 1 : 0);
+                i++;
+        } ZEND_HASH_FOREACH_END();
+
+        if (size > UINT32_MAX) {
+                php_error_docref(NULL, E_WARNING, "Packet is too large");
+                error = 1;
+        }
+        for (i = 0; !error && i + 1 < count; i++) {
+                if (memchr(ZSTR_VAL(strs[i]), '\0', ZSTR_LEN(strs[i])) != NULL) {
+                        php_error_docref(NULL, E_WARNING, "Only the last argument may contain NUL bytes");
+                        error = 1;
+                }
+        }
+        if (error) {
+                for (i = 0; i < count; i++) {
+                        zend_string_release(strs[i]);
+                }
+                RETURN_FALSE;
+        }
+
+        packet = zend_string_alloc(PHP_GEARMAN_HEADER_SIZE + size, 0);
+        p = ZSTR_VAL(packet);
+
+        memcpy(p, response ? "\0RES" : "\0REQ", 4);
+        value = htonl((uint32_t) command);
+        memcpy(p + 4, &value, 4);
+        value = htonl((uint32_t) size);
+        memcpy(p + 8, &value, 4);
+        p += PHP_GEARMAN_HEADER_SIZE;
+
+        for (i = 0; i < count; i++) {
+                if (i > 0) {
+                        *p++ = '\0';
+                }
+                memcpy(p, ZSTR_VAL(strs[i]), ZSTR_LEN(strs[i]));
+                p += ZSTR_LEN(strs[i]);
+                zend_string_release(strs[i]);
+        }
+        *p = '\0';
+
+        RETURN_NEW_STR(packet);
+}
+/* }}} */
+
+/* {{{ proto array GearmanPacket::decode(string buffer [, int offset [, bool slices]])
+   Decodes the packet at offset in buffer. Returns null while buffer does not hold all of it yet, so data read from a socket can be appended and decoded again, and false for bytes that are no valid packet. The array has magic ("REQ" or "RES"), command, size, the bytes the packet takes so the next one starts at offset + size, and args. With slices set args are [offset, length] pairs into buffer instead of copies. */
+PHP_FUNCTION(gearman_packet_decode) {
+        zend_string *buffer;
+        zend_long offset = 0;
+        zend_bool slices = 0;
+        const char *start, *magic, *nul;
+        uint32_t command, size, value, i;
+        size_t left, arg_len;
+        zval args, slice;
+        int argc;
+
+        if (zend_parse_parameters(ZEND_NUM_ARGS(), "S|lb", &buffer, &offset, &slices) == FAILURE) {
+                RETURN_FALSE;
+        }
+
+        if (offset < 0 || (size_t) offset > ZSTR_LEN(buffer)) {
+                php_error_docref(NULL, E_WARNING, "Offset is outside of the buffer");
+                RETURN_FALSE;
+        }
+
+        left = ZSTR_LEN(buffer) - (size_t) offset;
+        if (left < PHP_GEARMAN_HEADER_SIZE) {
+                RETURN_NULL();
+        }
+
+        start = ZSTR_VAL(buffer) + offset;
+        magic = start + 1;
+        if (start[0] != '\0' || (memcmp(magic, "REQ", 3) != 0 && memcmp(magic, "RES", 3) != 0)) {
+                php_error_docref(NULL, E_WARNING, "Invalid magic");
+                RETURN_FALSE;
+        }
+
+        memcpy(&value, start + 4, 4);
+        command = ntohl(value);
+        memcpy(&value, start + 8, 4);
+        size = ntohl(value);
+
+        argc = php_gearman_command_argc(command);
+        if (argc < 0) {
+                php_error_docref(NULL, E_WARNING, "Invalid command: %u", command);
+                RETURN_FALSE;
+        }
+        if (argc == 0 && size > 0) {
+                php_error_docref(NULL, E_WARNING, "Command %u takes no arguments, got %u bytes", command, size);
+                RETURN_FALSE;
+        }
+
+        if (left - PHP_GEARMAN_HEADER_SIZE < size) {
+                RETURN_NULL();
+        }
+
+        array_init_size(&args, (uint32_t) argc);
+        start += PHP_GEARMAN_HEADER_SIZE;
+        left = size;
+        for (i = 0; i < (uint32_t) argc; i++) {
+                arg_len = left;
+                if (i + 1 < (uint32_t) argc) {
+                        nul = memchr(start, '\0', left);
+                        if (nul == NULL) {
+                                php_error_docref(NULL, E_WARNING, "Command %u takes %d arguments, got %u", command, argc, i + 1);
+                                zval_dtor(&args);
+                                RETURN_FALSE;
+                        }
+                        arg_len = nul - start;
+                }
+
+                if (slices) {
+                        array_init_size(&slice, 2);
+                        add_next_index_long(&slice, (zend_long) (start - ZSTR_VAL(buffer)));
+                        add_next_index_long(&slice, (zend_long) arg_len);
+                        add_next_index_zval(&args, &slice);
+                } else {
+                        add_next_index_stringl(&args, start, arg_len);
+                }
+
+                if (i + 1 < (uint32_t) argc) {
+                        start += arg_len + 1;
+                        left -= arg_len + 1;
+                }
+        }
+
+        array_init_size(return_value, 4);
+        add_assoc_stringl(return_value, "magic", (char *) magic, 3);
+        add_assoc_long(return_value, "command", (zend_long) command);
+        add_assoc_long(return_value, "size", (zend_long) PHP_GEARMAN_HEADER_SIZE + size);
+        add_assoc_zval(return_value, "args", &args);
+}
+/* }}} */
@@ -0,0 +1,29 @@
+/*
+ * Gearman PHP Extension
+ *
+ * Copyright (C) 2008 James M. Luedke <contact@jamesluedke.com>,
+ *			Eric Day <eday@oddments.org>
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the PHP license.  See
+ * the LICENSE file in this directory for full text.
+ */
+
+#ifndef __PHP_GEARMAN_PACKET_H
+#define __PHP_GEARMAN_PACKET_H
+
+#include "php.h"
+#include "php_ini.h"
+#include "ext/standard/info.h"
+
+#include "php_gearman.h"
+#include "php_gearman_conn.h"
+
+/* GearmanPacket, the binary protocol's framing for code that inspects,
+ * records or proxies traffic. Only static methods, no state. */
+zend_class_entry *gearman_packet_ce;
+
+PHP_FUNCTION(gearman_packet_encode);
+PHP_FUNCTION(gearman_packet_decode);
+
+#endif  /* __PHP_GEARMAN_PACKET_H */
@@ -0,0 +1,260 @@
+/*
+ * Gearman PHP Extension
+ *
+ * Copyright (C) 2008 James M. Luedke <contact@jamesluedke.com>,
+ *			Eric Day <eday@oddments.org>
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the PHP license.  See
+ * the LICENSE file in this directory for full text.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "php_gearman_sender.h"
+
+static uint64_t php_gearman_sender_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Releases everything, including the jobs that were never sent. */
+static void php_gearman_sender_destroy(php_gearman_sender *sender) {
+	while (sender->head != sender->tail) {
+		free(sender->slots[sender->head & sender->mask]);
+		sender->head++;
+	}
+
+	sem_destroy(&sender->used);
+	sem_destroy(&sender->free);
+	sem_destroy(&sender->done);
+	gearman_client_free(sender->client);
+	free(sender->slots);
+	free(sender);
+}
+
+static void *php_gearman_sender_main(void *arg) {
+	php_gearman_sender *sender = (php_gearman_sender *)arg;
+	php_gearman_sender_job *job;
+	gearman_job_handle_t job_handle;
+	gearman_return_t ret;
+	uint64_t now;
+	int left;
+
+	while (1) {
+		while (sem_wait(&sender->used) == -1 && errno == EINTR);
+
+		/* an extra post without a job means we are asked to stop,
+		 * it always comes after everything queued before it */
+		if (sender->head == __atomic_load_n(&sender->tail, __ATOMIC_ACQUIRE)) {
+			if (__atomic_load_n(&sender->stop, __ATOMIC_ACQUIRE)) {
+				break;
+			}
+			continue;
+		}
+
+		/* once stopping, each submit only gets what is left of the
+		 * drain, the rest stays in the ring and is dropped */
+		if (__atomic_load_n(&sender->stop, __ATOMIC_ACQUIRE)) {
+			now = php_gearman_sender_now();
+			if (now >= sender->deadline) {
+				break;
+			}
+			left = (int) (sender->deadline - now);
+			gearman_client_set_timeout(sender->client,
+					sender->timeout >= 0 && sender->timeout < left ? sender->timeout : left);
+		}
+
+		job = sender->slots[sender->head & sender->mask];
+		__atomic_store_n(&sender->head, sender->head + 1, __ATOMIC_RELEASE);
+		sem_post(&sender->free);
+
+		ret = job->submit(sender->client,
+				job->function_name,
+				job->unique,
+				job->workload,
+				job->workload_size,
+				job_handle);
+
+		if (gearman_failed(ret)) {
+			__atomic_fetch_add(&sender->errors, 1, __ATOMIC_RELAXED);
+		} else {
+			__atomic_fetch_add(&sender->sent, 1, __ATOMIC_RELAXED);
+		}
+
+		free(job);
+	}
+
+	sem_post(&sender->done);
+
+	/* whoever gets here second cleans up, see php_gearman_sender_free() */
+	if (__atomic_exchange_n(&sender->detached, 1, __ATOMIC_ACQ_REL)) {
+		php_gearman_sender_destroy(sender);
+	}
+
+	return NULL;
+}
+
+/* Starts a sender thread with its own libgearman client connected to
+ * servers. Returns NULL if any of the resources could not be set up. */
+php_gearman_sender *php_gearman_sender_create(const char *servers, int timeout, uint32_t capacity, php_gearman_sender_policy_t policy) {
+	php_gearman_sender *sender;
+	uint32_t slots = 1;
+
+	if (capacity == 0 || capacity > ((uint32_t) 1 << 31)) {
+		return NULL;
+	}
+	while (slots < capacity) {
+		slots <<= 1;
+	}
+
+	sender = calloc(1, sizeof(php_gearman_sender));
+	if (sender == NULL) {
+		return NULL;
+	}
+
+	sender->slots = calloc(slots, sizeof(php_gearman_sender_job *));
+	if (sender->slots == NULL) {
+		free(sender);
+		return NULL;
+	}
+
+	sender->mask = slots - 1;
+	sender->capacity = capacity;
+	sender->policy = policy;
+
+	sender->client = gearman_client_create(NULL);
+	if (sender->client == NULL) {
+		free(sender->slots);
+		free(sender);
+		return NULL;
+	}
+
+	if (gearman_failed(gearman_client_add_servers(sender->client, servers))) {
+		gearman_client_free(sender->client);
+		free(sender->slots);
+		free(sender);
+		return NULL;
+	}
+	gearman_client_set_timeout(sender->client, timeout);
+	sender->timeout = timeout;
+
+	sem_init(&sender->used, 0, 0);
+	sem_init(&sender->free, 0, capacity);
+	sem_init(&sender->done, 0, 0);
+
+	if (pthread_create(&sender->thread, NULL, php_gearman_sender_main, sender) != 0) {
+		sem_destroy(&sender->used);
+		sem_destroy(&sender->free);
+		sem_destroy(&sender->done);
+		gearman_client_free(sender->client);
+		free(sender->slots);
+		free(sender);
+		return NULL;
+	}
+
+	return sender;
+}
+
+/* Queues a background submission. Returns GEARMAN_JOB_QUEUE_FULL when the
+ * ring is full and the policy is not GEARMAN_SENDER_BLOCK, in which case
+ * the job was either dropped or has to be spilled by the caller. */
+gearman_return_t php_gearman_sender_push(php_gearman_sender *sender,
+				php_gearman_background_fn submit,
+				const char *function_name, size_t function_name_len,
+				const char *unique, size_t unique_len,
+				const char *workload, size_t workload_len) {
+	php_gearman_sender_job *job;
+	char *buf;
+
+	if (sender->policy == GEARMAN_SENDER_BLOCK) {
+		while (sem_wait(&sender->free) == -1 && errno == EINTR);
+	} else if (sem_trywait(&sender->free) == -1) {
+		if (sender->policy == GEARMAN_SENDER_DROP) {
+			__atomic_fetch_add(&sender->dropped, 1, __ATOMIC_RELAXED);
+		} else {
+			__atomic_fetch_add(&sender->spilled, 1, __ATOMIC_RELAXED);
+		}
+		return GEARMAN_JOB_QUEUE_FULL;
+	}
+
+	job = malloc(sizeof(php_gearman_sender_job) + function_name_len + 1 + unique_len + 1 + workload_len + 1);
+	if (job == NULL) {
+		sem_post(&sender->free);
+		return GEARMAN_MEMORY_ALLOCATION_FAILURE;
+	}
+
+	buf = (char *)(job + 1);
+
+	job->submit = submit;
+
+	job->function_name = buf;
+	memcpy(buf, function_name, function_name_len);
+	buf[function_name_len] = '\0';
+	buf += function_name_len + 1;
+
+	job->unique = NULL;
+	if (unique != NULL) {
+		job->unique = buf;
+		memcpy(buf, unique, unique_len);
+		buf[unique_len] = '\0';
+		buf += unique_len + 1;
+	}
+
+	job->workload = buf;
+	memcpy(buf, workload, workload_len);
+	buf[workload_len] = '\0';
+	job->workload_size = workload_len;
+
+	sender->slots[sender->tail & sender->mask] = job;
+	__atomic_store_n(&sender->tail, sender->tail + 1, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&sender->queued, 1, __ATOMIC_RELAXED);
+	sem_post(&sender->used);
+
+	return GEARMAN_SUCCESS;
+}
+
+/* Number of submissions waiting in the ring. */
+uint32_t php_gearman_sender_pending(php_gearman_sender *sender) {
+	return __atomic_load_n(&sender->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&sender->head, __ATOMIC_ACQUIRE);
+}
+
+/* Lets the thread drain whatever is still queued for up to timeout
+ * milliseconds, then tears it down. Returns how many jobs were dropped
+ * because the drain ran out of time. A thread still stuck in a submit
+ * at that point is left to finish it and clean up after itself. */
+uint32_t php_gearman_sender_free(php_gearman_sender *sender, int timeout) {
+	struct timespec ts;
+	uint32_t dropped;
+	int waited;
+
+	sender->deadline = php_gearman_sender_now() + timeout;
+	__atomic_store_n(&sender->stop, 1, __ATOMIC_RELEASE);
+	sem_post(&sender->used);
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout / 1000;
+	ts.tv_nsec += (long) (timeout % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	while ((waited = sem_timedwait(&sender->done, &ts)) == -1 && errno == EINTR);
+
+	dropped = php_gearman_sender_pending(sender);
+
+	if (waited == -1 && !__atomic_exchange_n(&sender->detached, 1, __ATOMIC_ACQ_REL)) {
+		pthread_detach(sender->thread);
+		return dropped;
+	}
+
+	pthread_join(sender->thread, NULL);
+	php_gearman_sender_destroy(sender);
+
+	return dropped;
+}
@@ -0,0 +1,92 @@
+/*
+ * Gearman PHP Extension
+ *
+ * Copyright (C) 2008 James M. Luedke <contact@jamesluedke.com>,
+ *			Eric Day <eday@oddments.org>
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the PHP license.  See
+ * the LICENSE file in this directory for full text.
+ */
+
+#ifndef __PHP_GEARMAN_SENDER_H
+#define __PHP_GEARMAN_SENDER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <libgearman-1.0/gearman.h>
+
+/* how long stopping the thread waits for the ring to drain, in ms */
+#define PHP_GEARMAN_SENDER_DRAIN_TIMEOUT 5000
+
+/* what GearmanClient::doBackground() does when the ring is full */
+typedef enum {
+	GEARMAN_SENDER_BLOCK = 0,
+	GEARMAN_SENDER_DROP = 1,
+	GEARMAN_SENDER_SPILL = 2
+} php_gearman_sender_policy_t;
+
+typedef gearman_return_t (*php_gearman_background_fn)(
+				gearman_client_st *client,
+				const char *function_name,
+				const char *unique,
+				const void *workload,
+				size_t workload_size,
+				gearman_job_handle_t job_handle);
+
+/* A queued submission. Strings live in the same malloc() block right
+ * after the struct, the sender thread frees it once it is sent. */
+typedef struct {
+	php_gearman_background_fn submit;
+	char *function_name;
+	char *unique;
+	char *workload;
+	size_t workload_size;
+} php_gearman_sender_job;
+
+/* Single producer (the PHP thread) / single consumer (the sender thread)
+ * ring. The semaphores count used and free slots, so neither side ever
+ * takes a lock to move head or tail. head and tail run freely and wrap at
+ * 2^32, slots has a power of two entries so masking them stays in step
+ * across the wrap. At most capacity of them are in use. Nothing in here
+ * may touch the Zend allocator, the sender thread runs outside of the
+ * engine. */
+typedef struct {
+	php_gearman_sender_job **slots;
+	uint32_t mask;
+	uint32_t capacity;
+	uint32_t head;
+	uint32_t tail;
+	sem_t used;
+	sem_t free;
+	/* posted by the thread as it exits */
+	sem_t done;
+
+	php_gearman_sender_policy_t policy;
+	int stop;
+	/* set by whichever of the two threads lets go of the sender first */
+	int detached;
+	uint64_t deadline;
+	int timeout;
+	pthread_t thread;
+	gearman_client_st *client;
+
+	uint64_t queued;
+	uint64_t sent;
+	uint64_t dropped;
+	uint64_t spilled;
+	uint64_t errors;
+} php_gearman_sender;
+
+php_gearman_sender *php_gearman_sender_create(const char *servers, int timeout, uint32_t capacity, php_gearman_sender_policy_t policy);
+gearman_return_t php_gearman_sender_push(php_gearman_sender *sender,
+				php_gearman_background_fn submit,
+				const char *function_name, size_t function_name_len,
+				const char *unique, size_t unique_len,
+				const char *workload, size_t workload_len);
+uint32_t php_gearman_sender_pending(php_gearman_sender *sender);
+uint32_t php_gearman_sender_free(php_gearman_sender *sender, int timeout);
+
+#endif  /* __PHP_GEARMAN_SENDER_H */
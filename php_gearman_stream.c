@@ -0,0 +1,113 @@
+/*
+ * Gearman PHP Extension
+ *
+ * Copyright (C) 2008 James M. Luedke <contact@jamesluedke.com>,
+ *			Eric Day <eday@oddments.org>
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the PHP license.  See
+ * the LICENSE file in this directory for full text.
+ */
+
+#include "php_gearman_stream.h"
+
+/* GearmanTask::getStream(), holds the task while the stream is open */
+typedef struct {
+        zval ztask;
+} php_gearman_task_stream;
+
+/* Reads straight off the connection, as much of the packet as is left
+ * and fits into buf. */
+static PHP_GEARMAN_STREAM_RET php_gearman_task_stream_read(php_stream *stream, char *buf, size_t count) {
+        php_gearman_task_stream *self = (php_gearman_task_stream *) stream->abstract;
+        gearman_task_obj *task = Z_GEARMAN_TASK_P(&self->ztask);
+        gearman_client_obj *client = Z_GEARMAN_CLIENT_P(&task->zclient);
+        gearman_client_st *target;
+        size_t n;
+
+        while (1) {
+                if (task->recv_left == 0 || !(task->flags & GEARMAN_TASK_OBJ_CREATED)) {
+                        stream->eof = 1;
+                        return 0;
+                }
+
+                n = gearman_task_recv_data(task->task, buf, MIN(count, task->recv_left), &task->ret);
+                if (n > 0) {
+                        task->recv_left -= n;
+                        return (PHP_GEARMAN_STREAM_RET) n;
+                }
+                if (task->ret != GEARMAN_IO_WAIT) {
+                        break;
+                }
+
+                /* libgearman runs tasks non-blocking, wait for the rest here */
+                target = task->server >= 0 ? client->servers[task->server].client : &(client->client);
+                task->ret = gearman_client_wait(target);
+                if (task->ret != GEARMAN_SUCCESS) {
+                        break;
+                }
+        }
+
+        php_error_docref(NULL, E_WARNING, "Unable to read task data: %s", gearman_strerror(task->ret));
+        stream->eof = 1;
+        return PHP_GEARMAN_STREAM_ERROR;
+}
+
+static PHP_GEARMAN_STREAM_RET php_gearman_task_stream_write(php_stream *stream, const char *buf, size_t count) {
+        return PHP_GEARMAN_STREAM_ERROR;
+}
+
+static int php_gearman_task_stream_close(php_stream *stream, int close_handle) {
+        php_gearman_task_stream *self = (php_gearman_task_stream *) stream->abstract;
+
+        zval_ptr_dtor(&self->ztask);
+        efree(self);
+        return 0;
+}
+
+static php_stream_ops php_gearman_task_stream_ops = {
+        php_gearman_task_stream_write,
+        php_gearman_task_stream_read,
+        php_gearman_task_stream_close,
+        NULL, /* flush */
+        "gearman",
+        NULL, /* seek */
+        NULL, /* cast */
+        NULL, /* stat */
+        NULL  /* set_option */
+};
+
+/* {{{ proto resource GearmanTask::getStream()
+   A read-only stream over the data of the packet being reported to the data callback, for clients with GEARMAN_CLIENT_UNBUFFERED_RESULT. It reads straight off the connection, unbuffered, and ends with the packet. */
+PHP_FUNCTION(gearman_task_get_stream) {
+        php_gearman_task_stream *self;
+        gearman_task_obj *obj;
+        php_stream *stream;
+        zval *zobj;
+
+        if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &zobj, gearman_task_ce) == FAILURE) {
+                RETURN_FALSE;
+        }
+        obj = Z_GEARMAN_TASK_P(zobj);
+
+        if (!(obj->flags & GEARMAN_TASK_OBJ_CREATED) ||
+            !gearman_client_has_option(&Z_GEARMAN_CLIENT_P(&obj->zclient)->client, GEARMAN_CLIENT_UNBUFFERED_RESULT)) {
+                php_error_docref(NULL, E_WARNING, "Task streams need a running task on a client with GEARMAN_CLIENT_UNBUFFERED_RESULT");
+                RETURN_FALSE;
+        }
+
+        self = emalloc(sizeof(php_gearman_task_stream));
+        ZVAL_COPY(&self->ztask, zobj);
+
+        stream = php_stream_alloc(&php_gearman_task_stream_ops, self, NULL, "rb");
+        if (stream == NULL) {
+                zval_ptr_dtor(&self->ztask);
+                efree(self);
+                RETURN_FALSE;
+        }
+        /* reads go straight into the caller's buffer */
+        stream->flags |= PHP_STREAM_FLAG_NO_BUFFER;
+
+        php_stream_to_zval(stream, return_value);
+}
+/* }}} */
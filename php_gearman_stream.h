@@ -0,0 +1,36 @@
+/*
+ * Gearman PHP Extension
+ *
+ * Copyright (C) 2008 James M. Luedke <contact@jamesluedke.com>,
+ *			Eric Day <eday@oddments.org>
+ * All rights reserved.
+ *
+ * Use and distribution licensed under the PHP license.  See
+ * the LICENSE file in this directory for full text.
+ */
+
+#ifndef __PHP_GEARMAN_STREAM_H
+#define __PHP_GEARMAN_STREAM_H
+
+#include "php.h"
+#include "php_ini.h"
+#include "ext/standard/info.h"
+
+#include "php_gearman.h"
+#include "php_gearman_task.h"
+
+/* stream read and write ops return ssize_t and -1 on error since 7.4 */
+#if PHP_VERSION_ID >= 70400
+# define PHP_GEARMAN_STREAM_RET ssize_t
+# define PHP_GEARMAN_STREAM_ERROR ((ssize_t) -1)
+#else
+# define PHP_GEARMAN_STREAM_RET size_t
+# define PHP_GEARMAN_STREAM_ERROR 0
+#endif
+
+/* default WORK_DATA size of GearmanJob::getOutputStream() */
+#define PHP_GEARMAN_OUTPUT_CHUNK 65536
+
+PHP_FUNCTION(gearman_task_get_stream);
+
+#endif  /* __PHP_GEARMAN_STREAM_H */
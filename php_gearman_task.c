@@ -23,6 +23,7 @@ inline zend_object *gearman_task_obj_new(zend_class_entry *ce) {
         zend_object_std_init(&(intern->std), ce); 
         object_properties_init(&intern->std, ce); 
         intern->task_id = 0;
+        intern->server = -1;
 
         intern->std.handlers = &gearman_task_obj_handlers;
         return &intern->std;
@@ -35,6 +36,11 @@ gearman_return_t _php_task_cb_fn(gearman_task_obj *task, gearman_client_obj *cli
         zval ztask, argv[2], retval;
         uint32_t param_count;
 
+        /* internal tasks make us report events nobody asked for */
+        if (Z_ISUNDEF(zcall)) {
+                return GEARMAN_SUCCESS;
+        }
+
         ZVAL_OBJ(&ztask, &task->std);
         ZVAL_COPY_VALUE(&argv[0], &ztask);
 
@@ -69,10 +75,227 @@ gearman_return_t _php_task_cb_fn(gearman_task_obj *task, gearman_client_obj *cli
 void _php_task_free(gearman_task_st *task, void *context) {
 	gearman_task_obj *task_obj= (gearman_task_obj *) context;
 	gearman_client_obj *cli_obj = Z_GEARMAN_CLIENT_P(&task_obj->zclient);
-	task_obj->flags &= ~GEARMAN_TASK_OBJ_CREATED;
+	zval *ztask;
+
+	if (task_obj->flags & GEARMAN_TASK_OBJ_INTERNAL) {
+		if (task_obj->flags & GEARMAN_TASK_OBJ_CREATED) {
+			task_obj->internal_fn(task_obj, GEARMAN_TASK_OBJ_EVENT_FREE);
+		}
+		zend_hash_index_del(&cli_obj->internal_tasks, task_obj->task_id);
+		zval_ptr_dtor(&task_obj->zdata);
+		zval_ptr_dtor(&task_obj->zworkload);
+		efree(task_obj);
+		return;
+	}
+
+	if (task_obj->flags & GEARMAN_TASK_OBJ_BACKGROUND) {
+		cli_obj->background_queued--;
+	}
+	if (task_obj->server >= 0) {
+		cli_obj->servers[task_obj->server].tasks--;
+		cli_obj->routed_tasks--;
+		task_obj->server = -1;
+	}
+	if (task_obj->deadline) {
+		cli_obj->deadline_tasks--;
+		task_obj->deadline = 0;
+	}
+	/* task_list holds the last reference we can hand out */
+	if (cli_obj->completions > 0 && (ztask = zend_hash_index_find(Z_ARRVAL(cli_obj->task_list), task_obj->task_id)) != NULL) {
+		Z_ADDREF_P(ztask);
+		add_next_index_zval(&cli_obj->completed, ztask);
+	}
+	task_obj->flags &= ~(GEARMAN_TASK_OBJ_CREATED | GEARMAN_TASK_OBJ_BACKGROUND);
 	zend_hash_index_del(Z_ARRVAL(cli_obj->task_list), task_obj->task_id);
 }
 
+/* libgearman only reports the events a function is set for, the ones
+ * without a PHP callback return right away. */
+void _php_task_install_fns(gearman_client_st *client) {
+	gearman_client_set_created_fn(client, _php_task_created_fn);
+	gearman_client_set_data_fn(client, _php_task_data_fn);
+	gearman_client_set_warning_fn(client, _php_task_warning_fn);
+	gearman_client_set_status_fn(client, _php_task_status_fn);
+	gearman_client_set_complete_fn(client, _php_task_complete_fn);
+	gearman_client_set_exception_fn(client, _php_task_exception_fn);
+	gearman_client_set_fail_fn(client, _php_task_fail_fn);
+}
+
+/* Records how a task ended, for runTasks() completion policies and for
+ * completion iterators. libgearman frees the task right after this, so an
+ * open iterator gets a copy of its data. */
+static void _php_task_finish(gearman_task_obj *task_obj, gearman_client_obj *client_obj, gearman_return_t ret, zend_bool keep_data) {
+	const void *data;
+	const char *function_name;
+	uint64_t now;
+
+	task_obj->flags |= GEARMAN_TASK_OBJ_FINISHED;
+	task_obj->ret = ret;
+
+	if (task_obj->batch != 0 && task_obj->batch == client_obj->batch) {
+		if (ret == GEARMAN_SUCCESS) {
+			client_obj->batch_succeeded++;
+		} else if (client_obj->batch_failed++ == 0) {
+			client_obj->batch_ret = ret;
+		}
+	}
+
+	now = _php_gearman_now_ms();
+	if (task_obj->started && task_obj->server >= 0) {
+		_php_client_server_done(client_obj, task_obj->server, ret, now - task_obj->started);
+	}
+
+	/* only tasks that completed count toward their function's latency */
+	if (task_obj->started && ret == GEARMAN_SUCCESS) {
+		function_name = gearman_task_function_name(task_obj->task);
+		if (function_name != NULL) {
+			_php_client_record_latency(client_obj, function_name, strlen(function_name), now - task_obj->started);
+		}
+	} else if ((task_obj->flags & GEARMAN_TASK_OBJ_ADAPTIVE) && ret == GEARMAN_TIMEOUT) {
+		function_name = gearman_task_function_name(task_obj->task);
+		if (function_name != NULL) {
+			_php_client_record_timeout(client_obj, function_name, strlen(function_name));
+		}
+	}
+
+	if (client_obj->completions == 0 || !keep_data) {
+		return;
+	}
+
+	zval_ptr_dtor(&task_obj->zresult);
+	ZVAL_UNDEF(&task_obj->zresult);
+	if ((data = gearman_task_data(task_obj->task)) != NULL) {
+		ZVAL_STRINGL(&task_obj->zresult, (char *) data, gearman_task_data_size(task_obj->task));
+	}
+}
+
+/* Gives up on a task. It ends with ret, its fail callback runs and
+ * libgearman stops waiting for it. */
+void _php_task_cancel(gearman_task_obj *task_obj, gearman_return_t ret) {
+	gearman_client_obj *client_obj = Z_GEARMAN_CLIENT_P(&task_obj->zclient);
+
+	if (!(task_obj->flags & GEARMAN_TASK_OBJ_CREATED)) {
+		return;
+	}
+
+	_php_task_finish(task_obj, client_obj, ret, 0);
+	_php_task_cb_fn(task_obj, client_obj, client_obj->zfail_fn);
+
+	/* the callback may have dropped it already */
+	if (task_obj->flags & GEARMAN_TASK_OBJ_CREATED) {
+		gearman_task_free(task_obj->task);
+	}
+}
+
+/* Drops a task without reporting anything, for tasks nobody waits for
+ * anymore. */
+void _php_task_abandon(gearman_task_obj *task_obj) {
+	if (task_obj->flags & GEARMAN_TASK_OBJ_CREATED) {
+		gearman_task_free(task_obj->task);
+	}
+}
+
+/* Submits a task on behalf of the extension itself, through target or
+ * _php_client_internal() if target is NULL, never the user's client.
+ * Events for it go to internal_fn, zdata is kept for internal_fn to use.
+ * Returns NULL with client->ret set if libgearman did not take the task. */
+gearman_task_obj *_php_task_internal_add(gearman_client_obj *client,
+				gearman_client_st *target,
+				php_gearman_add_task_fn add_task_func,
+				gearman_task_obj_internal_fn internal_fn,
+				const char *function_name,
+				const char *unique,
+				zval *zworkload,
+				zval *zdata) {
+	gearman_task_obj *task_obj;
+	zend_ulong task_id;
+
+	if (target == NULL && (target = _php_client_internal(client)) == NULL) {
+		client->ret = GEARMAN_MEMORY_ALLOCATION_FAILURE;
+		return NULL;
+	}
+
+	task_obj = ecalloc(1, sizeof(gearman_task_obj));
+	task_id = ++client->created_tasks;
+
+	task_obj->flags = GEARMAN_TASK_OBJ_INTERNAL;
+	task_obj->internal_fn = internal_fn;
+	task_obj->task_id = task_id;
+	task_obj->ret = GEARMAN_IO_WAIT;
+	task_obj->server = -1;
+	/* not counted, the client frees all its tasks before it goes away */
+	ZVAL_OBJ(&task_obj->zclient, &client->std);
+	ZVAL_COPY(&task_obj->zworkload, zworkload);
+	if (zdata != NULL) {
+		ZVAL_COPY(&task_obj->zdata, zdata);
+	}
+	zend_hash_index_add_ptr(&client->internal_tasks, task_id, task_obj);
+
+	task_obj->task = add_task_func(target,
+				NULL,
+				task_obj,
+				function_name,
+				unique,
+				Z_STRVAL_P(zworkload),
+				Z_STRLEN_P(zworkload),
+				&client->ret);
+
+	if (client->ret != GEARMAN_SUCCESS) {
+		/* libgearman may or may not have released the context already */
+		if ((task_obj = zend_hash_index_find_ptr(&client->internal_tasks, task_id)) != NULL) {
+			zend_hash_index_del(&client->internal_tasks, task_id);
+			zval_ptr_dtor(&task_obj->zdata);
+			zval_ptr_dtor(&task_obj->zworkload);
+			efree(task_obj);
+		}
+		return NULL;
+	}
+
+	task_obj->flags |= GEARMAN_TASK_OBJ_CREATED;
+	return task_obj;
+}
+
+/* Number of internal tasks handled by internal_fn that libgearman still
+ * holds. */
+uint32_t _php_task_internal_count(gearman_client_obj *client, gearman_task_obj_internal_fn internal_fn) {
+	gearman_task_obj *task_obj;
+	uint32_t count = 0;
+
+	ZEND_HASH_FOREACH_PTR(&client->internal_tasks, task_obj) {
+		if (task_obj->internal_fn == internal_fn) {
+			count++;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	return count;
+}
+
+/* Drops every internal task handled by internal_fn that libgearman still
+ * holds, each gets a GEARMAN_TASK_OBJ_EVENT_FREE first. */
+void _php_task_internal_abandon_all(gearman_client_obj *client, gearman_task_obj_internal_fn internal_fn) {
+	gearman_task_st **tasks;
+	gearman_task_obj *task_obj;
+	uint32_t count = 0, i;
+
+	if (zend_hash_num_elements(&client->internal_tasks) == 0) {
+		return;
+	}
+
+	/* freeing removes entries, so collect first */
+	tasks = safe_emalloc(zend_hash_num_elements(&client->internal_tasks), sizeof(gearman_task_st *), 0);
+	ZEND_HASH_FOREACH_PTR(&client->internal_tasks, task_obj) {
+		if (task_obj->internal_fn == internal_fn && task_obj->task != NULL) {
+			tasks[count++] = task_obj->task;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	for (i = 0; i < count; i++) {
+		gearman_task_free(tasks[i]);
+	}
+
+	efree(tasks);
+}
+
 /* TODO: clean this up a bit, Macro? */
 gearman_return_t _php_task_workload_fn(gearman_task_st *task) {
         gearman_task_obj *task_obj = (gearman_task_obj *) gearman_task_context(task);
@@ -83,41 +306,78 @@ gearman_return_t _php_task_workload_fn(gearman_task_st *task) {
 gearman_return_t _php_task_created_fn(gearman_task_st *task) {
         gearman_task_obj *task_obj = (gearman_task_obj *) gearman_task_context(task);
         gearman_client_obj *client_obj = Z_GEARMAN_CLIENT_P(&task_obj->zclient);
+        if (task_obj->flags & GEARMAN_TASK_OBJ_INTERNAL) {
+                return task_obj->internal_fn(task_obj, GEARMAN_TASK_OBJ_EVENT_CREATED);
+        }
         return _php_task_cb_fn(task_obj, client_obj, client_obj->zcreated_fn);
 }
 
+/* Runs a callback for a packet that carries data. Without buffering the
+ * data is still on the connection, for recvData() and getStream() to
+ * read while the callback runs. */
+static gearman_return_t _php_task_data_cb_fn(gearman_task_obj *task_obj, gearman_client_obj *client_obj, zval zcall) {
+        gearman_return_t ret;
+        if (gearman_client_has_option(&client_obj->client, GEARMAN_CLIENT_UNBUFFERED_RESULT)) {
+                task_obj->recv_left = gearman_task_data_size(task_obj->task);
+        }
+        ret = _php_task_cb_fn(task_obj, client_obj, zcall);
+        task_obj->recv_left = 0;
+        return ret;
+}
+
 gearman_return_t _php_task_data_fn(gearman_task_st *task) {
         gearman_task_obj *task_obj = (gearman_task_obj *) gearman_task_context(task);
         gearman_client_obj *client_obj = Z_GEARMAN_CLIENT_P(&task_obj->zclient);
-        return _php_task_cb_fn(task_obj, client_obj, client_obj->zdata_fn);
+        if (task_obj->flags & GEARMAN_TASK_OBJ_INTERNAL) {
+                return task_obj->internal_fn(task_obj, GEARMAN_TASK_OBJ_EVENT_DATA);
+        }
+        return _php_task_data_cb_fn(task_obj, client_obj, client_obj->zdata_fn);
 }
 
 gearman_return_t _php_task_warning_fn(gearman_task_st *task) {
         gearman_task_obj *task_obj = (gearman_task_obj *) gearman_task_context(task);
         gearman_client_obj *client_obj = Z_GEARMAN_CLIENT_P(&task_obj->zclient);
+        if (task_obj->flags & GEARMAN_TASK_OBJ_INTERNAL) {
+                return task_obj->internal_fn(task_obj, GEARMAN_TASK_OBJ_EVENT_WARNING);
+        }
         return _php_task_cb_fn(task_obj, client_obj, client_obj->zwarning_fn);
 }
 
 gearman_return_t _php_task_status_fn(gearman_task_st *task) {
         gearman_task_obj *task_obj = (gearman_task_obj *) gearman_task_context(task);
         gearman_client_obj *client_obj = Z_GEARMAN_CLIENT_P(&task_obj->zclient);
+        if (task_obj->flags & GEARMAN_TASK_OBJ_INTERNAL) {
+                return task_obj->internal_fn(task_obj, GEARMAN_TASK_OBJ_EVENT_STATUS);
+        }
         return _php_task_cb_fn(task_obj, client_obj, client_obj->zstatus_fn);
 }
 
 gearman_return_t _php_task_complete_fn(gearman_task_st *task) {
         gearman_task_obj *task_obj = (gearman_task_obj *) gearman_task_context(task);
         gearman_client_obj *client_obj = Z_GEARMAN_CLIENT_P(&task_obj->zclient);
-        return _php_task_cb_fn(task_obj, client_obj, client_obj->zcomplete_fn);
+        if (task_obj->flags & GEARMAN_TASK_OBJ_INTERNAL) {
+                return task_obj->internal_fn(task_obj, GEARMAN_TASK_OBJ_EVENT_COMPLETE);
+        }
+        _php_task_finish(task_obj, client_obj, GEARMAN_SUCCESS, 1);
+        return _php_task_data_cb_fn(task_obj, client_obj, client_obj->zcomplete_fn);
 }
 
 gearman_return_t _php_task_exception_fn(gearman_task_st *task) {
         gearman_task_obj *task_obj = (gearman_task_obj *) gearman_task_context(task);
         gearman_client_obj *client_obj = Z_GEARMAN_CLIENT_P(&task_obj->zclient);
-        return _php_task_cb_fn(task_obj, client_obj, client_obj->zexception_fn);
+        if (task_obj->flags & GEARMAN_TASK_OBJ_INTERNAL) {
+                return task_obj->internal_fn(task_obj, GEARMAN_TASK_OBJ_EVENT_EXCEPTION);
+        }
+        _php_task_finish(task_obj, client_obj, GEARMAN_WORK_EXCEPTION, 1);
+        return _php_task_data_cb_fn(task_obj, client_obj, client_obj->zexception_fn);
 }
 
 gearman_return_t _php_task_fail_fn(gearman_task_st *task) {
         gearman_task_obj *task_obj = (gearman_task_obj *) gearman_task_context(task);
         gearman_client_obj *client_obj = Z_GEARMAN_CLIENT_P(&task_obj->zclient);
+        if (task_obj->flags & GEARMAN_TASK_OBJ_INTERNAL) {
+                return task_obj->internal_fn(task_obj, GEARMAN_TASK_OBJ_EVENT_FAIL);
+        }
+        _php_task_finish(task_obj, client_obj, GEARMAN_WORK_FAIL, 1);
         return _php_task_cb_fn(task_obj, client_obj, client_obj->zfail_fn);
 }
@@ -32,9 +32,39 @@ zend_object_handlers gearman_task_obj_handlers;
 
 typedef enum {
         GEARMAN_TASK_OBJ_CREATED = (1 << 0),
+        GEARMAN_TASK_OBJ_INTERNAL = (1 << 1),
+        GEARMAN_TASK_OBJ_BACKGROUND = (1 << 2),
+        GEARMAN_TASK_OBJ_FINISHED = (1 << 3),
+        /* the deadline came from _php_client_adaptive_timeout() */
+        GEARMAN_TASK_OBJ_ADAPTIVE = (1 << 4),
 } gearman_task_obj_flags_t;
 
-typedef struct {
+typedef enum {
+        GEARMAN_TASK_OBJ_EVENT_CREATED,
+        GEARMAN_TASK_OBJ_EVENT_DATA,
+        GEARMAN_TASK_OBJ_EVENT_WARNING,
+        GEARMAN_TASK_OBJ_EVENT_STATUS,
+        GEARMAN_TASK_OBJ_EVENT_COMPLETE,
+        GEARMAN_TASK_OBJ_EVENT_EXCEPTION,
+        GEARMAN_TASK_OBJ_EVENT_FAIL,
+        GEARMAN_TASK_OBJ_EVENT_FREE
+} gearman_task_obj_event_t;
+
+typedef struct _gearman_task_obj gearman_task_obj;
+
+typedef gearman_return_t (*gearman_task_obj_internal_fn)(gearman_task_obj *task, gearman_task_obj_event_t event);
+
+typedef gearman_task_st *(*php_gearman_add_task_fn)(
+                                gearman_client_st *client,
+                                gearman_task_st *task,
+                                void *context,
+                                const char *function_name,
+                                const char *unique,
+                                const void *workload,
+                                size_t workload_size,
+                                gearman_return_t *ret_ptr);
+
+struct _gearman_task_obj {
         gearman_return_t ret;
         gearman_task_obj_flags_t flags;
         gearman_task_st *task;
@@ -43,14 +73,49 @@ typedef struct {
         zval zworkload;
         zend_ulong task_id;
 
+        /* data of the last packet, kept for after libgearman freed the task */
+        zval zresult;
+
+        /* ms timestamp the task is given up at, 0 for none */
+        uint64_t deadline;
+        /* when a foreground task was added, for its function's latency */
+        uint64_t started;
+        /* servers entry the task went through, -1 for the client's own */
+        int32_t server;
+        /* runTasks() call whose completion policy covers the task, 0 for
+         * none */
+        uint32_t batch;
+        /* data of the packet an unbuffered client is reporting that was
+         * not read yet, see getStream() */
+        size_t recv_left;
+
+        /* GEARMAN_TASK_OBJ_INTERNAL tasks are submitted by the extension
+         * itself. They have no PHP object, std is unused and events go to
+         * internal_fn instead of the callbacks set on the client. */
+        gearman_task_obj_internal_fn internal_fn;
+
         zend_object std;
-} gearman_task_obj;
+};
 
 gearman_task_obj *gearman_task_fetch_object(zend_object *obj);
 #define Z_GEARMAN_TASK_P(zv) gearman_task_fetch_object(Z_OBJ_P((zv)))
 
 gearman_return_t _php_task_cb_fn(gearman_task_obj *task, gearman_client_obj *client, zval zcall);
 void _php_task_free(gearman_task_st *task, void *context);
+void _php_task_install_fns(gearman_client_st *client);
+void _php_task_cancel(gearman_task_obj *task_obj, gearman_return_t ret);
+void _php_task_abandon(gearman_task_obj *task_obj);
+
+gearman_task_obj *_php_task_internal_add(gearman_client_obj *client,
+                                gearman_client_st *target,
+                                php_gearman_add_task_fn add_task_func,
+                                gearman_task_obj_internal_fn internal_fn,
+                                const char *function_name,
+                                const char *unique,
+                                zval *zworkload,
+                                zval *zdata);
+uint32_t _php_task_internal_count(gearman_client_obj *client, gearman_task_obj_internal_fn internal_fn);
+void _php_task_internal_abandon_all(gearman_client_obj *client, gearman_task_obj_internal_fn internal_fn);
 
 gearman_return_t _php_task_workload_fn(gearman_task_st *task);
 gearman_return_t _php_task_created_fn(gearman_task_st *task);
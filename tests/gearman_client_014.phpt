@@ -0,0 +1,35 @@
+--TEST--
+GearmanClient::enableBackgroundSender(), GearmanClient::getStats(), GearmanClient::disableBackgroundSender()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+$client = new GearmanClient();
+$client->addServer('localhost', 4730);
+print "GearmanClient::getStats() before (OO): " . count($client->getStats()) . PHP_EOL;
+print "GearmanClient::enableBackgroundSender() (OO): " . ($client->enableBackgroundSender(16, GEARMAN_SENDER_DROP) ? 'Success' : 'Failure') . PHP_EOL;
+$stats = $client->getStats();
+print "capacity: " . $stats['sender']['capacity'] . PHP_EOL;
+print "pending: " . $stats['sender']['pending'] . PHP_EOL;
+print "GearmanClient::disableBackgroundSender() (OO): " . ($client->disableBackgroundSender() ? 'Success' : 'Failure') . PHP_EOL;
+
+$client2 = gearman_client_create();
+gearman_client_add_server($client2, 'localhost', 4730);
+print "gearman_client_enable_background_sender() (Procedural): " . (gearman_client_enable_background_sender($client2) ? 'Success' : 'Failure') . PHP_EOL;
+$stats = gearman_client_get_stats($client2);
+print "capacity: " . $stats['sender']['capacity'] . PHP_EOL;
+print "gearman_client_disable_background_sender() (Procedural): " . (gearman_client_disable_background_sender($client2) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::getStats() before (OO): 0
+GearmanClient::enableBackgroundSender() (OO): Success
+capacity: 16
+pending: 0
+GearmanClient::disableBackgroundSender() (OO): Success
+gearman_client_enable_background_sender() (Procedural): Success
+capacity: 1024
+gearman_client_disable_background_sender() (Procedural): Success
+OK
@@ -0,0 +1,36 @@
+--TEST--
+GearmanClient::setDeferredBackground(), GearmanClient::flushDeferred()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+// Nothing listens here, so every flushed job fails
+$client = new GearmanClient();
+$client->addServer('127.0.0.1', 1);
+print "GearmanClient::setDeferredBackground() (OO): " . ($client->setDeferredBackground(true, function($function, $workload, $unique, $ret) {
+    print "failed: $function $workload " . var_export($unique, true) . PHP_EOL;
+}) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::doBackground() (OO): " . var_export($client->doBackground("reverse", "a"), true) . PHP_EOL;
+$client->doHighBackground("reverse", "b", "unique-b");
+print "GearmanClient::flushDeferred() (OO): " . ($client->flushDeferred() ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::flushDeferred() empty (OO): " . ($client->flushDeferred() ? 'Success' : 'Failure') . PHP_EOL;
+
+$client2 = gearman_client_create();
+gearman_client_add_server($client2, '127.0.0.1', 1);
+print "gearman_client_set_deferred_background() (Procedural): " . (gearman_client_set_deferred_background($client2, true) ? 'Success' : 'Failure') . PHP_EOL;
+gearman_client_do_background($client2, "reverse", "c");
+print "gearman_client_flush_deferred() (Procedural): " . (@gearman_client_flush_deferred($client2) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::setDeferredBackground() (OO): Success
+GearmanClient::doBackground() (OO): ''
+failed: reverse a NULL
+failed: reverse b 'unique-b'
+GearmanClient::flushDeferred() (OO): Failure
+GearmanClient::flushDeferred() empty (OO): Success
+gearman_client_set_deferred_background() (Procedural): Success
+gearman_client_flush_deferred() (Procedural): Failure
+OK
@@ -0,0 +1,29 @@
+--TEST--
+GearmanClient::setMaxInFlight(), gearman_client_set_max_in_flight()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+// Nothing listens here, so making room for a second task fails
+$client = new GearmanClient();
+$client->addServer('127.0.0.1', 1);
+print "GearmanClient::setMaxInFlight() (OO): " . ($client->setMaxInFlight(1) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setMaxInFlight() negative (OO): " . (@$client->setMaxInFlight(-1) ? 'Success' : 'Failure') . PHP_EOL;
+print "First addTask() (OO): " . get_class($client->addTask("reverse", "a")) . PHP_EOL;
+print "Second addTask() (OO): " . var_export(@$client->addTask("reverse", "b"), true) . PHP_EOL;
+print "Without limit (OO): " . ($client->setMaxInFlight(0) && $client->addTask("reverse", "b") instanceof GearmanTask ? 'Success' : 'Failure') . PHP_EOL;
+
+$client2 = gearman_client_create();
+print "gearman_client_set_max_in_flight() (Procedural): " . (gearman_client_set_max_in_flight($client2, 100) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::setMaxInFlight() (OO): Success
+GearmanClient::setMaxInFlight() negative (OO): Failure
+First addTask() (OO): GearmanTask
+Second addTask() (OO): false
+Without limit (OO): Success
+gearman_client_set_max_in_flight() (Procedural): Success
+OK
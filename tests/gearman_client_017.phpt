@@ -0,0 +1,40 @@
+--TEST--
+GearmanClient::setAutoFlush(), gearman_client_set_auto_flush()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+// Nothing listens here, so only the flush attempt is visible
+$client = new GearmanClient();
+$client->addServer('127.0.0.1', 1);
+print "GearmanClient::setAutoFlush() (OO): " . ($client->setAutoFlush(2, 1000) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setAutoFlush() negative (OO): " . (@$client->setAutoFlush(-1) ? 'Success' : 'Failure') . PHP_EOL;
+$client->addTaskBackground("reverse", "a");
+print "First task queued" . PHP_EOL;
+$client->addTaskBackground("reverse", "b");
+print "Second task flushed" . PHP_EOL;
+
+// A foreground task is outstanding, so nothing runs until runTasks()
+$client3 = new GearmanClient();
+$client3->addServer('127.0.0.1', 1);
+$client3->setAutoFlush(1);
+$client3->addTask("reverse", "c");
+$client3->addTaskBackground("reverse", "d");
+print "Left to runTasks()" . PHP_EOL;
+
+$client2 = gearman_client_create();
+print "gearman_client_set_auto_flush() (Procedural): " . (gearman_client_set_auto_flush($client2, 0, 50) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECTF--
+GearmanClient::setAutoFlush() (OO): Success
+GearmanClient::setAutoFlush() negative (OO): Failure
+First task queued
+
+Warning: GearmanClient::addTaskBackground(): Unable to flush background tasks: %s in %s on line %d
+Second task flushed
+Left to runTasks()
+gearman_client_set_auto_flush() (Procedural): Success
+OK
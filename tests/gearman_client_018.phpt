@@ -0,0 +1,40 @@
+--TEST--
+GearmanClient::setHedging(), gearman_client_set_hedging()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+// Nothing listens on either server, so both copies fail
+$client = new GearmanClient();
+$client->addServers('127.0.0.1:1,127.0.0.1:2');
+print "GearmanClient::setHedging() (OO): " . ($client->setHedging(10) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setHedging() negative (OO): " . (@$client->setHedging(-1) ? 'Success' : 'Failure') . PHP_EOL;
+
+$stats = $client->getStats();
+print "Hedges sent: " . $stats['hedge']['sent'] . PHP_EOL;
+print "Hedges won: " . $stats['hedge']['won'] . PHP_EOL;
+print "Hedge delay: " . $stats['hedge']['delay'] . PHP_EOL;
+
+print "Result: " . var_export(@$client->doNormal("reverse", "a"), true) . PHP_EOL;
+print "Return code ok: " . ($client->returnCode() == GEARMAN_SUCCESS ? 'Yes' : 'No') . PHP_EOL;
+
+$client2 = gearman_client_create();
+print "gearman_client_set_hedging() (Procedural): " . (gearman_client_set_hedging($client2, 20, true) ? 'Success' : 'Failure') . PHP_EOL;
+print "Hedge stats: " . var_export(isset($client2->getStats()['hedge']), true) . PHP_EOL;
+gearman_client_set_hedging($client2, 0);
+print "Hedge stats after reset: " . var_export(isset($client2->getStats()['hedge']), true) . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::setHedging() (OO): Success
+GearmanClient::setHedging() negative (OO): Failure
+Hedges sent: 0
+Hedges won: 0
+Hedge delay: 10
+Result: ''
+Return code ok: No
+gearman_client_set_hedging() (Procedural): Success
+Hedge stats: true
+Hedge stats after reset: false
@@ -0,0 +1,29 @@
+--TEST--
+GearmanClient::setAdaptiveTimeout(), gearman_client_set_adaptive_timeout()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+$client = new GearmanClient();
+$client->addServer('127.0.0.1', 1);
+print "GearmanClient::setAdaptiveTimeout() (OO): " . ($client->setAdaptiveTimeout(3.0, 50, 5000) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setAdaptiveTimeout() negative (OO): " . (@$client->setAdaptiveTimeout(-1.0) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setAdaptiveTimeout() ceiling below floor (OO): " . (@$client->setAdaptiveTimeout(3.0, 100, 10) ? 'Success' : 'Failure') . PHP_EOL;
+
+// Calls that never reached a server say nothing about latency
+@$client->doNormal("reverse", "a");
+print "Latency recorded: " . var_export(isset($client->getStats()['latency']), true) . PHP_EOL;
+
+$client2 = gearman_client_create();
+print "gearman_client_set_adaptive_timeout() (Procedural): " . (gearman_client_set_adaptive_timeout($client2, 0) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::setAdaptiveTimeout() (OO): Success
+GearmanClient::setAdaptiveTimeout() negative (OO): Failure
+GearmanClient::setAdaptiveTimeout() ceiling below floor (OO): Failure
+Latency recorded: false
+gearman_client_set_adaptive_timeout() (Procedural): Success
+OK
@@ -0,0 +1,33 @@
+--TEST--
+GearmanClient::setRouting(), GearmanClient::setShardKey()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+$client = new GearmanClient();
+$client->addServers('127.0.0.1:1,127.0.0.1:2,127.0.0.1:3');
+print "GearmanClient::setRouting() (OO): " . ($client->setRouting(GEARMAN_ROUTING_CONSISTENT_HASH) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setRouting() invalid (OO): " . (@$client->setRouting(42) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setShardKey() (OO): " . ($client->setShardKey("user:1") ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setShardKey() null (OO): " . ($client->setShardKey(null) ? 'Success' : 'Failure') . PHP_EOL;
+
+// Routed tasks are queued on the server their key maps to
+$task = $client->addTask("reverse", "a", null, "key-1");
+print "Task added: " . ($task instanceof GearmanTask ? 'Yes' : 'No') . PHP_EOL;
+
+$client2 = gearman_client_create();
+print "gearman_client_set_routing() (Procedural): " . (gearman_client_set_routing($client2, GEARMAN_ROUTING_DEFAULT) ? 'Success' : 'Failure') . PHP_EOL;
+print "gearman_client_set_shard_key() (Procedural): " . (gearman_client_set_shard_key($client2, "user:2") ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::setRouting() (OO): Success
+GearmanClient::setRouting() invalid (OO): Failure
+GearmanClient::setShardKey() (OO): Success
+GearmanClient::setShardKey() null (OO): Success
+Task added: Yes
+gearman_client_set_routing() (Procedural): Success
+gearman_client_set_shard_key() (Procedural): Success
+OK
@@ -0,0 +1,47 @@
+--TEST--
+GearmanClient::setServerWeights(), GEARMAN_ROUTING_LEAST_OUTSTANDING
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+// Nothing listens on either server
+$client = new GearmanClient();
+$client->addServers('127.0.0.1:1,127.0.0.1:2');
+print "GearmanClient::setRouting() (OO): " . ($client->setRouting(GEARMAN_ROUTING_LEAST_OUTSTANDING) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setServerWeights() invalid (OO): " . (@$client->setServerWeights(array(3)) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setServerWeights() (OO): " . ($client->setServerWeights(array('127.0.0.1:1' => 0)) ? 'Success' : 'Failure') . PHP_EOL;
+
+// Weight 0 leaves only the second server, which then fails
+@$client->doBackground("reverse", "a");
+$stats = $client->getStats();
+foreach ($stats['servers'] as $server => $info) {
+    print "$server weight " . $info['weight'] . ", available " . var_export($info['available'], true) . PHP_EOL;
+}
+
+$client2 = gearman_client_create();
+print "gearman_client_set_server_weights() (Procedural): " . (gearman_client_set_server_weights($client2, array('localhost:4730' => 2)) ? 'Success' : 'Failure') . PHP_EOL;
+
+// Keys are matched as "host:port" whatever way the server was spelled
+$client3 = new GearmanClient();
+$client3->addServers('LOCALHOST:1, 127.0.0.1');
+$client3->setRouting(GEARMAN_ROUTING_LEAST_OUTSTANDING);
+$client3->setServerWeights(array('localhost:1' => 2, 'other' => 4, '127.0.0.1:4730' => 0));
+@$client3->doBackground("reverse", "a");
+$stats = $client3->getStats();
+foreach ($stats['servers'] as $server => $info) {
+    print "$server weight " . $info['weight'] . PHP_EOL;
+}
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::setRouting() (OO): Success
+GearmanClient::setServerWeights() invalid (OO): Failure
+GearmanClient::setServerWeights() (OO): Success
+127.0.0.1:1 weight 0, available true
+127.0.0.1:2 weight 1, available false
+gearman_client_set_server_weights() (Procedural): Success
+localhost:1 weight 2
+127.0.0.1:4730 weight 0
+OK
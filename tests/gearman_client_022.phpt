@@ -0,0 +1,30 @@
+--TEST--
+GearmanClient::setCircuitBreaker(), gearman_client_set_circuit_breaker()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+// Nothing listens on either server, the call fails over once and both trip
+$client = new GearmanClient();
+$client->addServers('127.0.0.1:1,127.0.0.1:2');
+print "GearmanClient::setCircuitBreaker() (OO): " . ($client->setCircuitBreaker(3, 60000) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setCircuitBreaker() negative (OO): " . (@$client->setCircuitBreaker(-1) ? 'Success' : 'Failure') . PHP_EOL;
+
+@$client->doNormal("reverse", "a");
+foreach ($client->getStats()['servers'] as $server => $info) {
+    print "$server breaker " . $info['breaker'] . ", errors " . $info['errors'] . ", trips " . $info['trips'] . PHP_EOL;
+}
+
+$client2 = gearman_client_create();
+print "gearman_client_set_circuit_breaker() (Procedural): " . (gearman_client_set_circuit_breaker($client2, 0) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::setCircuitBreaker() (OO): Success
+GearmanClient::setCircuitBreaker() negative (OO): Failure
+127.0.0.1:1 breaker open, errors 1, trips 1
+127.0.0.1:2 breaker open, errors 1, trips 1
+gearman_client_set_circuit_breaker() (Procedural): Success
+OK
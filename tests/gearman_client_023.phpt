@@ -0,0 +1,30 @@
+--TEST--
+GearmanClient::connect(), GearmanClient::setKeepalive(), gearman_client_connect(), gearman_client_set_keepalive()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+// Nothing listens there, so warming up has to fail
+$client = new GearmanClient();
+$client->addServer('127.0.0.1', 1);
+print "GearmanClient::connect() (OO): " . (@$client->connect() ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setKeepalive() (OO): " . ($client->setKeepalive(30000) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setKeepalive() negative (OO): " . (@$client->setKeepalive(-1) ? 'Success' : 'Failure') . PHP_EOL;
+print "Keepalive stats: " . json_encode($client->getStats()['keepalive']) . PHP_EOL;
+
+$client2 = gearman_client_create();
+gearman_client_add_server($client2, '127.0.0.1', 1);
+print "gearman_client_connect() (Procedural): " . (@gearman_client_connect($client2) ? 'Success' : 'Failure') . PHP_EOL;
+print "gearman_client_set_keepalive() (Procedural): " . (gearman_client_set_keepalive($client2, 0) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::connect() (OO): Failure
+GearmanClient::setKeepalive() (OO): Success
+GearmanClient::setKeepalive() negative (OO): Failure
+Keepalive stats: {"probes":0,"failures":0,"interval":30000}
+gearman_client_connect() (Procedural): Failure
+gearman_client_set_keepalive() (Procedural): Success
+OK
@@ -0,0 +1,30 @@
+--TEST--
+GearmanClient::setServers(), gearman_client_set_servers()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+// Trip both breakers, then swap one server: what is known about the kept one stays
+$client = new GearmanClient();
+$client->addServers('127.0.0.1:1,127.0.0.1:2');
+$client->setCircuitBreaker(3, 60000);
+@$client->doNormal("reverse", "a");
+
+print "GearmanClient::setServers() (OO): " . ($client->setServers('127.0.0.1:2,127.0.0.1:3') ? 'Success' : 'Failure') . PHP_EOL;
+foreach ($client->getStats()['servers'] as $server => $info) {
+    print "$server breaker " . $info['breaker'] . ", trips " . $info['trips'] . PHP_EOL;
+}
+
+$client2 = gearman_client_create();
+gearman_client_add_server($client2, '127.0.0.1', 1);
+print "gearman_client_set_servers() (Procedural): " . (gearman_client_set_servers($client2, '127.0.0.1:1,127.0.0.1:2') ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::setServers() (OO): Success
+127.0.0.1:2 breaker open, trips 1
+127.0.0.1:3 breaker closed, trips 0
+gearman_client_set_servers() (Procedural): Success
+OK
@@ -0,0 +1,32 @@
+--TEST--
+GearmanClient::addServer(), GearmanClient::addServers() with unix:// servers
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+// Nothing listens on the socket, so calls fail without reaching libgearman
+$client = new GearmanClient();
+print "GearmanClient::addServer() unix (OO): " . ($client->addServer('unix:///nonexistent/gearmand.sock') ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::ping() unix (OO): " . (@$client->ping('x') ? 'Success' : 'Failure') . PHP_EOL;
+print "Return code: " . ($client->returnCode() == GEARMAN_COULD_NOT_CONNECT ? 'GEARMAN_COULD_NOT_CONNECT' : $client->returnCode()) . PHP_EOL;
+print "GearmanClient::doNormal() unix (OO): '" . @$client->doNormal('reverse', 'a') . "'" . PHP_EOL;
+print "GearmanClient::doBackground() unix (OO): '" . @$client->doBackground('reverse', 'a') . "'" . PHP_EOL;
+
+$client2 = gearman_client_create();
+print "gearman_client_add_servers() unix (Procedural): " . (gearman_client_add_servers($client2, '127.0.0.1:1,unix:///nonexistent/gearmand.sock') ? 'Success' : 'Failure') . PHP_EOL;
+
+$worker = new GearmanWorker();
+print "GearmanWorker::addServer() unix (OO): " . (@$worker->addServer('unix:///nonexistent/gearmand.sock') ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::addServer() unix (OO): Success
+GearmanClient::ping() unix (OO): Failure
+Return code: GEARMAN_COULD_NOT_CONNECT
+GearmanClient::doNormal() unix (OO): ''
+GearmanClient::doBackground() unix (OO): ''
+gearman_client_add_servers() unix (Procedural): Success
+GearmanWorker::addServer() unix (OO): Failure
+OK
@@ -0,0 +1,27 @@
+--TEST--
+GearmanClient::setSocketOptions(), gearman_client_set_socket_options()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+$client = new GearmanClient();
+$client->addServer('unix:///nonexistent/gearmand.sock');
+$options = array('send_size' => 4194304, 'recv_size' => 4194304, 'nodelay' => 1, 'quickack' => 1, 'busy_poll' => 50);
+print "GearmanClient::setSocketOptions() (OO): " . ($client->setSocketOptions($options) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setSocketOptions() unknown (OO): " . (@$client->setSocketOptions(array('linger' => 1)) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setSocketOptions() negative (OO): " . (@$client->setSocketOptions(array('send_size' => -1)) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::ping() (OO): " . (@$client->ping('x') ? 'Success' : 'Failure') . PHP_EOL;
+
+$client2 = gearman_client_create();
+print "gearman_client_set_socket_options() (Procedural): " . (gearman_client_set_socket_options($client2, array('nodelay' => 0)) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::setSocketOptions() (OO): Success
+GearmanClient::setSocketOptions() unknown (OO): Failure
+GearmanClient::setSocketOptions() negative (OO): Failure
+GearmanClient::ping() (OO): Failure
+gearman_client_set_socket_options() (Procedural): Success
+OK
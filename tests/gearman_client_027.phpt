@@ -0,0 +1,30 @@
+--TEST--
+GearmanClient::setEngine(), gearman_client_set_engine()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+$client = new GearmanClient();
+$client->addServer('127.0.0.1', 1);
+print "GearmanClient::setEngine() native (OO): " . ($client->setEngine(GEARMAN_ENGINE_NATIVE) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setEngine() invalid (OO): " . (@$client->setEngine(42) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::doNormal() native (OO): '" . @$client->doNormal('reverse', 'a') . "'" . PHP_EOL;
+print "Return code: " . ($client->returnCode() == GEARMAN_COULD_NOT_CONNECT ? 'GEARMAN_COULD_NOT_CONNECT' : $client->returnCode()) . PHP_EOL;
+print "GearmanClient::enableBackgroundSender() native (OO): " . (@$client->enableBackgroundSender(16) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanClient::setEngine() libgearman (OO): " . ($client->setEngine(GEARMAN_ENGINE_LIBGEARMAN) ? 'Success' : 'Failure') . PHP_EOL;
+
+$client2 = gearman_client_create();
+print "gearman_client_set_engine() (Procedural): " . (gearman_client_set_engine($client2, GEARMAN_ENGINE_NATIVE) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::setEngine() native (OO): Success
+GearmanClient::setEngine() invalid (OO): Failure
+GearmanClient::doNormal() native (OO): ''
+Return code: GEARMAN_COULD_NOT_CONNECT
+GearmanClient::enableBackgroundSender() native (OO): Failure
+GearmanClient::setEngine() libgearman (OO): Success
+gearman_client_set_engine() (Procedural): Success
+OK
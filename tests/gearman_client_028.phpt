@@ -0,0 +1,34 @@
+--TEST--
+GearmanClient::doNormal(), doBackground() with a stream workload
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+$file = tmpfile();
+fwrite($file, str_repeat('x', 200000));
+rewind($file);
+
+$client = new GearmanClient();
+$client->addServer('127.0.0.1', 1);
+print "GearmanClient::doNormal() libgearman (OO): '" . @$client->doNormal('reverse', $file) . "'" . PHP_EOL;
+print "Return code: " . ($client->returnCode() == GEARMAN_INVALID_ARGUMENT ? 'GEARMAN_INVALID_ARGUMENT' : $client->returnCode()) . PHP_EOL;
+
+$client->setEngine(GEARMAN_ENGINE_NATIVE);
+print "GearmanClient::doNormal() native (OO): '" . @$client->doNormal('reverse', $file) . "'" . PHP_EOL;
+print "Return code: " . ($client->returnCode() == GEARMAN_COULD_NOT_CONNECT ? 'GEARMAN_COULD_NOT_CONNECT' : $client->returnCode()) . PHP_EOL;
+print "GearmanClient::doBackground() native (OO): '" . @$client->doBackground('reverse', $file, null, 1024) . "'" . PHP_EOL;
+print "Return code: " . ($client->returnCode() == GEARMAN_COULD_NOT_CONNECT ? 'GEARMAN_COULD_NOT_CONNECT' : $client->returnCode()) . PHP_EOL;
+print "Nothing read: " . (ftell($file) == 0 ? 'Yes' : 'No') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanClient::doNormal() libgearman (OO): ''
+Return code: GEARMAN_INVALID_ARGUMENT
+GearmanClient::doNormal() native (OO): ''
+Return code: GEARMAN_COULD_NOT_CONNECT
+GearmanClient::doBackground() native (OO): ''
+Return code: GEARMAN_COULD_NOT_CONNECT
+Nothing read: Yes
+OK
@@ -0,0 +1,40 @@
+--TEST--
+GearmanClient::doNormal(), doBackground() reject non-string workloads
+--SKIPIF--
+<?php
+if (!extension_loaded("gearman")) print "skip";
+if (PHP_VERSION_ID < 80000) print "skip parameter errors are TypeErrors as of PHP 8";
+?>
+--FILE--
+<?php
+declare(strict_types=1);
+
+$client = new GearmanClient();
+$client->addServer('127.0.0.1', 1);
+
+foreach (['doNormal', 'doBackground'] as $method) {
+    foreach ([['a'], 1] as $workload) {
+        try {
+            $client->$method('reverse', $workload);
+            print "$method(" . gettype($workload) . "): sent" . PHP_EOL;
+        } catch (TypeError $e) {
+            print "$method(" . gettype($workload) . "): " . $e->getMessage() . PHP_EOL;
+        }
+    }
+}
+
+try {
+    gearman_client_do_normal($client, 'reverse', ['a']);
+} catch (TypeError $e) {
+    print "gearman_client_do_normal(array): " . $e->getMessage() . PHP_EOL;
+}
+
+print "OK";
+?>
+--EXPECT--
+doNormal(array): GearmanClient::doNormal(): Argument #2 ($workload) must be of type string, array given
+doNormal(integer): GearmanClient::doNormal(): Argument #2 ($workload) must be of type string, int given
+doBackground(array): GearmanClient::doBackground(): Argument #2 ($workload) must be of type string, array given
+doBackground(integer): GearmanClient::doBackground(): Argument #2 ($workload) must be of type string, int given
+gearman_client_do_normal(array): gearman_client_do_normal(): Argument #3 ($workload) must be of type string, array given
+OK
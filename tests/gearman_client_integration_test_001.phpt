@@ -0,0 +1,41 @@
+--TEST--
+GearmanClient created before pcntl_fork() keeps working in parent and child
+--SKIPIF--
+<?php
+require_once('skipif.inc');
+require_once('skipifconnect.inc');
+?>
+--FILE--
+<?php
+require_once('connect.inc');
+
+print "Start" . PHP_EOL;
+
+$client = new GearmanClient();
+$client->addServer($host, $port);
+print "Parent before fork: " . var_export($client->ping("before"), true) . PHP_EOL;
+
+$pid = pcntl_fork();
+if ($pid == -1) {
+    die("Could not fork");
+} else if ($pid == 0) {
+    // Child. Reuses the inherited client, don't echo anything here
+    exit($client->ping("child") ? 0 : 1);
+}
+
+// Parent. Wait for child, its exit must not have closed our connection
+$exit_status = 0;
+if (pcntl_wait($exit_status) <= 0) {
+    print "pcntl_wait exited with error" . PHP_EOL;
+} else if (!pcntl_wifexited($exit_status) || pcntl_wexitstatus($exit_status) != 0) {
+    print "child exited with error" . PHP_EOL;
+}
+
+print "Parent after fork: " . var_export($client->ping("after"), true) . PHP_EOL;
+
+print "Done";
+--EXPECT--
+Start
+Parent before fork: true
+Parent after fork: true
+Done
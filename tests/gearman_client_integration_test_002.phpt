@@ -0,0 +1,64 @@
+--TEST--
+GearmanClient::doMulti() returns results keyed like its input
+--SKIPIF--
+<?php
+require_once('skipif.inc');
+require_once('skipifconnect.inc');
+?>
+--FILE--
+<?php
+require_once('connect.inc');
+
+print "Start" . PHP_EOL;
+
+$job_name = uniqid();
+
+$pid = pcntl_fork();
+if ($pid == -1) {
+    die("Could not fork");
+} else if ($pid == 0) {
+    // Child. This is the worker, don't echo anything here
+    $worker = new GearmanWorker();
+    $worker->addServer($host, $port);
+    $worker->addFunction($job_name, function($job) {
+        if ($job->workload() == "fail") {
+            $job->sendFail();
+            return;
+        }
+        return strrev($job->workload());
+    });
+    for ($i = 0; $i < 3; $i++) {
+        $worker->work();
+    }
+    exit(0);
+}
+
+// Parent. This is the client
+$client = new GearmanClient();
+$client->addServer($host, $port);
+$errors = null;
+$results = $client->doMulti([
+    'first' => [$job_name, "abc"],
+    7 => [$job_name, "fail"],
+    'last' => [$job_name, 123],
+], 10000, $errors);
+var_dump($results);
+print "error keys: " . implode(",", array_keys($errors)) . PHP_EOL;
+print "error code: " . var_export($errors[7]['code'] == GEARMAN_WORK_FAIL, true) . PHP_EOL;
+
+pcntl_wait($exit_status);
+
+print "Done";
+--EXPECT--
+Start
+array(3) {
+  ["first"]=>
+  string(3) "cba"
+  [7]=>
+  bool(false)
+  ["last"]=>
+  string(3) "321"
+}
+error keys: 7
+error code: true
+Done
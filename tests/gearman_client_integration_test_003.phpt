@@ -0,0 +1,63 @@
+--TEST--
+GearmanClient::completions() yields tasks as they finish
+--SKIPIF--
+<?php
+require_once('skipif.inc');
+require_once('skipifconnect.inc');
+?>
+--FILE--
+<?php
+require_once('connect.inc');
+
+print "Start" . PHP_EOL;
+
+$job_name = uniqid();
+
+$pid = pcntl_fork();
+if ($pid == -1) {
+    die("Could not fork");
+} else if ($pid == 0) {
+    // Child. This is the worker, don't echo anything here
+    $worker = new GearmanWorker();
+    $worker->addServer($host, $port);
+    $worker->addFunction($job_name, function($job) {
+        return strtoupper($job->workload());
+    });
+    for ($i = 0; $i < 3; $i++) {
+        $worker->work();
+    }
+    exit(0);
+}
+
+// Parent. This is the client
+$client = new GearmanClient();
+$client->addServer($host, $port);
+foreach (["a", "b", "c"] as $item) {
+    $client->addTask($job_name, $item, "item-$item");
+}
+
+$results = [];
+foreach ($client->completions(10000) as $context => $task) {
+    $results[$context] = $task->data();
+    print "returnCode: " . var_export($task->returnCode() == GEARMAN_SUCCESS, true) . PHP_EOL;
+}
+ksort($results);
+var_dump($results);
+
+pcntl_wait($exit_status);
+
+print "Done";
+--EXPECT--
+Start
+returnCode: true
+returnCode: true
+returnCode: true
+array(3) {
+  ["item-a"]=>
+  string(1) "A"
+  ["item-b"]=>
+  string(1) "B"
+  ["item-c"]=>
+  string(1) "C"
+}
+Done
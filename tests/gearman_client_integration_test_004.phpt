@@ -0,0 +1,43 @@
+--TEST--
+Per-task timeouts given to GearmanClient::addTask() are enforced by runTasks()
+--SKIPIF--
+<?php
+require_once('skipif.inc');
+require_once('skipifconnect.inc');
+?>
+--FILE--
+<?php
+require_once('connect.inc');
+
+print "Start" . PHP_EOL;
+
+// Nobody works on this function, so its tasks never finish
+$job_name = uniqid();
+
+$client = new GearmanClient();
+$client->addServer($host, $port);
+$client->setFailCallback(function($task, $context) {
+    print "fail: $context " . var_export($task->returnCode() == GEARMAN_TIMEOUT, true) . PHP_EOL;
+});
+
+$start = microtime(true);
+$client->addTask($job_name, "a", "short", null, 100);
+$client->addTask($job_name, "b", "long", null, 300);
+print "runTasks: " . var_export($client->runTasks(), true) . PHP_EOL;
+print "within deadlines: " . var_export(microtime(true) - $start < 5, true) . PHP_EOL;
+
+$client->addTask($job_name, "c", "batch");
+print "runTasks with timeout: " . var_export($client->runTasks(100), true) . PHP_EOL;
+print "returnCode: " . var_export($client->returnCode() == GEARMAN_TIMEOUT, true) . PHP_EOL;
+
+print "Done";
+--EXPECT--
+Start
+fail: short true
+fail: long true
+runTasks: true
+within deadlines: true
+fail: batch true
+runTasks with timeout: false
+returnCode: true
+Done
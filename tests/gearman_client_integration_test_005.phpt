@@ -0,0 +1,81 @@
+--TEST--
+GearmanClient::setCompletionPolicy() lets runTasks() return before every task finished
+--SKIPIF--
+<?php
+require_once('skipif.inc');
+require_once('skipifconnect.inc');
+?>
+--FILE--
+<?php
+require_once('connect.inc');
+
+print "Start" . PHP_EOL;
+
+$job_name = uniqid();
+// Nobody works on this function, so its tasks never finish
+$stuck_name = uniqid();
+
+$pid = pcntl_fork();
+if ($pid == -1) {
+    die("Could not fork");
+} else if ($pid == 0) {
+    // Child. This is the worker, don't echo anything here
+    $worker = new GearmanWorker();
+    $worker->addServer($host, $port);
+    $worker->addFunction($job_name, function($job) {
+        if ($job->workload() == "fail") {
+            $job->sendFail();
+            return;
+        }
+        return strtoupper($job->workload());
+    });
+    for ($i = 0; $i < 3; $i++) {
+        $worker->work();
+    }
+    exit(0);
+}
+
+// Parent. This is the client
+$client = new GearmanClient();
+$client->addServer($host, $port);
+
+print "setCompletionPolicy invalid: " . var_export(@$client->setCompletionPolicy(GEARMAN_COMPLETION_QUORUM), true) . PHP_EOL;
+
+$created = false;
+$client->setCreatedCallback(function($task, $context) use (&$created) {
+    if ($context === "bg") {
+        $created = true;
+    }
+});
+
+print "setCompletionPolicy quorum: " . var_export($client->setCompletionPolicy(GEARMAN_COMPLETION_QUORUM, 2), true) . PHP_EOL;
+$client->addTask($job_name, "a");
+$client->addTask($job_name, "b");
+$client->addTask($stuck_name, "c");
+// Background tasks are not part of the batch and still get submitted
+$client->addTaskBackground($stuck_name, "bg", "bg");
+print "runTasks: " . var_export($client->runTasks(), true) . PHP_EOL;
+
+print "setCompletionPolicy fail fast: " . var_export($client->setCompletionPolicy(GEARMAN_COMPLETION_FAIL_FAST), true) . PHP_EOL;
+$client->addTask($job_name, "fail");
+$client->addTask($stuck_name, "d");
+print "runTasks: " . var_export($client->runTasks(), true) . PHP_EOL;
+print "returnCode: " . var_export($client->returnCode() == GEARMAN_WORK_FAIL, true) . PHP_EOL;
+
+$client->setCompletionPolicy(GEARMAN_COMPLETION_ALL);
+$client->runTasks();
+print "background task created: " . var_export($created, true) . PHP_EOL;
+
+pcntl_wait($exit_status);
+
+print "Done";
+--EXPECT--
+Start
+setCompletionPolicy invalid: false
+setCompletionPolicy quorum: true
+runTasks: true
+setCompletionPolicy fail fast: true
+runTasks: false
+returnCode: true
+background task created: true
+Done
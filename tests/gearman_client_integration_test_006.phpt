@@ -0,0 +1,69 @@
+--TEST--
+GEARMAN_ENGINE_NATIVE client and worker round trip
+--SKIPIF--
+<?php
+require_once('skipif.inc');
+require_once('skipifconnect.inc');
+?>
+--FILE--
+<?php
+require_once('connect.inc');
+
+print "Start" . PHP_EOL;
+
+$job_name = uniqid();
+
+$pid = pcntl_fork();
+if ($pid == -1) {
+    die("Could not fork");
+} else if ($pid == 0) {
+    // Child. This is the worker, don't echo anything here
+    $worker = new GearmanWorker();
+    $worker->setEngine(GEARMAN_ENGINE_NATIVE);
+    $worker->addServer($host, $port);
+    $worker->addFunction($job_name, function($job) {
+        if ($job->workload() == "fail") {
+            $job->sendFail();
+            return;
+        }
+        $job->sendData("<");
+        return strrev($job->workload());
+    });
+    for ($i = 0; $i < 3; $i++) {
+        $worker->work();
+    }
+    exit(0);
+}
+
+// Parent. This is the client
+$client = new GearmanClient();
+print "setEngine: " . var_export($client->setEngine(GEARMAN_ENGINE_NATIVE), true) . PHP_EOL;
+$client->addServer($host, $port);
+
+print "ping: " . var_export($client->ping("ping"), true) . PHP_EOL;
+
+$handle = $client->doBackground($job_name, "background");
+print "doBackground: " . var_export($client->returnCode() == GEARMAN_SUCCESS && $handle != "", true) . PHP_EOL;
+
+// WORK_DATA comes before the result
+print "doNormal: " . var_export($client->doNormal($job_name, "hello"), true) . PHP_EOL;
+print "returnCode: " . var_export($client->returnCode() == GEARMAN_SUCCESS, true) . PHP_EOL;
+
+print "doNormal fail: " . var_export($client->doNormal($job_name, "fail"), true) . PHP_EOL;
+print "returnCode: " . var_export($client->returnCode() == GEARMAN_WORK_FAIL, true) . PHP_EOL;
+
+pcntl_wait($exit_status);
+print "worker exit: " . var_export(pcntl_wifexited($exit_status) && pcntl_wexitstatus($exit_status) == 0, true) . PHP_EOL;
+
+print "Done";
+--EXPECT--
+Start
+setEngine: true
+ping: true
+doBackground: true
+doNormal: '<olleh'
+returnCode: true
+doNormal fail: ''
+returnCode: true
+worker exit: true
+Done
@@ -0,0 +1,68 @@
+--TEST--
+GearmanClient::setAdaptiveTimeout() falls back to the static timeout
+--SKIPIF--
+<?php
+require_once('skipif.inc');
+require_once('skipifconnect.inc');
+?>
+--FILE--
+<?php
+require_once('connect.inc');
+
+print "Start" . PHP_EOL;
+
+$job_name = uniqid();
+
+$pid = pcntl_fork();
+if ($pid == -1) {
+    die("Could not fork");
+} else if ($pid == 0) {
+    // Child. This is the worker, don't echo anything here
+    $worker = new GearmanWorker();
+    $worker->addServer($host, $port);
+    $worker->addFunction($job_name, function($job) {
+        switch ($job->workload()) {
+        case "stop":
+            exit(0);
+        case "slow":
+            usleep(300000);
+            break;
+        }
+        return $job->workload();
+    });
+    while ($worker->work());
+    exit(0);
+}
+
+// Parent. This is the client
+$client = new GearmanClient();
+$client->addServer($host, $port);
+print "setAdaptiveTimeout: " . var_export($client->setAdaptiveTimeout(2.0, 50), true) . PHP_EOL;
+
+// Enough fast calls for an adaptive timeout of the 50 ms floor
+for ($i = 0; $i < 20; $i++) {
+    $client->doNormal($job_name, "fast");
+}
+
+// The function got slower than the adaptive timeout, after three timed
+// out calls the next one waits as long as the static timeout lets it
+for ($i = 1; $i <= 4; $i++) {
+    $result = @$client->doNormal($job_name, "slow");
+    print "slow call $i: " . ($client->returnCode() == GEARMAN_TIMEOUT ? "timeout" : var_export($result, true)) . PHP_EOL;
+}
+
+$client->doBackground($job_name, "stop");
+
+pcntl_wait($exit_status);
+print "worker exit: " . var_export(pcntl_wifexited($exit_status) && pcntl_wexitstatus($exit_status) == 0, true) . PHP_EOL;
+
+print "Done";
+--EXPECT--
+Start
+setAdaptiveTimeout: true
+slow call 1: timeout
+slow call 2: timeout
+slow call 3: timeout
+slow call 4: 'slow'
+worker exit: true
+Done
@@ -0,0 +1,72 @@
+--TEST--
+GearmanClient::setHedging() takes the result of the faster copy
+--SKIPIF--
+<?php
+require_once('skipif.inc');
+require_once('skipifconnect.inc');
+if (gethostbyname($host) == $host) {
+    die("skip needs the test server by name and by address");
+}
+?>
+--FILE--
+<?php
+require_once('connect.inc');
+
+print "Start" . PHP_EOL;
+
+$job_name = uniqid();
+// Whichever worker takes the first copy creates this and is slow
+$marker = sys_get_temp_dir() . "/" . $job_name;
+
+$pids = [];
+for ($i = 0; $i < 2; $i++) {
+    $pid = pcntl_fork();
+    if ($pid == -1) {
+        die("Could not fork");
+    } else if ($pid == 0) {
+        // Child. This is a worker, don't echo anything here
+        $worker = new GearmanWorker();
+        $worker->addServer($host, $port);
+        $worker->addFunction($job_name, function($job) use ($marker) {
+            if (($fp = @fopen($marker, 'x')) !== false) {
+                fclose($fp);
+                sleep(1);
+                return "slow";
+            }
+            return "fast";
+        });
+        $worker->work();
+        exit(0);
+    }
+    $pids[] = $pid;
+}
+
+// Parent. This is the client. The one server under two names makes two
+// entries, so the hedge goes out on a second connection
+$client = new GearmanClient();
+$client->addServers("$host:$port," . gethostbyname($host) . ":$port");
+$client->setHedging(100);
+
+print "doNormal: " . var_export($client->doNormal($job_name, "workload"), true) . PHP_EOL;
+print "returnCode: " . var_export($client->returnCode() == GEARMAN_SUCCESS, true) . PHP_EOL;
+
+$stats = $client->getStats();
+print "Hedges sent: " . $stats['hedge']['sent'] . PHP_EOL;
+print "Hedges won: " . $stats['hedge']['won'] . PHP_EOL;
+
+foreach ($pids as $pid) {
+    pcntl_waitpid($pid, $exit_status);
+    print "worker exit: " . var_export(pcntl_wifexited($exit_status) && pcntl_wexitstatus($exit_status) == 0, true) . PHP_EOL;
+}
+@unlink($marker);
+
+print "Done";
+--EXPECT--
+Start
+doNormal: 'fast'
+returnCode: true
+Hedges sent: 1
+Hedges won: 1
+worker exit: true
+worker exit: true
+Done
@@ -0,0 +1,17 @@
+--TEST--
+GearmanJob::getOutputStream(), gearman_job_get_output_stream()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+$job = new GearmanJob();
+print "GearmanJob::getOutputStream() without a job (OO): " . var_export($job->getOutputStream(), true) . PHP_EOL;
+print "gearman_job_get_output_stream() without a job (Procedural): " . var_export(gearman_job_get_output_stream($job, 4096), true) . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanJob::getOutputStream() without a job (OO): false
+gearman_job_get_output_stream() without a job (Procedural): false
+OK
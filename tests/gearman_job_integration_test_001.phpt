@@ -0,0 +1,79 @@
+--TEST--
+GearmanJob::getOutputStream() sends chunks in order with sendData()
+--SKIPIF--
+<?php
+require_once('skipif.inc');
+require_once('skipifconnect.inc');
+?>
+--FILE--
+<?php
+require_once('connect.inc');
+
+print "Start" . PHP_EOL;
+
+$job_name = uniqid();
+
+$pid = pcntl_fork();
+if ($pid == -1) {
+    die("Could not fork");
+} else if ($pid == 0) {
+    // Child. This is the worker.
+    // Don't echo anything here
+    $worker = new GearmanWorker();
+    $worker->addServer($host, $port);
+    $worker->addFunction(
+        $job_name,
+        function($job) {
+            $out = $job->getOutputStream(4);
+            // Two whole chunks go out, "ij" waits for more
+            fwrite($out, "abcdefghij");
+            // Sends "ij" first to keep the order
+            $job->sendData("X");
+            // Still buffered when the function returns
+            fwrite($out, "klm");
+            return "done";
+        }
+    );
+
+    $worker->work();
+
+    $worker->unregister($job_name);
+    exit(0);
+} else {
+    //Parent. This is the client.
+    $client = new GearmanClient();
+    if ($client->addServer($host, $port) !== true) {
+        exit(1); // error
+    };
+
+    $client->setCompleteCallback(function($task) {
+        print "Complete: " . $task->data() . PHP_EOL;
+    });
+    $client->setDataCallback(function($task) {
+        print "Data: " . $task->data() . " (" . $task->dataSize() . ")" . PHP_EOL;
+    });
+
+    $client->addTask($job_name, "workload");
+    $client->runTasks();
+    print "returnCode: " . var_export($client->returnCode(), true) . PHP_EOL;
+
+    // Wait for child
+    $exit_status = 0;
+    if (pcntl_wait($exit_status) <= 0) {
+        print "pcntl_wait exited with error" . PHP_EOL;
+    } else if (!pcntl_wifexited($exit_status)) {
+        print "child exited with error" . PHP_EOL;
+    }
+}
+
+print "Done";
+--EXPECT--
+Start
+Data: abcd (4)
+Data: efgh (4)
+Data: ij (2)
+Data: X (1)
+Data: klm (3)
+Complete: done
+returnCode: 0
+Done
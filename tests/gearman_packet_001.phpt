@@ -0,0 +1,43 @@
+--TEST--
+GearmanPacket::encode(), GearmanPacket::decode(), gearman_packet_encode(), gearman_packet_decode()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+// SUBMIT_JOB is 7, JOB_CREATED 8, NOOP 6
+$request = GearmanPacket::encode(7, array('reverse', 'u1', "a\0b"));
+print "GearmanPacket::encode() (OO): " . bin2hex($request) . PHP_EOL;
+print "GearmanPacket::encode() bad argument count (OO): " . (@GearmanPacket::encode(7, array('reverse')) === false ? 'Failure' : 'Success') . PHP_EOL;
+print "GearmanPacket::encode() NUL in first argument (OO): " . (@GearmanPacket::encode(7, array("a\0", 'u', 'w')) === false ? 'Failure' : 'Success') . PHP_EOL;
+
+$stream = $request . gearman_packet_encode(8, array('H:1'), true) . gearman_packet_encode(6, array(), true);
+
+// fed a byte short the packet is not complete yet
+var_dump(GearmanPacket::decode(substr($stream, 0, strlen($request) - 1)));
+
+$offset = 0;
+while (($packet = GearmanPacket::decode($stream, $offset)) !== null) {
+  print $packet['magic'] . " " . $packet['command'] . " " . json_encode($packet['args']) . PHP_EOL;
+  $offset += $packet['size'];
+}
+
+$packet = gearman_packet_decode($stream, 0, true);
+print "gearman_packet_decode() slices (Procedural): " . json_encode($packet['args']) . " " . substr($stream, $packet['args'][0][0], $packet['args'][0][1]) . PHP_EOL;
+print "GearmanPacket::decode() bad magic (OO): " . (@GearmanPacket::decode("\0XYZ" . str_repeat("\0", 8)) === false ? 'Failure' : 'Success') . PHP_EOL;
+print "GearmanPacket::decode() bad command (OO): " . (@GearmanPacket::decode("\0RES\0\0\0\xff\0\0\0\0") === false ? 'Failure' : 'Success') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanPacket::encode() (OO): 00524551000000070000000e7265766572736500753100610062
+GearmanPacket::encode() bad argument count (OO): Failure
+GearmanPacket::encode() NUL in first argument (OO): Failure
+NULL
+REQ 7 ["reverse","u1","a\u0000b"]
+RES 8 ["H:1"]
+RES 6 []
+gearman_packet_decode() slices (Procedural): [[12,7],[20,2],[23,3]] reverse
+GearmanPacket::decode() bad magic (OO): Failure
+GearmanPacket::decode() bad command (OO): Failure
+OK
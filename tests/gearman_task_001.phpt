@@ -0,0 +1,29 @@
+--TEST--
+GearmanTask::getStream(), gearman_task_get_stream()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+$client = new GearmanClient();
+$client->addServer('127.0.0.1', 1);
+$task = $client->addTask('reverse', 'abc');
+print "GearmanTask::getStream() buffered (OO): " . var_export(@$task->getStream(), true) . PHP_EOL;
+
+$client->addOptions(GEARMAN_CLIENT_UNBUFFERED_RESULT);
+$stream = $task->getStream();
+$meta = stream_get_meta_data($stream);
+print "Stream type: " . $meta['stream_type'] . PHP_EOL;
+print "Outside the data callback: '" . fread($stream, 8192) . "' eof " . var_export(feof($stream), true) . PHP_EOL;
+fclose($stream);
+
+print "gearman_task_get_stream() (Procedural): " . (is_resource(gearman_task_get_stream($task)) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanTask::getStream() buffered (OO): false
+Stream type: gearman
+Outside the data callback: '' eof true
+gearman_task_get_stream() (Procedural): Success
+OK
@@ -0,0 +1,76 @@
+--TEST--
+Test generator worker functions
+--SKIPIF--
+<?php
+require_once('skipif.inc');
+require_once('skipifconnect.inc');
+?>
+--FILE--
+<?php
+require_once('connect.inc');
+
+print "Start" . PHP_EOL;
+
+$job_name = uniqid();
+
+$pid = pcntl_fork();
+if ($pid == -1) {
+    die("Could not fork");
+} else if ($pid == 0) {
+    // Child. This is the worker.
+    // Don't echo anything here
+    $worker = new GearmanWorker();
+    $worker->addServer($host, $port);
+    $worker->addFunction(
+        $job_name,
+        function($job) {
+            yield "first";
+            yield ['status' => [1, 2]];
+            yield "second";
+            return "done";
+        }
+    );
+
+    $worker->work();
+
+    $worker->unregister($job_name);
+    exit(0);
+} else {
+    //Parent. This is the client.
+    $client = new GearmanClient();
+    if ($client->addServer($host, $port) !== true) {
+        exit(1); // error
+    };
+
+    $client->setCompleteCallback(function($task) {
+        print "Complete: " . $task->data() . PHP_EOL;
+    });
+    $client->setDataCallback(function($task) {
+        print "Data: " . $task->data() . PHP_EOL;
+    });
+    $client->setStatusCallback(function($task) {
+        print "Status: " . $task->taskNumerator() . "/" . $task->taskDenominator() . PHP_EOL;
+    });
+
+    $client->addTask($job_name, "workload");
+    $client->runTasks();
+    print "returnCode: " . var_export($client->returnCode(), true) . PHP_EOL;
+
+    // Wait for child
+    $exit_status = 0;
+    if (pcntl_wait($exit_status) <= 0) {
+        print "pcntl_wait exited with error" . PHP_EOL;
+    } else if (!pcntl_wifexited($exit_status)) {
+        print "child exited with error" . PHP_EOL;
+    }
+}
+
+print "Done";
+--EXPECT--
+Start
+Data: first
+Status: 1/2
+Data: second
+Complete: done
+returnCode: 0
+Done
@@ -0,0 +1,80 @@
+--TEST--
+Task data read off the connection in callbacks with GEARMAN_CLIENT_UNBUFFERED_RESULT
+--SKIPIF--
+<?php
+require_once('skipif.inc');
+require_once('skipifconnect.inc');
+?>
+--FILE--
+<?php
+require_once('connect.inc');
+
+print "Start" . PHP_EOL;
+
+$job_name = uniqid();
+
+$pid = pcntl_fork();
+if ($pid == -1) {
+    die("Could not fork");
+} else if ($pid == 0) {
+    // Child. This is the worker.
+    // Don't echo anything here
+    $worker = new GearmanWorker();
+    $worker->addServer($host, $port);
+    $worker->addFunction(
+        $job_name,
+        function($job) {
+            if ($job->workload() == "throw") {
+                $job->sendException("boom");
+                return;
+            }
+            $job->sendData("partial");
+            return strrev($job->workload());
+        }
+    );
+
+    $worker->work();
+    $worker->work();
+
+    $worker->unregister($job_name);
+    exit(0);
+} else {
+    //Parent. This is the client.
+    $client = new GearmanClient();
+    if ($client->addServer($host, $port) !== true) {
+        exit(1); // error
+    };
+    $client->addOptions(GEARMAN_CLIENT_UNBUFFERED_RESULT);
+
+    $client->setDataCallback(function($task) {
+        print "Data: " . stream_get_contents($task->getStream()) . PHP_EOL;
+    });
+    $client->setCompleteCallback(function($task) {
+        print "Complete: " . stream_get_contents($task->getStream()) . PHP_EOL;
+    });
+    $client->setExceptionCallback(function($task) {
+        $data = $task->recvData(64);
+        print "Exception: " . $data[1] . PHP_EOL;
+    });
+
+    $client->addTask($job_name, "workload");
+    $client->runTasks();
+    $client->addTask($job_name, "throw");
+    $client->runTasks();
+
+    // Wait for child
+    $exit_status = 0;
+    if (pcntl_wait($exit_status) <= 0) {
+        print "pcntl_wait exited with error" . PHP_EOL;
+    } else if (!pcntl_wifexited($exit_status)) {
+        print "child exited with error" . PHP_EOL;
+    }
+}
+
+print "Done";
+--EXPECT--
+Start
+Data: partial
+Complete: daolkrow
+Exception: boom
+Done
@@ -0,0 +1,27 @@
+--TEST--
+GearmanWorker::connect(), GearmanWorker::setKeepalive(), gearman_worker_connect(), gearman_worker_set_keepalive()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+$worker = new GearmanWorker();
+$worker->addServer('127.0.0.1', 1);
+print "GearmanWorker::connect() (OO): " . (@$worker->connect() ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanWorker::setKeepalive() (OO): " . ($worker->setKeepalive(30000) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanWorker::setKeepalive() negative (OO): " . (@$worker->setKeepalive(-1) ? 'Success' : 'Failure') . PHP_EOL;
+
+$worker2 = gearman_worker_create();
+gearman_worker_add_server($worker2, '127.0.0.1', 1);
+print "gearman_worker_connect() (Procedural): " . (@gearman_worker_connect($worker2) ? 'Success' : 'Failure') . PHP_EOL;
+print "gearman_worker_set_keepalive() (Procedural): " . (gearman_worker_set_keepalive($worker2, 0) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanWorker::connect() (OO): Failure
+GearmanWorker::setKeepalive() (OO): Success
+GearmanWorker::setKeepalive() negative (OO): Failure
+gearman_worker_connect() (Procedural): Failure
+gearman_worker_set_keepalive() (Procedural): Success
+OK
@@ -0,0 +1,23 @@
+--TEST--
+GearmanWorker::setServers(), gearman_worker_set_servers()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+$worker = new GearmanWorker();
+$worker->addServer('127.0.0.1', 1);
+$worker->addFunction("reverse", function($job) { return strrev($job->workload()); });
+print "GearmanWorker::setServers() append (OO): " . ($worker->setServers('127.0.0.1:1,127.0.0.1:2') ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanWorker::setServers() replace (OO): " . ($worker->setServers('127.0.0.1:3') ? 'Success' : 'Failure') . PHP_EOL;
+
+$worker2 = gearman_worker_create();
+print "gearman_worker_set_servers() (Procedural): " . (gearman_worker_set_servers($worker2, '127.0.0.1:1') ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanWorker::setServers() append (OO): Success
+GearmanWorker::setServers() replace (OO): Success
+gearman_worker_set_servers() (Procedural): Success
+OK
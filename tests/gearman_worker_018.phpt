@@ -0,0 +1,30 @@
+--TEST--
+GearmanWorker::setEngine(), gearman_worker_set_engine()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+$worker = new GearmanWorker();
+print "GearmanWorker::addServer() unix (OO): " . (@$worker->addServer('unix:///nonexistent/gearmand.sock') ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanWorker::setEngine() native (OO): " . ($worker->setEngine(GEARMAN_ENGINE_NATIVE) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanWorker::addServer() unix native (OO): " . ($worker->addServer('unix:///nonexistent/gearmand.sock') ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanWorker::setEngine() libgearman with unix (OO): " . (@$worker->setEngine(GEARMAN_ENGINE_LIBGEARMAN) ? 'Success' : 'Failure') . PHP_EOL;
+$worker->addFunction("reverse", function($job) { return strrev($job->workload()); });
+print "GearmanWorker::work() native (OO): " . (@$worker->work() ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanWorker::ping() native (OO): " . (@$worker->ping('x') ? 'Success' : 'Failure') . PHP_EOL;
+
+$worker2 = gearman_worker_create();
+print "gearman_worker_set_engine() invalid (Procedural): " . (@gearman_worker_set_engine($worker2, 42) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanWorker::addServer() unix (OO): Failure
+GearmanWorker::setEngine() native (OO): Success
+GearmanWorker::addServer() unix native (OO): Success
+GearmanWorker::setEngine() libgearman with unix (OO): Failure
+GearmanWorker::work() native (OO): Failure
+GearmanWorker::ping() native (OO): Failure
+gearman_worker_set_engine() invalid (Procedural): Failure
+OK
@@ -0,0 +1,28 @@
+--TEST--
+GearmanWorker::setSocketOptions(), gearman_worker_set_socket_options()
+--SKIPIF--
+<?php if (!extension_loaded("gearman")) print "skip"; ?>
+--FILE--
+<?php
+
+$worker = new GearmanWorker();
+$worker->setEngine(GEARMAN_ENGINE_NATIVE);
+$worker->addServer('unix:///nonexistent/gearmand.sock');
+$options = array('send_size' => 4194304, 'recv_size' => 4194304, 'nodelay' => 1, 'quickack' => 1, 'busy_poll' => 50);
+print "GearmanWorker::setSocketOptions() (OO): " . ($worker->setSocketOptions($options) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanWorker::setSocketOptions() unknown (OO): " . (@$worker->setSocketOptions(array('linger' => 1)) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanWorker::setSocketOptions() negative (OO): " . (@$worker->setSocketOptions(array('send_size' => -1)) ? 'Success' : 'Failure') . PHP_EOL;
+print "GearmanWorker::ping() (OO): " . (@$worker->ping('x') ? 'Success' : 'Failure') . PHP_EOL;
+
+$worker2 = gearman_worker_create();
+print "gearman_worker_set_socket_options() (Procedural): " . (gearman_worker_set_socket_options($worker2, array('nodelay' => 0)) ? 'Success' : 'Failure') . PHP_EOL;
+
+print "OK";
+?>
+--EXPECT--
+GearmanWorker::setSocketOptions() (OO): Success
+GearmanWorker::setSocketOptions() unknown (OO): Failure
+GearmanWorker::setSocketOptions() negative (OO): Failure
+GearmanWorker::ping() (OO): Failure
+gearman_worker_set_socket_options() (Procedural): Success
+OK